@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <random>
+
+#include <boost/test/unit_test.hpp>
+
+#include "itkImage.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+#include "kvlAtlasMesh.h"
+#include "kvlTetrahedronInteriorConstIterator.h"
+
+// --------------------
+
+typedef itk::Image< float, 3 >  ImageType;
+typedef kvl::AtlasMesh::PointType  PointType;
+
+const int nExtraLoadings = 7;
+const double tolerance = 1e-9;
+
+// --------------------
+
+static ImageType::Pointer CreateImage( int size )
+{
+  ImageType::SizeType  imageSize;
+  imageSize.Fill( size );
+  ImageType::Pointer  image = ImageType::New();
+  image->SetRegions( imageSize );
+  image->Allocate();
+  image->FillBuffer( 0 );
+
+  return image;
+}
+
+// Scalar reference: baricentric coordinates of a voxel, evaluated directly
+static void ComputeBaricentric( const PointType p[ 4 ], const ImageType::IndexType& index, double pi[ 4 ] )
+{
+  double  T[ 3 ][ 3 ];
+  for ( int row = 0; row < 3; row++ )
+    {
+    for ( int column = 0; column < 3; column++ )
+      {
+      T[ row ][ column ] = p[ column + 1 ][ row ] - p[ 0 ][ row ];
+      }
+    }
+  const double  y[ 3 ] = { index[ 0 ] - p[ 0 ][ 0 ], index[ 1 ] - p[ 0 ][ 1 ], index[ 2 ] - p[ 0 ][ 2 ] };
+
+  // Cramer's rule
+  const double  determinant = T[0][0] * ( T[1][1] * T[2][2] - T[1][2] * T[2][1] ) -
+                              T[0][1] * ( T[1][0] * T[2][2] - T[1][2] * T[2][0] ) +
+                              T[0][2] * ( T[1][0] * T[2][1] - T[1][1] * T[2][0] );
+  for ( int column = 0; column < 3; column++ )
+    {
+    double  S[ 3 ][ 3 ];
+    for ( int row = 0; row < 3; row++ )
+      {
+      for ( int c = 0; c < 3; c++ )
+        {
+        S[ row ][ c ] = ( c == column ) ? y[ row ] : T[ row ][ c ];
+        }
+      }
+    pi[ column + 1 ] = ( S[0][0] * ( S[1][1] * S[2][2] - S[1][2] * S[2][1] ) -
+                         S[0][1] * ( S[1][0] * S[2][2] - S[1][2] * S[2][0] ) +
+                         S[0][2] * ( S[1][0] * S[2][1] - S[1][1] * S[2][0] ) ) / determinant;
+    }
+  pi[ 0 ] = 1.0 - pi[ 1 ] - pi[ 2 ] - pi[ 3 ];
+}
+
+// --------------------
+
+BOOST_AUTO_TEST_SUITE( TetrahedronInteriorConstIterator )
+
+BOOST_AUTO_TEST_CASE( RandomTetrahedraAgainstScalarReference )
+{
+  const int  size = 24;
+  ImageType::Pointer  image = CreateImage( size );
+
+  std::mt19937  generator( 17 );
+  std::uniform_real_distribution< double >  coordinate( -4.0, size + 4.0 );
+  std::uniform_real_distribution< double >  alpha( 0.0, 1.0 );
+
+  for ( int tetrahedronNumber = 0; tetrahedronNumber < 200; tetrahedronNumber++ )
+    {
+    PointType  p[ 4 ];
+    for ( int vertexNumber = 0; vertexNumber < 4; vertexNumber++ )
+      {
+      for ( int dimension = 0; dimension < 3; dimension++ )
+        {
+        p[ vertexNumber ][ dimension ] = coordinate( generator );
+        }
+      }
+    double  alphas[ nExtraLoadings ][ 4 ];
+    for ( int loadingNumber = 0; loadingNumber < nExtraLoadings; loadingNumber++ )
+      {
+      for ( int vertexNumber = 0; vertexNumber < 4; vertexNumber++ )
+        {
+        alphas[ loadingNumber ][ vertexNumber ] = alpha( generator );
+        }
+      }
+
+    // Visit all voxels the iterator claims are inside, and check the interpolated values
+    image->FillBuffer( 0 );
+    kvl::TetrahedronInteriorConstIterator< ImageType::PixelType >  it( image, p[ 0 ], p[ 1 ], p[ 2 ], p[ 3 ] );
+    for ( int loadingNumber = 0; loadingNumber < nExtraLoadings; loadingNumber++ )
+      {
+      it.AddExtraLoading( alphas[ loadingNumber ][ 0 ], alphas[ loadingNumber ][ 1 ],
+                          alphas[ loadingNumber ][ 2 ], alphas[ loadingNumber ][ 3 ] );
+      }
+    for ( ; !it.IsAtEnd(); ++it )
+      {
+      BOOST_TEST_CONTEXT( "Tetrahedron: " << tetrahedronNumber << " Voxel Index: " << it.GetIndex() )
+        {
+        double  pi[ 4 ];
+        ComputeBaricentric( p, it.GetIndex(), pi );
+        BOOST_CHECK_SMALL( it.GetPi0() - pi[ 0 ], tolerance );
+        BOOST_CHECK_SMALL( it.GetPi1() - pi[ 1 ], tolerance );
+        BOOST_CHECK_SMALL( it.GetPi2() - pi[ 2 ], tolerance );
+        BOOST_CHECK_SMALL( it.GetPi3() - pi[ 3 ], tolerance );
+        for ( int loadingNumber = 0; loadingNumber < nExtraLoadings; loadingNumber++ )
+          {
+          double  expected = 0.0;
+          for ( int vertexNumber = 0; vertexNumber < 4; vertexNumber++ )
+            {
+            expected += alphas[ loadingNumber ][ vertexNumber ] * pi[ vertexNumber ];
+            }
+          BOOST_CHECK_SMALL( it.GetExtraLoadingInterpolatedValue( loadingNumber ) - expected, tolerance );
+          }
+        image->SetPixel( it.GetIndex(), image->GetPixel( it.GetIndex() ) + 1 );
+        }
+      }
+
+    // Every voxel clearly inside must have been visited exactly once, and no voxel
+    // clearly outside may have been visited
+    itk::ImageRegionConstIteratorWithIndex< ImageType >  imageIt( image, image->GetBufferedRegion() );
+    for ( ; !imageIt.IsAtEnd(); ++imageIt )
+      {
+      double  pi[ 4 ];
+      ComputeBaricentric( p, imageIt.GetIndex(), pi );
+      const double  minimumPi = std::min( std::min( pi[ 0 ], pi[ 1 ] ), std::min( pi[ 2 ], pi[ 3 ] ) );
+      BOOST_TEST_CONTEXT( "Tetrahedron: " << tetrahedronNumber << " Voxel Index: " << imageIt.GetIndex() )
+        {
+        BOOST_CHECK_LE( imageIt.Value(), 1 );
+        if ( minimumPi > tolerance )
+          {
+          BOOST_CHECK_EQUAL( imageIt.Value(), 1 );
+          }
+        else if ( minimumPi < -tolerance )
+          {
+          BOOST_CHECK_EQUAL( imageIt.Value(), 0 );
+          }
+        }
+      }
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE( SharedFacesVisitedOnce )
+{
+  // Split a cube with grid-aligned corners into six tetrahedra sharing the main diagonal;
+  // many voxels lie exactly on shared faces, and each of them should be claimed by
+  // exactly one tetrahedron
+  const int  size = 16;
+  ImageType::Pointer  image = CreateImage( size + 1 );
+
+  PointType  corners[ 8 ];
+  for ( int cornerNumber = 0; cornerNumber < 8; cornerNumber++ )
+    {
+    for ( int dimension = 0; dimension < 3; dimension++ )
+      {
+      corners[ cornerNumber ][ dimension ] = ( ( cornerNumber >> dimension ) & 1 ) ? size : 0;
+      }
+    }
+  const int  permutations[ 6 ][ 3 ] = { { 0, 1, 2 }, { 0, 2, 1 }, { 1, 0, 2 },
+                                        { 1, 2, 0 }, { 2, 0, 1 }, { 2, 1, 0 } };
+  for ( int tetrahedronNumber = 0; tetrahedronNumber < 6; tetrahedronNumber++ )
+    {
+    const int  first = 1 << permutations[ tetrahedronNumber ][ 0 ];
+    const int  second = first | ( 1 << permutations[ tetrahedronNumber ][ 1 ] );
+    kvl::TetrahedronInteriorConstIterator< ImageType::PixelType >  it( image, corners[ 0 ], corners[ first ],
+                                                                       corners[ second ], corners[ 7 ] );
+    it.AddExtraLoading( 1.0, 1.0, 1.0, 1.0 );
+    for ( ; !it.IsAtEnd(); ++it )
+      {
+      BOOST_CHECK_SMALL( it.GetExtraLoadingInterpolatedValue( 0 ) - 1.0, tolerance );
+      image->SetPixel( it.GetIndex(), image->GetPixel( it.GetIndex() ) + 1 );
+      }
+    }
+
+  // Voxels on the far faces of the cube are excluded by the border rule; all others
+  // must be visited exactly once
+  itk::ImageRegionConstIteratorWithIndex< ImageType >  imageIt( image, image->GetBufferedRegion() );
+  for ( ; !imageIt.IsAtEnd(); ++imageIt )
+    {
+    BOOST_TEST_CONTEXT( "Voxel Index: " << imageIt.GetIndex() )
+      {
+      BOOST_CHECK_LE( imageIt.Value(), 1 );
+      const ImageType::IndexType  index = imageIt.GetIndex();
+      if ( ( index[ 0 ] < size ) && ( index[ 1 ] < size ) && ( index[ 2 ] < size ) )
+        {
+        BOOST_CHECK_EQUAL( imageIt.Value(), 1 );
+        }
+      }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END();
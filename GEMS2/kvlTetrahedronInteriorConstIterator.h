@@ -219,6 +219,12 @@ private:
   // Go the next voxel inside the bounding box around the tetrahedron
   void MoveOnePixel(); 
   
+  // Keep moving until we're at a voxel inside the tetrahedron (or at the end)
+  void MoveToInside();
+  
+  // Bring the extra loadings up to date with the baricentric coordinates
+  void ApplyPendingRowAdditions();
+  
   // Check if the current pixel is outside of the tetrahedron
   bool IsOutsideTetrahdron() const;
   
@@ -232,6 +238,15 @@ private:
   const InternalPixelType*  m_SliceBeginPosition;
   const InternalPixelType*  m_ColumnBeginPosition;
 
+  // Number of row steps taken since the extra loadings were last updated. While
+  // we're walking over voxels outside the tetrahedron only the four baricentric
+  // coordinates are kept up to date; the extra loadings catch up (with exactly
+  // the same sequence of additions) once we land on a voxel that's inside
+  int  m_NumberOfPendingRowAdditions;
+  
+  // Whether we've already visited a voxel inside the tetrahedron in the current row
+  bool  m_RowEntered;
+
   
 };
 
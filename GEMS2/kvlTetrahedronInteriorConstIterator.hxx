@@ -23,7 +23,9 @@ TetrahedronInteriorConstIterator< TPixel >
   m_NextColumnAdditions( 4 ), 
   m_NextSliceAdditions( 4 ),
   m_ColumnBeginInterpolatedValues( 4 ),
-  m_SliceBeginInterpolatedValues( 4 )
+  m_SliceBeginInterpolatedValues( 4 ),
+  m_NumberOfPendingRowAdditions( 0 ),
+  m_RowEntered( false )
 {
   
   // ============================================================================================
@@ -253,10 +255,7 @@ TetrahedronInteriorConstIterator< TPixel >
   // Part V: Advance to the first voxel that is actually inside the tetradron
   //
   // ============================================================================================
-  while ( this->IsOutsideTetrahdron() && !this->IsAtEnd() )
-    {
-    this->MoveOnePixel();
-    }
+  this->MoveToInside();
  
   
 }
@@ -311,12 +310,73 @@ TetrahedronInteriorConstIterator< TPixel >
 {
 
   this->MoveOnePixel();
-  while ( this->IsOutsideTetrahdron() && !this->IsAtEnd() )
+  this->MoveToInside();
+
+  return *this;
+}
+
+
+
+//
+//
+//
+template< typename TPixel >
+void
+TetrahedronInteriorConstIterator< TPixel >
+::MoveToInside()
+{
+  
+  // Along a row, each baricentric coordinate is repeatedly incremented by the same
+  // constant. Since floating-point addition is monotonic, each coordinate is therefore
+  // monotonically non-increasing or non-decreasing along the row, and the voxels that 
+  // are inside the tetrahedron (including the border cases, which only depend on the
+  // sign of the additions) form a single contiguous span. Once we've stepped out of 
+  // that span, we can therefore skip the remainder of the row altogether
+  while ( !this->IsAtEnd() && this->IsOutsideTetrahdron() )
     {
+    if ( m_RowEntered )
+      {
+      this->m_PositionIndex[ 0 ] = this->m_EndIndex[ 0 ] - 1;
+      }
     this->MoveOnePixel();
     }
+    
+  if ( !this->IsAtEnd() )
+    {
+    m_RowEntered = true;
+    this->ApplyPendingRowAdditions();
+    }
+    
+}
 
-  return *this;
+
+
+//
+//
+//
+template< typename TPixel >
+void
+TetrahedronInteriorConstIterator< TPixel >
+::ApplyPendingRowAdditions()
+{
+  
+  const int  numberOfExtraLoadings = m_InterpolatedValues.size() - 4;
+  if ( ( numberOfExtraLoadings > 0 ) && ( m_NumberOfPendingRowAdditions > 0 ) )
+    {
+    // Loop over loadings in the inner loop so that the compiler can vectorize across them
+    double*  values = &( m_InterpolatedValues[ 4 ] );
+    const double*  additions = &( m_NextRowAdditions[ 4 ] );
+    for ( int stepNumber = 0; stepNumber < m_NumberOfPendingRowAdditions; stepNumber++ )
+      {
+      for ( int loadingNumber = 0; loadingNumber < numberOfExtraLoadings; loadingNumber++ )
+        {
+        values[ loadingNumber ] += additions[ loadingNumber ];  
+        }  
+      }
+    }
+    
+  m_NumberOfPendingRowAdditions = 0;
+  
 }
 
    
@@ -359,15 +419,13 @@ TetrahedronInteriorConstIterator< TPixel >
     // Update the data pointer
     this->m_Position++;  
  
-    //  Update the baricentric coordinates
-    // for ( int loadingNumber = 0; loadingNumber < numberOfLoadings; loadingNumber++ )
-    //   {
-    //   m_InterpolatedValues[ loadingNumber ] += m_NextRowAdditions[ loadingNumber ];
-    //   }
-    for ( int loadingNumber = 0; loadingNumber < numberOfLoadings; loadingNumber++ )
+    //  Update the baricentric coordinates; the extra loadings are only updated 
+    // (in ApplyPendingRowAdditions()) once we know we're inside the tetrahedron
+    for ( int loadingNumber = 0; loadingNumber < 4; loadingNumber++ )
       {
       m_InterpolatedValues[ loadingNumber ] += m_NextRowAdditions[ loadingNumber ];  
       }  
+    m_NumberOfPendingRowAdditions++;
   
     }  
   else if ( this->m_PositionIndex[ 1 ] < ( this->m_EndIndex[ 1 ] - 1 ) )
@@ -382,6 +440,8 @@ TetrahedronInteriorConstIterator< TPixel >
     // Update the data pointer
     m_ColumnBeginPosition += this->m_OffsetTable[ 1 ];
     this->m_Position  =  m_ColumnBeginPosition;  
+    m_NumberOfPendingRowAdditions = 0;
+    m_RowEntered = false;
  
     //  Update the baricentric coordinates
     for ( int loadingNumber = 0; loadingNumber < numberOfLoadings; loadingNumber++ )
@@ -406,6 +466,8 @@ TetrahedronInteriorConstIterator< TPixel >
     m_SliceBeginPosition += this->m_OffsetTable[ 2 ];
     m_ColumnBeginPosition = m_SliceBeginPosition;  
     this->m_Position = m_SliceBeginPosition;  
+    m_NumberOfPendingRowAdditions = 0;
+    m_RowEntered = false;
  
     //  Update the baricentric coordinates
     for ( int loadingNumber = 0; loadingNumber < numberOfLoadings; loadingNumber++ )
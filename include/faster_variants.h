@@ -30,5 +30,6 @@
 #pragma once
 
 #define FASTER_gcamSmoothnessEnergy
+#define FASTER_gcamSmoothnessTerm
 #define FASTER_MRI_EM_REGISTER
 #define FASTER_mriSurfaceRASToVoxel
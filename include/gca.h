@@ -230,6 +230,10 @@ typedef struct
   int          total_training ;
   int          max_label ;
   COLOR_TABLE  *ct ;
+  // set when the atlas was mapped from a flat file (see GCAreadFlat)
+  void         *flat_map ;      // the read-only, copy-on-write mapping
+  size_t       flat_map_size ;
+  void         *flat_pool ;     // GC1D structs and gibbs pointers into the mapping
 }
 GAUSSIAN_CLASSIFIER_ARRAY, GCA ;
 
@@ -285,6 +289,12 @@ int  GCAtrain(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform,
 int  GCAtrainCovariances(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform) ;
 int  GCAwrite(GCA *gca,const char *fname) ;
 GCA  *GCAread(const char *fname) ;
+int  GCAwriteFlat(GCA *gca, const char *fname) ;
+GCA  *GCAreadFlat(const char *fname) ;
+int  GCAisFlat(const char *fname) ;
+int  GCAcacheLoad(const char *fname) ;
+int  GCAcacheUnload(const char *fname) ;
+int  GCAcacheIsLoaded(const char *fname) ;
 int  GCAcompleteMeanTraining(GCA *gca) ;
 int  GCAcompleteCovarianceTraining(GCA *gca) ;
 MRI  *GCAlabel(MRI *mri_src, GCA *gca, MRI *mri_dst, TRANSFORM *transform) ;
@@ -121,7 +121,19 @@ typedef struct
   MATRIX *ttpct; // percent of the signal in each seg from each tt
 
   // GLM stuff for GTM
-  MATRIX *X,*X0;
+  // X (with PSF) and X0 (without PSF) are only stored by column, never as
+  // dense nmask x nsegs matrices: column n has Xnnz[n] entries in rows Xrow[n]
+  // (0-based, ascending) with values Xval[n] in X and X0val[n] in X0. A row is
+  // kept if it is non-zero in either. Built by GTMbuildX(), which only fills
+  // X0val when not optimizing. GTMdenseX() expands one when it must be written.
+  int *Xnnz, **Xrow;
+  float **Xval, **X0val;
+  double XpsfKey[7]; // PSF and motion blur that the sparse X was built with
+  // Kept across GTMbuildX() calls while optimizing the PSF
+  MRI **segpvfbb; // PVF of each seg in its padded bounding box
+  MRI_REGION **segbbregion; // bounding box of each seg
+  int segbbnPad, segbbVoxFracCor; // nPad and DoVoxFracCor the boxes were made with
+  int *vox2row; // row of X for each voxel (c + r*width + s*width*height), -1 if not in mask
   MATRIX *y, *XtX, *iXtX, *Xty, *beta, *res, *yhat,*betavar;
   MATRIX *rvar,*rvargm,*rvarbrain,*rvarUnscaled; // residual variance, all vox and only GM
   MATRIX *som; // spillover matrix
@@ -198,6 +210,9 @@ int GTMpsfStd(GTM *gtm);
 int GTMsegidlist(GTM *gtm);
 int GTMnPad(GTM *gtm);
 int GTMbuildX(GTM *gtm);
+int GTMfreeX(GTM *gtm);
+MATRIX *GTMsparseAtB(GTM *gtm, float **Aval, float **Bval, MATRIX *AtB);
+MATRIX *GTMdenseX(GTM *gtm, float **val, MATRIX *X);
 int GTMsolve(GTM *gtm);
 int GTMsegrvar(GTM *gtm);
 int GTMsynth(GTM *gtm, int NoiseSeed, int nReps);
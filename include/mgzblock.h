@@ -0,0 +1,54 @@
+/**
+ * @file  mgzblock.h
+ * @brief block-compressed (BGZF-style) gzip files with random access
+ *
+ * A blocked gzip file is a concatenation of independently deflated gzip
+ * members, each holding a fixed number of uncompressed bytes, followed by
+ * empty gzip members that carry the block index in their extra field.
+ * Because every piece is a valid gzip member, plain gunzip (and gzread)
+ * still decompress the file to exactly the original bytes. Knowing the
+ * index allows compressing and decompressing the blocks in parallel and
+ * inflating only the blocks that cover a requested byte range.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MGZBLOCK_H
+#define MGZBLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// default number of uncompressed bytes per gzip member
+#define MGZB_DEFAULT_BLOCK_SIZE (256 * 1024)
+
+typedef struct
+{
+  int fd;
+  size_t block_size;      // uncompressed bytes per block (last may be short)
+  size_t nblocks;
+  size_t total_size;      // total uncompressed size of the file
+  uint64_t *offsets;      // nblocks+1 file offsets; offsets[nblocks] = start of index
+} MGZ_BLOCKED;
+
+int MGZBisBlocked(const char *fname);
+MGZ_BLOCKED *MGZBopen(const char *fname);
+int MGZBread(MGZ_BLOCKED *mgzb, void *buf, size_t offset, size_t nbytes);
+int MGZBclose(MGZ_BLOCKED **pmgzb);
+
+int MGZBwrite(const char *fname, const void *buf, size_t nbytes, size_t block_size);
+int MGZBwriteEnabled(void);
+
+#endif
@@ -181,6 +181,8 @@ public:
   ~MRI();
 
   void initIndices();
+  void initSlices();
+  bool mapChunk(const char *filename, size_t offset);
   void write(const std::string& filename);
   FnvHash hash();
 
@@ -276,6 +278,8 @@ public:
   int ischunked;                // indicates whether the buffer is chunked (contiguous)
   BUFTYPE ***slices = nullptr;  // fallback non-contiguous storage for 3D-indexed image data
   void *chunk = nullptr;        // default contiguous storage for image data
+  void *chunk_map = nullptr;    // file mapping that chunk points into (see mapChunk)
+  size_t chunk_map_size = 0;    // size of the file mapping
 };
 
 
@@ -119,6 +119,28 @@ int MRIsegStatsRobust(MRI *seg, int segid, MRI *mri,int frame,
 		      float *min, float *max, float *range,
 		      float *mean, float *std, float Pct);
 
+/* Voxels of each of a set of segmentations, in scan order (see MRIsegIndexAlloc()) */
+typedef struct
+{
+  int nsegs;      // number of unique segmentation ids
+  int *segids;    // sorted unique ids
+  int *start;     // voxels of slot n are crs[3*start[n]] .. crs[3*start[n+1]-1]
+  int *crs;       // col, row, slice of each voxel
+  int idmin, nlut;
+  int *lut;       // id-idmin to slot, or NULL to binary search segids
+} MRI_SEG_INDEX;
+MRI_SEG_INDEX *MRIsegIndexAlloc(MRI *seg, int nsegs, const int *segids);
+int MRIsegIndexFree(MRI_SEG_INDEX **pindex);
+int MRIsegIndexSlot(const MRI_SEG_INDEX *index, int segid);
+int MRIsegIndexCount(const MRI_SEG_INDEX *index, int segid);
+int MRIsegStatsIndexed(const MRI_SEG_INDEX *index, int segid, MRI *mri, int frame,
+                       float *min, float *max, float *range,
+                       float *mean, float *std);
+int MRIsegStatsRobustIndexed(const MRI_SEG_INDEX *index, int segid, MRI *mri, int frame,
+                             float *min, float *max, float *range,
+                             float *mean, float *std, float Pct);
+int MRIsegFrameAvgIndexed(const MRI_SEG_INDEX *index, int segid, MRI *mri, double *favg);
+
 MRI *MRImask_with_T2_and_aparc_aseg(MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior) ;
 int *MRIsegmentationList(MRI *seg, int *pListLength);
 
@@ -49,6 +49,7 @@ typedef struct
   int              const max_bins ;
   int                    nused ;
   int                    size, ysize, zsize ;
+  bool                   readonly ;     // copied from the table when it was bulk built
 } MRIS_HASH_BUCKET, MHBT ;
 
 
@@ -109,6 +110,9 @@ struct _mht
 
   int                nfaces;
   MHT_FACE*          f;
+
+  bool               readonly;                                          // Bulk built and not modified since, so
+                                                                        // queries from any thread need no locks
 } ;
 
 
@@ -947,6 +947,9 @@ MRI_SURFACE  *MRIScoordsFromParameterization(MRI_SP *mrisp, MRI_SURFACE *mris, i
 float         MRISPsample(MRI_SP *mrisp, float x, float y, float z, int fno) ;
 MRI_SP       *MRISPblur(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma,
                         int fno) ;
+MRI_SP       *MRISPblurTemplate(MRI_SP *mrisp_src, float sigma, int fno,
+                                int nframes) ;
+int          MRISPsetBlurCacheDir(const char *dir) ;
 MRI_SP       *MRISPconvolveGaussian(MRI_SP *mrisp_src, MRI_SP *mrisp_dst,
                                     float sigma, float radius, int fno) ;
 MRI_SP       *MRISPalign(MRI_SP *mrisp_orig, MRI_SP *mrisp_src,
@@ -113,6 +113,35 @@ MRI *vol2surf_linear(MRI *SrcVol,
                      int InterpMethod, int float2int, MRI *SrcHitVol,
                      int ProjDistFlag, int nskip);
 
+/* Per-sample kinds in VOL2SURF_WEIGHTS.status */
+#define VOL2SURF_SKIP      0  /* out of bounds, value is 0 */
+#define VOL2SURF_OUTSIDE   1  /* value is the volume's outside_val */
+#define VOL2SURF_NEAREST   2
+#define VOL2SURF_TRILINEAR 3
+
+/* Precomputed vertex-to-voxel sampling for vol2surf_linear(), one
+   sample per vertex per projection fraction (vtx*nprojfracs+p). Each
+   sample has 8 voxel offsets (within a frame) and 8 weights. */
+typedef struct
+{
+  int nvertices, nprojfracs;
+  int InterpMethod;
+  int width, height, depth, type;
+  char *status;
+  size_t *offset;
+  double *weight;
+  int *hitcrs; /* col,row,slc hit by each vertex at the last fraction (col=-1 for none) */
+} VOL2SURF_WEIGHTS;
+
+VOL2SURF_WEIGHTS *vol2surf_linear_weights(MRI *SrcVol,
+                                          MATRIX *Qsrc, MATRIX *Fsrc, MATRIX *Wsrc, MATRIX *Dsrc,
+                                          MRI_SURFACE *TrgSurf,
+                                          const float *ProjFracs, int nProjFracs,
+                                          int InterpMethod, int float2int, int ProjDistFlag);
+int vol2surf_weights_supported(const MRI *SrcVol, int InterpMethod);
+MRI *vol2surf_apply_weights(const VOL2SURF_WEIGHTS *w, MRI *SrcVol, int ProjMax, MRI *SrcHitVol);
+int vol2surf_free_weights(VOL2SURF_WEIGHTS **pw);
+
 MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs,
 		  int ReverseMapFlag, int DoJac, int UseHash);
 MRI *surf2surf_nnfr(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
@@ -70,6 +70,47 @@ size_t ROMP_countGoParallel();
     // Useful during debugging to write conditional code looking for a problem 
     // that is being caused by parallelism
 
+
+// Runtime profiling
+//
+// Setting FS_PROFILE in the environment turns on, without rebuilding anything, the timing of the
+// annotated omp loops and ROMP_SCOPE phases below plus a few counters kept by utils.
+// At exit a JSON report is written to the named file, or to <dir>/<program>.<pid>.json
+// when FS_PROFILE names an existing directory.
+//
+extern bool romp_profiling;
+
+// The file counters add up the sizes of the files named to MRIread, GCAread, MRISread... on
+// success, not the bytes actually read: a single frame read, or an atlas attached from the
+// resident cache, counts the whole file, and directory inputs (DICOM series, COR) count nothing.
+// The surface and atlas byte counters only cover the vertex, face and node/prior arrays.
+//
+typedef enum ROMP_counter {
+    ROMP_counter_volume_allocs,       // image buffers allocated by the MRI constructor
+    ROMP_counter_volume_alloc_bytes,
+    ROMP_counter_surface_allocs,      // surfaces allocated by MRISoverAlloc
+    ROMP_counter_surface_alloc_bytes,
+    ROMP_counter_atlas_allocs,        // GCAs allocated by gcaAllocMax
+    ROMP_counter_atlas_alloc_bytes,
+    ROMP_counter_morph_allocs,        // GCA_MORPHs allocated by GCAMalloc
+    ROMP_counter_morph_alloc_bytes,
+    ROMP_counter_input_file_bytes,    // sizes of the files read by MRIread, GCAread, MRISread...
+    ROMP_counter_output_file_bytes,   // sizes of the files written by MRIwrite, GCAwrite, MRISwrite...
+    ROMP_counter__size
+    } ROMP_counter;
+
+void ROMP_count(ROMP_counter counter, long amount);
+void ROMP_count_file(ROMP_counter counter, const char* fname);
+    // adds the size of fname, if it is a regular file
+
+#define ROMP_COUNT(COUNTER, AMOUNT) \
+    { if (romp_profiling) ROMP_count(ROMP_counter_##COUNTER, (AMOUNT)); } \
+    // end of macro
+
+#define ROMP_COUNT_FILE(COUNTER, FNAME) \
+    { if (romp_profiling) ROMP_count_file(ROMP_counter_##COUNTER, (FNAME)); } \
+    // end of macro
+
 // omp for loops should be annotated with the following macros
 // so that the romp support knows of their existence.  Other omp loops hjave no data collection.
 //
@@ -122,10 +163,13 @@ typedef struct ROMP_pf_static_struct {
 
 typedef struct ROMP_pf_stack_struct  { 
     struct ROMP_pf_static_struct * staticInfo; 
-    Timer timer;
+    long      begin_time;                   // not a Timer, to keep entering an unprofiled loop free
     long      watchedThreadBeginCPUTimes[ROMP_maxWatchedThreadNum];
     int 	  gone_parallel;
     ROMP_level    entry_level;
+    struct PerThreadScopeTreeData * scope;
+    struct PerThreadScopeTreeData * outer_scope;
+    size_t    parallel_at_begin;
 } ROMP_pf_stack_struct;
 
 
@@ -165,6 +209,9 @@ void ROMP_pflb_end(
 
 // The conditionalized macros that either do or don't add the variables and calls based on the above
 //
+// Without ROMP_SUPPORT_ENABLED the loops and scopes are only timed when romp_profiling is set,
+// and the omp if clauses are unchanged so the parallelism is the same whether profiling or not.
+//
 #if !defined(ROMP_SUPPORT_ENABLED)
 
     #define if_ROMPLEVEL(LEVEL) \
@@ -176,9 +223,14 @@ void ROMP_pflb_end(
 	// end of macro
 
     #define ROMP_PF_begin \
-	{
+	{ \
+	static ROMP_pf_static_struct ROMP_pf_static = { 0L, __BASE_FILE__, __func__, __LINE__ }; \
+	ROMP_pf_stack_struct  ROMP_pf_stack;  \
+	ROMP_pf_stack.staticInfo = NULL; \
+	if (romp_profiling) ROMP_pf_begin(&ROMP_pf_static, &ROMP_pf_stack);
 
     #define ROMP_PF_end \
+	if (ROMP_pf_stack.staticInfo) ROMP_pf_end(&ROMP_pf_stack); \
 	}
 
     #define ROMP_PFLB_begin
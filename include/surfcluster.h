@@ -67,6 +67,8 @@ SCS *sclustMapSurfClusters(MRI_SURFACE *Surf, float thmin, float thmax,
                            MATRIX *XFM, MRI *fwhmmap);
 int sclustGrowSurfCluster(int ClustNo, int SeedVtx, MRI_SURFACE *Surf,
                           float thmin, float thmax, int thsign);
+int sclustLabelSurfClusters(MRI_SURFACE *Surf, float thmin, float thmax,
+                            int thsign, float minarea);
 float sclustSurfaceArea(int ClusterNo, MRI_SURFACE *Surf, int *nvtxs) ;
 float sclustWeight(int ClusterNo, MRI_SURFACE *Surf, MRI *mri, int UseArea);
 float sclustSurfaceMax(int ClusterNo, MRI_SURFACE *Surf, int *vtxmax) ;
@@ -117,6 +117,13 @@ VOLCLUSTER **clustGetClusters(MRI *vol, int frame,
                               MRI *binmask, int *nClusters,
                               MATRIX *XFM);
 int clustMaxClusterCount(VOLCLUSTER **VolClustList, int nClusters);
+int clustUFFind(int *parent, int v);
+void clustUFUnion(int *parent, int a, int b);
+MRI *clustLabelHitMap(MRI *HitMap, int Connectivity, int *nClusters,
+                      int **pnMembers);
+int clustCountClusters(MRI *vol, int frame,
+                       float threshmin, float threshmax, int threshsign,
+                       MRI *binmask, int Connectivity, int *nClusters);
 int clustDumpSummary(FILE *fp,VOLCLUSTER **VolClustList, int nClusters);
 
 /*----------------------------------------------------------*/
@@ -30,10 +30,15 @@
 #include <stdlib.h>
 #include <math.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/wait.h>
 #ifdef HAVE_OPENMP // mrisurf.c has numerous parallelized functions
 #include "romp_support.h"
 #endif
@@ -242,6 +247,11 @@ struct utsname uts;
 char *cmdline2, cwd[2000];
 char *rusage_file=NULL;
 
+static char *batch_fname = NULL ;
+static int batch_jobs = 1 ;
+static int label_batch(const char *manifest, int njobs, const char *gca_fname,
+                       int nopts, char **opts) ;
+
 int main(int argc, char *argv[])
 {
   char         **av ;
@@ -311,6 +321,15 @@ int main(int argc, char *argv[])
     argv += nargs ;
   }
 
+  if (batch_fname)
+  {
+    if (argc != 2)
+    {
+      usage_exit(1) ;
+    }
+    exit(label_batch(batch_fname, batch_jobs, argv[1], argv - av, av)) ;
+  }
+
   if (getenv("BUILD_GCA_HISTO") != NULL)
   {
     int *counts, i, max_i ;
@@ -1550,6 +1569,14 @@ get_option(int argc, char *argv[])
     rusage_file = argv[2] ;
     nargs = 1 ;
   }
+  else if (!stricmp(option, "BATCH"))
+  {
+    batch_fname = argv[2] ;
+    batch_jobs = atoi(argv[3]) ;
+    nargs = 2 ;
+    printf("labeling the subjects listed in %s, %d at a time\n",
+           batch_fname, batch_jobs) ;
+  }
   else if (!stricmp(option, "-HELP")||!stricmp(option, "-USAGE"))
   {
     usage_exit(0) ;
@@ -1951,6 +1978,233 @@ usage_exit(int code)
   exit(code);
 }
 
+/*----------------------------------------------------------------------
+  Waits for one of the batch workers to finish, frees its slot and
+  returns 1 if it failed.
+  ----------------------------------------------------------------------*/
+static int
+label_batch_wait(pid_t *pids, char **outs, int njobs, int *pnrunning)
+{
+  int   status, slot, failed ;
+  pid_t pid ;
+
+  do
+  {
+    pid = wait(&status) ;
+  }
+  while (pid < 0 && errno == EINTR) ;
+  if (pid < 0)   // no children left, should not happen
+  {
+    failed = *pnrunning ;
+    *pnrunning = 0 ;
+    return(failed) ;
+  }
+
+  for (slot = 0 ; slot < njobs && pids[slot] != pid ; slot++)
+    ;
+  if (slot >= njobs)
+  {
+    return(0) ;
+  }
+
+  failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0 ;
+  printf("%s %s\n", outs[slot], failed ? "FAILED" : "done") ;
+  fflush(stdout) ;
+  free(outs[slot]) ;
+  outs[slot] = NULL ;
+  pids[slot] = 0 ;
+  (*pnrunning)-- ;
+  return(failed) ;
+}
+
+// the atlas label_batch() loaded into the gca cache, removed however the batch ends
+static const char *batch_cached_gca = NULL ;
+
+static void
+label_batch_unload(void)
+{
+  if (batch_cached_gca)
+  {
+    GCAcacheUnload(batch_cached_gca) ;
+    batch_cached_gca = NULL ;
+  }
+}
+
+static void
+label_batch_signal(int sig)
+{
+  label_batch_unload() ;
+  signal(sig, SIG_DFL) ;
+  raise(sig) ;
+}
+
+/*----------------------------------------------------------------------
+  label_batch() - labels every subject listed in the manifest, njobs at a
+  time. Each manifest line is "invol1 [invol2 ...] xform outvol" and the
+  options on the command line (other than -batch) apply to every subject.
+
+  The atlas is loaded once into the resident gca cache (see GCAcacheLoad),
+  so every worker maps the same copy rather than reading and holding its
+  own. The workers are processes running this program on one subject:
+  the labeling keeps its state in file-scope globals and renormalizes the
+  atlas in place, so it cannot run concurrently in threads, while the
+  copy-on-write mapping lets each process copy only the atlas pages it
+  modifies. The output of each subject is written to outvol.log. A cache
+  entry loaded here is removed at exit, including on SIGINT/SIGTERM.
+  Returns the exit status for the batch.
+  ----------------------------------------------------------------------*/
+static int
+label_batch(const char *manifest, int njobs, const char *gca_fname,
+            int nopts, char **opts)
+{
+  FILE  *fp ;
+  char  line[10*STRLEN], log_fname[STRLEN], *cp, *tokens[MAX_GCA_INPUTS+3], **args, **outs ;
+  int   ntokens, nargs, n, i, slot, loaded, nrunning, nsubjects, nfailed, fd ;
+  pid_t *pids, pid ;
+
+  fp = fopen(manifest, "r") ;
+  if (!fp)
+    ErrorExit(ERROR_NOFILE, "%s: could not open manifest %s",
+              Progname, manifest) ;
+  if (njobs < 1)
+  {
+    njobs = 1 ;
+  }
+
+  // load the atlas once for all the workers, unless it is resident already
+  loaded = 0 ;
+  if (!GCAcacheIsLoaded(gca_fname))
+  {
+    printf("loading %s into the gca cache\n", gca_fname) ;
+    if (GCAcacheLoad(gca_fname) == NO_ERROR)
+    {
+      loaded = 1 ;
+      batch_cached_gca = gca_fname ;
+      atexit(label_batch_unload) ;
+      signal(SIGINT, label_batch_signal) ;
+      signal(SIGTERM, label_batch_signal) ;
+    }
+    else
+    {
+      printf("WARNING: could not cache %s, each subject will read it\n",
+             gca_fname) ;
+    }
+  }
+
+#ifdef HAVE_OPENMP
+  // share the threads between the concurrent workers
+  {
+    char nthreads[STRLEN] ;
+    sprintf(nthreads, "%d", MAX(1, omp_get_max_threads() / njobs)) ;
+    setenv("OMP_NUM_THREADS", nthreads, 1) ;
+  }
+#endif
+
+  args = (char **)calloc(nopts + MAX_GCA_INPUTS + 5, sizeof(char *)) ;
+  pids = (pid_t *)calloc(njobs, sizeof(pid_t)) ;
+  outs = (char **)calloc(njobs, sizeof(char *)) ;
+  if (!args || !pids || !outs)
+    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d batch workers",
+              Progname, njobs) ;
+
+  // the program and its options, without -batch and its arguments
+  for (nargs = i = 0 ; i <= nopts ; i++)
+  {
+    if (i > 0 && !stricmp(opts[i], "-batch"))
+    {
+      i += 2 ;
+      continue ;
+    }
+    args[nargs++] = opts[i] ;
+  }
+
+  nrunning = nsubjects = nfailed = 0 ;
+  while ((cp = fgetl(line, sizeof(line), fp)) != NULL)
+  {
+    nsubjects++ ;
+    for (ntokens = 0, cp = strtok(cp, " \t") ;
+         cp && ntokens < MAX_GCA_INPUTS+2 ;
+         cp = strtok(NULL, " \t"))
+    {
+      tokens[ntokens++] = cp ;
+    }
+    if (ntokens < 3 || cp)
+    {
+      printf("ERROR: manifest line %d must be "
+             "invol1 [invol2 ...] xform outvol\n", nsubjects) ;
+      nfailed++ ;
+      continue ;
+    }
+
+    if (nrunning == njobs)
+    {
+      nfailed += label_batch_wait(pids, outs, njobs, &nrunning) ;
+    }
+    for (slot = 0 ; slot < njobs && pids[slot] ; slot++)
+      ;
+
+    n = nargs ;
+    for (i = 0 ; i < ntokens-2 ; i++)
+    {
+      args[n++] = tokens[i] ;
+    }
+    args[n++] = tokens[ntokens-2] ;
+    args[n++] = (char *)gca_fname ;
+    args[n++] = tokens[ntokens-1] ;
+    args[n] = NULL ;
+    snprintf(log_fname, STRLEN, "%s.log", tokens[ntokens-1]) ;
+
+    fflush(stdout) ;
+    fflush(stderr) ;
+    pid = fork() ;
+    if (pid == 0)
+    {
+      // only the batch unloads the atlas
+      signal(SIGINT, SIG_DFL) ;
+      signal(SIGTERM, SIG_DFL) ;
+      fd = open(log_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644) ;
+      if (fd >= 0)
+      {
+        dup2(fd, 1) ;
+        dup2(fd, 2) ;
+        close(fd) ;
+      }
+      // run this same binary, whatever PATH says
+      execv("/proc/self/exe", args) ;
+      execvp(args[0], args) ;
+      _exit(127) ;
+    }
+    if (pid < 0)
+    {
+      printf("ERROR: could not start a worker for %s\n", tokens[ntokens-1]) ;
+      nfailed++ ;
+      continue ;
+    }
+    printf("labeling %s (pid %d, log in %s)\n",
+           tokens[ntokens-1], (int)pid, log_fname) ;
+    fflush(stdout) ;
+    pids[slot] = pid ;
+    outs[slot] = strcpyalloc(tokens[ntokens-1]) ;
+    nrunning++ ;
+  }
+  fclose(fp) ;
+
+  while (nrunning > 0)
+  {
+    nfailed += label_batch_wait(pids, outs, njobs, &nrunning) ;
+  }
+  if (loaded)
+  {
+    label_batch_unload() ;
+  }
+
+  printf("%d of %d subjects labeled\n", nsubjects - nfailed, nsubjects) ;
+  free(args) ;
+  free(pids) ;
+  free(outs) ;
+  return(nfailed ? 1 : 0) ;
+}
+
 
 static int cma_editable_labels[] =
 {
@@ -10,3 +10,18 @@ test_command mri_ca_label -relabel_unlikely 9 .3 -prior 0.5 -align norm.mgz tala
     ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca aseg.auto_noCCseg.out.mgz
 
 compare_vol aseg.auto_noCCseg.out.mgz aseg.auto_noCCseg.mgz
+
+# the flat (memory-mapped) atlas must give identical labels
+export PATH="$(find_path $FSTEST_CWD mri_gca_flatten):$PATH"
+test_command "mri_gca_flatten ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca atlas.gcaf && \
+    mri_ca_label -relabel_unlikely 9 .3 -prior 0.5 -align norm.mgz talairach.m3z \
+    atlas.gcaf aseg.auto_noCCseg.flat.mgz"
+
+compare_vol aseg.auto_noCCseg.flat.mgz aseg.auto_noCCseg.mgz
+
+# batch mode must label each manifest entry as a standalone run would
+test_command "echo 'norm.mgz talairach.m3z aseg.auto_noCCseg.batch.mgz' > batch.txt && \
+    mri_ca_label -relabel_unlikely 9 .3 -prior 0.5 -align -batch batch.txt 2 \
+    ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca"
+
+compare_vol aseg.auto_noCCseg.batch.mgz aseg.auto_noCCseg.mgz
@@ -25,3 +25,20 @@ compare_vol nuuc.mgz nuuc.ref.mgz
 # (i.e. gcam->depth * gcam->spacing = gcam->atlas.depth - 1)
 test_command mri_convert -at odd.m3z orig.mgz morphed.mgz
 compare_vol morphed.mgz odd.ref.mgz
+
+# block-compressed mgz must round-trip and support single-frame reads
+test_command FS_MGZ_BLOCKED=1 mri_convert orig.ref.mgz blocked.mgz
+compare_vol blocked.mgz orig.ref.mgz
+test_command "FS_MGZ_BLOCKED=1 mri_convert orig.ref.mgz blocked.mgz && mri_convert blocked.mgz --nth_frame 0 nth.mgz"
+compare_vol nth.mgz orig.ref.mgz
+
+# a single frame of a blocked multi-frame mgz must keep TR etc. and the tags stored after the image
+export PATH="$(find_path $FSTEST_CWD mri_info):$PATH"
+test_command "mri_convert orig.ref.mgz --frame 0 0 0 multi.mgz && FS_MGZ_BLOCKED=1 mri_convert multi.mgz blocked.mgz && mri_convert blocked.mgz --nth_frame 1 nth.mgz && [ \$(mri_info --cmds nth.mgz | grep -c mri_convert) -ge 3 ]"
+compare_vol nth.mgz orig.ref.mgz
+
+# memory-mapped reads of uncompressed volumes
+test_command FS_MMAP_VOLUMES=1 mri_convert nifti.nii nifti.mmap.mgz
+compare_vol nifti.mmap.mgz freesurfer.mgz --notallow-acq --geo-thresh 0.000008
+test_command "mri_convert orig.ref.mgz orig.mgh && FS_MMAP_VOLUMES=1 mri_convert orig.mgh orig.mmap.mgz"
+compare_vol orig.mmap.mgz orig.ref.mgz
@@ -29,6 +29,7 @@
 #include "diag.h"
 #include "cma.h"
 #include "error.h"
+#include "romp_support.h"
 
 #include "emregisterutils.h"
 
@@ -36,6 +37,36 @@ extern int use_variance ;
 
 // ===========================================
 
+// score the samples under a linear transform whose m_L is already set
+static double score_samples( GCA *gca,
+                             GCA_SAMPLE *gcas,
+                             MRI *mri,
+                             TRANSFORM *transform,
+                             int nsamples,
+                             double clamp )
+{
+  double result;
+
+  if (robust)
+  {
+    // Defined 0 at the top of the file
+    result = GCAcomputeNumberOfGoodFittingSamples( gca, gcas, mri,
+             transform, nsamples );
+  }
+  else
+  {
+    if (use_variance)
+      result = GCAcomputeLabelIntensityVariance( gca, gcas, mri,
+						 transform, nsamples );
+    else
+      result = GCAcomputeLogSampleProbability( gca, gcas, mri,
+					       transform, nsamples, clamp );
+  }
+
+
+  return( result );
+}
+
 double local_GCAcomputeLogSampleProbability( GCA *gca,
     GCA_SAMPLE *gcas,
     MRI *mri,
@@ -65,27 +96,109 @@ double local_GCAcomputeLogSampleProbability( GCA *gca,
              SQR(fluid))) ;
   }
 
+  return( score_samples(gca, gcas, mri, transform, nsamples, clamp) );
+}
 
-  double result;
 
-  if (robust)
+// ===========================================
+
+/*
+  Score a batch of candidate transforms, and return the index of the first
+  one (in the order given) that reaches the highest score of the batch, if
+  that score exceeds *pmax_log_p. *pmax_log_p is then updated to it.
+  Returns -1 if no candidate exceeds *pmax_log_p. This is the comparison
+  the grid searches make one candidate at a time, so the winner is the same.
+
+  The candidates are scored concurrently. The scoring writes the source
+  voxel and log_p of every sample, so each thread works on its own copy of
+  the samples with its own transform. The exvivo score leaves the tissue
+  modes in globals, so it stays serial.
+*/
+int local_GCAfindMaxLogSampleProbability( GCA *gca,
+                                          GCA_SAMPLE *gcas,
+                                          MRI *mri,
+                                          MATRIX **m_Ls,
+                                          int ntransforms,
+                                          int nsamples,
+                                          int exvivo, double clamp,
+                                          double *pmax_log_p )
+{
+  int    n, best ;
+  double *log_ps ;
+
+  if (ntransforms <= 0)
   {
-    // Defined 0 at the top of the file
-    result = GCAcomputeNumberOfGoodFittingSamples( gca, gcas, mri,
-             transform, nsamples );
+    return(-1) ;
+  }
+  log_ps = (double *)calloc(ntransforms, sizeof(double)) ;
+  if (!log_ps)
+    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d scores",
+              __FUNCTION__, ntransforms) ;
+
+  if (exvivo || ntransforms == 1)
+  {
+    for (n = 0 ; n < ntransforms ; n++)
+      log_ps[n] = local_GCAcomputeLogSampleProbability
+                  (gca, gcas, mri, m_Ls[n], nsamples, exvivo, clamp) ;
   }
   else
   {
-    if (use_variance)
-      result = GCAcomputeLabelIntensityVariance( gca, gcas, mri,
-						 transform, nsamples );
-    else
-      result = GCAcomputeLogSampleProbability( gca, gcas, mri,
-					       transform, nsamples, clamp );
+    int const nthreads = MIN(MIN(omp_get_max_threads(), _MAX_FS_THREADS), ntransforms) ;
+    TRANSFORM  *transforms[_MAX_FS_THREADS] ;
+    MATRIX     *m_L_saved[_MAX_FS_THREADS] ;
+    GCA_SAMPLE *thread_gcas[_MAX_FS_THREADS] ;
+    int tid ;
+
+    for (tid = 0 ; tid < nthreads ; tid++)
+    {
+      transforms[tid] = TransformAlloc(LINEAR_VOX_TO_VOX, NULL) ;
+      m_L_saved[tid] = ((LTA *)transforms[tid]->xform)->xforms[0].m_L ;
+      thread_gcas[tid] = (GCA_SAMPLE *)calloc(nsamples, sizeof(GCA_SAMPLE)) ;
+      if (!thread_gcas[tid])
+        ErrorExit(ERROR_NOMEMORY, "%s: could not copy %d samples",
+                  __FUNCTION__, nsamples) ;
+      memmove(thread_gcas[tid], gcas, nsamples*sizeof(GCA_SAMPLE)) ;
+    }
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) num_threads(nthreads) schedule(dynamic, 1)
+#endif
+    for (n = 0 ; n < ntransforms ; n++)
+    {
+      ROMP_PFLB_begin
+      int const tid =
+#ifdef HAVE_OPENMP
+        omp_get_thread_num();
+#else
+        0;
+#endif
+      ((LTA *)transforms[tid]->xform)->xforms[0].m_L = m_Ls[n] ;
+      log_ps[n] = score_samples(gca, thread_gcas[tid], mri, transforms[tid],
+                                nsamples, clamp) ;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    for (tid = 0 ; tid < nthreads ; tid++)
+    {
+      ((LTA *)transforms[tid]->xform)->xforms[0].m_L = m_L_saved[tid] ;
+      TransformFree(&transforms[tid]) ;
+      free(thread_gcas[tid]) ;
+    }
   }
 
+  for (best = -1, n = 0 ; n < ntransforms ; n++)
+  {
+    if (log_ps[n] > *pmax_log_p)
+    {
+      *pmax_log_p = log_ps[n] ;
+      best = n ;
+    }
+  }
+  free(log_ps) ;
 
-  return( result );
+  return(best) ;
 }
 
 
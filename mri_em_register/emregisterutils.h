@@ -41,6 +41,18 @@ double local_GCAcomputeLogSampleProbability( GCA *gca,
                                              int nsamples,
                                              int exvivo, double clamp );
 
+// Score a batch of candidate transforms concurrently. Returns the index of
+// the first candidate reaching the batch maximum if that maximum is above
+// *pmax_log_p (which is updated), or -1.
+int local_GCAfindMaxLogSampleProbability( GCA *gca,
+                                          GCA_SAMPLE *gcas,
+                                          MRI *mri,
+                                          MATRIX **m_Ls,
+                                          int ntransforms,
+                                          int nsamples,
+                                          int exvivo, double clamp,
+                                          double *pmax_log_p );
+
 int compute_tissue_modes( MRI *mri_inputs,
                           GCA *gca,
                           GCA_SAMPLE *gcas,
@@ -84,6 +84,44 @@ void CheckInverseTranslation( const MATRIX* mat,
 
 // ------------------------------------------------------------
 
+// Candidates are scored in batches of this size, so that they can be
+// evaluated concurrently without keeping the whole grid in memory
+#define MAX_TRANSLATION_BATCH 1024
+
+// Score the pending candidates, recording the translation of any new maximum
+static void score_translation_batch( GCA *gca,
+                                     GCA_SAMPLE *gcas,
+                                     MRI *mri,
+                                     int nsamples,
+                                     MATRIX **m_Ls,
+                                     double (*translations)[3],
+                                     int *pnbatch,
+                                     double clamp,
+                                     double *pmax_log_p,
+                                     double *px_max,
+                                     double *py_max,
+                                     double *pz_max ) {
+  int n ;
+
+  n = local_GCAfindMaxLogSampleProbability(gca, gcas, mri, m_Ls, *pnbatch,
+                                           nsamples, exvivo, clamp,
+                                           pmax_log_p) ;
+  if (n >= 0)
+  {
+    *px_max = translations[n][0] ;
+    *py_max = translations[n][1] ;
+    *pz_max = translations[n][2] ;
+#if 0
+    printf("new max p %2.1f found at "
+           "(%2.1f, %2.1f, %2.1f)\n",
+           *pmax_log_p, *px_max, *py_max, *pz_max) ;
+#endif
+  }
+  *pnbatch = 0 ;
+}
+
+// ------------------------------------------------------------
+
 double find_optimal_translation( GCA *gca,
                                  GCA_SAMPLE *gcas,
                                  MRI *mri,
@@ -94,12 +132,19 @@ double find_optimal_translation( GCA *gca,
                                  float trans_steps,
                                  int nreductions ,
                                  double clamp ) {
-  MATRIX   *m_trans, *m_L_tmp ;
+  MATRIX   *m_trans, *m_L_tmp, *m_Ls[MAX_TRANSLATION_BATCH] ;
   double   x_trans, y_trans, z_trans, x_max, y_max, z_max, delta,
-           log_p, max_log_p, mean_trans ;
-  int      i ;
+           max_log_p, mean_trans ;
+  double   translations[MAX_TRANSLATION_BATCH][3] ;
+  int      i, n, nbatch, max_batch ;
 
-  log_p = 0;
+  // the exvivo score is reported as it improves, so score one at a time
+  max_batch = exvivo ? 1 : MAX_TRANSLATION_BATCH ;
+  for (n = 0 ; n < MAX_TRANSLATION_BATCH ; n++)
+  {
+    m_Ls[n] = NULL ;
+  }
+  nbatch = 0 ;
   x_trans = 0;
   y_trans = 0;
   z_trans = 0;
@@ -151,20 +196,23 @@ double find_optimal_translation( GCA *gca,
           {
             DiagBreak() ;
           }
-          // get the transform
-          m_L_tmp = MatrixMultiply(m_trans, m_L, m_L_tmp) ;
-          // calculate the LogSample probability
-
-          log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L_tmp,nsamples, exvivo, clamp) ;
-
-#if 0
-          printf( "%s: %8.3f %8.3f %8.3f %12.6f\n",
-                  __FUNCTION__,
-                  x_trans, y_trans, z_trans,
-                  log_p );
-#endif
+          // get the transform, and queue it to be scored. The batches
+          // are scored in scan order, so ties go to the same candidate
+          m_Ls[nbatch] = MatrixMultiply(m_trans, m_L, m_Ls[nbatch]) ;
+          translations[nbatch][0] = x_trans ;
+          translations[nbatch][1] = y_trans ;
+          translations[nbatch][2] = z_trans ;
+          if (++nbatch == max_batch)
+          {
+            score_translation_batch(gca, gcas, mri, nsamples, m_Ls,
+                                    translations, &nbatch, clamp,
+                                    &max_log_p, &x_max, &y_max, &z_max) ;
+          }
 
 #ifdef OUTPUT_STAGES
+          m_L_tmp = MatrixMultiply(m_trans, m_L, m_L_tmp) ;
+          double log_p = local_GCAcomputeLogSampleProbability
+            (gca, gcas, mri, m_L_tmp, nsamples, exvivo, clamp) ;
           outFile << std::setw(20) << std::setprecision(12) << x_trans << ",";
           outFile << std::setw(20) << std::setprecision(12) << y_trans << ",";
           outFile << std::setw(20) << std::setprecision(12) << z_trans << ",";
@@ -188,22 +236,12 @@ double find_optimal_translation( GCA *gca,
 #endif
           MatrixFree( &inv_m_L );
 #endif
-
-          if (log_p > max_log_p)
-          {
-            max_log_p = log_p ;
-            x_max = x_trans ;
-            y_max = y_trans ;
-            z_max = z_trans ;
-#if 0
-            printf("new max p %2.1f found at "
-                   "(%2.1f, %2.1f, %2.1f)\n",
-                   max_log_p, x_trans, y_trans, z_trans) ;
-#endif
-          }
         }
       }
     }
+    score_translation_batch(gca, gcas, mri, nsamples, m_Ls,
+                            translations, &nbatch, clamp,
+                            &max_log_p, &x_max, &y_max, &z_max) ;
 
     if( Gdiag & DIAG_SHOW )
     {
@@ -240,6 +278,17 @@ double find_optimal_translation( GCA *gca,
   }
 
   MatrixFree(&m_trans) ;
+  if (m_L_tmp)
+  {
+    MatrixFree(&m_L_tmp) ;
+  }
+  for (n = 0 ; n < MAX_TRANSLATION_BATCH ; n++)
+  {
+    if (m_Ls[n])
+    {
+      MatrixFree(&m_Ls[n]) ;
+    }
+  }
 
 #ifdef OUTPUT_STAGES
   std::cerr << __FUNCTION__
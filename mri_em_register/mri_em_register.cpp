@@ -2226,6 +2226,37 @@ get_option(int argc, char *argv[])
 
 
 
+// Candidates of the 9-parameter search are scored in batches of this size,
+// so that they can be evaluated concurrently
+#define MAX_LINEAR_XFORM_BATCH 1024
+
+typedef struct
+{
+  double scale[3], angle[3], trans[3] ;
+} LINEAR_XFORM_PARMS ;
+
+// score the pending candidates, recording the parameters of any new maximum
+static void
+score_linear_xform_batch(GCA *gca, GCA_SAMPLE *gcas, MRI *mri, int nsamples,
+                         MATRIX **m_Ls, LINEAR_XFORM_PARMS *candidates,
+                         int *pnbatch, double *pmax_log_p,
+                         LINEAR_XFORM_PARMS *max_parms)
+{
+  int n ;
+
+  n = local_GCAfindMaxLogSampleProbability(gca, gcas, mri, m_Ls, *pnbatch,
+                                           nsamples, exvivo, Gclamp,
+                                           pmax_log_p) ;
+  if (n >= 0)
+  {
+    if (exvivo)
+      printf("current estimates G=%d, W=%d, F=%d\n",
+             (int)G_gm_mean, (int)G_wm_mean, (int)G_fluid_mean) ;
+    *max_parms = candidates[n] ;
+  }
+  *pnbatch = 0 ;
+}
+
 /*/////////////////////////////////////////////////////////////
   search 9-dimensional parameter space
 */
@@ -2253,8 +2284,17 @@ find_optimal_linear_xform
   double x_trans, y_trans, z_trans;
   double x_scale, y_scale, z_scale;
   double x_angle, y_angle, z_angle;
-  double log_p;
-  int i;
+  int i, n, nbatch, max_batch;
+  MATRIX *m_Ls[MAX_LINEAR_XFORM_BATCH] ;
+  LINEAR_XFORM_PARMS candidates[MAX_LINEAR_XFORM_BATCH], max_parms ;
+
+  // the exvivo estimates are reported as they improve, so score one at a time
+  max_batch = exvivo ? 1 : MAX_LINEAR_XFORM_BATCH ;
+  for (n = 0 ; n < MAX_LINEAR_XFORM_BATCH ; n++)
+  {
+    m_Ls[n] = NULL ;
+  }
+  nbatch = 0 ;
 
   if (rigid)
   {
@@ -2304,6 +2344,16 @@ find_optimal_linear_xform
       fflush(stdout) ;
     }
 
+    max_parms.scale[0] = x_max_scale ;
+    max_parms.scale[1] = y_max_scale ;
+    max_parms.scale[2] = z_max_scale ;
+    max_parms.angle[0] = x_max_rot ;
+    max_parms.angle[1] = y_max_rot ;
+    max_parms.angle[2] = z_max_rot ;
+    max_parms.trans[0] = x_max_trans ;
+    max_parms.trans[1] = y_max_trans ;
+    max_parms.trans[2] = z_max_trans ;
+
     // scale /////////////////////////////////////////////////////////////
     for (x_scale = min_scale ; x_scale <= max_scale ; x_scale += delta_scale)
     {
@@ -2373,28 +2423,26 @@ find_optimal_linear_xform
                       *MATRIX_RELT(m_trans, 3, 4) =
                         z_trans ;
 
-                      m_L_tmp = MatrixMultiply
-                                (m_trans, m_tmp3, m_L_tmp) ;
-
-                      log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L_tmp, nsamples, exvivo, Gclamp);
-                      if (log_p > max_log_p)
+                      // queue the candidate; batches are scored in
+                      // scan order, so ties go to the same candidate
+                      m_Ls[nbatch] = MatrixMultiply
+                                     (m_trans, m_tmp3, m_Ls[nbatch]) ;
+                      candidates[nbatch].scale[0] = x_scale ;
+                      candidates[nbatch].scale[1] = y_scale ;
+                      candidates[nbatch].scale[2] = z_scale ;
+                      candidates[nbatch].angle[0] = x_angle ;
+                      candidates[nbatch].angle[1] = y_angle ;
+                      candidates[nbatch].angle[2] = z_angle ;
+                      candidates[nbatch].trans[0] = x_trans ;
+                      candidates[nbatch].trans[1] = y_trans ;
+                      candidates[nbatch].trans[2] = z_trans ;
+                      if (++nbatch == max_batch)
                       {
-                        if (exvivo)
-                          printf("current estimates G=%d, W=%d, F=%d\n",
-                                 (int)G_gm_mean, (int)G_wm_mean, (int)G_fluid_mean) ;
-                        max_log_p = log_p ;
-                        x_max_scale = x_scale ;
-                        y_max_scale = y_scale ;
-                        z_max_scale = z_scale ;
-                        x_max_rot = x_angle ;
-                        y_max_rot = y_angle ;
-                        z_max_rot = z_angle ;
-                        x_max_trans = x_trans ;
-                        y_max_trans = y_trans ;
-                        z_max_trans = z_trans ;
+                        score_linear_xform_batch(gca, gcas, mri, nsamples,
+                                                 m_Ls, candidates, &nbatch,
+                                                 &max_log_p, &max_parms) ;
                       }
 #if 0
-                      printf( "%s: log_p = %f\n", __FUNCTION__, log_p );
                       printf( "%s: Translation (%4.2f, %4.2f, %4.2f)\n",
                               __FUNCTION__, x_trans, y_trans, z_trans );
                       printf( "%s: Rotation (%4.2f, %4.2f, %4.2f)\n",
@@ -2412,6 +2460,17 @@ find_optimal_linear_xform
         }
       }
     }
+    score_linear_xform_batch(gca, gcas, mri, nsamples, m_Ls, candidates,
+                             &nbatch, &max_log_p, &max_parms) ;
+    x_max_scale = max_parms.scale[0] ;
+    y_max_scale = max_parms.scale[1] ;
+    z_max_scale = max_parms.scale[2] ;
+    x_max_rot = max_parms.angle[0] ;
+    y_max_rot = max_parms.angle[1] ;
+    z_max_rot = max_parms.angle[2] ;
+    x_max_trans = max_parms.trans[0] ;
+    y_max_trans = max_parms.trans[1] ;
+    z_max_trans = max_parms.trans[2] ;
 
     if (Gdiag & DIAG_SHOW)
     {
@@ -2487,6 +2546,13 @@ find_optimal_linear_xform
   MatrixFree(&m_tmp2) ;
   MatrixFree(&m_trans) ;
   MatrixFree(&m_tmp3) ;
+  for (n = 0 ; n < MAX_LINEAR_XFORM_BATCH ; n++)
+  {
+    if (m_Ls[n])
+    {
+      MatrixFree(&m_Ls[n]) ;
+    }
+  }
 
   return(max_log_p) ;
 }
@@ -8,3 +8,17 @@ fi
 
 test_command mri_em_register -uns 3 -mask brainmask.mgz nu.mgz ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca talairach.lta
 compare_lta talairach.lta talairach.ref.lta
+
+# the flat (memory-mapped) atlas must give the same registration
+export PATH="$(find_path $FSTEST_CWD mri_gca_flatten):$PATH"
+test_command "mri_gca_flatten ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca atlas.gcaf && \
+    mri_em_register -uns 3 -mask brainmask.mgz nu.mgz atlas.gcaf talairach.flat.lta"
+compare_lta talairach.flat.lta talairach.ref.lta
+
+# a copy of the atlas held resident by mri_gca_cache must give the same registration, and the
+# cache must still be there to release afterwards
+export PATH="$(find_path $FSTEST_CWD mri_gca_cache):$PATH"
+test_command "cp ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca atlas.gca && mri_gca_cache atlas.gca && \
+    { status=0; mri_em_register -uns 3 -mask brainmask.mgz nu.mgz atlas.gca talairach.cache.lta || status=\$?; \
+    mri_gca_cache -unload atlas.gca && [ \$status = 0 ]; }"
+compare_lta talairach.cache.lta talairach.ref.lta
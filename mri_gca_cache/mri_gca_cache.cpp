@@ -0,0 +1,126 @@
+/**
+ * @file  mri_gca_cache.cpp
+ * @brief keep GCA atlases resident in shared memory
+ *
+ * Loads atlases into POSIX shared memory in the flat layout. While an
+ * atlas is resident, GCAread() of the same file attaches to the shared
+ * copy instead of reading and parsing it, so the processes of a batch run
+ * on one node share a single copy of each atlas.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "error.h"
+#include "gca.h"
+#include "macros.h"
+#include "utils.h"
+#include "version.h"
+
+const char *Progname;
+
+static void usage_exit(int code);
+static int get_option(int argc, char *argv[]);
+
+static int unload = 0;
+
+int main(int argc, char *argv[])
+{
+  char cmdline[CMD_LINE_LEN];
+  int nargs, i, errors = 0;
+
+  make_cmd_version_string(argc, argv, "$Id$", "$Name:  $", cmdline);
+
+  nargs = handle_version_option(argc, argv, "$Id$", "$Name:  $");
+  if (nargs && argc - nargs == 1) {
+    exit(0);
+  }
+  argc -= nargs;
+
+  Progname = argv[0];
+
+  DiagInit(NULL, NULL, NULL);
+  ErrorInit(NULL, NULL, NULL);
+
+  for (; argc > 1 && ISOPTION(*argv[1]); argc--, argv++) {
+    nargs = get_option(argc, argv);
+    argc -= nargs;
+    argv += nargs;
+  }
+
+  if (argc < 2) {
+    usage_exit(1);
+  }
+
+  for (i = 1; i < argc; i++) {
+    if (unload) {
+      printf("unloading %s\n", argv[i]);
+      if (GCAcacheUnload(argv[i]) != NO_ERROR) {
+        errors++;
+      }
+    }
+    else {
+      printf("loading %s\n", argv[i]);
+      if (GCAcacheLoad(argv[i]) != NO_ERROR) {
+        errors++;
+      }
+    }
+  }
+
+  exit(errors ? 1 : 0);
+  return (0);
+}
+
+static int get_option(int argc, char *argv[])
+{
+  int nargs = 0;
+  char *option;
+
+  option = argv[1] + 1; /* past '-' */
+  if (!stricmp(option, "unload")) {
+    unload = 1;
+  }
+  else
+    switch (toupper(*option)) {
+      case 'U':
+        unload = 1;
+        break;
+      case '?':
+      case 'H':
+        usage_exit(0);
+        break;
+      default:
+        printf("unknown option %s\n", argv[1]);
+        exit(1);
+        break;
+    }
+
+  return (nargs);
+}
+
+static void usage_exit(int code)
+{
+  printf("usage: %s [-unload] <gca> [<gca> ...]\n\n", Progname);
+  printf("Loads atlases into shared memory, where GCAread() of the same files\n");
+  printf("attaches to them instead of reading them from disk. The copies stay\n");
+  printf("resident until unloaded with -unload (or a reboot). An atlas that is\n");
+  printf("modified on disk is not attached to until it is loaded again.\n");
+  printf("Set FS_GCA_CACHE=0 to ignore resident copies.\n");
+  exit(code);
+}
@@ -0,0 +1,117 @@
+/**
+ * @file  mri_gca_flatten.cpp
+ * @brief convert a GCA atlas to the flat, memory-mappable layout
+ *
+ * Reads a .gca (or .gcz) atlas and writes it with GCAwriteFlat(). GCAread()
+ * recognizes flat files and maps them instead of parsing them, so the
+ * output can be used anywhere an atlas is expected.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "error.h"
+#include "gca.h"
+#include "macros.h"
+#include "timer.h"
+#include "utils.h"
+#include "version.h"
+
+const char *Progname;
+
+static void usage_exit(int code);
+static int get_option(int argc, char *argv[]);
+
+int main(int argc, char *argv[])
+{
+  char *in_fname, *out_fname, cmdline[CMD_LINE_LEN];
+  int nargs;
+  GCA *gca;
+  Timer start;
+
+  make_cmd_version_string(argc, argv, "$Id$", "$Name:  $", cmdline);
+
+  nargs = handle_version_option(argc, argv, "$Id$", "$Name:  $");
+  if (nargs && argc - nargs == 1) {
+    exit(0);
+  }
+  argc -= nargs;
+
+  Progname = argv[0];
+
+  DiagInit(NULL, NULL, NULL);
+  ErrorInit(NULL, NULL, NULL);
+
+  for (; argc > 1 && ISOPTION(*argv[1]); argc--, argv++) {
+    nargs = get_option(argc, argv);
+    argc -= nargs;
+    argv += nargs;
+  }
+
+  if (argc < 3) {
+    usage_exit(1);
+  }
+
+  in_fname = argv[1];
+  out_fname = argv[2];
+
+  printf("reading atlas from %s...\n", in_fname);
+  gca = GCAread(in_fname);
+  if (!gca) {
+    ErrorExit(ERROR_NOFILE, "%s: could not read atlas from %s", Progname, in_fname);
+  }
+
+  printf("writing flat atlas to %s...\n", out_fname);
+  if (GCAwriteFlat(gca, out_fname) != NO_ERROR) {
+    ErrorExit(ERROR_BADFILE, "%s: could not write flat atlas to %s", Progname, out_fname);
+  }
+  GCAfree(&gca);
+
+  printf("flattening took %2.2f seconds\n", start.seconds());
+  exit(0);
+  return (0);
+}
+
+static int get_option(int argc, char *argv[])
+{
+  int nargs = 0;
+  char *option;
+
+  option = argv[1] + 1; /* past '-' */
+  switch (toupper(*option)) {
+    case '?':
+    case 'U':
+      usage_exit(0);
+      break;
+    default:
+      printf("unknown option %s\n", argv[1]);
+      exit(1);
+      break;
+  }
+
+  return (nargs);
+}
+
+static void usage_exit(int code)
+{
+  printf("usage: %s <input gca> <output flat gca>\n\n", Progname);
+  printf("Converts an atlas to the flat layout that GCAread() memory-maps\n");
+  printf("instead of parsing. Flat atlases use native byte order.\n");
+  exit(code);
+}
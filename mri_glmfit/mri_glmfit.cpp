@@ -96,7 +96,7 @@ USAGE: ./mri_glmfit
    --save-cond  : flag to save design matrix condition at each voxel
    --voxdump col row slice  : dump voxel GLM and exit
 
-   --seed seed : used for synthesizing noise
+   --seed seed : used for synthesizing noise (one stream per --sim iteration)
    --synth : replace input with gaussian
 
    --resynthtest niters : test GLM by resynthsis
@@ -118,6 +118,9 @@ USAGE: ./mri_glmfit
    --allow-zero-dof : mostly for very special purposes
    --illcond : allow ill-conditioned design matrices
    --sim-done SimDoneFile : create DoneFile when simulation finished 
+   --sim-checkpoint N : only rewrite the CSDs every N sim iterations (default 1)
+   --sim-resume : continue a simulation from the CSDs of an earlier run
+   --sim-first N : start at iteration N of the seed's sequence (for split jobs)
 
 ENDUSAGE --------------------------------------------------------------
 
@@ -420,7 +423,10 @@ nifti files with non-freesurfer software.
 
 Use seed as the seed for the random number generator. By default, mri_glmfit
 will select a seed based on time-of-day. This only has an effect with
---sim or --synth.
+--sim or --synth. With --sim, each iteration draws from its own stream
+derived from the seed and the iteration number (see --sim-first), so a
+given seed gives different simulations than versions of mri_glmfit that
+drew every iteration from one stream.
 
 --synth
 
@@ -477,9 +483,18 @@ csdbasename - base name of the file to store the CSD data in. Each
 
 Multiple simulations can be run in parallel by specifying different
 csdbasenames. Then pass the multiple CSD files to mri_surfcluster
-and mri_volcluster. The Full CSD file is written on each iteration,
-which means that the CSD file will be valid if the simulation
-is aborted or crashes.
+and mri_volcluster. The Full CSD file is written on each iteration
+(or every N iterations with --sim-checkpoint N), which means that
+the CSD file will be valid if the simulation is aborted or crashes.
+
+Each iteration draws its random numbers from a stream derived from
+the seed and the iteration number. A simulation that was killed can
+be continued by rerunning the same command with --sim-resume, which
+reloads the CSDs and the seed and runs the remaining iterations. A
+long simulation can be split over jobs that use the same --seed by
+giving each job its own csdbasename and --sim-first (eg, two jobs of
+5000 with --sim-first 0 and --sim-first 5000); the merged CSDs are
+the same as those of a single job of 10000.
 
 In the cases where the design matrix is a single columns of ones
 (ie, one-sample group mean), it makes no sense to permute the
@@ -564,6 +579,10 @@ static void print_help(void) ;
 static void print_version(void) ;
 static void dump_options(FILE *fp);
 static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel);
+static long SimIterSeed(long seed, int nthiter);
+static void SimCSDFileName(char *fname, CSD *csd, int n);
+static int SimCSDWrite(char *fname, CSD *csd, int n, double runtime_min);
+static int SimResume(void);
 
 int main(int argc, char *argv[]) ;
 
@@ -732,6 +751,9 @@ float ThreshList[4] = {1.3,  2.0,  2.3,  3.0};
 int  nSignList = 3, nthSign;
 int SignList[3] = {-1,0,1};
 CSD *csdList[5][3][20];
+int SimCheckpoint = 1; // rewrite the CSDs every this many iterations
+int DoSimResume = 0;
+int SimFirstIter = 0;  // offset into the per-iteration seed sequence
 
 MATRIX *RTM_Cr, *RTM_intCr, *RTM_TimeSec, *RTM_TimeMin;
 int DoMRTM1=0;
@@ -763,12 +785,14 @@ MRI *MRIremoveSpatialMean(MRI *vol, MRI *mask, MRI *out);
 /*--------------------------------------------------*/
 int main(int argc, char **argv) {
   int nargs, n,m;
-  int msecFitTime;
+  int msecFitTime, nthsimStart;
+  long simseed;
+  MATRIX *Xsim0=NULL;
+  MRI **simsig=NULL;
   MATRIX *wvect=NULL, *Mtmp=NULL, *Xselfreg=NULL, *Ex=NULL, *XgNew=NULL;
   MATRIX *Ct, *CCt;
   FILE *fp;
   double Ccond, dtmp, threshadj, eff;
-  char *tmpstr2=NULL;
 
   eresfwhm = -1;
   csd = CSDalloc();
@@ -1683,12 +1707,25 @@ int main(int argc, char **argv) {
       }
     }
 
+    // Each iteration draws from its own RNG stream derived from the
+    // seed and the iteration number, so a run that is resumed or split
+    // over several jobs (--sim-first) gives the same CSDs as one long
+    // run. Permutations are therefore always drawn from the original
+    // design rather than from the previous permutation.
+    Xsim0 = MatrixCopy(mriglm->Xg,NULL);
+    simsig = (MRI **) calloc(mriglm->glm->ncontrasts,sizeof(MRI*));
+    nthsimStart = 0;
+    if(DoSimResume) nthsimStart = SimResume();
+
     printf("\n\nStarting simulation sim over %d trials\n",nsim);
     mytimer.reset() ;
-    for (nthsim=0; nthsim < nsim; nthsim++) {
+    for (nthsim=nthsimStart; nthsim < nsim; nthsim++) {
       msecFitTime = mytimer.milliseconds();
       if(debug) printf("%d/%d t=%g ---------------------------------\n",
              nthsim+1,nsim,msecFitTime/(1000*60.0));
+      simseed = SimIterSeed(SynthSeed,SimFirstIter+nthsim);
+      srand48(simseed);
+      if(rfs) RFspecSetSeed(rfs,simseed);
 
       if (!strcmp(csd->simtype,"mc-full")) {
 	if(! UseUniform)
@@ -1702,7 +1739,10 @@ int main(int argc, char **argv) {
           SmoothSurfOrVol(surf, mriglm->y, mriglm->mask, SmoothLevel);
       }
       if (!strcmp(csd->simtype,"perm")) {
-        if (!OneSamplePerm) MatrixRandPermRows(mriglm->Xg);
+        if (!OneSamplePerm) {
+          MatrixCopy(Xsim0,mriglm->Xg);
+          MatrixRandPermRows(mriglm->Xg);
+        }
         else {
           for (n=0; n < mriglm->y->nframes; n++) {
             if (drand48() > 0.5) m = +1;
@@ -1736,6 +1776,10 @@ int main(int argc, char **argv) {
 	    // MRISsmoothMRI(surf, fwhmmap, SmthLevel, mriglm->mask, fwhmmap)
 	  }
         }
+	// -log10(p) does not depend on the threshold or sign, so compute
+	// it once per contrast rather than once per thresh/sign pair
+	for (n=0; n < mriglm->glm->ncontrasts; n++)
+	  simsig[n] = MRIlog10(mriglm->p[n],NULL,simsig[n],1);
       }
 
       for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
@@ -1758,7 +1802,7 @@ int main(int argc, char **argv) {
 	    else threshadj = csd->thresh - log10(2.0); // one-sided test
 
 	    if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
+	      sig = MRIcopy(simsig[n],sig);
 	      // If test is not ABS then apply the sign
 	      if(csd->threshsign != 0) MRIsetSign(sig,mriglm->gamma[n],0);
 	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
@@ -1825,56 +1869,42 @@ int main(int argc, char **argv) {
 	    else {
 	      // volume clustering -------------
 	      if (debug) printf("Clustering on volume\n");
-	      VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
-					      mriglm->mask, &nClusters, NULL);
-	      csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
-	      if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
-	      clustFreeClusterList(&VolClustList,nClusters);
+	      if (Gdiag_no > 0) {
+		VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
+						mriglm->mask, &nClusters, NULL);
+		csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
+		clustDumpSummary(stdout,VolClustList,nClusters);
+		clustFreeClusterList(&VolClustList,nClusters);
+	      }
+	      else {
+		// Only the number of clusters and the size of the largest
+		// are needed, so skip building the member lists
+		csize = voxelsize*clustCountClusters(sig, 0, threshadj,-1,csd->threshsign,
+						     mriglm->mask, 6, &nClusters);
+	      }
 	    }
 	    if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
 			     mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
 
-	    // Re-write the full CSD file each time. Should not take that
-	    // long and assures output can be used immediately regardless
-	    // of whether the job terminated properly or not
-	    strcpy(csd->contrast,mriglm->glm->Cname[n]);
-	    if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
-	      if(round(csd->threshsign) ==  0) tmpstr2 = "abs"; 
-	      if(round(csd->threshsign) == +1) tmpstr2 = "pos"; 
-	      if(round(csd->threshsign) == -1) tmpstr2 = "neg"; 
-	      //sprintf(tmpstr,"%s-%s.th%04d.%s.csd",simbase,mriglm->glm->Cname[n],
-	      //      (int)round(csd->thresh*100),tmpstr2);
-	      sprintf(tmpstr,"%s.th%02d.%s.j001-%s.csd",simbase,
-		      (int)round(csd->thresh*10),tmpstr2,mriglm->glm->Cname[n]);
-	    }
-	    else
-	      sprintf(tmpstr,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
-	    if(debug) printf("csd %s \n",tmpstr);
-	    fflush(stdout);
-	    fp = fopen(tmpstr,"w");
-	    if (fp == NULL) {
-	      printf("ERROR: opening %s\n",tmpstr);
-	      exit(1);
-	    }
-	    fprintf(fp,"# ClusterSimulationData 2\n");
-	    fprintf(fp,"# mri_glmfit simulation sim\n");
-	    fprintf(fp,"# hostname %s\n",uts.nodename);
-	    fprintf(fp,"# machine  %s\n",uts.machine);
-	    fprintf(fp,"# runtime_min %g\n",msecFitTime/(1000*60.0));
-	    fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
-	    if (mriglm->mask) fprintf(fp,"# masking 1\n");
-	    else             fprintf(fp,"# masking 0\n");
-	    fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
-	    fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
-	    fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
 	    csd->nreps = nthsim+1;
 	    csd->nClusters[nthsim] = nClusters;
 	    csd->MaxClusterSize[nthsim] = csize;
 	    csd->MaxSig[nthsim] = sigmax;
 	    csd->MaxStat[nthsim] = Fmax;
-	    CSDprint(fp, csd);
-	    fclose(fp);
-	    if(debug) CSDprint(stdout, csd);
+
+	    // Re-write the full CSD file every SimCheckpoint iterations
+	    // (every iteration by default). Should not take that long and
+	    // assures output can be used immediately (or resumed with
+	    // --sim-resume) regardless of whether the job terminated
+	    // properly or not
+	    strcpy(csd->contrast,mriglm->glm->Cname[n]);
+	    if((nthsim+1) % SimCheckpoint == 0 || nthsim == nsim-1 || DiagCluster){
+	      SimCSDFileName(tmpstr,csd,n);
+	      if(debug) printf("csd %s \n",tmpstr);
+	      fflush(stdout);
+	      SimCSDWrite(tmpstr,csd,n,msecFitTime/(1000*60.0));
+	      if(debug) CSDprint(stdout, csd);
+	    }
 
 	    if(DiagCluster) {
 	      sprintf(tmpstr,"./%s-sig.%s",mriglm->glm->Cname[n],format);
@@ -1889,6 +1919,10 @@ int main(int argc, char **argv) {
       //MRIfree(&sig);
 
     }// simulation loop
+    MatrixFree(&Xsim0);
+    for (n=0; n < mriglm->glm->ncontrasts; n++)
+      if(simsig[n]) MRIfree(&simsig[n]);
+    free(simsig);
     if(SimDoneFile){
       fp = fopen(SimDoneFile,"w");
       fclose(fp);
@@ -2898,6 +2932,18 @@ static int parse_commandline(int argc, char **argv) {
       SimDoneFile = pargv[0];
       nargsused = 1;
     } 
+    else if (!strcmp(option, "--sim-checkpoint")) {
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%d",&SimCheckpoint);
+      if(SimCheckpoint < 1) SimCheckpoint = 1;
+      nargsused = 1;
+    } 
+    else if (!strcmp(option, "--sim-resume")) DoSimResume = 1;
+    else if (!strcmp(option, "--sim-first")) {
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%d",&SimFirstIter);
+      nargsused = 1;
+    } 
     else {
       fprintf(stderr,"ERROR: Option %s unknown\n",option);
       if (CMDsingleDash(option))
@@ -2978,7 +3024,7 @@ printf("   --save-yhat : flag to save signal estimate\n");
 printf("   --save-cond  : flag to save design matrix condition at each voxel\n");
 printf("   --voxdump col row slice  : dump voxel GLM and exit\n");
 printf("\n");
-printf("   --seed seed : used for synthesizing noise\n");
+printf("   --seed seed : used for synthesizing noise (one stream per --sim iteration)\n");
 printf("   --synth : replace input with gaussian\n");
 printf("\n");
 printf("   --resynthtest niters : test GLM by resynthsis\n");
@@ -3000,6 +3046,9 @@ printf("                  before --fsgd)\n");
 printf("   --allow-zero-dof : mostly for very special purposes\n");
 printf("   --illcond : allow ill-conditioned design matrices\n");
 printf("   --sim-done SimDoneFile : create DoneFile when simulation finished \n");
+printf("   --sim-checkpoint N : only rewrite the CSDs every N sim iterations (default 1)\n");
+printf("   --sim-resume : continue a simulation from the CSDs of an earlier run\n");
+printf("   --sim-first N : start at iteration N of the seed's sequence (for split jobs)\n");
 printf("\n");
 printf("\n");
 }
@@ -3306,7 +3355,10 @@ printf("--seed seed\n");
 printf("\n");
 printf("Use seed as the seed for the random number generator. By default, mri_glmfit\n");
 printf("will select a seed based on time-of-day. This only has an effect with\n");
-printf("--sim or --synth.\n");
+printf("--sim or --synth. With --sim, each iteration draws from its own stream\n");
+printf("derived from the seed and the iteration number (see --sim-first), so a\n");
+printf("given seed gives different simulations than versions of mri_glmfit that\n");
+printf("drew every iteration from one stream.\n");
 printf("\n");
 printf("--synth\n");
 printf("\n");
@@ -3363,9 +3415,18 @@ printf("  name to the base name). A '.csd' is appended to each file name.\n");
 printf("\n");
 printf("Multiple simulations can be run in parallel by specifying different\n");
 printf("csdbasenames. Then pass the multiple CSD files to mri_surfcluster\n");
-printf("and mri_volcluster. The Full CSD file is written on each iteration,\n");
-printf("which means that the CSD file will be valid if the simulation\n");
-printf("is aborted or crashes.\n");
+printf("and mri_volcluster. The Full CSD file is written on each iteration\n");
+printf("(or every N iterations with --sim-checkpoint N), which means that\n");
+printf("the CSD file will be valid if the simulation is aborted or crashes.\n");
+printf("\n");
+printf("Each iteration draws its random numbers from a stream derived from\n");
+printf("the seed and the iteration number. A simulation that was killed can\n");
+printf("be continued by rerunning the same command with --sim-resume, which\n");
+printf("reloads the CSDs and the seed and runs the remaining iterations. A\n");
+printf("long simulation can be split over jobs that use the same --seed by\n");
+printf("giving each job its own csdbasename and --sim-first (eg, two jobs of\n");
+printf("5000 with --sim-first 0 and --sim-first 5000); the merged CSDs are\n");
+printf("the same as those of a single job of 10000.\n");
 printf("\n");
 printf("In the cases where the design matrix is a single columns of ones\n");
 printf("(ie, one-sample group mean), it makes no sense to permute the\n");
@@ -3652,6 +3713,134 @@ static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel) {
   return(0);
 }
 
+/*--------------------------------------------------------------------
+  SimIterSeed() - returns the seed of the random stream used by the
+  given simulation iteration. The base seed and iteration number are
+  mixed (splitmix64 finalizer) so that consecutive iterations get
+  unrelated streams. The result is positive, non-zero (RFspecSetSeed()
+  treats 0 as "seed from time of day"), and fits in the 32 bits that
+  srand48() uses.
+  --------------------------------------------------------------------*/
+static long SimIterSeed(long seed, int nthiter) {
+  unsigned long long x;
+  x = (unsigned long long) seed + 0x9E3779B97F4A7C15ULL*(unsigned long long)(nthiter+1);
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x = (x ^ (x >> 31)) & 0x7fffffff;
+  if(x == 0) x = 1;
+  return((long)x);
+}
+
+/*--------------------------------------------------------------------
+  SimCSDFileName() - name of the CSD file for the nth contrast. The
+  sign in the name comes from csd->threshsign, which the simulation
+  loop forces to abs for F-tests.
+  --------------------------------------------------------------------*/
+static void SimCSDFileName(char *fname, CSD *csd, int n) {
+  extern MRIGLM *mriglm;
+  const char *signstr="abs";
+
+  if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
+    if(round(csd->threshsign) == +1) signstr = "pos";
+    if(round(csd->threshsign) == -1) signstr = "neg";
+    sprintf(fname,"%s.th%02d.%s.j001-%s.csd",simbase,
+            (int)round(csd->thresh*10),signstr,mriglm->glm->Cname[n]);
+  }
+  else
+    sprintf(fname,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
+}
+
+/*--------------------------------------------------------------------
+  SimCSDWrite() - writes the simulation CSD for the nth contrast,
+  including the mri_glmfit-specific header lines.
+  --------------------------------------------------------------------*/
+static int SimCSDWrite(char *fname, CSD *csd, int n, double runtime_min) {
+  extern MRIGLM *mriglm;
+  FILE *fp;
+
+  fp = fopen(fname,"w");
+  if (fp == NULL) {
+    printf("ERROR: opening %s\n",fname);
+    exit(1);
+  }
+  fprintf(fp,"# ClusterSimulationData 2\n");
+  fprintf(fp,"# mri_glmfit simulation sim\n");
+  fprintf(fp,"# hostname %s\n",uts.nodename);
+  fprintf(fp,"# machine  %s\n",uts.machine);
+  fprintf(fp,"# runtime_min %g\n",runtime_min);
+  fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
+  if (mriglm->mask) fprintf(fp,"# masking 1\n");
+  else             fprintf(fp,"# masking 0\n");
+  fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
+  fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
+  fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
+  CSDprint(fp, csd);
+  fclose(fp);
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimResume() - reloads the CSDs written by an earlier run with the
+  same --sim arguments (eg, one that was killed) into csdList and
+  returns the number of iterations complete in all of them. The seed
+  is taken from the CSDs so that the remaining iterations continue
+  the same random streams. Returns 0 if any CSD is missing.
+  --------------------------------------------------------------------*/
+static int SimResume(void) {
+  extern MRIGLM *mriglm;
+  char fname[2000];
+  CSD *csdold, *csdnew;
+  int n, nthrep, nreps = -1;
+  long seed = -1;
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+        csdnew = csdList[nthThresh][nthSign][n];
+        csdnew->threshsign = SignList[nthSign];
+        if(mriglm->glm->C[n]->rows > 1) csdnew->threshsign = 0;
+        SimCSDFileName(fname,csdnew,n);
+        if(!fio_FileExistsReadable(fname)){
+          printf("INFO: %s does not exist, starting simulation from the beginning\n",fname);
+          return(0);
+        }
+        csdold = CSDread(fname);
+        if(csdold == NULL) exit(1);
+        if(strcmp(csdold->simtype,csdnew->simtype)){
+          printf("ERROR: cannot resume, %s has simtype %s, expected %s\n",
+                 fname,csdold->simtype,csdnew->simtype);
+          exit(1);
+        }
+        if(seed < 0) seed = csdold->seed;
+        else if(csdold->seed != seed){
+          printf("ERROR: cannot resume, %s has seed %ld, expected %ld\n",
+                 fname,csdold->seed,seed);
+          exit(1);
+        }
+        if(nreps < 0 || csdold->nreps < nreps) nreps = csdold->nreps;
+        for(nthrep = 0; nthrep < csdold->nreps && nthrep < nsim; nthrep++){
+          csdnew->nClusters[nthrep]      = csdold->nClusters[nthrep];
+          csdnew->MaxClusterSize[nthrep] = csdold->MaxClusterSize[nthrep];
+          csdnew->MaxSig[nthrep]         = csdold->MaxSig[nthrep];
+          csdnew->MaxStat[nthrep]        = csdold->MaxStat[nthrep];
+        }
+        CSDfreeData(csdold);
+        free(csdold);
+      }
+    }
+  }
+  if(nreps < 0) return(0);
+  if(nreps > nsim) nreps = nsim;
+
+  SynthSeed = seed;
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++)
+    for(nthSign = 0; nthSign < nSignList; nthSign++)
+      for (n=0; n < mriglm->glm->ncontrasts; n++)
+        csdList[nthThresh][nthSign][n]->seed = seed;
+  printf("Resuming simulation at iteration %d of %d with seed %ld\n",nreps,nsim,seed);
+  return(nreps);
+}
+
 
 /*--------------------------------------------------------------------*/
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag) {
@@ -23,3 +23,16 @@ done
 for f in F.mgh gamma.mgh sig.mgh; do
     compare_vol ${actual}/age/${f} ${expected}/age/${f} --thresh 0.008
 done
+
+# a permutation simulation split over two jobs (--sim-first), or stopped and
+# continued (--sim-resume), must give the same CSD rows as one uninterrupted run
+csd_rows() { grep -v '^#' $1 | awk '{$1=""; print}'; }
+glmsim="mri_glmfit --seed 1234 --y lh.gender_age.thickness.10.mgh --fsgd gender_age.txt doss \
+    --no-cortex --surf average lh --C age.mat"
+test_command "$glmsim --glmdir sim.full --sim perm 4 2 full && \
+    $glmsim --glmdir sim.a --sim perm 2 2 split.a && \
+    $glmsim --glmdir sim.b --sim perm 2 2 split.b --sim-first 2 && \
+    $glmsim --glmdir sim.r --sim perm 2 2 resumed && \
+    $glmsim --glmdir sim.r --sim perm 4 2 resumed --sim-resume && \
+    [ \"\$(csd_rows full-age.csd)\" = \"\$(csd_rows split.a-age.csd; csd_rows split.b-age.csd)\" ] && \
+    [ \"\$(csd_rows full-age.csd)\" = \"\$(csd_rows resumed-age.csd)\" ]"
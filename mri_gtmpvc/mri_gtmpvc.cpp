@@ -611,8 +611,7 @@ int main(int argc, char *argv[])
   if(Gdiag_no > 0) PrintMemUsage(stdout);
   PrintMemUsage(logfp);
   mytimer.reset();
-  GTMbuildX(gtm);
-  if(gtm->X==NULL) exit(1);
+  if(GTMbuildX(gtm)) exit(1);
   printf(" gtm build time %4.1f sec\n",mytimer.seconds());fflush(stdout);
   fprintf(logfp,"GTM-Build-time %4.1f sec\n",mytimer.seconds());fflush(logfp);
   if(Gdiag_no > 0) PrintMemUsage(stdout);
@@ -724,10 +723,7 @@ int main(int argc, char *argv[])
       if(Gdiag_no > 0) PrintMemUsage(stdout);
       PrintMemUsage(logfp);
       mytimer.reset();
-      MatrixFree(&gtm->X);
-      MatrixFree(&gtm->X0);
-      GTMbuildX(gtm);
-      if(gtm->X==NULL) exit(1);
+      if(GTMbuildX(gtm)) exit(1);
       printf(" gtm build time %4.1f sec\n", mytimer.seconds()); fflush(stdout);
       fprintf(logfp,"GTM-rebuild-time %4.1f sec\n", mytimer.seconds()); fflush(logfp);
       if(Gdiag_no > 0) PrintMemUsage(stdout);
@@ -743,12 +739,19 @@ int main(int argc, char *argv[])
   //printf("Freeing segpvf\n"); fflush(stdout);
   //MRIfree(&gtm->segpvf);
   if(SaveX0) {
+    // X0 and X are only dense while being written
     printf("Writing X0 to %s\n",Xfile);
-    MatlabWrite(gtm->X0, X0file,"X0");
+    MATRIX *X0 = GTMdenseX(gtm,gtm->X0val,NULL);
+    if(X0 == NULL) exit(1);
+    MatlabWrite(X0, X0file,"X0");
+    MatrixFree(&X0);
   }
   if(SaveX) {
     printf("Writing X to %s\n",Xfile);
-    MatlabWrite(gtm->X, Xfile,"X");
+    MATRIX *X = GTMdenseX(gtm,gtm->Xval,NULL);
+    if(X == NULL) exit(1);
+    MatlabWrite(X, Xfile,"X");
+    MatrixFree(&X);
   }
 
   printf("Solving ...\n");
@@ -763,14 +766,13 @@ int main(int argc, char *argv[])
   if(Gdiag_no > 0) PrintMemUsage(stdout);
   PrintMemUsage(logfp);
 
-  if(gtm->X0 && DoGTMMat){
-    MATRIX *X0tX0, *X0t,*X0tX,*iX0tX0,*gtmmat;
+  if(DoGTMMat){
+    MATRIX *X0tX0,*X0tX,*iX0tX0,*gtmmat;
     printf("Computing actual GTM Matrix\n"); fflush(stdout);
-    X0tX0 = MatrixMtM(gtm->X0,NULL);
+    X0tX0 = GTMsparseAtB(gtm,gtm->X0val,gtm->X0val,NULL);
     iX0tX0 = MatrixInverse(X0tX0,NULL);
 
-    X0t = MatrixTranspose(gtm->X0,NULL);
-    X0tX = MatrixMultiplyD(X0t,gtm->X,NULL);
+    X0tX = GTMsparseAtB(gtm,gtm->X0val,gtm->Xval,NULL);
     gtmmat = MatrixMultiplyD(iX0tX0,X0tX,NULL);
     sprintf(tmpstr,"%s/gtm.mat",AuxDir);
     MatrixWriteTxt(tmpstr,gtmmat);
@@ -778,7 +780,6 @@ int main(int argc, char *argv[])
     sprintf(tmpstr,"%s/gtm.inv.mat",AuxDir);
     MatrixWriteTxt(tmpstr,gtmmat);
     printf("done computing gtm matrix\n"); fflush(stdout);
-    MatrixFree(&X0t);
     MatrixFree(&X0tX0);
     MatrixFree(&X0tX);
     MatrixFree(&gtmmat);
@@ -904,9 +905,6 @@ int main(int argc, char *argv[])
   if(err) exit(1);
   MRIfree(&mritmp);
 
-  printf("Freeing X\n");
-  MatrixFree(&gtm->X);
-
   nopvc = GTMnoPVC(gtm);
   sprintf(tmpstr,"%s/nopvc.nii.gz",OutDir);
   MRIwrite(nopvc,tmpstr);
@@ -986,8 +984,8 @@ int main(int argc, char *argv[])
   }
   if(yhat0File) MRIwrite(gtm->ysynth,yhat0File);
   
-  printf("Freeing X0\n");
-  MatrixFree(&gtm->X0);
+  printf("Freeing X and X0\n");
+  GTMfreeX(gtm);
 
 
   if(yhatFile|| yhatFullFoVFile){
@@ -2074,8 +2072,8 @@ double GTMcostPSF(GTM *gtm)
 
   GTMpsfStd(gtm);
 
-  GTMbuildX(gtm);
-  if(gtm->X==NULL) exit(1);
+  // Only the sparse X is built while optimizing
+  if(GTMbuildX(gtm)) exit(1);
 
   err=GTMsolve(gtm); 
   GTMrvarGM(gtm);
@@ -2393,30 +2391,37 @@ MRI *GTMsimAnatSeg(GTM *gtm)
  */
 int GTMsom(GTM *gtm)
 {
-  int rthseg, cthseg, k, f, c,r,s,segid;
+  int rthseg, cthseg, k, f, c,r,s,segid,n,*rowseg;
   double val,cbeta,sum;
 
   gtm->som = MatrixAlloc(gtm->nsegs,gtm->nsegs,MATRIX_REAL);
 
+  // seg of each row of X, -1 if none
+  rowseg = (int *) calloc(gtm->nmask,sizeof(int));
+  k = 0;
+  for(s=0; s < gtm->yvol->depth; s++){ // crs order is important here!
+    for(c=0; c < gtm->yvol->width; c++){
+      for(r=0; r < gtm->yvol->height; r++){
+	if(gtm->mask && MRIgetVoxVal(gtm->mask,c,r,s,0) < 0.5) continue;
+	segid = MRIgetVoxVal(gtm->gtmseg,c,r,s,0);
+	if(segid != 0) rowseg[k] = GTMsegid2nthseg(gtm,segid);
+	else           rowseg[k] = -1;
+	k++;
+      }
+    }
+  }
+
   f = 0; // only one frame with the matrix
   for(cthseg=0; cthseg < gtm->nsegs; cthseg++){
-    k = 0;
     cbeta = gtm->beta->rptr[cthseg+1][f+1];
-    for(s=0; s < gtm->yvol->depth; s++){ // crs order is important here!
-      for(c=0; c < gtm->yvol->width; c++){
-	for(r=0; r < gtm->yvol->height; r++){
-	  if(gtm->mask && MRIgetVoxVal(gtm->mask,c,r,s,0) < 0.5) continue;
-	  val = cbeta*gtm->X->rptr[k+1][cthseg+1];
-	  segid = MRIgetVoxVal(gtm->gtmseg,c,r,s,0);
-	  if(segid != 0) {
-	    rthseg = GTMsegid2nthseg(gtm,segid);
-	    gtm->som->rptr[rthseg+1][cthseg+1] += val;
-	  }
-	  k++;
-	}
-      }
+    for(n=0; n < gtm->Xnnz[cthseg]; n++){
+      rthseg = rowseg[gtm->Xrow[cthseg][n]];
+      if(rthseg < 0) continue;
+      val = cbeta*gtm->Xval[cthseg][n];
+      gtm->som->rptr[rthseg+1][cthseg+1] += val;
     }
   } // cthseg
+  free(rowseg);
     
   /* Normalize SOM(rNoPVC,cGTM) is the proportion that cGTM
      contributes to rNoPVC, ie, it is the amount of spill-out of
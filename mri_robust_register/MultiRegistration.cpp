@@ -72,6 +72,9 @@ void MultiRegistration::clear()
       MRIfree(&mri_mov[i]);
     if (i < mri_bsplines.size() && mri_bsplines[i])
       MRIfreeBSpline(&mri_bsplines[i]);
+    if (i < mri_pyramids.size())
+      for (unsigned int r = 0; r < mri_pyramids[i].size(); r++)
+        MRIfree(&mri_pyramids[i][r]);
   }
 
 }
@@ -568,6 +571,11 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
   // the methods are: maxit 3, maxit 2, maxit 1, subsample 180
   int noxformits[4] =
   { 3, 1, 0, 0 };
+
+  // source pyramids only depend on the input and the (fixed) template geometry,
+  // so they can be reused across iterations if requested
+  if (keeppyramids && !nomulti && !iscaleonly)
+    mri_pyramids.resize(nin);
   while (itcount < itmax && maxchange > eps)
   {
     itcount++;
@@ -591,9 +599,10 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
       cout << "  noxformits = " << noxformits[itcount - 1] << endl;
 
     // register all inputs to mean
+    // (dynamic schedule, as registration times differ between time points)
     vector<double> dists(nin, 1000); // should be larger than maxchange!
 #ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(static,1)
+#pragma omp parallel for schedule(dynamic,1)
 #endif
     for (int i = 0; i < nin; i++)
     {
@@ -609,6 +618,8 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
 //      R.setTarget(mri_mean, fixvoxel, keeptype); // gaussian pyramid will be constructed for
 //                                                 // each Rv[i], could be optimized
       R.setSourceAndTarget(mri_mov[i],mri_mean,keeptype);
+      if (i < (int) mri_pyramids.size() && mri_pyramids[i].size() > 0)
+        R.setGPS(mri_pyramids[i]);
 
       ostringstream oss;
       oss << outdir << "tp" << i + 1 << "_to_template-it" << itcount;
@@ -648,18 +659,24 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
       if (satit)
         R.findSaturation();
 
+      // only the output is serialized, the registrations run concurrently
+      if (nomulti || iscaleonly)
+      {
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif 
-      if (nomulti || iscaleonly)
-      {
         cout << " - running high-res registration on TP " << i + 1 << "..." << endl;
         R.computeIterativeRegistration(iterate, epsit); 
       }
       else
       {
+#ifdef HAVE_OPENMP
+#pragma omp critical
+#endif 
         cout << " - running multi-resolutional registration on TP " << i + 1 << "..." << endl;
         R.computeMultiresRegistration(maxres, iterate, epsit);
+        if (i < (int) mri_pyramids.size())
+          mri_pyramids[i] = R.releaseGPS();
       }
 
       Md.first = R.getFinalVox2Vox();
@@ -700,12 +717,14 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
             MyMatrix::AffineTransDistSq(lastlta->xforms[0].m_L,
                 ltas[i]->xforms[0].m_L));
         LTAfree(&lastlta);
-        if (dists[i] > maxchange)
-          maxchange = dists[i];
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-        cout << "   tp " << i + 1 << " distance: " << dists[i] << endl;
+        {
+          if (dists[i] > maxchange)
+            maxchange = dists[i];
+          cout << "   tp " << i + 1 << " distance: " << dists[i] << endl;
+        }
       }
 
       // create warps: warp mov to mean
@@ -55,7 +55,8 @@ public:
           satit(false), debug(0), iscale(false), iscaleonly(false),
           nomulti(false), subsamplesize(-1), highit(-1), fixvoxel(false),
           keeptype(false), average(1), doubleprec(false), backupweights(false),
-          sampletype(SAMPLE_CUBIC_BSPLINE), crascenter(false), mri_mean(NULL)
+          sampletype(SAMPLE_CUBIC_BSPLINE), crascenter(false), keeppyramids(false),
+          mri_mean(NULL)
   {
   }
 
@@ -99,6 +100,7 @@ public:
     std::cout << " BackupWeights: " << backupweights << std::endl;
     std::cout << " SampleType:    " << sampletype<< std::endl;
     std::cout << " CRASCenter:    " << crascenter<< std::endl;
+    std::cout << " KeepPyramids:  " << keeppyramids << std::endl;
     std::cout << " Debug:         " << debug << std::endl;
     std::cout <<  std::noboolalpha << std::endl;
   
@@ -273,6 +275,12 @@ public:
     crascenter=b;
   }
 
+  //! If true: keep the Gaussian pyramids of the inputs across template iterations (more memory)
+  void setKeepPyramids(bool b)
+  {
+    keeppyramids = b;
+  }
+
   //! Maps mov based on ltas (also iscale) and then averages them
   bool mapAndAverageMov(int itdebug);
 
@@ -321,6 +329,7 @@ private:
   bool backupweights;
   int sampletype;
   bool crascenter;
+  bool keeppyramids;
 
   // DATA
   std::vector<MRI*> mri_mov;
@@ -328,6 +337,7 @@ private:
   std::vector<LTA*> ltas;
   std::vector<MRI*> mri_warps;
   std::vector<MRI*> mri_weights;
+  std::vector<std::vector<MRI*> > mri_pyramids; // source pyramids (if keeppyramids)
   std::vector<double> intensities;
   MRI * mri_mean;
 
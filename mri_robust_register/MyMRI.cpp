@@ -194,11 +194,25 @@ MRI * MyMRI::subSample(MRI * mri_src, MRI * mri_dst, bool fixheader,
 
   int x, y, z, f;
   int dx, dy, dz = 0;
-  for (z = 0; z < d; z++)
-    for (y = 0; y < h; y++)
-      for (x = 0; x < w; x++)
-      {
-        if (randpos >= 0)
+  if (randpos < 0)
+  {
+    // plain subsampling, slices are independent
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(x, y, f)
+#endif
+    for (z = 0; z < d; z++)
+      for (y = 0; y < h; y++)
+        for (x = 0; x < w; x++)
+          for (f = 0; f<mri_src->nframes; f++)
+            MRIsetVoxVal(mri_dst, x, y, z, f,
+                MRIgetVoxVal(mri_src, 2 * x, 2 * y, 2 * z, f));
+  }
+  else
+  {
+    // random offsets are drawn sequentially (randpos), so this stays serial
+    for (z = 0; z < d; z++)
+      for (y = 0; y < h; y++)
+        for (x = 0; x < w; x++)
         {
           // random offset 0 or 1:
           dx = (int) (2.0 * MyMRI::getRand(randpos));
@@ -214,11 +228,7 @@ MRI * MyMRI::subSample(MRI * mri_src, MRI * mri_dst, bool fixheader,
             MRIsetVoxVal(mri_dst, x, y, z, f,
                 MRIgetVoxVal(mri_src, 2 * x + dx, 2 * y + dy, 2 * z + dz, f));
         }
-        else
-          for (f = 0; f<mri_src->nframes; f++)
-            MRIsetVoxVal(mri_dst, x, y, z, f,
-                MRIgetVoxVal(mri_src, 2 * x, 2 * y, 2 * z, f));
-      }
+  }
 
   if (fixheader) // adjusts header of dest so that RAS coordinates agree
   {
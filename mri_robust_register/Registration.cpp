@@ -3119,12 +3119,20 @@ vector<MRI*> Registration::buildGaussianPyramid(MRI * mri_in, int min, int max)
         || p[i - 1]->depth < min)
       break;
     //else subsample:
-    mri_tmp = MRIconvolveGaussian(mri_tmp, NULL, mri_kernel);
-    //p[i] = MRIdownsample2(mri_tmp,NULL);
-    p[i] = MyMRI::subSample(mri_tmp, NULL, true);
+    if (mri_tmp == mri_in)
+    {
+      // p[0] already is the smoothed input, no need to convolve it again
+      p[i] = MyMRI::subSample(p[0], NULL, true);
+    }
+    else
+    {
+      mri_tmp = MRIconvolveGaussian(mri_tmp, NULL, mri_kernel);
+      //p[i] = MRIdownsample2(mri_tmp,NULL);
+      p[i] = MyMRI::subSample(mri_tmp, NULL, true);
+      //p[i] = MRIdownsample2BSpline(mri_tmp, NULL);
+      MRIfree(&mri_tmp);
+    }
     p[i]->outside_val = mri_in->outside_val;
-    //p[i] = MRIdownsample2BSpline(mri_tmp, NULL);
-    MRIfree(&mri_tmp);
     mri_tmp = p[i];
     //cout << " w[" << i<<"]: " << p[i]->width << endl;
   }
@@ -96,6 +96,22 @@ public:
     freeGaussianPyramid(gpT);
   }
 
+  //! Hand the source Gaussian pyramid to the caller (who then owns it)
+  std::vector<MRI*> releaseGPS()
+  {
+    std::vector<MRI*> gp;
+    gp.swap(gpS);
+    return gp;
+  }
+
+  //! Use a source Gaussian pyramid built earlier for the same source and target geometry
+  //! (takes ownership, call after setSourceAndTarget)
+  void setGPS(std::vector<MRI*> & gp)
+  {
+    freeGaussianPyramid(gpS);
+    gpS.swap(gp);
+  }
+
   //! Allow only translation
   void setTransonly()
   {
@@ -34,6 +34,7 @@
 #include <limits>
 #include <vector>
 #include <fstream>
+#include <algorithm>
 #include "RobustGaussian.h"
 
 #define export // obsolete feature 'export template' used in these headers 
@@ -45,6 +46,10 @@
 #include <stdlib.h>
 #include "error.h"
 
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
 using namespace std;
 
 template<class T>
@@ -282,7 +287,7 @@ vnl_vector<T> Regression<T>::getRobustEstWAB(vnl_vector<T>& wfinal, double sat,
       *p = getWeightedLSEst(*w);
 
     // compute new residuals
-    *r = *b - (*A * *p);
+    *r = getResiduals(*p);
 
     // and total errors (using new r)
     // err = sum (w r^2) / sum (w)
@@ -361,81 +366,135 @@ vnl_vector<T> Regression<T>::getRobustEstWAB(vnl_vector<T>& wfinal, double sat,
 }
 
 
-/** Solving \f$ p = [A^T W A]^{-1} A^T W b\f$     (with \f$ W = diag(w_i^2) \f$ )
- done by computing \f$ M := \sqrt{W} A\f$ and  \f$ v := \sqrt{W} b\f$
- then we have \f$ p = [ M^T M ]^{-1} M^T v  \f$
- or \f$ M p = v \f$, this we solve with QR decomposition (faster than svd).
+/** Accumulates the normal equations \f$ A^T W A \f$ and \f$ A^T W b \f$ (with \f$ W = diag(w_i^2) \f$ )
+ without forming \f$ \sqrt{W} A\f$ (which would be as large as A itself).
+ Rows are summed in double over fixed blocks in parallel, and the block sums
+ are added up in order, so the result does not depend on the number of threads.
  \param w vector representing a diagnoal matrix with the sqrt of the weights as elements
  */
 template<class T>
-vnl_vector<T> Regression<T>::getWeightedLSEst(const vnl_vector<T> & w)
+void Regression<T>::getWeightedNormalEquations(const vnl_vector<T> & w,
+    vnl_matrix<double> & AtWA, vnl_vector<double> & AtWb)
 {
-  unsigned int rr, cc;
-
   assert(w.size() == A->rows());
 
-  // compute wA  where w = diag(sqrt(W));
-  vnl_matrix<T> wA(A->rows(), A->cols());
-  for (rr = 0; rr < A->rows(); rr++)
-    for (cc = 0; cc < A->cols(); cc++)
-      wA(rr, cc) = A->operator()(rr, cc) * w(rr);
-
-  vnl_qr<T>* QR = new vnl_qr<T>(wA);
-  // I could maybe delete wA here?  
-
-  // compute wb:
-  vnl_vector<T> wb(b->size());
-  //if (!wb.valid()) ErrorExit(ERROR_NO_MEMORY,"Regression<T>::getWeightedLSEst could not allocate memory for wb") ;
-  for (rr = 0; rr < b->size(); rr++)
-    wb[rr] = b->operator[](rr) * w[rr];
+  const int arows = A->rows();
+  const int acols = A->cols();
+  const int ntri = acols * (acols + 1) / 2; // upper triangle of A^T W A
+  const int nsums = ntri + acols;
+  const int blocksize = 4096;
+  const int nblocks = (arows + blocksize - 1) / blocksize;
+  std::vector<double> partial((size_t) nblocks * nsums, 0.0);
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int block = 0; block < nblocks; block++)
+  {
+    double * sums = &partial[(size_t) block * nsums];
+    std::vector<double> wa(acols);
+    const int rend = std::min(arows, (block + 1) * blocksize);
+    for (int rr = block * blocksize; rr < rend; rr++)
+    {
+      const double wi = (double) w[rr] * (double) w[rr];
+      if (wi == 0.0)
+        continue; // outliers do not contribute
+      const T * arow = A->operator[](rr);
+      for (int cc = 0; cc < acols; cc++)
+        wa[cc] = wi * arow[cc];
+      const double bi = b->operator[](rr);
+      int k = 0;
+      for (int c1 = 0; c1 < acols; c1++)
+      {
+        for (int c2 = c1; c2 < acols; c2++)
+          sums[k++] += wa[c1] * arow[c2];
+        sums[ntri + c1] += wa[c1] * bi;
+      }
+    }
+  }
 
-  // solve wA p = wb
-  vnl_vector<T> p = QR->solve(wb);
+  AtWA.set_size(acols, acols);
+  AtWA.fill(0.0);
+  AtWb.set_size(acols);
+  AtWb.fill(0.0);
+  for (int block = 0; block < nblocks; block++)
+  {
+    const double * sums = &partial[(size_t) block * nsums];
+    int k = 0;
+    for (int c1 = 0; c1 < acols; c1++)
+    {
+      for (int c2 = c1; c2 < acols; c2++)
+        AtWA(c1, c2) += sums[k++];
+      AtWb[c1] += sums[ntri + c1];
+    }
+  }
+  for (int c1 = 0; c1 < acols; c1++)
+    for (int c2 = 0; c2 < c1; c2++)
+      AtWA(c1, c2) = AtWA(c2, c1);
+}
 
-  delete (QR);
+/** Computes residuals \f$ r = b - A p \f$ (in parallel).
+ */
+template<class T>
+vnl_vector<T> Regression<T>::getResiduals(const vnl_vector<T> & p)
+{
+  const int arows = A->rows();
+  const int acols = A->cols();
+  vnl_vector<T> r(arows);
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int rr = 0; rr < arows; rr++)
+  {
+    const T * arow = A->operator[](rr);
+    T ap = 0;
+    for (int cc = 0; cc < acols; cc++)
+      ap += arow[cc] * p[cc];
+    r[rr] = b->operator[](rr) - ap;
+  }
 
-  return p;
+  return r;
 }
 
-/** Uses FLOAT internaly.
- Solving \f$ p = [A^T W A]^{-1} A^T W b\f$     (with \f$ W = diag(w_i^2) \f$ )
- done by computing \f$ M := \sqrt{W} A\f$ and  \f$ v := \sqrt{W} b\f$
- then we have \f$ p = [ M^T M ]^{-1} M^T v  \f$
- or \f$ M p = v \f$, this we solve with QR decomposition (faster than svd).
+/** Solving \f$ p = [A^T W A]^{-1} A^T W b\f$     (with \f$ W = diag(w_i^2) \f$ )
+ via the normal equations, which are accumulated in double without copying A
+ (see getWeightedNormalEquations). The small system is solved with SVD.
  \param w vector representing a diagnoal matrix with the sqrt of the weights as elements
  */
 template<class T>
-vnl_vector<T> Regression<T>::getWeightedLSEstFloat(const vnl_vector<T> & w)
+vnl_vector<T> Regression<T>::getWeightedLSEst(const vnl_vector<T> & w)
 {
-  unsigned int rr, cc;
-
-  assert(w.size() == A->rows());
+  vnl_matrix<double> AtWA;
+  vnl_vector<double> AtWb;
+  getWeightedNormalEquations(w, AtWA, AtWb);
 
-  // compute wA  where w = diag(sqrt(W));
-  vnl_matrix<float> wA(A->rows(), A->cols());
-  for (rr = 0; rr < A->rows(); rr++)
-    for (cc = 0; cc < A->cols(); cc++)
-      wA(rr, cc) = (float) (A->operator()(rr, cc) * w(rr));
-
-  vnl_qr<float>* QR = new vnl_qr<float>(wA);
-  // I could maybe delete wA here?  
-
-  // compute wb:
-  vnl_vector<float> wb(b->size());
-  //if (!wb.valid()) ErrorExit(ERROR_NO_MEMORY,"Regression<T>::getWeightedLSEst could not allocate memory for wb") ;
-  for (rr = 0; rr < b->size(); rr++)
-    wb[rr] = b->operator[](rr) * w[rr];
+  vnl_svd<double> svd(AtWA);
+  if (!svd.valid())
+  {
+    cerr << "    Regression<T>::getWeightedLSEst   could not solve normal equations!"
+        << endl;
+    exit(1);
+  }
+  vnl_vector<double> pd = svd.solve(AtWb);
 
-  // solve
-  vnl_vector<float> p = QR->solve(wb);
-  delete (QR);
+  vnl_vector<T> p(pd.size());
+  for (unsigned int rr = 0; rr < pd.size(); rr++)
+    p[rr] = (T) pd[rr];
 
-  // copy p back:
-  vnl_vector<T> pd(p.size());
-  for (rr = 0; rr < p.size(); rr++)
-    pd[rr] = p[rr];
+  return p;
+}
 
-  return pd;
+/** Used to compute the weighted least squares solution in FLOAT to save
+ memory on the copy of \f$ \sqrt{W} A\f$. Since the normal equations are now
+ accumulated without such a copy, this is the same as getWeightedLSEst
+ (solving the small system in float would only lose accuracy).
+ \param w vector representing a diagnoal matrix with the sqrt of the weights as elements
+ */
+template<class T>
+vnl_vector<T> Regression<T>::getWeightedLSEstFloat(const vnl_vector<T> & w)
+{
+  return getWeightedLSEst(w);
 }
 
 // template <class T>
@@ -642,24 +701,18 @@ void Regression<T>::getSqrtTukeyDiaWeights(const vnl_vector<T>& r,
   unsigned int n = r.size();
   assert(n == w.size());
 
-  double t1;
-  //double t2;
-  unsigned int rr;
+  const T * rp = r.data_block();
+  T * wp = w.data_block();
   //int ocount = 0;
-  for (rr = 0; rr < n; rr++)
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int rr = 0; rr < (int) n; rr++)
   {
-    // cout << " fabs: " << fabs(r->rptr[rr][cc]) << " sat: " << sat << endl;
-    if (fabs(r[rr]) >= sat)
-    {
-      w(rr) = 0.0;
-      //ocount++;
-    }
-    else
-    {
-      t1 = r[rr] / sat;
-      //t2 = 1.0 - t1 * t1;
-      w(rr) = (T) (1.0 - t1 * t1); // returning sqrt
-    }
+    // branch free, so that the compiler can vectorize
+    const double t1 = rp[rr] / sat;
+    const double t2 = 1.0 - t1 * t1;
+    wp[rr] = (T) (fabs(rp[rr]) >= sat ? 0.0 : t2); // returning sqrt
   }
   //cout << " over threshold: " << ocount << " times ! " << endl;
   //return w;
@@ -109,6 +109,9 @@ public:
 protected:
 
   vnl_vector<T> getRobustEstWAB(vnl_vector<T>&w, double sat = SATr, double sig = 1.4826);
+  void getWeightedNormalEquations(const vnl_vector<T> & sqrtweights,
+      vnl_matrix<double> & AtWA, vnl_vector<double> & AtWb);
+  vnl_vector<T> getResiduals(const vnl_vector<T> & p);
   double getRobustEstWB(vnl_vector<T>&w, double sat = SATr, double sig = 1.4826);
 
   T getSigmaMAD(const vnl_vector<T>& r, T d = 1.4826);
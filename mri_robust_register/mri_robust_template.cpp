@@ -123,6 +123,7 @@ struct Parameters
   bool crascenter;
   int pairiterate;
   double pairepsit;
+  bool keeppyramids;
 };
 
 // Initializations:
@@ -130,7 +131,7 @@ static struct Parameters P =
 { vector<string>(0), vector<string>(0), "", vector<string>(0), vector<string>(0), vector<string>(
     0), vector<string>(0), false, false, false, false, false, false, false, false, false,
     5, -1.0, SAT, vector<string>(0), 0, 1, -1, false, false, SSAMPLE, false, false, "", false,
-    true, vector<string>(0), vector<string>(0), SAMPLE_CUBIC_BSPLINE, -1, 0 , false, 5, 0.01};
+    true, vector<string>(0), vector<string>(0), SAMPLE_CUBIC_BSPLINE, -1, 0 , false, 5, 0.01, false};
 
 static void printUsage(void);
 static bool parseCommandLine(int argc, char *argv[], Parameters & P);
@@ -226,6 +227,7 @@ int main(int argc, char *argv[])
     if (P.nweights.size() > 0)
       MR.setBackupWeights(true);
     MR.useCRAS(P.crascenter);
+    MR.setKeepPyramids(P.keeppyramids);
     
     // init MultiRegistration and load movables
     //int nnin = (int) P.mov.size();
@@ -670,6 +672,13 @@ static int parseNextCommand(int argc, char *argv[], Parameters & P)
     nargs = 0;
     cout << "--satit: Will estimate SAT iteratively!" << endl;
   }
+  else if (!strcmp(option, "KEEPPYRAMIDS"))
+  {
+    P.keeppyramids = true;
+    nargs = 0;
+    cout << "--keeppyramids: Will keep input pyramids across iterations (higher mem usage)!"
+        << endl;
+  }
   else if (!strcmp(option, "DOUBLEPREC"))
   {
     P.doubleprec = true;
@@ -133,6 +133,7 @@ int dontrun = 0;
 long seed = 0;
 MRI *seg, *invol, *famri, *maskvol, *pvvol, *brainvol, *mri_aseg, *mri_ribbon,*mritmp;
 int nsegid0, *segidlist0;
+MRI_SEG_INDEX *segindex = NULL;
 int nsegid, *segidlist;
 int NonEmptyOnly = 1;
 int UserSegIdList[1000];
@@ -208,6 +209,7 @@ int main(int argc, char **argv)
   float min, max, range, mean, std, snr;
   FILE *fp;
   double  **favg, *favgmn;
+  int *nvoxlist;
   char tmpstr[1000];
   double atlas_icv=0;
   int ntotalsegid=0;
@@ -778,6 +780,17 @@ int main(int argc, char **argv)
   printf("Computing statistics for each segmentation\n");
   fflush(stdout);
 
+  // Find the voxels of every segmentation in a single pass so that
+  // each segmentation below only visits its own voxels
+  segindex = NULL;
+  if (!dontrun || DoFrameAvg)
+  {
+    int *segids = (int *) calloc(sizeof(int),nsegid);
+    for (n=0; n < nsegid; n++) segids[n] = StatSumTable[n].id;
+    segindex = MRIsegIndexAlloc(seg, nsegid, segids);
+    free(segids);
+  }
+
   DoContinue=0;nx=0;skip=0;n0=0;vol=0;nhits=0;c=0;min=0.0;max=0.0;range=0.0;mean=0.0;std=0.0;snr=0.0;
 
   ROMP_PF_begin
@@ -822,13 +835,13 @@ int main(int argc, char **argv)
       {
         if (pvvol == NULL)
         {
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          nhits = MRIsegIndexCount(segindex, StatSumTable[n].id);
           vol = nhits*voxelvolume;
         }
         else
         {
           vol = MRIvoxelsInLabelWithPartialVolumeEffects(seg, pvvol, StatSumTable[n].id, NULL, NULL);
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          nhits = MRIsegIndexCount(segindex, StatSumTable[n].id);
 //          nhits = nint(vol/voxelvolume);
         }
       }
@@ -866,10 +879,10 @@ int main(int argc, char **argv)
       if (nhits > 0)
       {
         if(UseRobust == 0)
-          MRIsegStats(seg, StatSumTable[n].id, invol, frame,
+          MRIsegStatsIndexed(segindex, StatSumTable[n].id, invol, frame,
             &min, &max, &range, &mean, &std);
         else
-          MRIsegStatsRobust(seg, StatSumTable[n].id, invol, frame,
+          MRIsegStatsRobustIndexed(segindex, StatSumTable[n].id, invol, frame,
             &min, &max, &range, &mean, &std, RobustPct);
 
         snr = mean/std;
@@ -1379,11 +1392,22 @@ int main(int argc, char **argv)
     for (n=0; n < nsegid; n++)
       favg[n] = (double *) calloc(sizeof(double),invol->nframes);
     favgmn = (double *) calloc(sizeof(double *),nsegid);
+    nvoxlist = (int *) calloc(sizeof(int),nsegid);
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+#endif
+    for (n=0; n < nsegid; n++) {
+      ROMP_PFLB_begin
+      nvoxlist[n] = MRIsegFrameAvgIndexed(segindex, StatSumTable[n].id, invol, favg[n]);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
     for (n=0; n < nsegid; n++) {
       printf("%3d",n);
       if (n%20 == 19) printf("\n");
       fflush(stdout);
-      nvox = MRIsegFrameAvg(seg, StatSumTable[n].id, invol, favg[n]);
+      nvox = nvoxlist[n];
       favgmn[n] = 0.0;
       for(f=0; f < invol->nframes; f++) {
 	if(DoFrameSum) favg[n][f] *= nvox; // Undo spatial average
@@ -1393,6 +1417,7 @@ int main(int argc, char **argv)
       if(RmFrameAvgMn) for(f=0; f < invol->nframes; f++) favg[n][f] -= favgmn[n];
     }
     printf("\n");
+    free(nvoxlist);
 
     // Save mean over space and frames in simple text file
     // Each seg on a separate line
@@ -1437,6 +1462,7 @@ int main(int argc, char **argv)
       MRIwrite(famri,FrameAvgVolFile);
     }
   }// Done with Frame Average
+  MRIsegIndexFree(&segindex);
 
   printf("mri_segstats done\n");
   return(0);
@@ -47,6 +47,7 @@
 #include <math.h>
 #include <string.h>
 #include <sys/time.h>
+#include <vector>
 
 #include "icosahedron.h"
 #include "MRIio_old.h"
@@ -504,6 +505,37 @@ int main(int argc, char **argv) {
                                   mri_wm, mri_gm, mri_csf) ;
     MatrixFree(&Qsrc) ; MatrixFree(&QFWDsrc) ;
   }
+  else if (UseOld && vol2surf_weights_supported(SrcVol, interpmethod) &&
+           ProjFracMin <= ProjFracMax)
+  {
+    // Compute the sampling weights for all projection fractions once,
+    // then apply them to all frames in a single pass over the volume.
+    // Gives the same result as the per-fraction loop below.
+    std::vector<float> ProjFracs;
+    for (ProjFrac=ProjFracMin; 
+         ProjFrac <= ProjFracMax; 
+         ProjFrac += ProjFracDelta) {
+      printf("%2d %g %g %g\n",(int)ProjFracs.size()+1,ProjFrac,ProjFracMin,ProjFracMax);
+      ProjFracs.push_back(ProjFrac);
+    }
+    nproj = ProjFracs.size();
+    printf("using precomputed weights\n");
+    fflush(stdout);
+    VOL2SURF_WEIGHTS *v2sw = 
+      vol2surf_linear_weights(SrcVol, Qsrc, Fsrc, Wsrc, Dsrc, Surf,
+                              &ProjFracs[0], nproj, interpmethod, float2int,
+                              ProjDistFlag);
+    if (v2sw == NULL) {
+      printf("ERROR: mapping volume to source\n");
+      exit(1);
+    }
+    SurfVals = vol2surf_apply_weights(v2sw, SrcVol, GetProjMax, SrcHitVol);
+    vol2surf_free_weights(&v2sw);
+    if (SurfVals == NULL) {
+      printf("ERROR: mapping volume to source\n");
+      exit(1);
+    }
+  }
   else
   {
     nproj = 0;
@@ -1069,6 +1069,12 @@ get_option(int argc, char *argv[])
     nargs = 1 ;
     fprintf(stderr, "dt_decrease=%2.3f\n", parms.dt_decrease) ;
   }
+  else if (!stricmp(option, "template_cache"))
+  {
+    MRISPsetBlurCacheDir(argv[2]) ;
+    printf("caching blurred template frames in %s\n", argv[2]) ;
+    nargs = 1 ;
+  }
   else if (!stricmp(option, "rusage"))
   {
     // resource usage
@@ -43,6 +43,7 @@
 #include "cma.h"
 #include "gca.h"
 #include "mrishash.h"
+#include "romp_support.h"
 
 static char vcid[] =
   "$Id: mris_sample_parc.c,v 1.31 2016/12/11 14:33:38 fischl Exp $";
@@ -871,7 +872,7 @@ replace_vertices_with_label(MRI_SURFACE *mris,
 
 int
 MRIsampleParcellationToSurface(MRI_SURFACE *mris, MRI *mri_parc) {
-  int             min_label, max_label, **label_histo, l, vno, nlabels, x, y, z, max_l ;
+  int             min_label, max_label, **label_histo, l, vno, nlabels, x, max_l ;
   float           fmin, fmax, max_count, d ;
   MRIS_HASH_TABLE *mht ;
   VERTEX          *v ;
@@ -898,8 +899,17 @@ MRIsampleParcellationToSurface(MRI_SURFACE *mris, MRI *mri_parc) {
 
   MRISclearMarks(mris) ;
 
-  // build histograms at each vertex
+  // build histograms at each vertex. The hash table is only read, so the
+  // slices can be searched in parallel; the counts are the same in any order.
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic,1)
+#endif
   for (x = 0 ; x < mri_parc->width ; x++) {
+    ROMP_PFLB_begin
+    int    y, z, l, vno ;
+    double xs, ys, zs ;
+    VERTEX *v ;
     for (y = 0 ; y < mri_parc->height ; y++) {
       for (z = 0 ; z < mri_parc->depth ; z++) {
         if (x == Gx && y == Gy && z == Gz)
@@ -921,10 +931,15 @@ MRIsampleParcellationToSurface(MRI_SURFACE *mris, MRI *mri_parc) {
                  vno, x, y, z, l);
           DiagBreak() ;
         }
+#ifdef HAVE_OPENMP
+        #pragma omp atomic
+#endif
         label_histo[vno][l-min_label]++ ;
       }
     }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
   MRIwrite(mri_parc_unused, "pu.mgz") ;
   for (vno = 0 ; vno < mris->nvertices ;  vno++) {
@@ -21,6 +21,7 @@
  */
 
 #include <coffin.h>
+#include "romp_support.h"
 
 using namespace std;
 
@@ -1663,6 +1664,11 @@ void Coffin::SetPathway(const char *InitFile,
       exit(1);
     }
   }
+
+  // Allocate space for saving and reusing anatomical priors of path points,
+  // which are specific to this pathway
+  mAnatomicalPriorCache.clear();
+  mAnatomicalPriorCache.resize(mNxy*mNz);
 }
 
 //
@@ -2360,7 +2366,7 @@ bool Coffin::InitializeMcmc() {
     // Compute atlas-derived prior terms on initial path
     mXyzPriorOnPathNew = ComputeXyzPriorOnPath(atlaspoints);
 
-    mAnatomicalPriorNew = ComputeAnatomicalPrior(atlaspoints);
+    mAnatomicalPriorNew = ComputeAnatomicalPrior(atlaspoints, mPathPointsNew);
 
     mShapePriorNew = ComputeShapePrior(atlaspoints);
 
@@ -2890,10 +2896,25 @@ bool Coffin::AcceptPath(bool UsePriorOnly) {
   mDataPosteriorOffPath = 0;
 
   // Compute data-fit terms for all time points on proposed and current path
-  if (!UsePriorOnly)
+  if (!UsePriorOnly) {
+    // Each time point has its own voxel data, so their data-fit terms can
+    // be computed concurrently. Check for errors in time point order after.
+    vector<char> isfit(mDwi.size());
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP2(mDwi.size() > 1, assume_reproducible)
+#endif
+    for (int itime = 0; itime < (int) mDwi.size(); itime++) {
+      ROMP_PFLB_begin
+      isfit[itime] = mDwi[itime].ComputePathDataFit();
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
     for (vector<Aeon>::iterator idwi = mDwi.begin(); idwi < mDwi.end();
                                                      idwi++) {
-      if (!idwi->ComputePathDataFit()) {
+      if (!isfit[idwi - mDwi.begin()]) {
         mRejectF = idwi->RejectF();
         mAcceptF = idwi->AcceptF();
         mRejectTheta = idwi->RejectTheta();
@@ -2913,6 +2934,7 @@ bool Coffin::AcceptPath(bool UsePriorOnly) {
       mDataPosteriorOnPath     += idwi->GetPosteriorOnPath();
       mDataPosteriorOffPath    += idwi->GetPosteriorOffPath();
     }
+  }
 
   // Map proposed path from diffusion/base space to atlas space
   atlaspoints.resize(mPathPointsNew.size());
@@ -2941,7 +2963,7 @@ bool Coffin::AcceptPath(bool UsePriorOnly) {
   mXyzPriorOffPathNew = ComputeXyzPriorOffPath(atlaspoints);
   mXyzPriorOnPathNew  = ComputeXyzPriorOnPath(atlaspoints);
 
-  mAnatomicalPriorNew = ComputeAnatomicalPrior(atlaspoints);
+  mAnatomicalPriorNew = ComputeAnatomicalPrior(atlaspoints, mPathPointsNew);
 
   mShapePriorNew = ComputeShapePrior(atlaspoints);
 
@@ -3104,114 +3126,141 @@ double Coffin::ComputeShapePrior(vector<int> &PathAtlasPoints) {
 //
 // Compute prior on path given anatomical segmentation labels around path
 //
-double Coffin::ComputeAnatomicalPrior(vector<int> &PathAtlasPoints) {
+double Coffin::ComputeAnatomicalPrior(vector<int> &PathAtlasPoints,
+                                      vector<int> &PathPoints) {
   const double darc = mNumArc / (double) (PathAtlasPoints.size()/3);
   double larc = 0, prior = 0;
-  vector<float>::iterator iseg0;
-  vector<unsigned int>::const_iterator imatch;
-  vector< vector<unsigned int> >::const_iterator iidlocal = mIdsLocal.begin(),
-                                                 iidnear  = mIdsNear.begin(),
-                                                 iid;
-  vector< vector<float> >::const_iterator iprlocal = mPriorLocal.begin(), 
-                                          iprnear  = mPriorNear.begin(),
-                                          ipr;
-  vector<float> seg0(mAseg.size());
+  int iarc = 0;
+  vector<int>::const_iterator iptbase = PathPoints.begin();
 
   if (mPriorLocal.empty() && mPriorNear.empty())
     return 0;
 
   for (vector<int>::const_iterator ipt = PathAtlasPoints.begin();
                                    ipt < PathAtlasPoints.end(); ipt += 3) {
-    const int ix0 = ipt[0], iy0 = ipt[1], iz0 = ipt[2];
+    // The prior of a point depends only on its voxel and its arc segment,
+    // and most of the points of a proposed path were also on earlier paths
+    if (iarc < mNumArc) {
+      vector<double> &iprcache = mAnatomicalPriorCache[iptbase[0] +
+                                                       iptbase[1]*mNx +
+                                                       iptbase[2]*mNxy];
 
-    // Find prior given local neighbor labels
-    iid = iidlocal;
-    ipr = iprlocal;
+      if (iprcache.empty())
+        iprcache.resize(mNumArc, numeric_limits<double>::quiet_NaN());
 
-    for (vector<int>::const_iterator idir = mDirLocal.begin();
-                                     idir != mDirLocal.end(); idir += 3) {
-      const int ix = ix0 + idir[0],
-                iy = iy0 + idir[1],
-                iz = iz0 + idir[2];
-
-      for (vector<MRI *>::const_iterator iaseg = mAseg.begin();
-                                         iaseg < mAseg.end(); iaseg++) {
-        imatch = find(iid->begin(), iid->end(),
-                      (unsigned int) MRIgetVoxVal(*iaseg,
-                                     ((ix > -1 && ix < mNxAtlas) ? ix : ix0),
-                                     ((iy > -1 && iy < mNyAtlas) ? iy : iy0),
-                                     ((iz > -1 && iz < mNzAtlas) ? iz : iz0),
-                                     0));
-
-        if (imatch < iid->end())
-          prior += ipr->at(imatch - iid->begin());
-        else
-          prior += *(ipr->end() - 1);
-      }
+      if (std::isnan(iprcache[iarc]))
+        // Compute prior for this voxel and arc segment
+        iprcache[iarc] = ComputeAnatomicalPriorPoint(ipt, iarc);
 
-      iid += mNumArc;
-      ipr += mNumArc;
+      prior += iprcache[iarc];
     }
+    else
+      prior += ComputeAnatomicalPriorPoint(ipt, iarc);
 
-    // Find prior given nearest neighbor labels
-    iid = iidnear;
-    ipr = iprnear;
+    iptbase += 3;
+
+    larc += darc;
+
+    if (larc > 1)  {	// Move to the next segment
+      larc -= 1;
+      iarc++;
+    }
+  }
+
+  return prior / (PathAtlasPoints.size()/3);
+}
+
+//
+// Compute prior at a single path point (in atlas space) given anatomical
+// segmentation labels around it and the arc segment that it belongs to
+//
+double Coffin::ComputeAnatomicalPriorPoint(vector<int>::const_iterator Point,
+                                           int ArcIndex) {
+  const int ix0 = Point[0], iy0 = Point[1], iz0 = Point[2];
+  double prior = 0;
+  vector<float>::iterator iseg0;
+  vector<unsigned int>::const_iterator imatch;
+  vector< vector<unsigned int> >::const_iterator iid;
+  vector< vector<float> >::const_iterator ipr;
+  vector<float> seg0(mAseg.size());
+
+  // Find prior given local neighbor labels
+  iid = mIdsLocal.begin() + ArcIndex;
+  ipr = mPriorLocal.begin() + ArcIndex;
+
+  for (vector<int>::const_iterator idir = mDirLocal.begin();
+                                   idir != mDirLocal.end(); idir += 3) {
+    const int ix = ix0 + idir[0],
+              iy = iy0 + idir[1],
+              iz = iz0 + idir[2];
 
-    iseg0 = seg0.begin();
     for (vector<MRI *>::const_iterator iaseg = mAseg.begin();
                                        iaseg < mAseg.end(); iaseg++) {
-      *iseg0 = MRIgetVoxVal(*iaseg, ix0, iy0, iz0, 0);
-      iseg0++;
+      imatch = find(iid->begin(), iid->end(),
+                    (unsigned int) MRIgetVoxVal(*iaseg,
+                                   ((ix > -1 && ix < mNxAtlas) ? ix : ix0),
+                                   ((iy > -1 && iy < mNyAtlas) ? iy : iy0),
+                                   ((iz > -1 && iz < mNzAtlas) ? iz : iz0),
+                                   0));
+
+      if (imatch < iid->end())
+        prior += ipr->at(imatch - iid->begin());
+      else
+        prior += *(ipr->end() - 1);
     }
 
-    for (vector<int>::const_iterator idir = mDirNear.begin();
-                                     idir != mDirNear.end(); idir += 3) {
-      int dist = 0, ix = ix0 + idir[0],
-                    iy = iy0 + idir[1],
-                    iz = iz0 + idir[2];
-
-      iseg0 = seg0.begin();
-      for (vector<MRI *>::const_iterator iaseg = mAseg.begin();
-                                         iaseg < mAseg.end(); iaseg++) {
-        float seg = *iseg0;
-
-        while ((ix > -1) && (ix < mNxAtlas) &&
-               (iy > -1) && (iy < mNyAtlas) &&
-               (iz > -1) && (iz < mNzAtlas) && (seg == *iseg0)) {
-          seg = MRIgetVoxVal(*iaseg, ix, iy, iz, 0);
-          dist++;
-
-          ix += idir[0];
-          iy += idir[1];
-          iz += idir[2];
-        }
+    iid += mNumArc;
+    ipr += mNumArc;
+  }
 
-        imatch = find(iid->begin(), iid->end(), (unsigned int) seg);
+  // Find prior given nearest neighbor labels
+  iid = mIdsNear.begin() + ArcIndex;
+  ipr = mPriorNear.begin() + ArcIndex;
 
-        if (imatch < iid->end())
-          prior += ipr->at(imatch - iid->begin());
-        else
-          prior += *(ipr->end() - 1);
+  iseg0 = seg0.begin();
+  for (vector<MRI *>::const_iterator iaseg = mAseg.begin();
+                                     iaseg < mAseg.end(); iaseg++) {
+    *iseg0 = MRIgetVoxVal(*iaseg, ix0, iy0, iz0, 0);
+    iseg0++;
+  }
+
+  for (vector<int>::const_iterator idir = mDirNear.begin();
+                                   idir != mDirNear.end(); idir += 3) {
+    int dist = 0, ix = ix0 + idir[0],
+                  iy = iy0 + idir[1],
+                  iz = iz0 + idir[2];
 
-        iseg0++;
+    iseg0 = seg0.begin();
+    for (vector<MRI *>::const_iterator iaseg = mAseg.begin();
+                                       iaseg < mAseg.end(); iaseg++) {
+      float seg = *iseg0;
+
+      while ((ix > -1) && (ix < mNxAtlas) &&
+             (iy > -1) && (iy < mNyAtlas) &&
+             (iz > -1) && (iz < mNzAtlas) && (seg == *iseg0)) {
+        seg = MRIgetVoxVal(*iaseg, ix, iy, iz, 0);
+        dist++;
+
+        ix += idir[0];
+        iy += idir[1];
+        iz += idir[2];
       }
 
-      iid += mNumArc;
-      ipr += mNumArc;
-    }
+      imatch = find(iid->begin(), iid->end(), (unsigned int) seg);
 
-    larc += darc;
+      if (imatch < iid->end())
+        prior += ipr->at(imatch - iid->begin());
+      else
+        prior += *(ipr->end() - 1);
 
-    if (larc > 1)  {	// Move to the next segment
-      larc -= 1;
-      iidlocal++;
-      iprlocal++;
-      iidnear++;
-      iprnear++;
+      iseg0++;
     }
+
+    iid += mNumArc;
+    ipr += mNumArc;
   }
 
-  return prior / (PathAtlasPoints.size()/3);
+  return prior;
 }
 
 //
@@ -204,6 +204,7 @@ class Coffin {		// The main container
                        mControlPointJumps,		// [mNumControl x 3]
                        mAcceptSpan, mRejectSpan;	// [mNumControl x 3]
     std::vector< std::vector<int> > mAtlasCoords;
+    std::vector< std::vector<double> > mAnatomicalPriorCache; // [mNxy x mNz]
     std::vector< std::vector<unsigned int> > mIdsLocal, mIdsNear;
     std::vector< std::vector<float> > mPriorTangent,	// [mNumArc]
                                       mPriorCurvature,	// [mNumArc]
@@ -233,7 +234,10 @@ class Coffin {		// The main container
     bool AcceptPath(bool UsePriorOnly=false);
     double ComputeXyzPriorOffPath(std::vector<int> &PathAtlasPoints);
     double ComputeXyzPriorOnPath(std::vector<int> &PathAtlasPoints);
-    double ComputeAnatomicalPrior(std::vector<int> &PathAtlasPoints);
+    double ComputeAnatomicalPrior(std::vector<int> &PathAtlasPoints,
+                                  std::vector<int> &PathPoints);
+    double ComputeAnatomicalPriorPoint(std::vector<int>::const_iterator Point,
+                                       int ArcIndex);
     double ComputeShapePrior(std::vector<int> &PathAtlasPoints);
     void UpdatePath();
     void UpdateAcceptanceRateFull();
@@ -23,12 +23,14 @@
 
 #include <ctype.h>
 #include <dirent.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <sys/timeb.h>
 #include <sys/types.h>
 #include <time.h>
@@ -47,6 +49,7 @@ void *malloc(size_t size);
 #include "diag.h"
 #include "dti.h"
 #include "fio.h"
+#include "fnv_hash.h"
 #include "fsenv.h"
 #include "macros.h"  // DEGREES
 #include "mosaic.h"
@@ -123,6 +126,8 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
 
   sliceDirCosPresent = 0;  // assume not present
 
+  if (getenv("FS_DICOM_INDEX")) printf("INFO: FS_DICOM_INDEX is not used for Siemens series, parsing every file\n");
+
   /* split progress to 3 parts */
   int nstart = global_progress_range[0];
   int nend = global_progress_range[1];
@@ -5487,6 +5492,312 @@ int alphasort(const void *a, const void *b)
 // Start of "new" dicom reader. New one can read everything but siemens
 // mosaics.
 
+/*--------------------------------------------------------------
+  DICOM directory index. DICOMRead2() runs IsDICOM() and
+  GetDICOMInfo() on every file in the directory, and each of those
+  is a full parse of the file. If FS_DICOM_INDEX is set to a
+  directory, the results are saved there (one index file per dicom
+  directory) and reused by later reads of the same directory for
+  every file whose size, inode and modification time (to the
+  nanosecond) have not changed. Only DICOMRead2() uses the index;
+  Siemens series read by sdcmLoadVolume() are parsed in full every
+  time.
+  --------------------------------------------------------------*/
+#define DCMINDEX_MAGIC "FSDCMIDX"
+#define DCMINDEX_VERSION 2
+#define DCMINDEX_NSTRINGS 9
+#ifdef Darwin
+#define DCMINDEX_MTIME_NSEC(st) ((st).st_mtimespec.tv_nsec)
+#else
+#define DCMINDEX_MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#endif
+
+typedef struct
+{
+  char *name;  // file name without the directory
+  long long size, mtime, mtime_nsec, ino;
+  int isdicom;
+  DICOMInfo info;  // only valid if isdicom, PixelData is never set
+} DCMINDEXENTRY;
+
+typedef struct
+{
+  char *fname;   // index file
+  char *dcmdir;  // absolute path of the dicom directory
+  int DoDWI;     // GetDICOMInfo() only fills in the DWI params if set
+  int nold, nnew, nnewalloc, nreused;
+  DCMINDEXENTRY *old;  // read from the index file, sorted by name
+  DCMINDEXENTRY *cur;  // files seen in this read, in directory order
+} DCMINDEX;
+
+// Pointers to the string members of a DICOMInfo (except FileName)
+static char **DCMindexStrings(DICOMInfo *info, int n)
+{
+  char **s[DCMINDEX_NSTRINGS] = {&info->StudyDate,
+                                 &info->PatientName,
+                                 &info->Manufacturer,
+                                 &info->StudyTime,
+                                 &info->SeriesTime,
+                                 &info->AcquisitionTime,
+                                 &info->TransferSyntaxUID,
+                                 &info->PhEncDir,
+                                 &info->FileName};
+  return (s[n]);
+}
+
+// Copy a DICOMInfo header, giving the copy its own strings
+static void DCMindexCopyInfo(DICOMInfo *dst, const DICOMInfo *src, const char *fname)
+{
+  int n;
+  char **ps;
+  memmove(dst, src, sizeof(DICOMInfo));
+  for (n = 0; n < DCMINDEX_NSTRINGS - 1; n++) {
+    ps = DCMindexStrings(dst, n);
+    if (*ps) *ps = strcpyalloc(*ps);
+  }
+  dst->FileName = fname ? strcpyalloc(fname) : NULL;
+  dst->PixelData = NULL;
+}
+
+static void DCMindexFreeEntries(DCMINDEXENTRY *entry, int n)
+{
+  int k, m;
+  for (k = 0; k < n; k++) {
+    free(entry[k].name);
+    if (!entry[k].isdicom) continue;
+    for (m = 0; m < DCMINDEX_NSTRINGS; m++) free(*DCMindexStrings(&entry[k].info, m));
+  }
+  free(entry);
+}
+
+static int DCMindexCompareEntries(const void *a, const void *b)
+{
+  return (strcmp(((const DCMINDEXENTRY *)a)->name, ((const DCMINDEXENTRY *)b)->name));
+}
+
+static int DCMindexWriteString(FILE *fp, const char *s)
+{
+  int len = s ? strlen(s) : -1;
+  if (fwrite(&len, sizeof(int), 1, fp) != 1) return (1);
+  if (len > 0 && fwrite(s, sizeof(char), len, fp) != (size_t)len) return (1);
+  return (0);
+}
+
+static int DCMindexReadString(FILE *fp, char **ps)
+{
+  int len;
+  *ps = NULL;
+  if (fread(&len, sizeof(int), 1, fp) != 1) return (1);
+  if (len < 0) return (0);
+  if (len > 100000) return (1);
+  *ps = (char *)calloc(len + 1, sizeof(char));
+  if (len > 0 && fread(*ps, sizeof(char), len, fp) != (size_t)len) return (1);
+  return (0);
+}
+
+/*--------------------------------------------------------------
+  DCMindexRead() - returns the index for dcmdir, or NULL if
+  FS_DICOM_INDEX is not set. A missing, stale or unreadable index
+  file just gives an empty index.
+  --------------------------------------------------------------*/
+static DCMINDEX *DCMindexRead(const char *dcmdir)
+{
+  DCMINDEX *index;
+  DCMINDEXENTRY *e;
+  FILE *fp;
+  char *indexdir, *pc, *s, absdir[PATH_MAX], magic[8];
+  unsigned long hash;
+  int version, infosize, DoDWI, n, m, err;
+
+  indexdir = getenv("FS_DICOM_INDEX");
+  if (indexdir == NULL || strlen(indexdir) == 0) return (NULL);
+
+  if (realpath(dcmdir, absdir) == NULL) {
+    printf("WARNING: DICOM index: cannot resolve %s, not using index\n", dcmdir);
+    return (NULL);
+  }
+  hash = fnv_add(fnv_init(), (const unsigned char *)absdir, strlen(absdir));
+
+  index = (DCMINDEX *)calloc(1, sizeof(DCMINDEX));
+  index->dcmdir = strcpyalloc(absdir);
+  index->fname = (char *)calloc(strlen(indexdir) + 100, sizeof(char));
+  sprintf(index->fname, "%s/dcmindex.%08lx.dat", indexdir, hash & 0xffffffffUL);
+  // Same rule as GetDICOMInfo()
+  index->DoDWI = 1;
+  pc = getenv("FS_LOAD_DWI");
+  if (pc != NULL && strcmp(pc, "0") == 0) index->DoDWI = 0;
+
+  fp = fopen(index->fname, "rb");
+  if (fp == NULL) return (index);
+
+  err = 1;
+  s = NULL;
+  if (fread(magic, sizeof(char), 8, fp) != 8 || memcmp(magic, DCMINDEX_MAGIC, 8) != 0) goto done;
+  if (fread(&version, sizeof(int), 1, fp) != 1 || version != DCMINDEX_VERSION) goto done;
+  if (fread(&infosize, sizeof(int), 1, fp) != 1 || infosize != (int)sizeof(DICOMInfo)) goto done;
+  if (fread(&DoDWI, sizeof(int), 1, fp) != 1 || DoDWI != index->DoDWI) goto done;
+  // The directory is stored so that a hash collision is not a hit
+  if (DCMindexReadString(fp, &s) || s == NULL || strcmp(s, absdir) != 0) goto done;
+  if (fread(&n, sizeof(int), 1, fp) != 1 || n < 0) goto done;
+
+  index->old = (DCMINDEXENTRY *)calloc(n, sizeof(DCMINDEXENTRY));
+  if (index->old == NULL) goto done;
+  for (index->nold = 0; index->nold < n; index->nold++) {
+    e = &index->old[index->nold];
+    if (DCMindexReadString(fp, &e->name) || e->name == NULL) goto done;
+    if (fread(&e->size, sizeof(long long), 1, fp) != 1) goto done;
+    if (fread(&e->mtime, sizeof(long long), 1, fp) != 1) goto done;
+    if (fread(&e->mtime_nsec, sizeof(long long), 1, fp) != 1) goto done;
+    if (fread(&e->ino, sizeof(long long), 1, fp) != 1) goto done;
+    if (fread(&e->isdicom, sizeof(int), 1, fp) != 1) goto done;
+    if (!e->isdicom) continue;
+    if (fread(&e->info, sizeof(DICOMInfo), 1, fp) != 1) {
+      e->isdicom = 0;
+      goto done;
+    }
+    for (m = 0; m < DCMINDEX_NSTRINGS; m++) *DCMindexStrings(&e->info, m) = NULL;
+    e->info.PixelData = NULL;
+    for (m = 0; m < DCMINDEX_NSTRINGS - 1; m++)
+      if (DCMindexReadString(fp, DCMindexStrings(&e->info, m))) goto done;
+  }
+  qsort(index->old, index->nold, sizeof(DCMINDEXENTRY), DCMindexCompareEntries);
+  err = 0;
+
+done:
+  fclose(fp);
+  free(s);
+  if (err) {
+    printf("WARNING: DICOM index %s is out of date or corrupt, rebuilding\n", index->fname);
+    // unread entries are zeroed, so all n can be freed
+    if (index->old) DCMindexFreeEntries(index->old, n);
+    index->old = NULL;
+    index->nold = 0;
+  }
+  return (index);
+}
+
+/*--------------------------------------------------------------
+  DCMindexGetInfo() - returns IsDICOM(fname) and, if it is a dicom,
+  fills dcminfo as GetDICOMInfo(fname,dcminfo,FALSE,1) would. The
+  index may be NULL. Results come from the index when the file is
+  unchanged, otherwise the file is parsed and the index updated.
+  --------------------------------------------------------------*/
+static int DCMindexGetInfo(DCMINDEX *index, const char *fname, DICOMInfo *dcminfo)
+{
+  DCMINDEXENTRY key, *old, *e;
+  struct stat st;
+  const char *name;
+  int isdicom;
+
+  // directories (. and ..) are not indexed, their times change with every write
+  if (index == NULL || stat(fname, &st) != 0 || !S_ISREG(st.st_mode)) {
+    isdicom = IsDICOM(fname);
+    if (isdicom) GetDICOMInfo(fname, dcminfo, FALSE, 1);
+    return (isdicom);
+  }
+
+  name = strrchr(fname, '/');
+  name = name ? name + 1 : fname;
+  key.name = (char *)name;
+  old = (DCMINDEXENTRY *)bsearch(&key, index->old, index->nold, sizeof(DCMINDEXENTRY), DCMindexCompareEntries);
+  if (old && (old->size != (long long)st.st_size || old->mtime != (long long)st.st_mtime ||
+              old->mtime_nsec != (long long)DCMINDEX_MTIME_NSEC(st) || old->ino != (long long)st.st_ino))
+    old = NULL;
+
+  if (index->nnew == index->nnewalloc) {
+    index->nnewalloc = index->nnewalloc ? 2 * index->nnewalloc : 256;
+    index->cur = (DCMINDEXENTRY *)realloc(index->cur, index->nnewalloc * sizeof(DCMINDEXENTRY));
+  }
+  e = &index->cur[index->nnew];
+  memset(e, 0, sizeof(DCMINDEXENTRY));
+  e->name = strcpyalloc(name);
+  e->size = st.st_size;
+  e->mtime = st.st_mtime;
+  e->mtime_nsec = DCMINDEX_MTIME_NSEC(st);
+  e->ino = st.st_ino;
+  index->nnew++;
+
+  if (old) {
+    index->nreused++;
+    e->isdicom = old->isdicom;
+    if (e->isdicom) {
+      DCMindexCopyInfo(&e->info, &old->info, NULL);
+      DCMindexCopyInfo(dcminfo, &old->info, fname);
+    }
+    return (e->isdicom);
+  }
+
+  e->isdicom = IsDICOM(fname);
+  if (e->isdicom) {
+    GetDICOMInfo(fname, dcminfo, FALSE, 1);
+    DCMindexCopyInfo(&e->info, dcminfo, NULL);
+  }
+  return (e->isdicom);
+}
+
+/*--------------------------------------------------------------
+  DCMindexClose() - writes the index file if anything in the
+  directory changed since it was last written, then frees the index.
+  The file is written under a temporary name and renamed so that
+  concurrent readers never see a partial index.
+  --------------------------------------------------------------*/
+static int DCMindexClose(DCMINDEX **pindex)
+{
+  DCMINDEX *index = *pindex;
+  DCMINDEXENTRY *e;
+  FILE *fp;
+  char *tmpfname;
+  int version = DCMINDEX_VERSION, infosize = sizeof(DICOMInfo), k, m, err = 0;
+
+  if (index == NULL) return (0);
+  printf("DICOM index: reused %d of %d files\n", index->nreused, index->nnew);
+
+  if (index->nreused != index->nnew || index->nold != index->nnew) {
+    tmpfname = (char *)calloc(strlen(index->fname) + 100, sizeof(char));
+    sprintf(tmpfname, "%s.tmp.%d", index->fname, (int)getpid());
+    fp = fopen(tmpfname, "wb");
+    if (fp == NULL) {
+      printf("WARNING: DICOM index: could not open %s for writing\n", tmpfname);
+      err = 1;
+    }
+    else {
+      err |= (fwrite(DCMINDEX_MAGIC, sizeof(char), 8, fp) != 8);
+      err |= (fwrite(&version, sizeof(int), 1, fp) != 1);
+      err |= (fwrite(&infosize, sizeof(int), 1, fp) != 1);
+      err |= (fwrite(&index->DoDWI, sizeof(int), 1, fp) != 1);
+      err |= DCMindexWriteString(fp, index->dcmdir);
+      err |= (fwrite(&index->nnew, sizeof(int), 1, fp) != 1);
+      for (k = 0; k < index->nnew && !err; k++) {
+        e = &index->cur[k];
+        err |= DCMindexWriteString(fp, e->name);
+        err |= (fwrite(&e->size, sizeof(long long), 1, fp) != 1);
+        err |= (fwrite(&e->mtime, sizeof(long long), 1, fp) != 1);
+        err |= (fwrite(&e->mtime_nsec, sizeof(long long), 1, fp) != 1);
+        err |= (fwrite(&e->ino, sizeof(long long), 1, fp) != 1);
+        err |= (fwrite(&e->isdicom, sizeof(int), 1, fp) != 1);
+        if (!e->isdicom) continue;
+        err |= (fwrite(&e->info, sizeof(DICOMInfo), 1, fp) != 1);
+        for (m = 0; m < DCMINDEX_NSTRINGS - 1; m++) err |= DCMindexWriteString(fp, *DCMindexStrings(&e->info, m));
+      }
+      err |= (fclose(fp) != 0);
+      if (!err) err = (rename(tmpfname, index->fname) != 0);
+      if (err) {
+        printf("WARNING: DICOM index: could not write %s\n", index->fname);
+        unlink(tmpfname);
+      }
+    }
+    free(tmpfname);
+  }
+
+  if (index->old) DCMindexFreeEntries(index->old, index->nold);
+  if (index->cur) DCMindexFreeEntries(index->cur, index->nnew);
+  free(index->fname);
+  free(index->dcmdir);
+  free(index);
+  *pindex = NULL;
+  return (err);
+}
+
 /*--------------------------------------------------------------
   DICOMRead2() - generic dicom reader. It should be possible to
   use this for everything but siemens mosaics. There is a 
@@ -5506,6 +5817,7 @@ MRI *DICOMRead2(const char *dcmfile, int LoadVolume)
   FSENV *env;
   char tmpfile[2000], tmpfilestdout[2000], *FileNameUse, cmd[4000];
   int IsCompressed;
+  DCMINDEX *index;
 
   printf("Starting DICOMRead2()\n");
 
@@ -5539,37 +5851,28 @@ MRI *DICOMRead2(const char *dcmfile, int LoadVolume)
   printf("Found %d files, checking for dicoms\n", nfiles);
 
   // Go thru each of those to determine which ones are dicom
-  // and belong to the same series.
+  // and belong to the same series, and load their info. Each file
+  // is only parsed once (or not at all if it is in the index).
+  index = DCMindexRead(dcmdir);
+  dcminfo = NULL;
   ndcmfiles = 0;
   for (nthfile = 0; nthfile < nfiles; nthfile++) {
     // printf("%d %s\n",nthfile,FileNames[nthfile]);
-    if (!IsDICOM(FileNames[nthfile])) {
+    if (!DCMindexGetInfo(index, FileNames[nthfile], &TmpDCMInfo)) {
       continue;
     }
-    GetDICOMInfo(FileNames[nthfile], &TmpDCMInfo, FALSE, 1);
     if (TmpDCMInfo.SeriesNumber != RefDCMInfo.SeriesNumber) {
       continue;
     }
-    ndcmfiles++;
-  }
-  printf("Found %d dicom files in series.\n", ndcmfiles);
-
-  // Go thru each dicom, make sure it belongs to series, load info
-  dcminfo = (DICOMInfo **)calloc(ndcmfiles, sizeof(DICOMInfo *));
-  ndcmfiles = 0;
-  for (nthfile = 0; nthfile < nfiles; nthfile++) {
-    // printf("%d %s\n",nthfile,FileNames[nthfile]);
-    if (!IsDICOM(FileNames[nthfile])) {
-      continue;
-    }
-    GetDICOMInfo(FileNames[nthfile], &TmpDCMInfo, FALSE, 1);
-    if (TmpDCMInfo.SeriesNumber != RefDCMInfo.SeriesNumber) {
-      continue;
+    if (ndcmfiles % 256 == 0) {
+      dcminfo = (DICOMInfo **)realloc(dcminfo, (ndcmfiles + 256) * sizeof(DICOMInfo *));
     }
     dcminfo[ndcmfiles] = (DICOMInfo *)calloc(1, sizeof(DICOMInfo));
     memmove(dcminfo[ndcmfiles], &TmpDCMInfo, sizeof(DICOMInfo));
     ndcmfiles++;
   }
+  DCMindexClose(&index);
+  printf("Found %d dicom files in series.\n", ndcmfiles);
 
   // Sort twice, 1st NOT using slice direction, 2nd using slice direction
   // First sort will not use it because Vs=0 from GetDICOMInfo()
@@ -49,6 +49,7 @@ double round(double x);
 #include "numerics.h"
 #include "pdf.h"
 #include "randomfields.h"
+#include "romp_support.h"
 #include "sig.h"
 #include "utils.h"
 #include "volcluster.h"
@@ -905,6 +906,230 @@ MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn)
   return (wn);
 }
 
+/*---------------------------------------------------------------------
+  glmBatchMultiply() - out = A*B for a block of voxels, where B and
+  out are packed (rows x GLM_BATCH_NVOX) with one column per voxel.
+  Each element is accumulated in double in the same order as
+  MatrixMultiplyD() and then stored as float, so the result for each
+  voxel is identical to doing the voxels one at a time.
+  --------------------------------------------------------------------*/
+#define GLM_BATCH_NVOX 256
+static void glmBatchMultiply(const MATRIX *A, const float *B, int nv, float *out)
+{
+  int row, k, v;
+  double acc[GLM_BATCH_NVOX];
+
+  for (row = 1; row <= A->rows; row++) {
+    for (v = 0; v < nv; v++) acc[v] = 0.0;
+    for (k = 1; k <= A->cols; k++) {
+      double a = A->rptr[row][k];
+      const float *b = &B[(k - 1) * GLM_BATCH_NVOX];
+      for (v = 0; v < nv; v++) acc[v] += a * b[v];
+    }
+    float *o = &out[(row - 1) * GLM_BATCH_NVOX];
+    for (v = 0; v < nv; v++) o[v] = acc[v];
+  }
+}
+
+/*---------------------------------------------------------------------
+  MRIglmFitAndTestBatch() - fits and tests all the voxels in one go
+  when the design matrix is the same at every voxel (no per-voxel
+  weights, regressors, or frame mask). The masked voxels are packed
+  into nf-by-GLM_BATCH_NVOX blocks so that X'*y, beta, yhat, eres,
+  rvar, gamma, F, p, and z are computed with matrix-matrix products,
+  and the blocks are spread across threads. inv(X'*X) and the contrast
+  matrices are computed only once. The arithmetic is the same as in
+  GLMfit() and GLMtest(), so the output is identical to the
+  voxel-by-voxel loop. Returns 1 (without computing anything) if the
+  analysis cannot be done this way, in which case the caller should
+  use the voxel loop.
+  --------------------------------------------------------------------*/
+static int MRIglmFitAndTestBatch(MRIGLM *mriglm)
+{
+  GLMMAT *glm = mriglm->glm;
+  MATRIX *igCVM[GLMMAT_NCONTRASTS_MAX];
+  int c, r, s, n, nc, nr, ns, nf, nregtot, maxJ, nblocks, nthblock;
+  long nvox, nthvox;
+  int *vc, *vr, *vs;
+  float Xcond = 0;
+
+  if (mriglm->pervoxflag || mriglm->yffxvar != NULL || glm->DoPCC) return (1);
+
+  nc = mriglm->y->width;
+  nr = mriglm->y->height;
+  ns = mriglm->y->depth;
+  nf = mriglm->y->nframes;
+
+  // The design (possibly weighted by wg) is the same at every voxel,
+  // so load it and compute the intermediate matrices once
+  MRIglmLoadVox(mriglm, 0, 0, 0, 0);
+  GLMxMatrices(glm);
+  if (mriglm->condsave) Xcond = MatrixConditionNumber(glm->XtX);
+  if (glm->ill_cond_flag) return (1);
+  nregtot = glm->X->cols;
+
+  maxJ = 1;
+  for (n = 0; n < glm->ncontrasts; n++) {
+    igCVM[n] = MatrixInverse(glm->CiXtXCt[n], NULL);
+    maxJ = MAX(maxJ, glm->C[n]->rows);
+  }
+
+  // List the voxels in the mask, in the same order as the voxel loop
+  nvox = 0;
+  for (c = 0; c < nc; c++)
+    for (r = 0; r < nr; r++)
+      for (s = 0; s < ns; s++)
+        if (mriglm->mask == NULL || MRIgetVoxVal(mriglm->mask, c, r, s, 0) >= 0.5) nvox++;
+  vc = (int *)calloc(nvox + 1, sizeof(int));
+  vr = (int *)calloc(nvox + 1, sizeof(int));
+  vs = (int *)calloc(nvox + 1, sizeof(int));
+  nthvox = 0;
+  for (c = 0; c < nc; c++)
+    for (r = 0; r < nr; r++)
+      for (s = 0; s < ns; s++) {
+        if (mriglm->mask != NULL && MRIgetVoxVal(mriglm->mask, c, r, s, 0) < 0.5) continue;
+        vc[nthvox] = c;
+        vr[nthvox] = r;
+        vs[nthvox] = s;
+        if (mriglm->condsave) MRIsetVoxVal(mriglm->cond, c, r, s, 0, Xcond);
+        nthvox++;
+      }
+
+  nblocks = (nvox + GLM_BATCH_NVOX - 1) / GLM_BATCH_NVOX;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (nthblock = 0; nthblock < nblocks; nthblock++) {
+    ROMP_PFLB_begin
+    int f, k, v, n, J, i, j, vc0, vr0, vs0;
+    long v0 = (long)nthblock * GLM_BATCH_NVOX;
+    int nv = MIN(GLM_BATCH_NVOX, nvox - v0);
+    float *Y = (float *)calloc(nf * GLM_BATCH_NVOX, sizeof(float));
+    float *Xty = (float *)calloc(nregtot * GLM_BATCH_NVOX, sizeof(float));
+    float *beta = (float *)calloc(nregtot * GLM_BATCH_NVOX, sizeof(float));
+    float *yhat = (float *)calloc(nf * GLM_BATCH_NVOX, sizeof(float));
+    float *gamma = (float *)calloc(maxJ * GLM_BATCH_NVOX, sizeof(float));
+    double rvar[GLM_BATCH_NVOX];
+    MATRIX *betav = NULL, *ypmf = NULL;
+
+    // Pack y (weighted as in MRIglmLoadVox())
+    for (f = 0; f < nf; f++) {
+      for (v = 0; v < nv; v++) {
+        float y = MRIgetVoxVal(mriglm->y, vc[v0 + v], vr[v0 + v], vs[v0 + v], f);
+        if (mriglm->wg != NULL && !mriglm->skipweight) y *= (double)mriglm->wg->rptr[f + 1][1];
+        Y[f * GLM_BATCH_NVOX + v] = y;
+      }
+    }
+
+    // GLMfit(): beta = inv(X'*X)*X'*y, yhat = X*beta, eres = y - yhat
+    glmBatchMultiply(glm->Xt, Y, nv, Xty);
+    glmBatchMultiply(glm->iXtX, Xty, nv, beta);
+    glmBatchMultiply(glm->X, beta, nv, yhat);
+    for (v = 0; v < nv; v++) rvar[v] = 0;
+    for (f = 0; f < nf; f++) {
+      for (v = 0; v < nv; v++) {
+        float e = Y[f * GLM_BATCH_NVOX + v] - yhat[f * GLM_BATCH_NVOX + v];
+        float e2 = e * e;
+        Y[f * GLM_BATCH_NVOX + v] = e;  // y is not needed any more, keep eres
+        rvar[v] += e2;
+      }
+    }
+    for (v = 0; v < nv; v++) {
+      rvar[v] /= glm->dof;
+      if (rvar[v] < FLT_MIN) rvar[v] = FLT_MIN;
+    }
+
+    for (v = 0; v < nv; v++) {
+      vc0 = vc[v0 + v];
+      vr0 = vr[v0 + v];
+      vs0 = vs[v0 + v];
+      MRIsetVoxVal(mriglm->rvar, vc0, vr0, vs0, 0, rvar[v]);
+      for (k = 0; k < nregtot; k++) MRIsetVoxVal(mriglm->beta, vc0, vr0, vs0, k, beta[k * GLM_BATCH_NVOX + v]);
+      for (f = 0; f < nf; f++) MRIsetVoxVal(mriglm->eres, vc0, vr0, vs0, f, Y[f * GLM_BATCH_NVOX + v]);
+      if (mriglm->yhatsave)
+        for (f = 0; f < nf; f++) MRIsetVoxVal(mriglm->yhat, vc0, vr0, vs0, f, yhat[f * GLM_BATCH_NVOX + v]);
+    }
+
+    // GLMtest()
+    for (n = 0; n < glm->ncontrasts; n++) {
+      J = glm->C[n]->rows;
+      glmBatchMultiply(glm->C[n], beta, nv, gamma);
+      for (v = 0; v < nv; v++) {
+        double dtmp, F, p, z;
+        float gtigCVM, Ff;
+        vc0 = vc[v0 + v];
+        vr0 = vr[v0 + v];
+        vs0 = vs[v0 + v];
+        if (glm->UseGamma0[n])
+          for (i = 0; i < J; i++) gamma[i * GLM_BATCH_NVOX + v] -= glm->gamma0[n]->rptr[i + 1][1];
+
+        // Error trap for when rvar==0
+        if (rvar[v] < 2 * FLT_MIN)
+          dtmp = 1e10 * J;
+        else
+          dtmp = rvar[v] * J;
+
+        F = 0;
+        p = 1;
+        z = 0;
+        if (igCVM[n] != NULL && rvar[v] > FLT_MIN) {
+          float scale = 1.0 / dtmp;
+          double Fsum = 0;
+          for (j = 0; j < J; j++) {
+            double acc = 0;
+            for (i = 0; i < J; i++) {
+              float ig = igCVM[n]->rptr[i + 1][j + 1] * scale;
+              acc += (double)gamma[i * GLM_BATCH_NVOX + v] * ig;
+            }
+            gtigCVM = acc;
+            Fsum += (double)gtigCVM * gamma[j * GLM_BATCH_NVOX + v];
+          }
+          Ff = Fsum;
+          F = Ff;
+          p = sc_cdf_fdist_Q(F, J, glm->dof);
+          z = sc_cdf_gaussian_Qinv(p / 2.0, 1);  // same as RFp2StatVal() for "z"
+          if (J == 1 && gamma[v] < 0) z *= -1;
+        }
+
+        for (i = 0; i < J; i++) MRIsetVoxVal(mriglm->gamma[n], vc0, vr0, vs0, i, gamma[i * GLM_BATCH_NVOX + v]);
+        if (J == 1) {
+          float dtmpf = dtmp;
+          MRIsetVoxVal(mriglm->gammaVar[n], vc0, vr0, vs0, 0, glm->CiXtXCt[n]->rptr[1][1] * dtmpf);
+        }
+        MRIsetVoxVal(mriglm->F[n], vc0, vr0, vs0, 0, F);
+        MRIsetVoxVal(mriglm->p[n], vc0, vr0, vs0, 0, p);
+        MRIsetVoxVal(mriglm->z[n], vc0, vr0, vs0, 0, z);
+
+        if (glm->ypmfflag[n]) {
+          if (betav == NULL) betav = MatrixAlloc(nregtot, 1, MATRIX_REAL);
+          for (k = 0; k < nregtot; k++) betav->rptr[k + 1][1] = beta[k * GLM_BATCH_NVOX + v];
+          ypmf = MatrixMultiplyD(glm->Mpmf[n], betav, ypmf);
+          MRIfromMatrix(mriglm->ypmf[n], vc0, vr0, vs0, ypmf, NULL);
+          MatrixFree(&ypmf);
+        }
+      }
+    }
+
+    if (betav) MatrixFree(&betav);
+    free(Y);
+    free(Xty);
+    free(beta);
+    free(yhat);
+    free(gamma);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (n = 0; n < glm->ncontrasts; n++)
+    if (igCVM[n]) MatrixFree(&igCVM[n]);
+  free(vc);
+  free(vr);
+  free(vs);
+  mriglm->n_ill_cond = 0;
+  return (0);
+}
+
 /*---------------------------------------------------------------------
   MRIglmFitAndTest() - fits and tests glm on a voxel-by-voxel basis.
   There are also two other related functions, MRIglmFit() and
@@ -986,6 +1211,9 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
     }
   }
 
+  // When the design is the same at every voxel, do all the voxels at once
+  if (MRIglmFitAndTestBatch(mriglm) == 0) return (0);
+
   //--------------------------------------------
   pctdone = 0;
   nthvox = 0;
@@ -29,9 +29,15 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -1864,11 +1870,30 @@ GCA *gcaAllocMax(
   gca->prior_r_to_i__ = NULL;
   gca->tal_i_to_r__ = gca->tal_r_to_i__ = 0;
 
+  ROMP_COUNT(atlas_allocs, 1);
+  if (max_labels >= 0) {
+    ROMP_COUNT(atlas_alloc_bytes,
+               (long)gca->node_width * gca->node_height * gca->node_depth * sizeof(GCA_NODE) +
+                   (long)gca->prior_width * gca->prior_height * gca->prior_depth * sizeof(GCA_PRIOR));
+  }
+
   GCAsetup(gca);
 
   return (gca);
 }
 
+/*
+  Returns 1 if p points into the mapping of a flat GCA (see GCAreadFlat).
+  The per-node and per-prior arrays of a flat GCA live in its mapping and
+  pool and must not be freed, unless they have since been replaced by
+  private copies (see GCAinsertLabels).
+*/
+static int gcaFlatMapped(const GCA *gca, const void *p)
+{
+  return (gca->flat_map && (const char *)p >= (const char *)gca->flat_map &&
+          (const char *)p < (const char *)gca->flat_map + gca->flat_map_size);
+}
+
 int GCAfree(GCA **pgca)
 {
   GCA *gca;
@@ -1880,7 +1905,9 @@ int GCAfree(GCA **pgca)
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
-        GCANfree(&gca->nodes[x][y][z], gca->ninputs);
+        if (!gcaFlatMapped(gca, gca->nodes[x][y][z].labels)) {
+          GCANfree(&gca->nodes[x][y][z], gca->ninputs);
+        }
       }
       free(gca->nodes[x][y]);
     }
@@ -1891,6 +1918,9 @@ int GCAfree(GCA **pgca)
   for (x = 0; x < gca->prior_width; x++) {
     for (y = 0; y < gca->prior_height; y++) {
       for (z = 0; z < gca->prior_depth; z++) {
+        if (gcaFlatMapped(gca, gca->priors[x][y][z].labels)) {
+          continue;
+        }
         free(gca->priors[x][y][z].labels);
         free(gca->priors[x][y][z].priors);
       }
@@ -1902,6 +1932,11 @@ int GCAfree(GCA **pgca)
   free(gca->priors);
   GCAcleanup(gca);
 
+  if (gca->flat_map) {
+    free(gca->flat_pool);
+    munmap(gca->flat_map, gca->flat_map_size);
+  }
+
   free(gca);
 
   return (NO_ERROR);
@@ -2514,11 +2549,667 @@ int GCAwrite(GCA *gca, const char *fname)
   znzwriteFloat(gca->zsize, file);
 
   znzclose(file);
+  ROMP_COUNT_FILE(output_file_bytes, fname);
+
+  return (NO_ERROR);
+}
+
+/*
+  Flat GCA files hold the same information as a .gca, laid out as a fixed
+  header followed by 8-byte aligned arrays addressed by file offsets. A
+  node (or prior) is found through a table of (nlabels, total_training,
+  index of first entry) records, and all per-label data for all nodes is
+  stored contiguously in those arrays. GCAreadFlat() can therefore mmap the
+  file and point the GCA at it instead of parsing and allocating every node,
+  and concurrent processes reading the same atlas share it in the page
+  cache. Flat files are written in native byte order and are not meant to
+  be moved between machines of different endianness - the .gca remains
+  the interchange format.
+*/
+#define GCA_FLAT_MAGIC "GCAFLAT"
+#define GCA_FLAT_VERSION 1
+#define GCA_FLAT_BYTE_ORDER 0x01020304
+
+typedef struct
+{
+  char magic[8];
+  int version;
+  int byte_order;
+  float prior_spacing, node_spacing;
+  int prior_width, prior_height, prior_depth;
+  int node_width, node_height, node_depth;
+  int ninputs, flags, type, max_label;
+  int width, height, depth;
+  float x_r, x_a, x_s, y_r, y_a, y_s, z_r, z_a, z_s, c_r, c_a, c_s;
+  float xsize, ysize, zsize;
+  double TRs[MAX_GCA_INPUTS], FAs[MAX_GCA_INPUTS], TEs[MAX_GCA_INPUTS];
+  long long ngcs, ngibbs, nprior_labels;
+  // file offsets of the sections
+  long long node_table, node_labels, gc_means, gc_covars, gc_ntraining;
+  long long gc_gibbs_nlabels, gibbs_labels, gibbs_priors;
+  long long prior_table, prior_labels, prior_priors;
+  long long ctab, ctab_size;
+} GCA_FLAT_HEADER;
+
+typedef struct
+{
+  int nlabels;
+  int total_training;
+  long long first;  // index of the first label of this node/prior in the label arrays
+} GCA_FLAT_ENTRY;
+
+/*!
+  \fn int GCAisFlat(const char *fname)
+  \brief Returns 1 if fname is a flat GCA written by GCAwriteFlat().
+*/
+int GCAisFlat(const char *fname)
+{
+  FILE *fp;
+  char magic[8];
+  int flat = 0;
+
+  fp = fopen(fname, "rb");
+  if (fp == NULL) {
+    return (0);
+  }
+  if (fread(magic, sizeof(magic), 1, fp) == 1 && !memcmp(magic, GCA_FLAT_MAGIC, sizeof(magic))) {
+    flat = 1;
+  }
+  fclose(fp);
+  return (flat);
+}
+
+// pad the file with zeros to the next 8-byte boundary and return the offset
+static long long gcaFlatAlign(FILE *fp)
+{
+  static const char zeros[8] = {0};
+  long long offset = ftell(fp);
+
+  if (offset % 8) {
+    fwrite(zeros, 1, 8 - offset % 8, fp);
+    offset += 8 - offset % 8;
+  }
+  return (offset);
+}
+
+// writes the flat layout to a seekable stream positioned at its start
+static int gcaWriteFlatStream(GCA *gca, FILE *fp, const char *fname)
+{
+  GCA_FLAT_HEADER hdr;
+  GCA_FLAT_ENTRY entry;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  int x, y, z, n, i, ncov, mrf;
+  long long first;
+
+  ncov = (gca->ninputs * (gca->ninputs + 1)) / 2;
+  mrf = !(gca->flags & GCA_NO_MRF);
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.version = GCA_FLAT_VERSION;
+  hdr.byte_order = GCA_FLAT_BYTE_ORDER;
+  hdr.prior_spacing = gca->prior_spacing;
+  hdr.node_spacing = gca->node_spacing;
+  hdr.prior_width = gca->prior_width;
+  hdr.prior_height = gca->prior_height;
+  hdr.prior_depth = gca->prior_depth;
+  hdr.node_width = gca->node_width;
+  hdr.node_height = gca->node_height;
+  hdr.node_depth = gca->node_depth;
+  hdr.ninputs = gca->ninputs;
+  hdr.flags = gca->flags;
+  hdr.type = gca->type;
+  hdr.max_label = gca->max_label;
+  hdr.width = gca->width;
+  hdr.height = gca->height;
+  hdr.depth = gca->depth;
+  hdr.x_r = gca->x_r;
+  hdr.x_a = gca->x_a;
+  hdr.x_s = gca->x_s;
+  hdr.y_r = gca->y_r;
+  hdr.y_a = gca->y_a;
+  hdr.y_s = gca->y_s;
+  hdr.z_r = gca->z_r;
+  hdr.z_a = gca->z_a;
+  hdr.z_s = gca->z_s;
+  hdr.c_r = gca->c_r;
+  hdr.c_a = gca->c_a;
+  hdr.c_s = gca->c_s;
+  hdr.xsize = gca->xsize;
+  hdr.ysize = gca->ysize;
+  hdr.zsize = gca->zsize;
+  memcpy(hdr.TRs, gca->TRs, sizeof(hdr.TRs));
+  memcpy(hdr.FAs, gca->FAs, sizeof(hdr.FAs));
+  memcpy(hdr.TEs, gca->TEs, sizeof(hdr.TEs));
+
+  // the header is rewritten once the section offsets are known. The magic
+  // is only set then, so a partially written file is never taken as flat.
+  fwrite(&hdr, sizeof(hdr), 1, fp);
+
+  // node table, then each per-label array in the same node order
+  hdr.node_table = gcaFlatAlign(fp);
+  for (first = 0, x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        entry.nlabels = gcan->nlabels;
+        entry.total_training = gcan->total_training;
+        entry.first = first;
+        fwrite(&entry, sizeof(entry), 1, fp);
+        first += gcan->nlabels;
+      }
+  hdr.ngcs = first;
+
+#define GCA_FLAT_FOREACH_GC(BODY)                         \
+  for (x = 0; x < gca->node_width; x++)                   \
+    for (y = 0; y < gca->node_height; y++)                \
+      for (z = 0; z < gca->node_depth; z++) {             \
+        gcan = &gca->nodes[x][y][z];                      \
+        for (n = 0; n < gcan->nlabels; n++) {             \
+          gc = &gcan->gcs[n];                             \
+          BODY                                            \
+        }                                                 \
+      }
+
+  hdr.node_labels = gcaFlatAlign(fp);
+  GCA_FLAT_FOREACH_GC(fwrite(&gcan->labels[n], sizeof(unsigned short), 1, fp);)
+  hdr.gc_means = gcaFlatAlign(fp);
+  GCA_FLAT_FOREACH_GC(fwrite(gc->means, sizeof(float), gca->ninputs, fp);)
+  hdr.gc_covars = gcaFlatAlign(fp);
+  GCA_FLAT_FOREACH_GC(fwrite(gc->covars, sizeof(float), ncov, fp);)
+  hdr.gc_ntraining = gcaFlatAlign(fp);
+  GCA_FLAT_FOREACH_GC(fwrite(&gc->ntraining, sizeof(int), 1, fp);)
+  hdr.ngibbs = 0;
+  if (mrf) {
+    hdr.gc_gibbs_nlabels = gcaFlatAlign(fp);
+    GCA_FLAT_FOREACH_GC(fwrite(gc->nlabels, sizeof(short), GIBBS_NEIGHBORHOOD, fp);
+                        for (i = 0; i < GIBBS_NEIGHBORHOOD; i++) hdr.ngibbs += gc->nlabels[i];)
+    hdr.gibbs_labels = gcaFlatAlign(fp);
+    GCA_FLAT_FOREACH_GC(for (i = 0; i < GIBBS_NEIGHBORHOOD; i++)
+                            fwrite(gc->labels[i], sizeof(unsigned short), gc->nlabels[i], fp);)
+    hdr.gibbs_priors = gcaFlatAlign(fp);
+    GCA_FLAT_FOREACH_GC(for (i = 0; i < GIBBS_NEIGHBORHOOD; i++)
+                            fwrite(gc->label_priors[i], sizeof(float), gc->nlabels[i], fp);)
+  }
+#undef GCA_FLAT_FOREACH_GC
+
+  hdr.prior_table = gcaFlatAlign(fp);
+  for (first = 0, x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcap = &gca->priors[x][y][z];
+        entry.nlabels = gcap->nlabels;
+        entry.total_training = gcap->total_training;
+        entry.first = first;
+        fwrite(&entry, sizeof(entry), 1, fp);
+        first += gcap->nlabels;
+      }
+  hdr.nprior_labels = first;
+  hdr.prior_labels = gcaFlatAlign(fp);
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcap = &gca->priors[x][y][z];
+        fwrite(gcap->labels, sizeof(unsigned short), gcap->nlabels, fp);
+      }
+  hdr.prior_priors = gcaFlatAlign(fp);
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcap = &gca->priors[x][y][z];
+        fwrite(gcap->priors, sizeof(float), gcap->nlabels, fp);
+      }
+
+  if (gca->ct) {
+    hdr.ctab = gcaFlatAlign(fp);
+    CTABwriteIntoBinary(gca->ct, fp);
+    hdr.ctab_size = ftell(fp) - hdr.ctab;
+  }
+
+  fflush(fp);
+  fseek(fp, 0, SEEK_SET);
+  memcpy(hdr.magic, GCA_FLAT_MAGIC, sizeof(hdr.magic));
+  fwrite(&hdr, sizeof(hdr), 1, fp);
+  fflush(fp);
+  if (ferror(fp)) {
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAwriteFlat(%s): write failed", fname));
+  }
+
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int GCAwriteFlat(GCA *gca, const char *fname)
+  \brief Writes gca in the flat, memory-mappable layout read by GCAreadFlat().
+*/
+int GCAwriteFlat(GCA *gca, const char *fname)
+{
+  FILE *fp;
+  int ret;
+
+  fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAwriteFlat(%s): could not open file", fname));
+  }
+  ret = gcaWriteFlatStream(gca, fp, fname);
+  fclose(fp);
+  return (ret);
+}
+
+// 1 if count elements of size bytes at offset off lie inside a file of size bytes
+static int gcaFlatSectionOK(long long off, long long count, long long size, long long file_size)
+{
+  return (off >= 0 && count >= 0 && off <= file_size && count <= (file_size - off) / size);
+}
+
+// maps a flat GCA from an open descriptor, which may be closed afterwards
+static GCA *gcaMapFlat(int fd, const char *fname)
+{
+  int x, y, z, n, i, ncov, mrf;
+  struct stat st;
+  char *base;
+  const GCA_FLAT_HEADER *hdr;
+  const GCA_FLAT_ENTRY *entries;
+  GCA *gca;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gcs, *gc;
+  unsigned short **gibbs_labels;
+  float **gibbs_priors;
+  long long gibbs_first, nnodes, npriors;
+
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(GCA_FLAT_HEADER)) {
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): file too short", fname));
+  }
+  base = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (base == (char *)MAP_FAILED) {
+    ErrorReturn(NULL, (ERROR_NOMEMORY, "GCAreadFlat(%s): could not map file", fname));
+  }
+
+  hdr = (const GCA_FLAT_HEADER *)base;
+  if (memcmp(hdr->magic, GCA_FLAT_MAGIC, sizeof(hdr->magic)) || hdr->version != GCA_FLAT_VERSION ||
+      hdr->byte_order != GCA_FLAT_BYTE_ORDER) {
+    munmap(base, st.st_size);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): bad header or incompatible byte order", fname));
+  }
+
+  // every section the node and prior arrays will point into must be inside the file
+  nnodes = (long long)hdr->node_width * hdr->node_height * hdr->node_depth;
+  npriors = (long long)hdr->prior_width * hdr->prior_height * hdr->prior_depth;
+  ncov = (hdr->ninputs * (hdr->ninputs + 1)) / 2;
+  mrf = !(hdr->flags & GCA_NO_MRF);
+  if (hdr->ninputs < 1 || hdr->ninputs > MAX_GCA_INPUTS || hdr->node_width <= 0 || hdr->node_height <= 0 ||
+      hdr->node_depth <= 0 || hdr->prior_width <= 0 || hdr->prior_height <= 0 || hdr->prior_depth <= 0 ||
+      !gcaFlatSectionOK(hdr->node_table, nnodes, sizeof(GCA_FLAT_ENTRY), st.st_size) ||
+      !gcaFlatSectionOK(hdr->node_labels, hdr->ngcs, sizeof(unsigned short), st.st_size) ||
+      !gcaFlatSectionOK(hdr->gc_means, hdr->ngcs, hdr->ninputs * sizeof(float), st.st_size) ||
+      !gcaFlatSectionOK(hdr->gc_covars, hdr->ngcs, ncov * sizeof(float), st.st_size) ||
+      !gcaFlatSectionOK(hdr->gc_ntraining, hdr->ngcs, sizeof(int), st.st_size) ||
+      (mrf && (!gcaFlatSectionOK(hdr->gc_gibbs_nlabels, hdr->ngcs, GIBBS_NEIGHBORHOOD * sizeof(short), st.st_size) ||
+               !gcaFlatSectionOK(hdr->gibbs_labels, hdr->ngibbs, sizeof(unsigned short), st.st_size) ||
+               !gcaFlatSectionOK(hdr->gibbs_priors, hdr->ngibbs, sizeof(float), st.st_size))) ||
+      !gcaFlatSectionOK(hdr->prior_table, npriors, sizeof(GCA_FLAT_ENTRY), st.st_size) ||
+      !gcaFlatSectionOK(hdr->prior_labels, hdr->nprior_labels, sizeof(unsigned short), st.st_size) ||
+      !gcaFlatSectionOK(hdr->prior_priors, hdr->nprior_labels, sizeof(float), st.st_size) ||
+      !gcaFlatSectionOK(hdr->ctab, hdr->ctab_size, 1, st.st_size)) {
+    munmap(base, st.st_size);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): truncated or corrupt file", fname));
+  }
+
+  gca = gcaAllocMax(hdr->ninputs,
+                    hdr->prior_spacing,
+                    hdr->node_spacing,
+                    hdr->node_spacing * hdr->node_width,
+                    hdr->node_spacing * hdr->node_height,
+                    hdr->node_spacing * hdr->node_depth,
+                    0,
+                    hdr->flags);
+  if (!gca) {
+    munmap(base, st.st_size);
+    ErrorReturn(NULL, (Gerror, NULL));
+  }
+  gca->flat_map = base;
+  gca->flat_map_size = st.st_size;
+  if (gca->prior_width != hdr->prior_width || gca->prior_height != hdr->prior_height ||
+      gca->prior_depth != hdr->prior_depth) {
+    GCAfree(&gca);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): inconsistent prior dimensions", fname));
+  }
+
+  // the GC1D structs (and their gibbs pointer arrays) are the only per-label memory allocated
+  gca->flat_pool = calloc(1,
+                          hdr->ngcs * sizeof(GC1D) +
+                              (mrf ? hdr->ngcs * GIBBS_NEIGHBORHOOD * (sizeof(unsigned short *) + sizeof(float *)) : 0));
+  if (!gca->flat_pool) {
+    ErrorExit(ERROR_NOMEMORY, "GCAreadFlat(%s): could not allocate %lld gcs", fname, hdr->ngcs);
+  }
+  gcs = (GC1D *)gca->flat_pool;
+  gibbs_labels = (unsigned short **)(gcs + hdr->ngcs);
+  gibbs_priors = (float **)(gibbs_labels + (mrf ? hdr->ngcs * GIBBS_NEIGHBORHOOD : 0));
+
+  entries = (const GCA_FLAT_ENTRY *)(base + hdr->node_table);
+  gibbs_first = 0;
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++, entries++) {
+        gcan = &gca->nodes[x][y][z];
+        if (entries->nlabels < 0 || entries->first < 0 || entries->first > hdr->ngcs - entries->nlabels) {
+          GCAfree(&gca);
+          ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): node (%d, %d, %d) out of range", fname, x, y, z));
+        }
+        gcan->nlabels = gcan->max_labels = entries->nlabels;
+        gcan->total_training = entries->total_training;
+        if (gcan->nlabels == 0) {
+          gcan->labels = 0;
+          gcan->gcs = 0;
+          continue;
+        }
+        gcan->labels = (unsigned short *)(base + hdr->node_labels) + entries->first;
+        gcan->gcs = gcs + entries->first;
+        for (n = 0; n < gcan->nlabels; n++) {
+          long long const k = entries->first + n;
+          gc = &gcan->gcs[n];
+          gc->means = (float *)(base + hdr->gc_means) + k * gca->ninputs;
+          gc->covars = (float *)(base + hdr->gc_covars) + k * ncov;
+          gc->ntraining = ((int *)(base + hdr->gc_ntraining))[k];
+          if (!mrf) {
+            continue;
+          }
+          gc->nlabels = (short *)(base + hdr->gc_gibbs_nlabels) + k * GIBBS_NEIGHBORHOOD;
+          gc->labels = gibbs_labels + k * GIBBS_NEIGHBORHOOD;
+          gc->label_priors = gibbs_priors + k * GIBBS_NEIGHBORHOOD;
+          for (i = 0; i < GIBBS_NEIGHBORHOOD; i++) {
+            if (gc->nlabels[i] < 0 || gibbs_first > hdr->ngibbs - gc->nlabels[i]) {
+              GCAfree(&gca);
+              ErrorReturn(NULL,
+                          (ERROR_BADFILE, "GCAreadFlat(%s): gibbs priors of node (%d, %d, %d) out of range", fname, x, y, z));
+            }
+            gc->labels[i] = (unsigned short *)(base + hdr->gibbs_labels) + gibbs_first;
+            gc->label_priors[i] = (float *)(base + hdr->gibbs_priors) + gibbs_first;
+            gibbs_first += gc->nlabels[i];
+          }
+        }
+      }
+
+  entries = (const GCA_FLAT_ENTRY *)(base + hdr->prior_table);
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++, entries++) {
+        gcap = &gca->priors[x][y][z];
+        if (entries->nlabels < 0 || entries->first < 0 || entries->first > hdr->nprior_labels - entries->nlabels) {
+          GCAfree(&gca);
+          ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): prior (%d, %d, %d) out of range", fname, x, y, z));
+        }
+        gcap->nlabels = gcap->max_labels = entries->nlabels;
+        gcap->total_training = entries->total_training;
+        if (gcap->nlabels == 0) {
+          gcap->labels = 0;
+          gcap->priors = 0;
+          continue;
+        }
+        gcap->labels = (unsigned short *)(base + hdr->prior_labels) + entries->first;
+        gcap->priors = (float *)(base + hdr->prior_priors) + entries->first;
+      }
+
+  gca->type = hdr->type;
+  gca->max_label = hdr->max_label;
+  memcpy(gca->TRs, hdr->TRs, sizeof(gca->TRs));
+  memcpy(gca->FAs, hdr->FAs, sizeof(gca->FAs));
+  memcpy(gca->TEs, hdr->TEs, sizeof(gca->TEs));
+  gca->x_r = hdr->x_r;
+  gca->x_a = hdr->x_a;
+  gca->x_s = hdr->x_s;
+  gca->y_r = hdr->y_r;
+  gca->y_a = hdr->y_a;
+  gca->y_s = hdr->y_s;
+  gca->z_r = hdr->z_r;
+  gca->z_a = hdr->z_a;
+  gca->z_s = hdr->z_s;
+  gca->c_r = hdr->c_r;
+  gca->c_a = hdr->c_a;
+  gca->c_s = hdr->c_s;
+  gca->width = hdr->width;
+  gca->height = hdr->height;
+  gca->depth = hdr->depth;
+  gca->xsize = hdr->xsize;
+  gca->ysize = hdr->ysize;
+  gca->zsize = hdr->zsize;
+
+  if (hdr->ctab_size > 0) {
+    FILE *fp = fmemopen(base + hdr->ctab, hdr->ctab_size, "rb");
+    if (fp) {
+      gca->ct = CTABreadFromBinary(fp);
+      fclose(fp);
+    }
+  }
+
+  GCAsetup(gca);
+
+  return (gca);
+}
+
+/*!
+  \fn GCA *GCAreadFlat(const char *fname)
+  \brief Maps a flat GCA written by GCAwriteFlat(). The node and prior
+  arrays (labels, means, covariances, gibbs priors...) point straight into
+  a private copy-on-write mapping of the file, so pages are only read when
+  touched and are shared with every other process mapping the same atlas.
+  Code that modifies atlas values in place still works (the touched pages
+  become private). GCAfree(), GCAfreeGibbs() and GCAinsertLabels() know
+  about the mapping, but other code that frees or reallocates per-node
+  arrays (ie, training) must use a GCA read with the regular GCAread() path.
+*/
+GCA *GCAreadFlat(const char *fname)
+{
+  GCA *gca;
+  int fd;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    ErrorReturn(NULL, (ERROR_BADPARM, "GCAreadFlat(%s): could not open file", fname));
+  }
+  gca = gcaMapFlat(fd, fname);
+  close(fd);
+  return (gca);
+}
+
+/*
+  Resident atlas cache. mri_gca_cache loads an atlas once into a POSIX
+  shared memory object in the flat layout, named after the atlas path,
+  size and modification time. GCAread() attaches to that object when it
+  exists, so a node running many subjects keeps a single copy of each atlas
+  in memory and skips parsing it in every process. Nothing needs to stay
+  running: the object persists until it is unloaded (or the node reboots).
+  An edited atlas gets a different name, so a stale copy is never used.
+  Setting FS_GCA_CACHE=0 disables attaching.
+*/
+static int gcaCacheName(const char *fname, char *name, size_t len)
+{
+  char path[PATH_MAX];
+  struct stat st;
+  unsigned long long hash = 14695981039346656037ULL;
+  const unsigned char *p;
+
+  if (realpath(fname, path) == NULL || stat(path, &st) != 0) {
+    return (ERROR_NOFILE);
+  }
+  for (p = (const unsigned char *)path; *p; p++) {
+    hash = (hash ^ *p) * 1099511628211ULL;
+  }
+  snprintf(name,
+           len,
+           "/fs_gca_%016llx_%llx_%llx_v%d",
+           hash,
+           (unsigned long long)st.st_size,
+           (unsigned long long)st.st_mtime,
+           GCA_FLAT_VERSION);
+  return (NO_ERROR);
+}
+
+// the magic is written last, so an object without it is still being
+// loaded or was left behind by a loader that died
+static int gcaCacheHasMagic(int fd)
+{
+  char magic[8];
+
+  return (pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) && !memcmp(magic, GCA_FLAT_MAGIC, sizeof(magic)));
+}
+
+static GCA *gcaCacheAttach(const char *fname)
+{
+  char name[STRLEN];
+  const char *env;
+  GCA *gca;
+  int fd;
+
+  env = getenv("FS_GCA_CACHE");
+  if (env && !strcmp(env, "0")) {
+    return (NULL);
+  }
+  if (gcaCacheName(fname, name, sizeof(name)) != NO_ERROR) {
+    return (NULL);
+  }
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return (NULL);
+  }
+  // not (completely) loaded: fall back to the file
+  if (!gcaCacheHasMagic(fd)) {
+    close(fd);
+    return (NULL);
+  }
+  gca = gcaMapFlat(fd, fname);
+  close(fd);
+  if (gca && Gdiag & DIAG_SHOW) {
+    printf("GCAread(%s): attached to resident copy %s\n", fname, name);
+  }
+  return (gca);
+}
 
+/*!
+  \fn int GCAcacheLoad(const char *fname)
+  \brief Loads the atlas in fname into shared memory, where GCAread() will
+  find it (see gcaCacheName). Does nothing if it is already resident.
+  The loader holds an flock on the object until the magic is written, so
+  an object that has no magic and is not locked was left by a loader that
+  was killed; it is removed and loaded again. If another process is
+  loading the atlas, this waits for it to finish.
+*/
+int GCAcacheLoad(const char *fname)
+{
+  char name[STRLEN];
+  GCA *gca;
+  FILE *fp;
+  int fd, ret;
+
+  if (gcaCacheName(fname, name, sizeof(name)) != NO_ERROR) {
+    ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "GCAcacheLoad(%s): could not stat file", fname));
+  }
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0 && errno == EEXIST) {
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd >= 0) {
+      // blocks while another loader is still writing it
+      flock(fd, LOCK_EX);
+      if (gcaCacheHasMagic(fd)) {
+        close(fd);
+        return (NO_ERROR);
+      }
+      printf("GCAcacheLoad(%s): removing incomplete %s\n", fname, name);
+      shm_unlink(name);
+      close(fd);
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == EEXIST) {
+      // another process just started loading it
+      return (NO_ERROR);
+    }
+  }
+  if (fd < 0) {
+    ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "GCAcacheLoad(%s): could not create %s", fname, name));
+  }
+  // released when fd is closed, after the magic has been written
+  flock(fd, LOCK_EX);
+
+  // the object exists but has no magic yet, so this read comes from disk
+  gca = GCAread(fname);
+  if (!gca) {
+    close(fd);
+    shm_unlink(name);
+    ErrorReturn(Gerror, (Gerror, "GCAcacheLoad(%s): could not read atlas", fname));
+  }
+  fp = fdopen(fd, "w+b");
+  ret = fp ? gcaWriteFlatStream(gca, fp, name) : ERROR_NOFILE;
+  if (fp) {
+    fclose(fp);
+  }
+  else {
+    close(fd);
+  }
+  GCAfree(&gca);
+  if (ret != NO_ERROR) {
+    shm_unlink(name);
+  }
+  return (ret);
+}
+
+/*!
+  \fn int GCAcacheUnload(const char *fname)
+  \brief Removes the resident copy of the atlas in fname. Processes that
+  are attached to it keep their mapping.
+*/
+int GCAcacheUnload(const char *fname)
+{
+  char name[STRLEN];
+
+  if (gcaCacheName(fname, name, sizeof(name)) != NO_ERROR) {
+    ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "GCAcacheUnload(%s): could not stat file", fname));
+  }
+  if (shm_unlink(name) != 0) {
+    ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "GCAcacheUnload(%s): %s is not loaded", fname, name));
+  }
   return (NO_ERROR);
 }
 
+/*!
+  \fn int GCAcacheIsLoaded(const char *fname)
+  \brief Returns 1 if a complete resident copy of the atlas in fname exists,
+  0 otherwise (including while it is being loaded).
+*/
+int GCAcacheIsLoaded(const char *fname)
+{
+  char name[STRLEN];
+  int fd, loaded;
+
+  if (gcaCacheName(fname, name, sizeof(name)) != NO_ERROR) {
+    return (0);
+  }
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return (0);
+  }
+  loaded = gcaCacheHasMagic(fd);
+  close(fd);
+  return (loaded);
+}
+
+
+static GCA *gcaRead(const char *fname);
+
 GCA *GCAread(const char *fname)
+{
+  GCA *gca;
+
+  ROMP_SCOPE_begin
+  gca = gcaRead(fname);
+  if (gca) ROMP_COUNT_FILE(input_file_bytes, fname);
+  ROMP_SCOPE_end
+
+  return (gca);
+}
+
+static GCA *gcaRead(const char *fname)
 {
   znzFile file;
   int x, y, z, n, i, j;
@@ -2533,6 +3224,15 @@ GCA *GCAread(const char *fname)
   int gzipped = 0;
   int tempZNZ;
 
+  if (GCAisFlat(fname)) {
+    return (GCAreadFlat(fname));
+  }
+
+  gca = gcaCacheAttach(fname);
+  if (gca) {
+    return (gca);
+  }
+
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
@@ -3524,6 +4224,14 @@ int GCAcompleteCovarianceTraining(GCA *gca)
   return (NO_ERROR);
 }
 
+/*!
+  \fn MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
+  \brief Gives each voxel its MAP label under the atlas, without the MRF
+  (Gibbs) term. The voxel context (node, prior and intensities) is already
+  looked up once per voxel and each candidate label only costs a density
+  evaluation, so unlike GCAreclassifyUsingGibbsPriors() there is nothing
+  for the gcaGibbsVoxelLoad() split to hoist out of the label loop.
+*/
 MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
 {
   int x, width, height, depth, num_pv, use_partial_volume_stuff;
@@ -7676,6 +8384,182 @@ double MAX_PRIOR_FACTOR = 1.0 ;
 double MIN_PRIOR_FACTOR = 1.0 ;
 #endif
 
+/*
+  Everything GCAvoxelGibbsLogPosterior() needs to know about a voxel other
+  than its own label. GCAreclassifyUsingGibbsPriors() evaluates every
+  candidate label of a voxel and only the label changes between those
+  evaluations, so the transform, node and prior lookups, intensities and
+  neighbor labels are gathered once per voxel instead of once per label.
+*/
+typedef struct
+{
+  int outside;  // voxel does not map into the atlas
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  int xn, yn, zn;
+  float vals[MAX_GCA_INPUTS];
+  int nbr_labels[GIBBS_NEIGHBORS];  // -1 where the (clamped) neighbor is the voxel itself
+} GCA_GIBBS_VOXEL;
+
+static void gcaGibbsVoxelLoad(
+    GCA *gca, MRI *mri_labels, MRI *mri_inputs, int x, int y, int z, TRANSFORM *transform, GCA_GIBBS_VOXEL *gv)
+{
+  int i, xnbr, ynbr, znbr;
+
+  load_vals(mri_inputs, x, y, z, gv->vals, gca->ninputs);
+  gv->gcan = NULL;
+  gv->outside = GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &gv->xn, &gv->yn, &gv->zn);
+  if (!gv->outside) {
+    gv->gcan = &gca->nodes[gv->xn][gv->yn][gv->zn];
+  }
+  gv->gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
+  for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+    xnbr = mri_labels->xi[x + xnbr_offset[i]];
+    ynbr = mri_labels->yi[y + ynbr_offset[i]];
+    znbr = mri_labels->zi[z + znbr_offset[i]];
+    if (xnbr == x && ynbr == y && znbr == z) {
+      gv->nbr_labels[i] = -1;
+    }
+    else {
+      gv->nbr_labels[i] = nint(MRIgetVoxVal(mri_labels, xnbr, ynbr, znbr, 0));
+    }
+  }
+}
+
+static double gcaGibbsVoxelLogPosterior(GCA *gca,
+                                        const GCA_GIBBS_VOXEL *gv,
+                                        int label,
+                                        int x,
+                                        int y,
+                                        int z,
+                                        MRI *mri_inputs,
+                                        TRANSFORM *transform,
+                                        double gibbs_coef)
+{
+  double log_posterior /*, dist*/, nbr_prior;
+  int nbr_label, i, j, n;
+  GCA_NODE *gcan = gv->gcan;
+  GCA_PRIOR *gcap = gv->gcap;
+  GC1D *gc = 0;
+#if INTERP_PRIOR
+  float prior;
+#endif
+  // float     tmp = 0;
+
+  // signify error
+  log_posterior = 0.;
+
+  // what happens with higher number > CMA_MAX?
+  /* find the node associated with this coordinate and classify */
+  if (!gv->outside) {
+    if (gcap == NULL || gcap->nlabels <= 0) {
+      if (label == Unknown)  // okay for there to be an
+                             // unknown label out of the fov
+      {
+        return (0.0);
+      }
+      else {
+        return (10 * BIG_AND_NEGATIVE);
+      }
+    }
+
+    ////////////////// debug code (this should not occur ) /////////
+    if (label > MAX_CMA_LABEL) {
+      printf(
+          "\nGCAvoxelGibbsLogPosterior() is called "
+          "with label %d at (%d, %d, %d)\n",
+          label,
+          x,
+          y,
+          z);
+      printf("gcan = %p, gcap = %p\n", gcan, gcap);
+      if (gcan) {
+        printf("gcan->nlabels = %d, gcan->total_training = %d ", gcan->nlabels, gcan->total_training);
+        printf("log(return) = %.2f\n", log(0.01f / ((float)gcan->total_training * GIBBS_NEIGHBORS)));
+        printf("labels for this location\n");
+        for (n = 0; n < gcan->nlabels; n++)
+          printf("label=%s (%d); ", cma_label_to_name(gcan->labels[n]), gcan->labels[n]);
+      }
+    }
+    /////////////////////////////////////////////////////////////////
+    for (n = 0; n < gcan->nlabels; n++) {
+      if (gcan->labels[n] == label) {
+        break;
+      }
+    }
+    // could not find the label, then
+    if (n >= gcan->nlabels) {
+      gc = GCAfindClosestValidGC(gca, gv->xn, gv->yn, gv->zn, label, 0);
+    }
+    else {
+      gc = &gcan->gcs[n];
+    }
+    if (gc == NULL) {
+      // if (gcan->total_training > 0)
+      // return(log(0.01f/((float)gcan->total_training*GIBBS_NEIGHBORS))) ;
+      /* 10*GIBBS_NEIGHBORS*BIG_AND_NEGATIVE*/
+      // else
+      return (10 * BIG_AND_NEGATIVE);
+      // return(log(VERY_UNLIKELY)) ;
+    }
+
+    /* compute 1-d Mahalanobis distance */
+    log_posterior = GCAcomputeConditionalLogDensity(gc, (float *)gv->vals, gca->ninputs, label);
+    if (check_finite("GCAvoxelGibbsLogPosterior: conditional log density", log_posterior) == 0) {
+      DiagBreak();
+    }
+
+    nbr_prior = 0.0;
+    if (gc->nlabels == NULL) {
+      nbr_prior += log(0.1f / (float)gcan->total_training);
+    }
+    else {
+      for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+        nbr_label = gv->nbr_labels[i] < 0 ? label : gv->nbr_labels[i];
+        for (j = 0; j < gc->nlabels[i]; j++) {
+          if (nbr_label == gc->labels[i][j]) {
+            break;
+          }
+        }
+        if (j < gc->nlabels[i]) {
+          if (!FZERO(gc->label_priors[i][j])) {
+            nbr_prior += log(gc->label_priors[i][j]);
+          }
+          else {
+            nbr_prior += log(0.1f / (float)gcan->total_training);
+          }
+          /*BIG_AND_NEGATIVE */
+          check_finite("GCAvoxelGibbsLogPosterior: label_priors", nbr_prior);
+        }
+        else /* never occurred - make it unlikely */
+        {
+          if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
+            DiagBreak();
+          }
+          nbr_prior += log(0.1f / (float)gcan->total_training);
+          /*BIG_AND_NEGATIVE*/
+        }
+      }
+    }
+// added to the previous value
+#if INTERP_PRIOR
+    prior = gcaComputePrior(gca, mri_inputs, transform, x, y, z, label);
+    log_posterior += (gibbs_coef * nbr_prior + log(prior));
+#else
+    log_posterior += (gibbs_coef * nbr_prior + log(getPrior(gcap, label)));
+#endif
+    if (check_finite("GCAvoxelGibbsLogPosterior: final", log_posterior) == 0) {
+      DiagBreak();
+    }
+  }
+  else {
+    return (10 * BIG_AND_NEGATIVE);
+    // return (log(VERY_UNLIKELY)) ;
+  }
+
+  return (log_posterior);
+}
+
 MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
                                    GCA *gca,
                                    MRI *mri_dst,
@@ -7852,6 +8736,7 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
     for (index = 0; index < nindices; index++) {
       int x, y, z, n, label, old_label;
       GCA_PRIOR *gcap;
+      GCA_GIBBS_VOXEL gv;
       double new_posterior, max_posterior;
       // float val;
 
@@ -7870,8 +8755,11 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       // val =
       MRIgetVoxVal(mri_inputs, x, y, z, 0);
 
-      /* find the node associated with this coordinate and classify */
-      gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
+      /* find the node associated with this coordinate and classify. Only
+         the label of this voxel changes while its candidates are evaluated,
+         so everything else the posterior depends on is looked up once. */
+      gcaGibbsVoxelLoad(gca, mri_dst, mri_inputs, x, y, z, transform, &gv);
+      gcap = gv.gcap;
       // it is not in the right place
       if (gcap == NULL) continue;
 
@@ -7881,17 +8769,18 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       // save the current label
       label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
       // calculate neighborhood likelihood
-      max_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
+      max_posterior = gcaGibbsVoxelLogPosterior(gca, &gv, old_label, x, y, z, mri_inputs, transform, prior_factor);
+      check_finite("GCAnbhdGibbsLogPosterior: final", max_posterior);
 
       // go through all labels at this point
       for (n = 0; n < gcap->nlabels; n++) {
         // skip the current label
         if (gcap->labels[n] == old_label) continue;
 
-        // assign the new label
-        MRIsetVoxVal(mri_dst, x, y, z, 0, gcap->labels[n]);
-        // calculate neighborhood likelihood
-        new_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
+        // calculate neighborhood likelihood with the new label
+        new_posterior =
+            gcaGibbsVoxelLogPosterior(gca, &gv, gcap->labels[n], x, y, z, mri_inputs, transform, prior_factor);
+        check_finite("GCAnbhdGibbsLogPosterior: final", new_posterior);
         // if it is bigger than the old one, then replace the label
         // and change max_posterior
         if (new_posterior > max_posterior) {
@@ -8365,149 +9254,13 @@ double GCAwindowPosteriorLogProbability(
 double GCAvoxelGibbsLogPosterior(
     GCA *gca, MRI *mri_labels, MRI *mri_inputs, int x, int y, int z, TRANSFORM *transform, double gibbs_coef)
 {
-  double log_posterior /*, dist*/, nbr_prior;
-  int xn, yn, zn, xnbr, ynbr, znbr, nbr_label, label, i, j, n;
-  GCA_NODE *gcan = 0;
-  GCA_PRIOR *gcap = 0;
-  GC1D *gc = 0;
-  float vals[MAX_GCA_INPUTS];
-#if INTERP_PRIOR
-  float prior;
-#endif
-  // float     tmp = 0;
+  GCA_GIBBS_VOXEL gv;
+  int label;
 
-  // signify error
-  log_posterior = 0.;
-
-  // get the grey value
-  load_vals(mri_inputs, x, y, z, vals, gca->ninputs);
   // get the label
   label = nint(MRIgetVoxVal(mri_labels, x, y, z, 0));
-  // what happens with higher number > CMA_MAX?
-  /* find the node associated with this coordinate and classify */
-  if (!GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) {
-    gcan = &gca->nodes[xn][yn][zn];
-    gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
-    if (gcap == NULL || gcap->nlabels <= 0) {
-      if (label == Unknown)  // okay for there to be an
-                             // unknown label out of the fov
-      {
-        return (0.0);
-      }
-      else {
-        return (10 * BIG_AND_NEGATIVE);
-      }
-    }
-
-    ////////////////// debug code (this should not occur ) /////////
-    if (label > MAX_CMA_LABEL) {
-      printf(
-          "\nGCAvoxelGibbsLogPosterior() is called "
-          "with label %d at (%d, %d, %d)\n",
-          label,
-          x,
-          y,
-          z);
-      printf("gcan = %p, gcap = %p\n", gcan, gcap);
-      if (gcan) {
-        printf("gcan->nlabels = %d, gcan->total_training = %d ", gcan->nlabels, gcan->total_training);
-        printf("log(return) = %.2f\n", log(0.01f / ((float)gcan->total_training * GIBBS_NEIGHBORS)));
-        printf("labels for this location\n");
-        for (n = 0; n < gcan->nlabels; n++)
-          printf("label=%s (%d); ", cma_label_to_name(gcan->labels[n]), gcan->labels[n]);
-      }
-    }
-    /////////////////////////////////////////////////////////////////
-    for (n = 0; n < gcan->nlabels; n++) {
-      if (gcan->labels[n] == label) {
-        break;
-      }
-    }
-    // could not find the label, then
-    if (n >= gcan->nlabels) {
-      gc = GCAfindClosestValidGC(gca, xn, yn, zn, label, 0);
-    }
-    else {
-      gc = &gcan->gcs[n];
-    }
-    if (gc == NULL) {
-      // if (gcan->total_training > 0)
-      // return(log(0.01f/((float)gcan->total_training*GIBBS_NEIGHBORS))) ;
-      /* 10*GIBBS_NEIGHBORS*BIG_AND_NEGATIVE*/
-      // else
-      return (10 * BIG_AND_NEGATIVE);
-      // return(log(VERY_UNLIKELY)) ;
-    }
-
-    /* compute 1-d Mahalanobis distance */
-    log_posterior = GCAcomputeConditionalLogDensity(gc, vals, gca->ninputs, label);
-    if (check_finite("GCAvoxelGibbsLogPosterior: conditional log density", log_posterior) == 0) {
-      DiagBreak();
-    }
-
-    nbr_prior = 0.0;
-    if (gc->nlabels == NULL) {
-      nbr_prior += log(0.1f / (float)gcan->total_training);
-    }
-    else {
-      for (i = 0; i < GIBBS_NEIGHBORS; i++) {
-        xnbr = mri_labels->xi[x + xnbr_offset[i]];
-        ynbr = mri_labels->yi[y + ynbr_offset[i]];
-        znbr = mri_labels->zi[z + znbr_offset[i]];
-        nbr_label = nint(MRIgetVoxVal(mri_labels, xnbr, ynbr, znbr, 0));
-        for (j = 0; j < gc->nlabels[i]; j++) {
-          if (nbr_label == gc->labels[i][j]) {
-            break;
-          }
-        }
-        if (j < gc->nlabels[i]) {
-          if (!FZERO(gc->label_priors[i][j])) {
-            nbr_prior += log(gc->label_priors[i][j]);
-          }
-          else {
-            nbr_prior += log(0.1f / (float)gcan->total_training);
-          }
-          /*BIG_AND_NEGATIVE */
-          check_finite("GCAvoxelGibbsLogPosterior: label_priors", nbr_prior);
-        }
-        else /* never occurred - make it unlikely */
-        {
-          if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
-            DiagBreak();
-          }
-          nbr_prior += log(0.1f / (float)gcan->total_training);
-          /*BIG_AND_NEGATIVE*/
-        }
-      }
-    }
-// added to the previous value
-#if INTERP_PRIOR
-    prior = gcaComputePrior(gca, mri_inputs, transform, x, y, z, label);
-    log_posterior += (gibbs_coef * nbr_prior + log(prior));
-#else
-    log_posterior += (gibbs_coef * nbr_prior + log(getPrior(gcap, label)));
-#endif
-    if (check_finite("GCAvoxelGibbsLogPosterior: final", log_posterior) == 0) {
-      DiagBreak();
-    }
-  }
-  else {
-    return (10 * BIG_AND_NEGATIVE);
-    // return (log(VERY_UNLIKELY)) ;
-  }
-
-// just check
-#if 0
-  tmp = log(0.01f/((float) gcan->total_training*GIBBS_NEIGHBORS));
-  if (tmp > log_posterior)
-  {
-    printf("GCAvoxelLogPosterior: (%d, %d, %d)\n", x, y, z);
-    printf("label %s(%d) log_posterior %.2f is less"
-           " than no label found %.2f\n",
-           cma_label_to_name(label), label, log_posterior, tmp);
-  }
-#endif
-  return (log_posterior);
+  gcaGibbsVoxelLoad(gca, mri_labels, mri_inputs, x, y, z, transform, &gv);
+  return (gcaGibbsVoxelLogPosterior(gca, &gv, label, x, y, z, mri_inputs, transform, gibbs_coef));
 }
 // the posterior of an image given a segmentation without any MRF
 double GCAimagePosteriorLogProbability(GCA *gca, MRI *mri_labels, MRI *mri_inputs, TRANSFORM *transform)
@@ -14895,6 +15648,16 @@ int GCAfreeGibbs(GCA *gca)
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
         gcan = &gca->nodes[x][y][z];
+        // the gibbs arrays of a flat GCA node live in its mapping and pool
+        if (gcaFlatMapped(gca, gcan->labels)) {
+          for (n = 0; n < gcan->nlabels; n++) {
+            gc = &gcan->gcs[n];
+            gc->nlabels = NULL;
+            gc->labels = NULL;
+            gc->label_priors = NULL;
+          }
+          continue;
+        }
         for (n = 0; n < gcan->nlabels; n++) {
           gc = &gcan->gcs[n];
           for (i = 0; i < GIBBS_NEIGHBORS; i++) {
@@ -15335,10 +16098,12 @@ static MATRIX *load_sample_covariance_matrix(GCA_SAMPLE *gcas, MATRIX *m_cov, in
   return (m_cov);
 }
 
+// The scratch matrices below are per thread (not per omp thread number),
+// since the samples may be scored from inside a nested parallel region
 static double sample_covariance_determinant(GCA_SAMPLE *gcas, int ninputs)
 {
   double det;
-  static MATRIX *m_cov = NULL;
+  static __thread MATRIX *m_cov = NULL;
 
   if (ninputs == 1) {
     return (gcas->covars[0]);
@@ -15362,8 +16127,8 @@ static double GCAsampleMahDist_1_input(GCA_SAMPLE *gcas, float val)
 
 double GCAsampleMahDist(GCA_SAMPLE *gcas, float *vals, int ninputs)
 {
-  static VECTOR *v_means = NULL, *v_vals = NULL;
-  static MATRIX *m_cov = NULL, *m_cov_inv;
+  static __thread VECTOR *v_means = NULL, *v_vals = NULL;
+  static __thread MATRIX *m_cov = NULL, *m_cov_inv = NULL;
   int i;
   double dsq;
 
@@ -22083,6 +22848,11 @@ GCA *GCAcompactify(GCA *gca)
   int i, j, k;
   double byteSaved = 0.;
 
+  // a flat GCA is already compact, and its arrays are not ours to realloc
+  if (gca->flat_map) {
+    return gca;
+  }
+
   width = gca->prior_width;
   height = gca->prior_height;
   depth = gca->prior_depth;
@@ -26119,7 +26889,24 @@ int GCAinsertLabels(GCA *gca,
                 }
               }
               copy_gcs(gcan->nlabels, gcan->gcs, gcs, gca->ninputs);
-              free_gcs(gcan->gcs, gcan->nlabels, gca->ninputs);
+              // the arrays of a flat GCA node are in its mapping and pool, so the node gets private ones
+              if (!gcaFlatMapped(gca, gcan->labels)) {
+                free_gcs(gcan->gcs, gcan->nlabels, gca->ninputs);
+              }
+              if (gcaFlatMapped(gca, gcan->labels) || gcan->max_labels <= gcan->nlabels) {
+                unsigned short *labels = (unsigned short *)calloc(gcan->nlabels + 1, sizeof(unsigned short));
+                if (!labels) {
+                  ErrorExit(ERROR_NOMEMORY, "GCAinsertLabels: couldn't expand labels to %d", gcan->nlabels + 1);
+                }
+                if (gcan->nlabels > 0) {
+                  memmove(labels, gcan->labels, gcan->nlabels * sizeof(unsigned short));
+                }
+                if (!gcaFlatMapped(gca, gcan->labels)) {
+                  free(gcan->labels);
+                }
+                gcan->labels = labels;
+                gcan->max_labels = gcan->nlabels + 1;
+              }
               gc->ntraining = gcan->total_training;  // arbitrary
               gcan->total_training *= 2;
               gcan->gcs = gcs;
@@ -26137,6 +26924,18 @@ int GCAinsertLabels(GCA *gca,
             if (found == 0) {
               gcap = &gca->priors[xp][yp][zp];
               printf("inserting label %s at prior (%d, %d, %d)\n", cma_label_to_name(label), xp, yp, zp);
+              if (gcap->max_labels < 1) {
+                if (!gcaFlatMapped(gca, gcap->labels)) {
+                  free(gcap->labels);
+                  free(gcap->priors);
+                }
+                gcap->labels = (unsigned short *)calloc(1, sizeof(unsigned short));
+                gcap->priors = (float *)calloc(1, sizeof(float));
+                if (!gcap->labels || !gcap->priors) {
+                  ErrorExit(ERROR_NOMEMORY, "GCAinsertLabels: couldn't allocate prior at (%d, %d, %d)", xp, yp, zp);
+                }
+                gcap->max_labels = 1;
+              }
               gcap->nlabels = 1;
               gcap->priors[0] = 1.0;
               gcap->labels[0] = label;
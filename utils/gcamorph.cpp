@@ -1309,6 +1309,8 @@ GCA_MORPH *GCAMalloc(const int width, const int height, const int depth)
   gcam->depth = depth;
   gcam->spacing = 1; // may be changed by the user later
   gcam->type = GCAM_VOX;
+  ROMP_COUNT(morph_allocs, 1);
+  ROMP_COUNT(morph_alloc_bytes, (long)width * height * depth * sizeof(GCA_MORPH_NODE));
 
   gcam->nodes = (GCA_MORPH_NODE ***)calloc(width, sizeof(GCA_MORPH_NODE **));
   if (!gcam->nodes) {
@@ -6451,7 +6453,186 @@ int gcamLimitGradientMagnitude(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms, MRI *mri
   return (NO_ERROR);
 }
 
+#ifdef FASTER_gcamSmoothnessTerm
+static int gcamSmoothnessTerm_old(GCA_MORPH *gcam, const MRI *mri, const double l_smoothness);
+static int gcamSmoothnessTerm_planes(GCA_MORPH *gcam, const double l_smoothness);
+
+int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothness)
+{
+  static bool const do_compare = false;
+
+  if (DZERO(l_smoothness)) {
+    return (NO_ERROR);
+  }
+
+  if (do_compare) {
+    // run both on copies of the gradient and insist on identical results
+    GCA_MORPH *gcam_old = GCAMcopy(gcam, NULL);
+    int x, y, z;
+    gcamSmoothnessTerm_old(gcam_old, mri, l_smoothness);
+    gcamSmoothnessTerm_planes(gcam, l_smoothness);
+    for (x = 0; x < gcam->width; x++)
+      for (y = 0; y < gcam->height; y++)
+        for (z = 0; z < gcam->depth; z++) {
+          GMN const *o = &gcam_old->nodes[x][y][z], *n = &gcam->nodes[x][y][z];
+          if (o->dx != n->dx || o->dy != n->dy || o->dz != n->dz) {
+            fprintf(stderr, "%s:%d gcamSmoothnessTerm diff at (%d,%d,%d)\n", __FILE__, __LINE__, x, y, z);
+            exit(1);
+          }
+        }
+    GCAMfree(&gcam_old);
+    return (NO_ERROR);
+  }
+
+  return gcamSmoothnessTerm_planes(gcam, l_smoothness);
+}
+
+/*!
+  \fn static int gcamSmoothnessTerm_planes(GCA_MORPH *gcam, const double l_smoothness)
+  \brief Same result as gcamSmoothnessTerm_old(), but first gathers the node
+  displacements (x-origx etc.) and validity into dense, padded planes, one
+  per component, instead of walking the ~200 byte GMN records 27 times per
+  node. The padding replicates the border nodes, which is what clamping the
+  neighbor coordinates did. Each (x,y) column is then processed with the z
+  loop innermost, so the compiler can vectorize across nodes while every
+  node still sums its 26 neighbors in the original order.
+
+  The other gradient terms are left on the node records: the likelihood
+  and label terms read each node once and their time goes into sampling
+  the image and the atlas (the label term already accumulates its deltas
+  in an MRI), and the jacobian term is dominated by the exp() and vector
+  algebra of its eight tetrahedra per node in gcamJacobianTermAtNode().
+*/
+static int gcamSmoothnessTerm_planes(GCA_MORPH *gcam, const double l_smoothness)
+{
+  int const width = gcam->width, height = gcam->height, depth = gcam->depth;
+  int const pdepth = depth + 2, parea = (height + 2) * pdepth;
+  size_t const pvolume = (size_t)(width + 2) * parea;
+  int xm;
+
+#define PLANE_INDEX(XM, YM, ZM) ((size_t)((XM) + 1) * parea + ((YM) + 1) * pdepth + ((ZM) + 1))
+
+  double *vxs = (double *)malloc(pvolume * sizeof(double));
+  double *vys = (double *)malloc(pvolume * sizeof(double));
+  double *vzs = (double *)malloc(pvolume * sizeof(double));
+  char *valid = (char *)malloc(pvolume * sizeof(char));
+  if (!vxs || !vys || !vzs || !valid) {
+    ErrorExit(ERROR_NOMEMORY, "gcamSmoothnessTerm: could not allocate %d x %d x %d planes", width, height, depth);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) shared(gcam) schedule(static, 1)
+#endif
+  for (xm = -1; xm <= width; xm++) {
+    ROMP_PFLB_begin
+
+    int const xn = MIN(width - 1, MAX(0, xm));
+    int ym, zm;
+    for (ym = -1; ym <= height; ym++) {
+      int const yn = MIN(height - 1, MAX(0, ym));
+      GMN const *column = gcam->nodes[xn][yn];
+      for (zm = -1; zm <= depth; zm++) {
+        GMN const *gcamn = &column[MIN(depth - 1, MAX(0, zm))];
+        size_t const index = PLANE_INDEX(xm, ym, zm);
+        valid[index] = (gcamn->invalid != GCAM_POSITION_INVALID);
+        vxs[index] = gcamn->x - gcamn->origx;
+        vys[index] = gcamn->y - gcamn->origy;
+        vzs[index] = gcamn->z - gcamn->origz;
+      }
+    }
+
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  int x;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) shared(gcam, Gx, Gy, Gz) schedule(static, 1)
+#endif
+  for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
+
+    double *dxs = (double *)malloc(depth * sizeof(double));
+    double *dys = (double *)malloc(depth * sizeof(double));
+    double *dzs = (double *)malloc(depth * sizeof(double));
+    int *nums = (int *)malloc(depth * sizeof(int));
+    int y, z, xk, yk, zk;
+
+    for (y = 0; y < height; y++) {
+      size_t const center = PLANE_INDEX(x, y, 0);
+      double const *vx = &vxs[center], *vy = &vys[center], *vz = &vzs[center];
+
+      for (z = 0; z < depth; z++) {
+        dxs[z] = dys[z] = dzs[z] = 0.0;
+        nums[z] = 0;
+      }
+
+      for (xk = -1; xk <= 1; xk++) {
+        for (yk = -1; yk <= 1; yk++) {
+          for (zk = -1; zk <= 1; zk++) {
+            if (!zk && !yk && !xk) {
+              continue;
+            }
+            size_t const nbr = PLANE_INDEX(x + xk, y + yk, zk);
+            double const *vnx = &vxs[nbr], *vny = &vys[nbr], *vnz = &vzs[nbr];
+            char const *vn = &valid[nbr];
+            for (z = 0; z < depth; z++) {
+              if (vn[z]) {
+                dxs[z] += (vnx[z] - vx[z]);
+                dys[z] += (vny[z] - vy[z]);
+                dzs[z] += (vnz[z] - vz[z]);
+                nums[z]++;
+              }
+            }
+          }
+        }
+      }
+
+      GMN *column = gcam->nodes[x][y];
+      char const *vc = &valid[center];
+      for (z = 0; z < depth; z++) {
+        if (!vc[z]) {
+          continue;
+        }
+        double dx = dxs[z], dy = dys[z], dz = dzs[z];
+        if (nums[z]) {
+          dx = dx * l_smoothness / nums[z];
+          dy = dy * l_smoothness / nums[z];
+          dz = dz * l_smoothness / nums[z];
+        }
+        if (x == Gx && y == Gy && z == Gz) {
+          printf("l_smoo: node(%d,%d,%d): DX=(%2.2f,%2.2f,%2.2f)\n", x, y, z, dx, dy, dz);
+        }
+        column[z].dx += dx;
+        column[z].dy += dy;
+        column[z].dz += dz;
+      }
+    }
+
+    free(dxs);
+    free(dys);
+    free(dzs);
+    free(nums);
+
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+#undef PLANE_INDEX
+
+  free(vxs);
+  free(vys);
+  free(vzs);
+  free(valid);
+  return (NO_ERROR);
+}
+
+static int gcamSmoothnessTerm_old(GCA_MORPH *gcam, const MRI *mri, const double l_smoothness)
+#else
 int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothness)
+#endif
 {
   double vx = 0.0, vy = 0.0, vz = 0.0, vnx = 0.0, vny = 0.0, vnz = 0.0;
   double dx = 0.0, dy = 0.0, dz = 0.0;
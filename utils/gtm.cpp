@@ -55,6 +55,7 @@
 
 #include "romp_support.h"
 
+static void GTMfreeSegBB(GTM *gtm);
 
 /*------------------------------------------------------------------------------------*/
 int GTMSEGprint(GTMSEG *gtmseg, FILE *fp)
@@ -858,7 +859,8 @@ int GTMfree(GTM **pGTM)
   MRIfree(&gtm->yvol);
   // MRIfree(&gtm->gtmseg);
   MRIfree(&gtm->mask);
-  MatrixFree(&gtm->X);
+  GTMfreeX(gtm);
+  GTMfreeSegBB(gtm);
   MatrixFree(&gtm->y);
   MatrixFree(&gtm->XtX);
   MatrixFree(&gtm->iXtX);
@@ -966,19 +968,198 @@ int GTMnPad(GTM *gtm)
   return (0);
 }
 /*------------------------------------------------------------------*/
+/*
+  \fn int GTMfreeX(GTM *gtm)
+  \brief Frees the sparse X and X0 built by GTMbuildX().
+*/
+int GTMfreeX(GTM *gtm)
+{
+  int nthseg;
+
+  if (gtm->Xnnz == NULL) return (0);
+  for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+    free(gtm->Xrow[nthseg]);
+    free(gtm->Xval[nthseg]);
+    free(gtm->X0val[nthseg]);
+  }
+  free(gtm->Xnnz);
+  free(gtm->Xrow);
+  free(gtm->Xval);
+  free(gtm->X0val);
+  gtm->Xnnz = NULL;
+  gtm->Xrow = NULL;
+  gtm->Xval = NULL;
+  gtm->X0val = NULL;
+  return (0);
+}
+/*------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseAtB(GTM *gtm, float **Aval, float **Bval, MATRIX *AtB)
+  \brief Computes A'*B where A and B are X or X0 in the sparse form built by
+  GTMbuildX(), ie, Aval and Bval are gtm->Xval or gtm->X0val. Only rows where
+  both columns are non-zero are visited, in row order and in double, so the
+  result is the same as MatrixMtM(X) when Aval=Bval and as
+  MatrixMultiplyD(A',B) otherwise.
+*/
+MATRIX *GTMsparseAtB(GTM *gtm, float **Aval, float **Bval, MATRIX *AtB)
+{
+  int c1;
+
+  if (AtB == NULL) AtB = MatrixAlloc(gtm->nsegs, gtm->nsegs, MATRIX_REAL);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (c1 = 0; c1 < gtm->nsegs; c1++) {
+    ROMP_PFLB_begin
+    int c2, i, j, n1, n2, *r1, *r2;
+    float *x1, *x2;
+    double v;
+    n1 = gtm->Xnnz[c1];
+    r1 = gtm->Xrow[c1];
+    x1 = Aval[c1];
+    // A'A is symmetric, so only the upper triangle is computed
+    for (c2 = (Aval == Bval) ? c1 : 0; c2 < gtm->nsegs; c2++) {
+      n2 = gtm->Xnnz[c2];
+      r2 = gtm->Xrow[c2];
+      x2 = Bval[c2];
+      v = 0;
+      i = j = 0;
+      while (i < n1 && j < n2) {
+        if (r1[i] < r2[j])
+          i++;
+        else if (r1[i] > r2[j])
+          j++;
+        else {
+          v += (double)x1[i] * (double)x2[j];
+          i++;
+          j++;
+        }
+      }
+      AtB->rptr[c1 + 1][c2 + 1] = v;
+      if (Aval == Bval) AtB->rptr[c2 + 1][c1 + 1] = v;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (AtB);
+}
+/*------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMdenseX(GTM *gtm, float **val, MATRIX *X)
+  \brief Expands X (val=gtm->Xval) or X0 (val=gtm->X0val) into a dense
+  nmask x nsegs matrix, eg, to save it. Nothing in the GTM itself needs
+  the dense matrix.
+*/
+MATRIX *GTMdenseX(GTM *gtm, float **val, MATRIX *X)
+{
+  int nthseg, n;
+
+  if (X == NULL) X = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
+  if (X == NULL) {
+    printf("ERROR: GTMdenseX(): could not alloc %d %d\n", gtm->nmask, gtm->nsegs);
+    return (NULL);
+  }
+  MatrixClear(X);
+  for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
+    for (n = 0; n < gtm->Xnnz[nthseg]; n++) X->rptr[gtm->Xrow[nthseg][n] + 1][nthseg + 1] = val[nthseg][n];
+
+  return (X);
+}
+/*------------------------------------------------------------------*/
+/*
+  \fn static MATRIX *GTMsparseXty(GTM *gtm, MATRIX *y, MATRIX *Xty)
+  \brief Computes X'*y from the sparse columns of X. Same result as
+  MatrixAtB(X,y).
+*/
+static MATRIX *GTMsparseXty(GTM *gtm, MATRIX *y, MATRIX *Xty)
+{
+  int nthseg;
+
+  if (Xty == NULL) Xty = MatrixAlloc(gtm->nsegs, y->cols, MATRIX_REAL);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+    ROMP_PFLB_begin
+    int f, n;
+    double sum;
+    for (f = 0; f < y->cols; f++) {
+      sum = 0;
+      for (n = 0; n < gtm->Xnnz[nthseg]; n++)
+        sum += (double)gtm->Xval[nthseg][n] * y->rptr[gtm->Xrow[nthseg][n] + 1][f + 1];
+      Xty->rptr[nthseg + 1][f + 1] = sum;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (Xty);
+}
+/*------------------------------------------------------------------*/
+/*
+  \fn static MATRIX *GTMsparseXbeta(GTM *gtm, float **val, MATRIX *beta, MATRIX *yhat, int DoublePrec)
+  \brief Computes X*beta (val=gtm->Xval) or X0*beta (val=gtm->X0val) from
+  the sparse columns. Each element is accumulated over the columns in
+  order, in double if DoublePrec and in float otherwise, so the result is
+  the same as MatrixMultiplyD() or MatrixMultiply() of the dense matrix.
+*/
+static MATRIX *GTMsparseXbeta(GTM *gtm, float **val, MATRIX *beta, MATRIX *yhat, int DoublePrec)
+{
+  int f;
+
+  if (yhat == NULL) yhat = MatrixAlloc(gtm->nmask, beta->cols, MATRIX_REAL);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (f = 0; f < beta->cols; f++) {
+    ROMP_PFLB_begin
+    int nthseg, n, k;
+    if (DoublePrec) {
+      double b, *sum = (double *)calloc(gtm->nmask, sizeof(double));
+      for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+      b = beta->rptr[nthseg + 1][f + 1];
+      for (n = 0; n < gtm->Xnnz[nthseg]; n++) sum[gtm->Xrow[nthseg][n]] += (double)val[nthseg][n] * b;
+    }
+    for (k = 0; k < gtm->nmask; k++) yhat->rptr[k + 1][f + 1] = sum[k];
+    free(sum);
+    }
+    else {
+    float b, *sum = (float *)calloc(gtm->nmask, sizeof(float));
+    for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+      b = beta->rptr[nthseg + 1][f + 1];
+      for (n = 0; n < gtm->Xnnz[nthseg]; n++) sum[gtm->Xrow[nthseg][n]] += val[nthseg][n] * b;
+    }
+    for (k = 0; k < gtm->nmask; k++) yhat->rptr[k + 1][f + 1] = sum[k];
+    free(sum);
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (yhat);
+}
+/*------------------------------------------------------------------*/
 /*
   \fn int GTMsolve(GTM *gtm)
   \brief Solves the GTM using a GLM. X must already have been created.
   Computes Xt, XtX, iXtX, beta, yhat, res, dof, rvar, kurtosis, and skew.
   Also will rescale if rescaling. Returns 1 and computes condition
-  number if matrix cannot be inverted. Otherwise returns 0.
+  number if matrix cannot be inverted. Otherwise returns 0. Uses the
+  sparse X from GTMbuildX().
 */
 int GTMsolve(GTM *gtm)
 {
   int n, f;
   double sum;
 
-  if (gtm->X == NULL) {
+  if (gtm->Xnnz == NULL) {
     printf("ERROR: GTMsolve(): must build design matrix first\n");
     exit(1);
   }
@@ -986,7 +1167,7 @@ int GTMsolve(GTM *gtm)
   if (!gtm->Optimizing) printf("Computing  XtX ... ");
   fflush(stdout);
   Timer timer;
-  gtm->XtX = MatrixMtM(gtm->X, gtm->XtX);
+  gtm->XtX = GTMsparseAtB(gtm, gtm->Xval, gtm->Xval, gtm->XtX);
   if (!gtm->Optimizing) printf(" %4.1f sec\n", timer.seconds());
   fflush(stdout);
 
@@ -997,15 +1178,15 @@ int GTMsolve(GTM *gtm)
     printf("ERROR: matrix cannot be inverted, cond=%g\n", gtm->XtXcond);
     return (1);
   }
-  gtm->Xty = MatrixAtB(gtm->X, gtm->y, gtm->Xty);
+  gtm->Xty = GTMsparseXty(gtm, gtm->y, gtm->Xty);
   gtm->beta = MatrixMultiplyD(gtm->iXtX, gtm->Xty, gtm->beta);
   if (gtm->rescale) GTMrescale(gtm);
   GTMrefTAC(gtm);
   if (gtm->DoSteadyState) GTMsteadyState(gtm);
 
-  gtm->yhat = MatrixMultiplyD(gtm->X, gtm->beta, gtm->yhat);
+  gtm->yhat = GTMsparseXbeta(gtm, gtm->Xval, gtm->beta, gtm->yhat, 1);
   gtm->res = MatrixSubtract(gtm->y, gtm->yhat, gtm->res);
-  gtm->dof = gtm->X->rows - gtm->X->cols;
+  gtm->dof = gtm->nmask - gtm->nsegs;
   if (gtm->rvar == NULL) gtm->rvar = MatrixAlloc(1, gtm->res->cols, MATRIX_REAL);
   if (gtm->rvarUnscaled == NULL) gtm->rvarUnscaled = MatrixAlloc(1, gtm->res->cols, MATRIX_REAL);
   for (f = 0; f < gtm->res->cols; f++) {
@@ -1013,9 +1194,9 @@ int GTMsolve(GTM *gtm)
     for (n = 0; n < gtm->res->rows; n++) sum += ((double)gtm->res->rptr[n + 1][f + 1] * gtm->res->rptr[n + 1][f + 1]);
     gtm->rvar->rptr[1][f + 1] = sum / gtm->dof;
     if (gtm->rescale)
-      gtm->rvarUnscaled->rptr[1][f + 1] = gtm->rvar->rptr[1][f + 1] / (gtm->scale * gtm->scale);
+    gtm->rvarUnscaled->rptr[1][f + 1] = gtm->rvar->rptr[1][f + 1] / (gtm->scale * gtm->scale);
     else
-      gtm->rvarUnscaled->rptr[1][f + 1] = gtm->rvar->rptr[1][f + 1];
+    gtm->rvarUnscaled->rptr[1][f + 1] = gtm->rvar->rptr[1][f + 1];
   }
   gtm->kurtosis = MatrixKurtosis(gtm->res, gtm->kurtosis);
   gtm->skew = MatrixSkew(gtm->res, gtm->skew);
@@ -1049,11 +1230,11 @@ MRI *GTMmat2vol(GTM *gtm, MATRIX *m, MRI *vol)
   k = 0;
   for (s = 0; s < gtm->yvol->depth; s++) {
     for (c = 0; c < gtm->yvol->width; c++) {
-      for (r = 0; r < gtm->yvol->height; r++) {
-        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
-        for (f = 0; f < m->cols; f++) MRIsetVoxVal(vol, c, r, s, f, m->rptr[k + 1][f + 1]);
-        k++;
-      }
+    for (r = 0; r < gtm->yvol->height; r++) {
+      if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
+      for (f = 0; f < m->cols; f++) MRIsetVoxVal(vol, c, r, s, f, m->rptr[k + 1][f + 1]);
+      k++;
+    }
     }
   }
   return (vol);
@@ -1074,8 +1255,8 @@ MATRIX *GTMvol2mat(GTM *gtm, MRI *vol, MATRIX *m)
   if (m == NULL) {
     m = MatrixAlloc(gtm->nmask, vol->nframes, MATRIX_REAL);
     if (m == NULL) {
-      printf("ERROR: GTMvol2mat(): could not alloc matrix %d %d\n", gtm->nmask, vol->nframes);
-      return (NULL);
+    printf("ERROR: GTMvol2mat(): could not alloc matrix %d %d\n", gtm->nmask, vol->nframes);
+    return (NULL);
     }
   }
   if (m->rows != gtm->nmask) {
@@ -1090,11 +1271,11 @@ MATRIX *GTMvol2mat(GTM *gtm, MRI *vol, MATRIX *m)
   k = 0;
   for (s = 0; s < vol->depth; s++) {  // crs order is important here!
     for (c = 0; c < vol->width; c++) {
-      for (r = 0; r < vol->height; r++) {
-        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
-        for (f = 0; f < vol->nframes; f++) m->rptr[k + 1][f + 1] = MRIgetVoxVal(vol, c, r, s, f);
-        k++;
-      }
+    for (r = 0; r < vol->height; r++) {
+      if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
+      for (f = 0; f < vol->nframes; f++) m->rptr[k + 1][f + 1] = MRIgetVoxVal(vol, c, r, s, f);
+      k++;
+    }
     }
   }
   return (m);
@@ -1117,27 +1298,27 @@ int GTMsegrvar(GTM *gtm)
   k = 0;
   for (s = 0; s < gtm->yvol->depth; s++) {
     for (c = 0; c < gtm->yvol->width; c++) {
-      for (r = 0; r < gtm->yvol->height; r++) {
-        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
-        segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
-        if (segid != 0) {
-          for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
-            if (gtm->segidlist[nthseg] == segid) break;
-          gtm->nperseg[nthseg]++;
-        }
-        for (f = 0; f < gtm->beta->cols; f++) {
-          v = gtm->res->rptr[k + 1][f + 1];
-          if (segid != 0) gtm->segrvar->rptr[nthseg + 1][f + 1] += v * v;
-        }
-        k++;
-      }  // r
+    for (r = 0; r < gtm->yvol->height; r++) {
+      if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
+      segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
+      if (segid != 0) {
+        for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
+          if (gtm->segidlist[nthseg] == segid) break;
+        gtm->nperseg[nthseg]++;
+      }
+      for (f = 0; f < gtm->beta->cols; f++) {
+        v = gtm->res->rptr[k + 1][f + 1];
+        if (segid != 0) gtm->segrvar->rptr[nthseg + 1][f + 1] += v * v;
+      }
+      k++;
+    }  // r
     }    // c
   }      // s
 
   for (f = 0; f < gtm->beta->cols; f++) {
     for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
-      v = gtm->segrvar->rptr[nthseg + 1][f + 1];
-      gtm->segrvar->rptr[nthseg + 1][f + 1] = v / gtm->nperseg[nthseg];
+    v = gtm->segrvar->rptr[nthseg + 1][f + 1];
+    gtm->segrvar->rptr[nthseg + 1][f + 1] = v / gtm->nperseg[nthseg];
     }
   }
   return (0);
@@ -1183,11 +1364,11 @@ int GTMrbv(GTM *gtm)
     int n, nReplace, ReplaceThis[1000], WithThat[1000];
     nReplace = 0;
     for (n = 0; n < gtm->ctGTMSeg->nentries; n++) {
-      if (gtm->ctGTMSeg->entries[n] == NULL) continue;
-      if (gtm->ctGTMSeg->entries[n]->TissueType != 5) continue;  // should not hard-code
-      ReplaceThis[nReplace] = n;
-      WithThat[nReplace] = 0;
-      nReplace++;
+    if (gtm->ctGTMSeg->entries[n] == NULL) continue;
+    if (gtm->ctGTMSeg->entries[n]->TissueType != 5) continue;  // should not hard-code
+    ReplaceThis[nReplace] = n;
+    WithThat[nReplace] = 0;
+    nReplace++;
     }
     printf("  replacing head voxels with 0\n");
     gtm->rbvsegmasked = MRIreplaceList(gtm->rbvseg, ReplaceThis, WithThat, nReplace, NULL, NULL);
@@ -1207,11 +1388,11 @@ int GTMrbv(GTM *gtm)
   // MRIwrite(gtm->rbvsegmasked,"segbrain.mgh");
 
   printf("   Allocating RBV nvox=%d\n",
-         gtm->rbvsegmasked->width * gtm->rbvsegmasked->height * gtm->rbvsegmasked->depth * gtm->nframes);
+       gtm->rbvsegmasked->width * gtm->rbvsegmasked->height * gtm->rbvsegmasked->depth * gtm->nframes);
   fflush(stdout);
   if (Gdiag_no > 0) PrintMemUsage(stdout);
   gtm->rbv = MRIallocSequence(
-      gtm->rbvsegmasked->width, gtm->rbvsegmasked->height, gtm->rbvsegmasked->depth, MRI_FLOAT, gtm->nframes);
+    gtm->rbvsegmasked->width, gtm->rbvsegmasked->height, gtm->rbvsegmasked->depth, MRI_FLOAT, gtm->nframes);
   if (gtm->rbv == NULL) {
     printf("ERROR: GTMrbv() could not alloc rbv\n");
     return (1);
@@ -1245,8 +1426,8 @@ int GTMrbv(GTM *gtm)
     if (Gdiag_no > 0) PrintMemUsage(stdout);
     yhat0seg = GTMsegSynth(gtm, f, yhat0seg);
     if (yhat0seg == NULL) {
-      printf("ERROR: GTMrbv() could not synthesize yhat0seg\n");
-      return (1);
+    printf("ERROR: GTMrbv() could not synthesize yhat0seg\n");
+    return (1);
     }
 
     printf("   Smoothing synthesized in seg space %4.2f \n", mytimer.minutes());
@@ -1254,8 +1435,8 @@ int GTMrbv(GTM *gtm)
     if (Gdiag_no > 0) PrintMemUsage(stdout);
     yhatseg = MRIgaussianSmoothNI(yhat0seg, gtm->cStd, gtm->rStd, gtm->sStd, yhatseg);
     if (yhatseg == NULL) {
-      printf("ERROR: GTMrbv() could not smooth yhatseg\n");
-      return (1);
+    printf("ERROR: GTMrbv() could not smooth yhatseg\n");
+    return (1);
     }
 
     printf("   Sampling input to seg space with trilin %4.2f \n", mytimer.minutes());
@@ -1271,36 +1452,36 @@ int GTMrbv(GTM *gtm)
     if (Gdiag_no > 0) PrintMemUsage(stdout);
     nhits = MatrixAlloc(gtm->beta->rows, 1, MATRIX_REAL);
     for (c = 0; c < gtm->rbvseg->width; c++) {  // crs order not important
-      for (r = 0; r < gtm->rbvseg->height; r++) {
-        for (s = 0; s < gtm->rbvseg->depth; s++) {
-          segid = MRIgetVoxVal(gtm->rbvseg, c, r, s, 0);
-          if (segid < 0.5) continue;
-
-          if (gtm->mask_rbv_to_brain) {
-            if (c < region->x || c >= region->x + region->dx) continue;
-            if (r < region->y || r >= region->y + region->dy) continue;
-            if (s < region->z || s >= region->z + region->dz) continue;
-          }
+    for (r = 0; r < gtm->rbvseg->height; r++) {
+      for (s = 0; s < gtm->rbvseg->depth; s++) {
+        segid = MRIgetVoxVal(gtm->rbvseg, c, r, s, 0);
+        if (segid < 0.5) continue;
 
-          for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
-            if (gtm->segidlist[nthseg] == segid) break;
-          if (f == 0) nhits->rptr[nthseg + 1][1]++;
-
-          v = MRIgetVoxVal(yseg, c, r, s, 0);
-          vhat0 = MRIgetVoxVal(yhat0seg, c, r, s, 0);
-          vhat = MRIgetVoxVal(yhatseg, c, r, s, 0);
-          val = v * vhat0 / (vhat + FLT_EPSILON);  // RBV equation
-          if (gtm->mask_rbv_to_brain)
-            MRIsetVoxVal(gtm->rbv, c - region->x, r - region->y, s - region->z, f, val);
-          else
-            MRIsetVoxVal(gtm->rbv, c, r, s, f, val);
-
-          // track seg means for QA. Head Segs won't reflect QA if masking
-          v2 = MRIgetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f);
-          MRIsetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f, v2 + val);
+        if (gtm->mask_rbv_to_brain) {
+          if (c < region->x || c >= region->x + region->dx) continue;
+          if (r < region->y || r >= region->y + region->dy) continue;
+          if (s < region->z || s >= region->z + region->dz) continue;
         }
+
+        for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
+          if (gtm->segidlist[nthseg] == segid) break;
+        if (f == 0) nhits->rptr[nthseg + 1][1]++;
+
+        v = MRIgetVoxVal(yseg, c, r, s, 0);
+        vhat0 = MRIgetVoxVal(yhat0seg, c, r, s, 0);
+        vhat = MRIgetVoxVal(yhatseg, c, r, s, 0);
+        val = v * vhat0 / (vhat + FLT_EPSILON);  // RBV equation
+        if (gtm->mask_rbv_to_brain)
+          MRIsetVoxVal(gtm->rbv, c - region->x, r - region->y, s - region->z, f, val);
+        else
+          MRIsetVoxVal(gtm->rbv, c, r, s, f, val);
+
+        // track seg means for QA. Head Segs won't reflect QA if masking
+        v2 = MRIgetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f);
+        MRIsetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f, v2 + val);
       }
     }
+    }
   }
   if (Gdiag_no > 0) PrintMemUsage(stdout);
   printf("  t = %4.2f min\n", mytimer.minutes());
@@ -1314,8 +1495,8 @@ int GTMrbv(GTM *gtm)
   // track seg means for QA
   for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
     for (f = 0; f < gtm->nframes; f++) {
-      val = MRIgetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f) / nhits->rptr[nthseg + 1][1];
-      MRIsetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f, val);
+    val = MRIgetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f) / nhits->rptr[nthseg + 1][1];
+    MRIsetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f, val);
     }
   }
   MatrixFree(&nhits);
@@ -1406,7 +1587,7 @@ int GTMrbv0(GTM *gtm)
   fflush(stdout);
   if (Gdiag_no > 0) PrintMemUsage(stdout);
   yseg =
-      MRIallocSequence(gtm->anatseg->width, gtm->anatseg->height, gtm->anatseg->depth, MRI_FLOAT, gtm->yvol->nframes);
+    MRIallocSequence(gtm->anatseg->width, gtm->anatseg->height, gtm->anatseg->depth, MRI_FLOAT, gtm->yvol->nframes);
   if (yseg == NULL) {
     printf("ERROR: GTMrbv0() could not alloc yseg\n");
     return (1);
@@ -1426,7 +1607,7 @@ int GTMrbv0(GTM *gtm)
   fflush(stdout);
   if (Gdiag_no > 0) PrintMemUsage(stdout);
   gtm->rbv =
-      MRIallocSequence(gtm->anatseg->width, gtm->anatseg->height, gtm->anatseg->depth, MRI_FLOAT, gtm->yvol->nframes);
+    MRIallocSequence(gtm->anatseg->width, gtm->anatseg->height, gtm->anatseg->depth, MRI_FLOAT, gtm->yvol->nframes);
   if (gtm->rbv == NULL) {
     printf("ERROR: GTMrbv0() could not alloc rbv\n");
     return (1);
@@ -1439,23 +1620,23 @@ int GTMrbv0(GTM *gtm)
   nhits = MatrixAlloc(gtm->beta->rows, 1, MATRIX_REAL);
   for (s = 0; s < gtm->anatseg->depth; s++) {  // crs order not important
     for (c = 0; c < gtm->anatseg->width; c++) {
-      for (r = 0; r < gtm->anatseg->height; r++) {
-        segid = MRIgetVoxVal(gtm->anatseg, c, r, s, 0);
-        if (segid < 0.5) continue;
-        for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
-          if (gtm->segidlist[nthseg] == segid) break;
-        nhits->rptr[nthseg + 1][1]++;
-        for (f = 0; f < gtm->yvol->nframes; f++) {
-          v = MRIgetVoxVal(yseg, c, r, s, f);
-          vhat0 = MRIgetVoxVal(yhat0seg, c, r, s, f);
-          vhat = MRIgetVoxVal(yhatseg, c, r, s, f);
-          val = v * vhat0 / (vhat + FLT_EPSILON);  // RBV equation
-          MRIsetVoxVal(gtm->rbv, c, r, s, f, val);
-          v2 = MRIgetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f);  // track seg means for QA
-          MRIsetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f, v2 + val);
-        }
+    for (r = 0; r < gtm->anatseg->height; r++) {
+      segid = MRIgetVoxVal(gtm->anatseg, c, r, s, 0);
+      if (segid < 0.5) continue;
+      for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
+        if (gtm->segidlist[nthseg] == segid) break;
+      nhits->rptr[nthseg + 1][1]++;
+      for (f = 0; f < gtm->yvol->nframes; f++) {
+        v = MRIgetVoxVal(yseg, c, r, s, f);
+        vhat0 = MRIgetVoxVal(yhat0seg, c, r, s, f);
+        vhat = MRIgetVoxVal(yhatseg, c, r, s, f);
+        val = v * vhat0 / (vhat + FLT_EPSILON);  // RBV equation
+        MRIsetVoxVal(gtm->rbv, c, r, s, f, val);
+        v2 = MRIgetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f);  // track seg means for QA
+        MRIsetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f, v2 + val);
       }
     }
+    }
   }
   if (Gdiag_no > 0) PrintMemUsage(stdout);
   MRIfree(&yseg);
@@ -1467,8 +1648,8 @@ int GTMrbv0(GTM *gtm)
   // track seg means for QA
   for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
     for (f = 0; f < gtm->yvol->nframes; f++) {
-      val = MRIgetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f) / nhits->rptr[nthseg + 1][1];
-      MRIsetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f, val);
+    val = MRIgetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f) / nhits->rptr[nthseg + 1][1];
+    MRIsetVoxVal(gtm->rbvsegmean, nthseg, 0, 0, f, val);
     }
   }
   MatrixFree(&nhits);
@@ -1484,11 +1665,11 @@ int GTMrbv0(GTM *gtm)
     MRI_REGION *region;
     nReplace = 0;
     for (n = 0; n < gtm->ctGTMSeg->nentries; n++) {
-      if (gtm->ctGTMSeg->entries[n] == NULL) continue;
-      if (gtm->ctGTMSeg->entries[n]->TissueType != 5) continue;  // should not hard-code
-      ReplaceThis[nReplace] = n;
-      WithThat[nReplace] = 0;
-      nReplace++;
+    if (gtm->ctGTMSeg->entries[n] == NULL) continue;
+    if (gtm->ctGTMSeg->entries[n]->TissueType != 5) continue;  // should not hard-code
+    ReplaceThis[nReplace] = n;
+    WithThat[nReplace] = 0;
+    nReplace++;
     }
     printf("  replacing head voxels with 0\n");
     segtmp = MRIreplaceList(gtm->anatseg, ReplaceThis, WithThat, nReplace, NULL, NULL);
@@ -1527,9 +1708,9 @@ int GTMrbv0(GTM *gtm)
  */
 MRI *GTMmgxpvc(GTM *gtm, int Target)
 {
-  int nthseg, segid, r, f, tt;
+  int nthseg, segid, r, f, tt, n;
   MATRIX *betaNotTarg, *yNotTarg, *ydiff;
-  double sum;
+  double *sum;
   MRI *mgx=NULL;
   COLOR_TABLE_ENTRY *cte;
   //COLOR_TABLE *ttctab = gtm->ctGTMSeg->ctabTissueType;
@@ -1541,15 +1722,15 @@ MRI *GTMmgxpvc(GTM *gtm, int Target)
     tt = gtm->ctGTMSeg->entries[segid]->TissueType;
     cte = gtm->ctGTMSeg->ctabTissueType->entries[tt];
     if(Target == 1 || Target == 3){
-      if(strcmp("cortex",cte->name)==0) continue;
-      if(strcmp("cortex-lh",cte->name)==0) continue;
-      if(strcmp("cortex-rh",cte->name)==0) continue;
+    if(strcmp("cortex",cte->name)==0) continue;
+    if(strcmp("cortex-lh",cte->name)==0) continue;
+    if(strcmp("cortex-rh",cte->name)==0) continue;
     }
     if(Target == 2 || Target == 3){
-      if(strcmp("subcort_gm",cte->name)==0) continue;
-      if(strcmp("subcort_gm-lh",cte->name)==0) continue;
-      if(strcmp("subcort_gm-rh",cte->name)==0) continue;
-      if(strcmp("subcort_gm-mid",cte->name)==0) continue;
+    if(strcmp("subcort_gm",cte->name)==0) continue;
+    if(strcmp("subcort_gm-lh",cte->name)==0) continue;
+    if(strcmp("subcort_gm-rh",cte->name)==0) continue;
+    if(strcmp("subcort_gm-mid",cte->name)==0) continue;
     }
     if(Target == 4 && strcmp("cortex-lh",cte->name)==0) continue;
     if(Target == 5 && strcmp("cortex-rh",cte->name)==0) continue;
@@ -1561,50 +1742,54 @@ MRI *GTMmgxpvc(GTM *gtm, int Target)
   }
 
   // Compute the estimate of the image without the target
-  yNotTarg = MatrixMultiplyD(gtm->X, betaNotTarg, NULL);
+  yNotTarg = GTMsparseXbeta(gtm, gtm->Xval, betaNotTarg, NULL, 1);
   // Subtract to resdiualize the PET wrt the non-target tissue
   ydiff = MatrixSubtract(gtm->y, yNotTarg, NULL);
 
-  // Scale by the fraction of target tissue type in voxel
-  for (r = 0; r < gtm->X->rows; r++) {
-    sum = 0;
-    for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
-      segid = gtm->segidlist[nthseg];
-      tt = gtm->ctGTMSeg->entries[segid]->TissueType;
-      cte = gtm->ctGTMSeg->ctabTissueType->entries[tt];
-      if(Target == 1){ // asking for cortex
-	if(strcmp("cortex",cte->name)!=0 &&
-	   strcmp("cortex-lh",cte->name)!=0 &&
-	   strcmp("cortex-rh",cte->name)!=0) continue; // but this is not cortex
-      }
-      if(Target == 2){ // asking for subcort
-	if(strcmp("subcort_gm",cte->name)!=0 && 
-	   strcmp("subcort_gm-lh",cte->name)!=0 &&
-	   strcmp("subcort_gm-rh",cte->name)!=0) continue; // but this is not subcort
-      }
-      if(Target == 3){ // asking for any GM
-	if(strcmp("cortex",cte->name)!=0 &&
-	   strcmp("cortex-lh",cte->name)!=0 &&
-	   strcmp("cortex-rh",cte->name)!=0 &&
-	   strcmp("subcort_gm",cte->name)!=0 &&
-	   strcmp("subcort_gm-lh",cte->name)!=0 &&
-	   strcmp("subcort_gm-rh",cte->name)!=0 &&
-	   strcmp("subcort_gm-mid",cte->name)!=0) continue; // but this is not GM
-      }
-      if(Target == 4 && strcmp("cortex-lh",cte->name)!=0) continue;
-      if(Target == 5 && strcmp("cortex-rh",cte->name)!=0) continue;
-      if(Target == 6 && strcmp("subcort_gm-lh",cte->name)!=0) continue;
-      if(Target == 7 && strcmp("subcort_gm-rh",cte->name)!=0) continue;
-      if(Target == 8 && strcmp("subcort_gm-mid",cte->name)!=0) continue;
+  // Fraction of target tissue type in each voxel, summed over the target
+  // segs in seg order
+  sum = (double *)calloc(gtm->nmask, sizeof(double));
+  for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+    segid = gtm->segidlist[nthseg];
+    tt = gtm->ctGTMSeg->entries[segid]->TissueType;
+    cte = gtm->ctGTMSeg->ctabTissueType->entries[tt];
+    if(Target == 1){ // asking for cortex
+      if(strcmp("cortex",cte->name)!=0 &&
+         strcmp("cortex-lh",cte->name)!=0 &&
+         strcmp("cortex-rh",cte->name)!=0) continue; // but this is not cortex
+    }
+    if(Target == 2){ // asking for subcort
+      if(strcmp("subcort_gm",cte->name)!=0 && 
+         strcmp("subcort_gm-lh",cte->name)!=0 &&
+         strcmp("subcort_gm-rh",cte->name)!=0) continue; // but this is not subcort
+    }
+    if(Target == 3){ // asking for any GM
+      if(strcmp("cortex",cte->name)!=0 &&
+         strcmp("cortex-lh",cte->name)!=0 &&
+         strcmp("cortex-rh",cte->name)!=0 &&
+         strcmp("subcort_gm",cte->name)!=0 &&
+         strcmp("subcort_gm-lh",cte->name)!=0 &&
+         strcmp("subcort_gm-rh",cte->name)!=0 &&
+         strcmp("subcort_gm-mid",cte->name)!=0) continue; // but this is not GM
+    }
+    if(Target == 4 && strcmp("cortex-lh",cte->name)!=0) continue;
+    if(Target == 5 && strcmp("cortex-rh",cte->name)!=0) continue;
+    if(Target == 6 && strcmp("subcort_gm-lh",cte->name)!=0) continue;
+    if(Target == 7 && strcmp("subcort_gm-rh",cte->name)!=0) continue;
+    if(Target == 8 && strcmp("subcort_gm-mid",cte->name)!=0) continue;
 
-      // otherwise
-      sum += gtm->X->rptr[r+1][nthseg+1];
-    }
-    if (sum < gtm->mgx_gmthresh)
+    // otherwise
+    for (n = 0; n < gtm->Xnnz[nthseg]; n++) sum[gtm->Xrow[nthseg][n]] += gtm->Xval[nthseg][n];
+  }
+
+  // Scale by the fraction of target tissue type in voxel
+  for (r = 0; r < gtm->nmask; r++) {
+    if (sum[r] < gtm->mgx_gmthresh)
       for (f = 0; f < gtm->nframes; f++) ydiff->rptr[r + 1][f + 1] = 0;
     else
-      for (f = 0; f < gtm->nframes; f++) ydiff->rptr[r + 1][f + 1] /= sum;
+      for (f = 0; f < gtm->nframes; f++) ydiff->rptr[r + 1][f + 1] /= sum[r];
   }
+  free(sum);
 
   mgx = GTMmat2vol(gtm, ydiff, NULL);
 
@@ -1823,6 +2008,10 @@ int GTMsynth(GTM *gtm, int NoiseSeed, int nReps)
   MATRIX *yhat;
   MRI *mritmp;
 
+  if (gtm->Xnnz == NULL || (gtm->nsegs > 0 && gtm->X0val[0] == NULL)) {
+    printf("ERROR: GTMsynth(): X0 has not been built\n");
+    return (1);
+  }
   if (gtm->ysynth) MRIfree(&gtm->ysynth);
   gtm->ysynth =
       MRIallocSequence(gtm->gtmseg->width, gtm->gtmseg->height, gtm->gtmseg->depth, MRI_FLOAT, gtm->beta->cols);
@@ -1830,7 +2019,7 @@ int GTMsynth(GTM *gtm, int NoiseSeed, int nReps)
     MRIcopyHeader(gtm->yvol, gtm->ysynth);
     MRIcopyPulseParameters(gtm->yvol, gtm->ysynth);
   }
-  yhat = MatrixMultiply(gtm->X0, gtm->beta, NULL);
+  yhat = GTMsparseXbeta(gtm, gtm->X0val, gtm->beta, NULL, 0);
   GTMmat2vol(gtm, yhat, gtm->ysynth);
   MatrixFree(&yhat);
 
@@ -1906,34 +2095,61 @@ int GTMcheckX(MATRIX *X)
 }
 /*------------------------------------------------------------------------------*/
 /*
-  \fn int GTMbuildX(GTM *gtm)
-  \brief Builds the GTM design matrix both with (X) and without (X0) PSF.  If
-  gtm->DoVoxFracCor=1 then corrects for volume fraction effect.
+  \fn static void GTMfreeSegBB(GTM *gtm)
+  \brief Frees the per-seg bounding box PVFs and the voxel-to-row map
+  used by GTMbuildX().
 */
-int GTMbuildX(GTM *gtm)
+static void GTMfreeSegBB(GTM *gtm)
 {
-  int nthseg, err;
-
-  if (gtm->X == NULL || gtm->X->rows != gtm->nmask || gtm->X->cols != gtm->nsegs) {
-    // Alloc or realloc X
-    if (gtm->X) MatrixFree(&gtm->X);
-    gtm->X = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
-    if (gtm->X == NULL) {
-      printf("ERROR: GTMbuildX(): could not alloc X %d %d\n", gtm->nmask, gtm->nsegs);
-      return (1);
+  int nthseg;
+  if (gtm->segpvfbb) {
+    for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+      if (gtm->segpvfbb[nthseg]) MRIfree(&gtm->segpvfbb[nthseg]);
+      if (gtm->segbbregion[nthseg]) free(gtm->segbbregion[nthseg]);
     }
+    free(gtm->segpvfbb);
+    free(gtm->segbbregion);
+    gtm->segpvfbb = NULL;
+    gtm->segbbregion = NULL;
   }
-  if (gtm->X0 == NULL || gtm->X0->rows != gtm->nmask || gtm->X0->cols != gtm->nsegs) {
-    if (gtm->X0) MatrixFree(&gtm->X0);
-    gtm->X0 = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
-    if (gtm->X0 == NULL) {
-      printf("ERROR: GTMbuildX(): could not alloc X0 %d %d\n", gtm->nmask, gtm->nsegs);
-      return (1);
+  if (gtm->vox2row) free(gtm->vox2row);
+  gtm->vox2row = NULL;
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn static int GTMbuildSegBB(GTM *gtm)
+  \brief Extracts the PVF (or binary mask if not DoVoxFracCor) of each
+  seg in its bounding box padded by nPad, and computes the row of X for
+  each voxel in the mask. None of this depends on the PSF, so it is
+  kept while optimizing the PSF. Returns the number of segs that
+  could not be extracted.
+*/
+static int GTMbuildSegBB(GTM *gtm)
+{
+  int nthseg, c, r, s, k, err;
+
+  GTMfreeSegBB(gtm);
+  gtm->segpvfbb = (MRI **)calloc(gtm->nsegs, sizeof(MRI *));
+  gtm->segbbregion = (MRI_REGION **)calloc(gtm->nsegs, sizeof(MRI_REGION *));
+  gtm->segbbnPad = gtm->nPad;
+  gtm->segbbVoxFracCor = gtm->DoVoxFracCor;
+
+  // Same order as GTMvol2mat()
+  gtm->vox2row = (int *)calloc((size_t)gtm->yvol->width * gtm->yvol->height * gtm->yvol->depth, sizeof(int));
+  k = 0;
+  for (s = 0; s < gtm->yvol->depth; s++) {
+    for (c = 0; c < gtm->yvol->width; c++) {
+      for (r = 0; r < gtm->yvol->height; r++) {
+        size_t v = c + (size_t)r * gtm->yvol->width + (size_t)s * gtm->yvol->width * gtm->yvol->height;
+        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) {
+          gtm->vox2row[v] = -1;
+          continue;
+        }
+        gtm->vox2row[v] = k;
+        k++;
+      }
     }
   }
-  gtm->dof = gtm->X->rows - gtm->X->cols;
-
-  Timer timer;
 
   err = 0;
   ROMP_PF_begin
@@ -1942,11 +2158,10 @@ int GTMbuildX(GTM *gtm)
 #endif
   for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
     ROMP_PFLB_begin
-    
-    int segid, k, c, r, s;
-    MRI *nthsegpvf = NULL, *nthsegpvfbb = NULL, *nthsegpvfbbsm = NULL, *nthsegpvfbbsmmb = NULL;
+
+    int segid;
+    MRI *nthsegpvf = NULL;
     MRI_REGION *region;
-    MB2D *mb;
     segid = gtm->segidlist[nthseg];
     if (gtm->DoVoxFracCor)
       nthsegpvf = fMRIframe(gtm->segpvf, nthseg, NULL);  // extract PVF for this seg
@@ -1962,69 +2177,178 @@ int GTMbuildX(GTM *gtm)
           "into the input space. \nCheck %s/aux/seg.nii.gz and the registration\n",
           gtm->OutDir);
       err++;
+      MRIfree(&nthsegpvf);
+      free(region);
       continue;
     }
-    nthsegpvfbb = MRIextractRegion(nthsegpvf, NULL, region);  // extract BB
-    if (nthsegpvfbb == NULL) {
+    gtm->segpvfbb[nthseg] = MRIextractRegion(nthsegpvf, NULL, region);  // extract BB
+    MRIfree(&nthsegpvf);
+    if (gtm->segpvfbb[nthseg] == NULL) {
       printf("ERROR: extracting nthseg=%d, segid=%d, %s\n", nthseg, segid, gtm->ctGTMSeg->entries[segid]->name);
       printf(
           "It may be that there are no voxels for this seg when mapped "
           "into the input space. \nCheck %s/aux/seg.nii.gz and the registration\n",
           gtm->OutDir);
       err++;
+      free(region);
       continue;
     }
-    nthsegpvfbbsm = MRIgaussianSmoothNI(nthsegpvfbb, gtm->cStd, gtm->rStd, gtm->sStd, NULL);
-    if (gtm->UseMBrad) {
-      // Order of operations should not matter
-      mb = MB2Dcopy(gtm->mbrad, 0, NULL);
-      mb->cR = region->x;
-      mb->rR = region->y;
-      nthsegpvfbbsmmb = MRImotionBlur2D(nthsegpvfbbsm, mb, NULL);
-      MRIfree(&nthsegpvfbbsm);
-      nthsegpvfbbsm = nthsegpvfbbsmmb;
-      MB2Dfree(&mb);
-    }
-    if (gtm->UseMBtan) {
-      // Order of operations should not matter
-      mb = MB2Dcopy(gtm->mbtan, 0, NULL);
-      mb->cR = region->x;
-      mb->rR = region->y;
-      nthsegpvfbbsmmb = MRImotionBlur2D(nthsegpvfbbsm, mb, NULL);
-      MRIfree(&nthsegpvfbbsm);
-      nthsegpvfbbsm = nthsegpvfbbsmmb;
-      MB2Dfree(&mb);
+    gtm->segbbregion[nthseg] = region;
+
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (err) GTMfreeSegBB(gtm);
+  return (err);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn static void GTMpsfKey(GTM *gtm, double *key)
+  \brief Collects everything that the smoothing in GTMbuildX() depends on
+  into key[7] so that a rebuild with an unchanged PSF can be skipped.
+*/
+static void GTMpsfKey(GTM *gtm, double *key)
+{
+  key[0] = gtm->cStd;
+  key[1] = gtm->rStd;
+  key[2] = gtm->sStd;
+  key[3] = gtm->UseMBrad ? gtm->mbrad->offset : -1;
+  key[4] = gtm->UseMBrad ? gtm->mbrad->slope : -1;
+  key[5] = gtm->UseMBtan ? gtm->mbtan->offset : -1;
+  key[6] = gtm->UseMBtan ? gtm->mbtan->slope : -1;
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int GTMbuildX(GTM *gtm)
+  \brief Builds the GTM design matrix both with (X) and without (X0) PSF.  If
+  gtm->DoVoxFracCor=1 then corrects for volume fraction effect. X and X0
+  are stored by column in sparse form (Xnnz, Xrow, Xval, X0val, see gtm.h);
+  only each seg's bounding box is visited and the dense nmask x nsegs
+  matrices are never allocated. While optimizing (gtm->Optimizing=1) X0 is
+  not built, the seg bounding boxes are kept from one call to the next, and
+  nothing is done if the PSF has not changed since the last call. Returns
+  non-zero (and frees X) on error.
+*/
+int GTMbuildX(GTM *gtm)
+{
+  int nthseg, err;
+  double key[7];
+
+  GTMpsfKey(gtm, key);
+  if (gtm->Optimizing && gtm->Xnnz && gtm->segpvfbb && gtm->segbbnPad == gtm->nPad &&
+      gtm->segbbVoxFracCor == gtm->DoVoxFracCor && memcmp(key, gtm->XpsfKey, sizeof(key)) == 0)
+    return (0);
+
+  gtm->dof = gtm->nmask - gtm->nsegs;
+
+  if (gtm->Xnnz == NULL) {
+    gtm->Xnnz = (int *)calloc(gtm->nsegs, sizeof(int));
+    gtm->Xrow = (int **)calloc(gtm->nsegs, sizeof(int *));
+    gtm->Xval = (float **)calloc(gtm->nsegs, sizeof(float *));
+    gtm->X0val = (float **)calloc(gtm->nsegs, sizeof(float *));
+    if (gtm->Xnnz == NULL || gtm->Xrow == NULL || gtm->Xval == NULL || gtm->X0val == NULL) {
+      printf("ERROR: GTMbuildX(): could not alloc X %d %d\n", gtm->nmask, gtm->nsegs);
+      return (1);
     }
-    // Fill X, creating X in this order makes it consistent with matlab
-    // Note: y must be ordered in the same way. See GTMvol2mat()
-    k = 0;
-    for (s = 0; s < gtm->yvol->depth; s++) {
-      for (c = 0; c < gtm->yvol->width; c++) {
-        for (r = 0; r < gtm->yvol->height; r++) {
-          if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
-          k++;  // have to incr here in case continue below
-          if (c < region->x || c >= region->x + region->dx) continue;
-          if (r < region->y || r >= region->y + region->dy) continue;
-          if (s < region->z || s >= region->z + region->dz) continue;
-          // do not use k+1 here because it has already been incr above
-          if (!gtm->Optimizing)
-            gtm->X0->rptr[k][nthseg + 1] = MRIgetVoxVal(nthsegpvfbb, c - region->x, r - region->y, s - region->z, 0);
+  }
+
+  Timer timer;
+
+  err = 0;
+  if (!gtm->Optimizing || gtm->segpvfbb == NULL || gtm->segbbnPad != gtm->nPad ||
+      gtm->segbbVoxFracCor != gtm->DoVoxFracCor)
+    err = GTMbuildSegBB(gtm);
 
-          gtm->X->rptr[k][nthseg + 1] = MRIgetVoxVal(nthsegpvfbbsm, c - region->x, r - region->y, s - region->z, 0);
+  if (!err) {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+    for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+      ROMP_PFLB_begin
+
+      int k, c, r, s, nnz, cmax, rmax, smax, *rows;
+      float v, v0, *vals, *vals0 = NULL;
+      size_t nbb;
+      MRI *nthsegpvfbb, *nthsegpvfbbsm = NULL, *nthsegpvfbbsmmb = NULL;
+      MRI_REGION *region;
+      MB2D *mb;
+      nthsegpvfbb = gtm->segpvfbb[nthseg];
+      region = gtm->segbbregion[nthseg];
+      nthsegpvfbbsm = MRIgaussianSmoothNI(nthsegpvfbb, gtm->cStd, gtm->rStd, gtm->sStd, NULL);
+      if (gtm->UseMBrad) {
+        // Order of operations should not matter
+        mb = MB2Dcopy(gtm->mbrad, 0, NULL);
+        mb->cR = region->x;
+        mb->rR = region->y;
+        nthsegpvfbbsmmb = MRImotionBlur2D(nthsegpvfbbsm, mb, NULL);
+        MRIfree(&nthsegpvfbbsm);
+        nthsegpvfbbsm = nthsegpvfbbsmmb;
+        MB2Dfree(&mb);
+      }
+      if (gtm->UseMBtan) {
+        // Order of operations should not matter
+        mb = MB2Dcopy(gtm->mbtan, 0, NULL);
+        mb->cR = region->x;
+        mb->rR = region->y;
+        nthsegpvfbbsmmb = MRImotionBlur2D(nthsegpvfbbsm, mb, NULL);
+        MRIfree(&nthsegpvfbbsm);
+        nthsegpvfbbsm = nthsegpvfbbsmmb;
+        MB2Dfree(&mb);
+      }
+      // Fill X, creating X in this order makes it consistent with matlab
+      // Note: y must be ordered in the same way. See GTMvol2mat(). Only
+      // the bounding box is visited; X is 0 everywhere else.
+      cmax = MIN(region->x + region->dx, gtm->yvol->width);
+      rmax = MIN(region->y + region->dy, gtm->yvol->height);
+      smax = MIN(region->z + region->dz, gtm->yvol->depth);
+      nbb = MAX((size_t)region->dx * region->dy * region->dz, 1);
+      rows = (int *)malloc(sizeof(int) * nbb);
+      vals = (float *)malloc(sizeof(float) * nbb);
+      if (!gtm->Optimizing) vals0 = (float *)malloc(sizeof(float) * nbb);
+      nnz = 0;
+      for (s = region->z; s < smax; s++) {
+        for (c = region->x; c < cmax; c++) {
+          for (r = region->y; r < rmax; r++) {
+            k = gtm->vox2row[c + (size_t)r * gtm->yvol->width + (size_t)s * gtm->yvol->width * gtm->yvol->height];
+            if (k < 0) continue;
+            v = MRIgetVoxVal(nthsegpvfbbsm, c - region->x, r - region->y, s - region->z, 0);
+            v0 = vals0 ? MRIgetVoxVal(nthsegpvfbb, c - region->x, r - region->y, s - region->z, 0) : 0;
+            if (v == 0 && v0 == 0) continue;
+            rows[nnz] = k;
+            vals[nnz] = v;
+            if (vals0) vals0[nnz] = v0;
+            nnz++;
+          }
         }
       }
+      // only keep the non-zeros
+      rows = (int *)realloc(rows, sizeof(int) * MAX(nnz, 1));
+      vals = (float *)realloc(vals, sizeof(float) * MAX(nnz, 1));
+      if (vals0) vals0 = (float *)realloc(vals0, sizeof(float) * MAX(nnz, 1));
+      if (gtm->Xrow[nthseg]) free(gtm->Xrow[nthseg]);
+      if (gtm->Xval[nthseg]) free(gtm->Xval[nthseg]);
+      if (gtm->X0val[nthseg]) free(gtm->X0val[nthseg]);
+      gtm->Xnnz[nthseg] = nnz;
+      gtm->Xrow[nthseg] = rows;
+      gtm->Xval[nthseg] = vals;
+      gtm->X0val[nthseg] = vals0;
+      MRIfree(&nthsegpvfbbsm);
+
+      ROMP_PFLB_end
     }
-    MRIfree(&nthsegpvf);
-    MRIfree(&nthsegpvfbb);
-    MRIfree(&nthsegpvfbbsm);
-    
-    ROMP_PFLB_end
+    ROMP_PF_end
   }
-  ROMP_PF_end
-  
+  if (!gtm->Optimizing) GTMfreeSegBB(gtm);
+
   if (!gtm->Optimizing) printf(" Build time %6.4f, err = %d\n", timer.seconds(), err);
   fflush(stdout);
-  if (err) gtm->X = NULL;
+  if (err) {
+    GTMfreeX(gtm);
+    return (1);
+  }
+  memcpy(gtm->XpsfKey, key, sizeof(key));
 
   return (0);
 }
@@ -2839,14 +3163,16 @@ MRI **GTMlocal(GTM *gtm, MRI **pvc)
 */
 int GTMttPercent(GTM *gtm)
 {
-  int nTT, k, s, c, r, segid, nthseg, mthseg, mthsegid, tt;
+  int nTT, k, s, c, r, segid, nthseg, mthseg, mthsegid, tt, *next;
   double sum;
 
   nTT = gtm->ttpvf->nframes;
   if (gtm->ttpct != NULL) MatrixFree(&gtm->ttpct);
   gtm->ttpct = MatrixAlloc(gtm->nsegs, nTT, MATRIX_REAL);
 
-  // Must be done in same order as GTMbuildX()
+  // Must be done in same order as GTMbuildX(). X is walked a row at a
+  // time, next[mthseg] being the first entry of column mthseg not before row k
+  next = (int *)calloc(gtm->nsegs, sizeof(int));
   k = 0;
   for (s = 0; s < gtm->yvol->depth; s++) {
     for (c = 0; c < gtm->yvol->width; c++) {
@@ -2858,17 +3184,20 @@ int GTMttPercent(GTM *gtm)
         for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
           if (segid == gtm->segidlist[nthseg]) break;
         for (mthseg = 0; mthseg < gtm->nsegs; mthseg++) {
+          while (next[mthseg] < gtm->Xnnz[mthseg] && gtm->Xrow[mthseg][next[mthseg]] < k - 1) next[mthseg]++;
+          // X is 0 in this row
+          if (next[mthseg] == gtm->Xnnz[mthseg] || gtm->Xrow[mthseg][next[mthseg]] != k - 1) continue;
           mthsegid = gtm->segidlist[mthseg];
           tt = gtm->ctGTMSeg->entries[mthsegid]->TissueType;
           // printf("k=%d, segid = %d, nthseg = %d, mthsegid = %d, mthseg = %d, tt=%d\n",
           // k,segid,nthseg,mthsegid,mthseg,tt);
-          fflush(stdout);
           gtm->ttpct->rptr[nthseg + 1][tt] +=  // not tt+1
-              (gtm->X->rptr[k][mthseg + 1] * gtm->beta->rptr[mthseg + 1][1]);
+              (gtm->Xval[mthseg][next[mthseg]] * gtm->beta->rptr[mthseg + 1][1]);
         }
       }
     }
   }
+  free(next);
 
   for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
     sum = 0;
@@ -0,0 +1,417 @@
+/**
+ * @file  mgzblock.cpp
+ * @brief block-compressed (BGZF-style) gzip files with random access
+ *
+ * Layout of a blocked file:
+ *
+ *   [gzip member 0] ... [gzip member nblocks-1]   deflated data blocks
+ *   [index member]  ... [index member]            empty members, 'FI' extra subfield
+ *   [footer member]                               empty member, 'FT' extra subfield
+ *
+ * Every data block holds block_size uncompressed bytes except the last. The
+ * index members hold the little-endian file offset of each data block, at
+ * most MGZB_INDEX_PER_MEMBER per member. The footer has a fixed size so it
+ * can be found by seeking to the end of the file.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "error.h"
+#include "mgzblock.h"
+#include "romp_support.h"
+
+#define MGZB_VERSION 1
+#define MGZB_FOOTER_PAYLOAD 40
+// gzip header (10) + XLEN (2) + subfield header (4) + payload + empty deflate (2) + CRC32/ISIZE (8)
+#define MGZB_FOOTER_SIZE (10 + 2 + 4 + MGZB_FOOTER_PAYLOAD + 2 + 8)
+#define MGZB_INDEX_PER_MEMBER 8000
+// number of blocks compressed concurrently before they are flushed to disk
+#define MGZB_WRITE_BATCH 64
+
+static void mgzbPut32(unsigned char *p, uint32_t v)
+{
+  int i;
+  for (i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void mgzbPut64(unsigned char *p, uint64_t v)
+{
+  int i;
+  for (i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t mgzbGet16(const unsigned char *p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8); }
+
+static uint32_t mgzbGet32(const unsigned char *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t mgzbGet64(const unsigned char *p)
+{
+  return (uint64_t)mgzbGet32(p) | ((uint64_t)mgzbGet32(p + 4) << 32);
+}
+
+/*!
+  \fn static size_t mgzbEmptyMember(unsigned char *out, char si2, const unsigned char *payload, size_t len)
+  \brief Builds a gzip member with no data whose FEXTRA field holds one
+  subfield ('F',si2) containing payload. Returns the member size. out
+  must hold at least len+26 bytes.
+*/
+static size_t mgzbEmptyMember(unsigned char *out, char si2, const unsigned char *payload, size_t len)
+{
+  size_t n = 0;
+  const unsigned char hdr[10] = {0x1f, 0x8b, 8, 4 /* FEXTRA */, 0, 0, 0, 0, 0, 0xff};
+
+  memcpy(out, hdr, 10);
+  n = 10;
+  out[n++] = (unsigned char)((len + 4) & 0xff);
+  out[n++] = (unsigned char)((len + 4) >> 8);
+  out[n++] = 'F';
+  out[n++] = si2;
+  out[n++] = (unsigned char)(len & 0xff);
+  out[n++] = (unsigned char)(len >> 8);
+  memcpy(out + n, payload, len);
+  n += len;
+  out[n++] = 0x03;  // empty final fixed-huffman deflate block
+  out[n++] = 0x00;
+  memset(out + n, 0, 8);  // CRC32 and ISIZE of zero bytes
+  n += 8;
+  return (n);
+}
+
+/*!
+  \fn static const unsigned char *mgzbParseMember(const unsigned char *buf, size_t size, char si2, size_t *plen)
+  \brief Checks that buf starts with an empty gzip member written by
+  mgzbEmptyMember() with subfield ('F',si2). Returns a pointer to the
+  payload (and its length in plen) or NULL.
+*/
+static const unsigned char *mgzbParseMember(const unsigned char *buf, size_t size, char si2, size_t *plen)
+{
+  size_t xlen, len;
+
+  if (size < 16 || buf[0] != 0x1f || buf[1] != 0x8b || buf[2] != 8 || !(buf[3] & 4)) return (NULL);
+  xlen = mgzbGet16(buf + 10);
+  if (xlen < 4 || 12 + xlen > size) return (NULL);
+  if (buf[12] != 'F' || buf[13] != si2) return (NULL);
+  len = mgzbGet16(buf + 14);
+  if (len + 4 > xlen) return (NULL);
+  *plen = len;
+  return (buf + 16);
+}
+
+static int mgzbPread(int fd, void *buf, size_t nbytes, uint64_t offset)
+{
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < nbytes) {
+    n = pread(fd, (char *)buf + done, nbytes - done, (off_t)(offset + done));
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      return (ERROR_BADFILE);
+    }
+    done += n;
+  }
+  return (NO_ERROR);
+}
+
+/*!
+  \fn static int mgzbReadFooter(int fd, uint64_t *block_size, uint64_t *nblocks, uint64_t *index_offset, uint64_t *total)
+  \brief Reads the fixed-size footer member at the end of the file. Returns
+  NO_ERROR if the file is a blocked gzip file.
+*/
+static int mgzbReadFooter(int fd, uint64_t *block_size, uint64_t *nblocks, uint64_t *index_offset, uint64_t *total)
+{
+  struct stat st;
+  unsigned char buf[MGZB_FOOTER_SIZE];
+  const unsigned char *p;
+  size_t len;
+
+  if (fstat(fd, &st) != 0 || st.st_size < MGZB_FOOTER_SIZE) return (ERROR_BADFILE);
+  if (mgzbPread(fd, buf, MGZB_FOOTER_SIZE, st.st_size - MGZB_FOOTER_SIZE) != NO_ERROR) return (ERROR_BADFILE);
+  p = mgzbParseMember(buf, MGZB_FOOTER_SIZE, 'T', &len);
+  if (p == NULL || len != MGZB_FOOTER_PAYLOAD || memcmp(p, "MGZB", 4) || mgzbGet32(p + 4) != MGZB_VERSION)
+    return (ERROR_BADFILE);
+
+  *block_size = mgzbGet64(p + 8);
+  *nblocks = mgzbGet64(p + 16);
+  *index_offset = mgzbGet64(p + 24);
+  *total = mgzbGet64(p + 32);
+  if (*block_size == 0 || *index_offset > (uint64_t)st.st_size || *total > *nblocks * *block_size)
+    return (ERROR_BADFILE);
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int MGZBisBlocked(const char *fname)
+  \brief Returns 1 if fname is a block-compressed gzip file written by
+  MGZBwrite(), 0 otherwise (including plain gzip files).
+*/
+int MGZBisBlocked(const char *fname)
+{
+  int fd, blocked;
+  uint64_t block_size, nblocks, index_offset, total;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) return (0);
+  blocked = (mgzbReadFooter(fd, &block_size, &nblocks, &index_offset, &total) == NO_ERROR);
+  close(fd);
+  return (blocked);
+}
+
+/*!
+  \fn MGZ_BLOCKED *MGZBopen(const char *fname)
+  \brief Opens a blocked gzip file and loads its block index.
+*/
+MGZ_BLOCKED *MGZBopen(const char *fname)
+{
+  MGZ_BLOCKED *mgzb;
+  uint64_t block_size, nblocks, index_offset, total, offset, n;
+  unsigned char *buf;
+  const unsigned char *p;
+  size_t len, maxmember, i;
+
+  mgzb = (MGZ_BLOCKED *)calloc(1, sizeof(MGZ_BLOCKED));
+  mgzb->fd = open(fname, O_RDONLY);
+  if (mgzb->fd < 0) {
+    free(mgzb);
+    ErrorReturn(NULL, (ERROR_NOFILE, "MGZBopen(%s): could not open file", fname));
+  }
+  if (mgzbReadFooter(mgzb->fd, &block_size, &nblocks, &index_offset, &total) != NO_ERROR) {
+    MGZBclose(&mgzb);
+    ErrorReturn(NULL, (ERROR_BADFILE, "MGZBopen(%s): not a block-compressed gzip file", fname));
+  }
+  mgzb->block_size = block_size;
+  mgzb->nblocks = nblocks;
+  mgzb->total_size = total;
+  mgzb->offsets = (uint64_t *)calloc(nblocks + 1, sizeof(uint64_t));
+
+  maxmember = 26 + 8 * MGZB_INDEX_PER_MEMBER;
+  buf = (unsigned char *)malloc(maxmember);
+  offset = index_offset;
+  for (n = 0; n < nblocks;) {
+    len = nblocks - n < MGZB_INDEX_PER_MEMBER ? 26 + 8 * (nblocks - n) : maxmember;
+    if (mgzbPread(mgzb->fd, buf, len, offset) != NO_ERROR || (p = mgzbParseMember(buf, len, 'I', &len)) == NULL ||
+        len % 8 || len == 0 || n + len / 8 > nblocks) {
+      free(buf);
+      MGZBclose(&mgzb);
+      ErrorReturn(NULL, (ERROR_BADFILE, "MGZBopen(%s): corrupt block index", fname));
+    }
+    for (i = 0; i < len / 8; i++) mgzb->offsets[n++] = mgzbGet64(p + 8 * i);
+    offset += 26 + len;
+  }
+  mgzb->offsets[nblocks] = index_offset;
+  free(buf);
+
+  return (mgzb);
+}
+
+/*!
+  \fn int MGZBread(MGZ_BLOCKED *mgzb, void *buf, size_t offset, size_t nbytes)
+  \brief Reads nbytes uncompressed bytes starting at offset into buf.
+  Only the blocks covering the range are inflated, in parallel.
+*/
+int MGZBread(MGZ_BLOCKED *mgzb, void *buf, size_t offset, size_t nbytes)
+{
+  long first, last, b;
+  int nerrors = 0;
+
+  if (nbytes == 0) return (NO_ERROR);
+  if (offset + nbytes > mgzb->total_size)
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM, "MGZBread: range %lu+%lu beyond end of file (%lu)",
+                 (unsigned long)offset, (unsigned long)nbytes, (unsigned long)mgzb->total_size));
+
+  first = offset / mgzb->block_size;
+  last = (offset + nbytes - 1) / mgzb->block_size;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : nerrors) schedule(dynamic, 1)
+#endif
+  for (b = first; b <= last; b++) {
+    ROMP_PFLB_begin
+
+    size_t bstart = (size_t)b * mgzb->block_size;
+    size_t usize = mgzb->block_size;
+    size_t csize = mgzb->offsets[b + 1] - mgzb->offsets[b];
+    size_t lo, hi;
+    unsigned char *cbuf, *ubuf;
+    z_stream zs;
+
+    if (bstart + usize > mgzb->total_size) usize = mgzb->total_size - bstart;
+    lo = offset > bstart ? offset - bstart : 0;
+    hi = offset + nbytes < bstart + usize ? offset + nbytes - bstart : usize;
+
+    // inflate straight into the caller's buffer unless the block is only partially wanted
+    if (lo == 0 && hi == usize)
+      ubuf = (unsigned char *)buf + (bstart - offset);
+    else
+      ubuf = (unsigned char *)malloc(usize);
+
+    cbuf = (unsigned char *)malloc(csize);
+    memset(&zs, 0, sizeof(zs));
+    if (mgzbPread(mgzb->fd, cbuf, csize, mgzb->offsets[b]) != NO_ERROR || inflateInit2(&zs, 15 + 16) != Z_OK)
+      nerrors++;
+    else {
+      zs.next_in = cbuf;
+      zs.avail_in = csize;
+      zs.next_out = ubuf;
+      zs.avail_out = usize;
+      if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out != usize) nerrors++;
+      inflateEnd(&zs);
+    }
+    free(cbuf);
+
+    if (ubuf != (unsigned char *)buf + (bstart - offset)) {
+      memcpy((unsigned char *)buf + (bstart + lo - offset), ubuf + lo, hi - lo);
+      free(ubuf);
+    }
+
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (nerrors) ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBread: %d corrupt blocks", nerrors));
+  return (NO_ERROR);
+}
+
+int MGZBclose(MGZ_BLOCKED **pmgzb)
+{
+  MGZ_BLOCKED *mgzb = *pmgzb;
+
+  if (mgzb == NULL) return (NO_ERROR);
+  if (mgzb->fd >= 0) close(mgzb->fd);
+  if (mgzb->offsets) free(mgzb->offsets);
+  free(mgzb);
+  *pmgzb = NULL;
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int MGZBwriteEnabled(void)
+  \brief Returns 1 if .mgz files should be written block-compressed, which
+  is requested by setting the FS_MGZ_BLOCKED environment variable.
+*/
+int MGZBwriteEnabled(void)
+{
+  const char *s = getenv("FS_MGZ_BLOCKED");
+  return (s != NULL && strcmp(s, "0") != 0);
+}
+
+/*!
+  \fn int MGZBwrite(const char *fname, const void *buf, size_t nbytes, size_t block_size)
+  \brief Writes buf to fname as a block-compressed gzip file. Blocks are
+  deflated in parallel, in batches of MGZB_WRITE_BATCH, and written in order.
+*/
+int MGZBwrite(const char *fname, const void *buf, size_t nbytes, size_t block_size)
+{
+  FILE *fp;
+  size_t nblocks, batch, b, n, k;
+  uint64_t offset;
+  uint64_t *offsets;
+  unsigned char *cbufs[MGZB_WRITE_BATCH];
+  size_t csizes[MGZB_WRITE_BATCH];
+  unsigned char *member, payload[MGZB_FOOTER_PAYLOAD];
+  int nerrors = 0;
+
+  if (block_size == 0) block_size = MGZB_DEFAULT_BLOCK_SIZE;
+  nblocks = (nbytes + block_size - 1) / block_size;
+
+  fp = fopen(fname, "wb");
+  if (fp == NULL) ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBwrite(%s): could not open file", fname));
+
+  offsets = (uint64_t *)calloc(nblocks + 1, sizeof(uint64_t));
+  offset = 0;
+  for (batch = 0; batch < nblocks && !nerrors; batch += MGZB_WRITE_BATCH) {
+    n = nblocks - batch < MGZB_WRITE_BATCH ? nblocks - batch : MGZB_WRITE_BATCH;
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : nerrors) schedule(dynamic, 1)
+#endif
+    for (k = 0; k < n; k++) {
+      ROMP_PFLB_begin
+
+      size_t bstart = (batch + k) * block_size;
+      size_t usize = bstart + block_size > nbytes ? nbytes - bstart : block_size;
+      z_stream zs;
+
+      memset(&zs, 0, sizeof(zs));
+      cbufs[k] = NULL;
+      csizes[k] = 0;
+      if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        nerrors++;
+      else {
+        size_t bound = deflateBound(&zs, usize);
+        cbufs[k] = (unsigned char *)malloc(bound);
+        zs.next_in = (Bytef *)buf + bstart;
+        zs.avail_in = usize;
+        zs.next_out = cbufs[k];
+        zs.avail_out = bound;
+        if (deflate(&zs, Z_FINISH) != Z_STREAM_END) nerrors++;
+        csizes[k] = zs.total_out;
+        deflateEnd(&zs);
+      }
+
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    for (k = 0; k < n; k++) {
+      offsets[batch + k] = offset;
+      if (!nerrors && fwrite(cbufs[k], 1, csizes[k], fp) != csizes[k]) nerrors++;
+      offset += csizes[k];
+      free(cbufs[k]);
+    }
+  }
+
+  // block index, split over as many empty members as needed
+  member = (unsigned char *)malloc(26 + 8 * MGZB_INDEX_PER_MEMBER);
+  offsets[nblocks] = offset;
+  for (b = 0; b < nblocks && !nerrors; b += MGZB_INDEX_PER_MEMBER) {
+    unsigned char entries[8 * MGZB_INDEX_PER_MEMBER];
+    n = nblocks - b < MGZB_INDEX_PER_MEMBER ? nblocks - b : MGZB_INDEX_PER_MEMBER;
+    for (k = 0; k < n; k++) mgzbPut64(entries + 8 * k, offsets[b + k]);
+    k = mgzbEmptyMember(member, 'I', entries, 8 * n);
+    if (fwrite(member, 1, k, fp) != k) nerrors++;
+  }
+
+  memcpy(payload, "MGZB", 4);
+  mgzbPut32(payload + 4, MGZB_VERSION);
+  mgzbPut64(payload + 8, block_size);
+  mgzbPut64(payload + 16, nblocks);
+  mgzbPut64(payload + 24, offsets[nblocks]);
+  mgzbPut64(payload + 32, nbytes);
+  k = mgzbEmptyMember(member, 'T', payload, MGZB_FOOTER_PAYLOAD);
+  if (!nerrors && fwrite(member, 1, k, fp) != k) nerrors++;
+
+  free(member);
+  free(offsets);
+  if (fclose(fp) != 0) nerrors++;
+  if (nerrors) ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBwrite(%s): write failed", fname));
+  return (NO_ERROR);
+}
@@ -26,11 +26,15 @@ extern const char *Progname;
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <memory.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -191,7 +195,19 @@ MRI::MRI(Shape volshape, int dtype, bool alloc) : shape(volshape), type(dtype)
   // attempt to chunk - if that fails, try allocating non-contiguous slices
   chunk = calloc(bytes_total, 1);
   ischunked = bool(chunk);
+  ROMP_COUNT(volume_allocs, 1);
+  ROMP_COUNT(volume_alloc_bytes, bytes_total);
 
+  initSlices();
+}
+
+
+/**
+  Allocates the slice and row pointer arrays, pointing them into the chunk when the
+  volume is chunked and allocating a buffer per slice otherwise.
+*/
+void MRI::initSlices()
+{
   // allocate an array of slice pointers - this is done regardless of chunking
   // so that we can still support 3d-indexing and not produce any weird issues
   int nslices = depth * nframes;
@@ -236,6 +252,46 @@ MRI::MRI(Shape volshape, int dtype, bool alloc) : shape(volshape), type(dtype)
 }
 
 
+/**
+  Points the image buffer of a header-only MRI at the voxel data of a file, starting at
+  byte `offset`, instead of allocating it. The data must already be in the in-memory
+  layout and byte order. The mapping is private and copy-on-write: pages are read from
+  disk (or shared through the page cache) only when touched, and a tool that modifies the
+  volume gets private copies of the pages it writes without changing the file. Returns
+  false, leaving the MRI untouched, if the file cannot be mapped.
+*/
+bool MRI::mapChunk(const char *filename, size_t offset)
+{
+  if (chunk || slices || offset % bytes_per_vox) return false;
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < offset + bytes_total) {
+    close(fd);
+    return false;
+  }
+
+  // mmap offsets must be page aligned
+  size_t pagesize = sysconf(_SC_PAGESIZE);
+  size_t start = offset - offset % pagesize;
+  size_t mapsize = offset - start + bytes_total;
+  void *map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, start);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  if (!xi) initIndices();
+  chunk_map = map;
+  chunk_map_size = mapsize;
+  chunk = (char *)map + (offset - start);
+  ischunked = 1;
+  initSlices();
+
+  return true;
+}
+
+
 /**
   Allocates the xi, yi, and zi index arrays to handle boundary conditions. This function should
   only be called once for a single volume and is separated from the MRI constructor for readability.
@@ -302,7 +358,10 @@ MRI::~MRI()
       free(slices);
     }
   } else {
-    free(chunk);
+    if (chunk_map)
+      munmap(chunk_map, chunk_map_size);
+    else
+      free(chunk);
     if (slices) {
       for (int slice = 0; slice < depth * nframes; slice++)
         if (slices[slice]) free(slices[slice]);
@@ -11059,6 +11118,167 @@ MRI *MRIlinearTransform(MRI *mri_src, MRI *mri_dst, MATRIX *mA)
   mri_dst = MRIlinearTransformInterp(mri_src, mri_dst, mA, SAMPLE_TRILINEAR);
   return (mri_dst);
 }
+/*-------------------------------------------------------------------
+  mriLinearTransformSrcCoord() - source voxel coordinate of output
+  voxel (y1,y2,y3) given the first three rows of the inverse transform.
+  The float accumulation matches MatrixMultiply(mAinv, v_Y, v_X).
+  ------------------------------------------------------------------*/
+static inline void mriLinearTransformSrcCoord(
+    const float a[3][4], int y1, int y2, int y3, double *x1, double *x2, double *x3)
+{
+  float fy1 = y1, fy2 = y2, fy3 = y3, v[3];
+  int r;
+
+  for (r = 0; r < 3; r++) {
+    v[r] = 0.0f;
+    v[r] += a[r][0] * fy1;
+    v[r] += a[r][1] * fy2;
+    v[r] += a[r][2] * fy3;
+    v[r] += a[r][3] * 1.0f;
+  }
+  *x1 = v[0];
+  *x2 = v[1];
+  *x3 = v[2];
+}
+
+/*-------------------------------------------------------------------
+  mriLinearTransformFrames() - nearest/trilinear body of
+  MRIlinearTransformInterp() for a chunked src of voxel type T. The
+  source coordinate, the nearest/trilinear decision and the trilinear
+  weights are computed once per output voxel and then applied to every
+  frame, using the same arithmetic as MRIsampleVolumeFrameType() so the
+  output is identical to sampling each frame separately. Output slices
+  are done in parallel.
+  ------------------------------------------------------------------*/
+template <class T>
+static void mriLinearTransformFrames(const MRI *mri_src, MRI *mri_dst, const float a[3][4], int InterpMethod)
+{
+  const T *src = (const T *)mri_src->chunk;
+  const size_t vpr = mri_src->vox_per_row, vps = mri_src->vox_per_slice, vpv = mri_src->vox_per_vol;
+  const int nframes = mri_src->nframes;
+  const int swidth = mri_src->width, sheight = mri_src->height, sdepth = mri_src->depth;
+  const int width = mri_dst->width, height = mri_dst->height, depth = mri_dst->depth;
+  const float outside_val = mri_src->outside_val;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (int y3 = 0; y3 < depth; y3++) {
+    ROMP_PFLB_begin
+    int y1, y2, frame, xv, yv, zv, xm, xp, ym, yp, zm, zp;
+    double x1, x2, x3, xmd, ymd, zmd, xpd, ypd, zpd, val, w[8];
+    size_t o[8];
+
+    for (y2 = 0; y2 < height; y2++) {
+      for (y1 = 0; y1 < width; y1++) {
+        mriLinearTransformSrcCoord(a, y1, y2, y3, &x1, &x2, &x3);
+
+        if (MRIindexNotInVolume(mri_src, x1, x2, x3) == 1) {
+          for (frame = 0; frame < nframes; frame++) MRIsetVoxVal(mri_dst, y1, y2, y3, frame, outside_val);
+          continue;
+        }
+
+        if (InterpMethod == SAMPLE_NEAREST || (FEQUAL((int)x1, x1) && FEQUAL((int)x2, x2) && FEQUAL((int)x3, x3))) {
+          xv = nint(x1);
+          yv = nint(x2);
+          zv = nint(x3);
+          if (xv < 0) xv = 0;
+          if (xv >= swidth) xv = swidth - 1;
+          if (yv < 0) yv = 0;
+          if (yv >= sheight) yv = sheight - 1;
+          if (zv < 0) zv = 0;
+          if (zv >= sdepth) zv = sdepth - 1;
+          const T *p = src + xv + yv * vpr + zv * vps;
+          for (frame = 0; frame < nframes; frame++) MRIsetVoxVal(mri_dst, y1, y2, y3, frame, (float)p[frame * vpv]);
+          continue;
+        }
+
+        if (x1 >= swidth) x1 = swidth - 1.0;
+        if (x2 >= sheight) x2 = sheight - 1.0;
+        if (x3 >= sdepth) x3 = sdepth - 1.0;
+        if (x1 < 0.0) x1 = 0.0;
+        if (x2 < 0.0) x2 = 0.0;
+        if (x3 < 0.0) x3 = 0.0;
+
+        xm = MAX((int)x1, 0);
+        xp = MIN(swidth - 1, xm + 1);
+        ym = MAX((int)x2, 0);
+        yp = MIN(sheight - 1, ym + 1);
+        zm = MAX((int)x3, 0);
+        zp = MIN(sdepth - 1, zm + 1);
+
+        xmd = x1 - (float)xm;
+        ymd = x2 - (float)ym;
+        zmd = x3 - (float)zm;
+        xpd = (1.0f - xmd);
+        ypd = (1.0f - ymd);
+        zpd = (1.0f - zmd);
+
+        // same corner order and weight products as MRIsampleVolumeFrame()
+        w[0] = xpd * ypd * zpd;
+        w[1] = xpd * ypd * zmd;
+        w[2] = xpd * ymd * zpd;
+        w[3] = xpd * ymd * zmd;
+        w[4] = xmd * ypd * zpd;
+        w[5] = xmd * ypd * zmd;
+        w[6] = xmd * ymd * zpd;
+        w[7] = xmd * ymd * zmd;
+        o[0] = xm + ym * vpr + zm * vps;
+        o[1] = xm + ym * vpr + zp * vps;
+        o[2] = xm + yp * vpr + zm * vps;
+        o[3] = xm + yp * vpr + zp * vps;
+        o[4] = xp + ym * vpr + zm * vps;
+        o[5] = xp + ym * vpr + zp * vps;
+        o[6] = xp + yp * vpr + zm * vps;
+        o[7] = xp + yp * vpr + zp * vps;
+
+        for (frame = 0; frame < nframes; frame++) {
+          const T *p = src + frame * vpv;
+          val = w[0] * (double)p[o[0]] + w[1] * (double)p[o[1]] + w[2] * (double)p[o[2]] + w[3] * (double)p[o[3]] +
+                w[4] * (double)p[o[4]] + w[5] * (double)p[o[5]] + w[6] * (double)p[o[6]] + w[7] * (double)p[o[7]];
+          MRIsetVoxVal(mri_dst, y1, y2, y3, frame, val);
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*-------------------------------------------------------------------
+  mriLinearTransformBSplineFrames() - cubic B-spline body of
+  MRIlinearTransformInterp(). MRIsampleSeqBSpline() computes the spline
+  weights once per output voxel for all frames and gives the same
+  values as calling MRIsampleBSpline() on each frame.
+  ------------------------------------------------------------------*/
+static void mriLinearTransformBSplineFrames(const MRI_BSPLINE *bspline, MRI *mri_dst, const float a[3][4], int nframes)
+{
+  const int width = mri_dst->width, height = mri_dst->height, depth = mri_dst->depth;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (int y3 = 0; y3 < depth; y3++) {
+    ROMP_PFLB_begin
+    int y1, y2, frame;
+    double x1, x2, x3;
+    float *valvect = (float *)calloc(nframes, sizeof(float));
+
+    for (y2 = 0; y2 < height; y2++) {
+      for (y1 = 0; y1 < width; y1++) {
+        mriLinearTransformSrcCoord(a, y1, y2, y3, &x1, &x2, &x3);
+        MRIsampleSeqBSpline(bspline, x1, x2, x3, valvect, 0, nframes - 1);
+        for (frame = 0; frame < nframes; frame++) MRIsetVoxVal(mri_dst, y1, y2, y3, frame, valvect[frame]);
+      }
+    }
+    free(valvect);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
 /*-------------------------------------------------------------------
   MRIlinearTransformInterp() Perform linear coordinate transformation
   x' = Ax on the MRI image mri_src into mri_dst using the specified
@@ -11094,6 +11314,42 @@ MRI *MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA, int Interp
   MRI_BSPLINE *bspline = NULL;
   if (InterpMethod == SAMPLE_CUBIC_BSPLINE) bspline = MRItoBSpline(mri_src, NULL, 3);
 
+  // Sample all frames at once for each output voxel when the source
+  // layout allows it; the results are the same as the loop below.
+  float a[3][4];
+  int r, c, done = 1;
+  for (r = 0; r < 3; r++)
+    for (c = 0; c < 4; c++) a[r][c] = mAinv->rptr[r + 1][c + 1];
+  if (bspline)
+    mriLinearTransformBSplineFrames(bspline, mri_dst, a, mri_src->nframes);
+  else if (!mri_src->ischunked || (InterpMethod != SAMPLE_NEAREST && InterpMethod != SAMPLE_TRILINEAR))
+    done = 0;
+  else {
+    switch (mri_src->type) {
+    case MRI_UCHAR:
+      mriLinearTransformFrames<unsigned char>(mri_src, mri_dst, a, InterpMethod);
+      break;
+    case MRI_SHORT:
+      mriLinearTransformFrames<short>(mri_src, mri_dst, a, InterpMethod);
+      break;
+    case MRI_INT:
+      mriLinearTransformFrames<int>(mri_src, mri_dst, a, InterpMethod);
+      break;
+    case MRI_FLOAT:
+      mriLinearTransformFrames<float>(mri_src, mri_dst, a, InterpMethod);
+      break;
+    default:
+      done = 0;
+      break;
+    }
+  }
+  if (done) {
+    MatrixFree(&mAinv);
+    if (bspline) MRIfreeBSpline(&bspline);
+    mri_dst->ras_good_flag = 1;
+    return (mri_dst);
+  }
+
   width = mri_dst->width;
   height = mri_dst->height;
   depth = mri_dst->depth;
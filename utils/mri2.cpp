@@ -22,12 +22,14 @@
  *
  */
 
+#include <algorithm>
 #include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <vector>
 
 #include "bfileio.h"
 #include "cma.h"
@@ -791,16 +793,14 @@ int MRIvol2Vol(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, float param)
         /* Assign output volume values */
         if (InterpCode == SAMPLE_TRILINEAR)
           MRIsampleSeqVolume(src, fcs, frs, fss, valvect, 0, src->nframes - 1);
+        else if (InterpCode == SAMPLE_CUBIC_BSPLINE)
+          MRIsampleSeqBSpline(bspline, fcs, frs, fss, valvect, 0, src->nframes - 1);
         else {
           for (f = 0; f < src->nframes; f++) {
             switch (InterpCode) {
               case SAMPLE_NEAREST:
                 valvect[f] = MRIgetVoxVal(src, ics, irs, iss, f);
                 break;
-              case SAMPLE_CUBIC_BSPLINE:
-                MRIsampleBSpline(bspline, fcs, frs, fss, f, &rval);
-                valvect[f] = rval;
-                break;
               case SAMPLE_SINC: /* no multi-frame */
                 MRIsincSampleVolume(src, fcs, frs, fss, sinchw, &rval);
                 valvect[f] = rval;
@@ -2975,16 +2975,14 @@ int MRIvol2VolVSM(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, float param
         /* Assign output volume values */
         if (InterpCode == SAMPLE_TRILINEAR)
           MRIsampleSeqVolume(src, fcs, frs, fss, valvect, 0, src->nframes - 1);
+        else if (InterpCode == SAMPLE_CUBIC_BSPLINE)
+          MRIsampleSeqBSpline(bspline, fcs, frs, fss, valvect, 0, src->nframes - 1);
         else {
           for (f = 0; f < src->nframes; f++) {
             switch (InterpCode) {
               case SAMPLE_NEAREST:
                 valvect[f] = MRIgetVoxVal(src, ics, irs, iss, f);
                 break;
-              case SAMPLE_CUBIC_BSPLINE:
-                MRIsampleBSpline(bspline, fcs, frs, fss, f, &rval);
-                valvect[f] = rval;
-                break;
               case SAMPLE_SINC: /* no multi-frame */
                 MRIsincSampleVolume(src, fcs, frs, fss, sinchw, &rval);
                 valvect[f] = rval;
@@ -3596,6 +3594,52 @@ int MRIsegStats(MRI *seg, int segid, MRI *mri, int frame, float *min, float *max
   return (nvoxels);
 }
 /*------------------------------------------------------------*/
+/*!
+  \fn static int segStatsRobustList(float *vlist, int nvoxels,
+                      float *min, float *max, float *range,
+                      float *mean, float *std, float Pct)
+  \brief Sorts vlist and computes the stats of the middle 100-2*Pct
+         values. Returns the number of values used.
+*/
+static int segStatsRobustList(
+    float *vlist, int nvoxels, float *min, float *max, float *range, float *mean, float *std, float Pct)
+{
+  int k, m;
+  double val, sum, sum2;
+
+  // Sort the array
+  qsort((void *)vlist, nvoxels, sizeof(float), compare_floats);
+
+  // Compute stats excluding Pct of the values from each end
+  sum = 0;
+  sum2 = 0;
+  m = 0;
+  // printf("Robust Indices: %d %d\n",(int)nint(Pct*nvoxels/100.0),(int)nint((100-Pct)*nvoxels/100.0));
+  for (k = 0; k < nvoxels; k++) {
+    if (k < Pct * nvoxels / 100.0) continue;
+    if (k > (100 - Pct) * nvoxels / 100.0) continue;
+    val = vlist[k];
+    if (m == 0) {
+      *min = val;
+      *max = val;
+    }
+    if (*min > val) *min = val;
+    if (*max < val) *max = val;
+    sum += val;
+    sum2 += (val * val);
+    m = m + 1;
+  }
+
+  *range = *max - *min;
+  *mean = sum / m;
+  if (m > 1)
+    *std = sqrt(((m) * (*mean) * (*mean) - 2 * (*mean) * sum + sum2) / (m - 1));
+  else
+    *std = 0.0;
+
+  return (m);
+}
+/*------------------------------------------------------------*/
 /*!
   \fn int MRIsegStatsRobust(MRI *seg, int segid, MRI *mri,int frame,
                       float *min, float *max, float *range,
@@ -3606,8 +3650,7 @@ int MRIsegStats(MRI *seg, int segid, MRI *mri, int frame, float *min, float *max
 int MRIsegStatsRobust(
     MRI *seg, int segid, MRI *mri, int frame, float *min, float *max, float *range, float *mean, float *std, float Pct)
 {
-  int id, nvoxels, r, c, s, k, m;
-  double val, sum, sum2;
+  int id, nvoxels, r, c, s, m;
   float *vlist;
 
   *min = 0;
@@ -3642,36 +3685,7 @@ int MRIsegStatsRobust(
       }
     }
   }
-  // Sort the array
-  qsort((void *)vlist, nvoxels, sizeof(float), compare_floats);
-
-  // Compute stats excluding Pct of the values from each end
-  sum = 0;
-  sum2 = 0;
-  m = 0;
-  // printf("Robust Indices: %d %d\n",(int)nint(Pct*nvoxels/100.0),(int)nint((100-Pct)*nvoxels/100.0));
-  for (k = 0; k < nvoxels; k++) {
-    if (k < Pct * nvoxels / 100.0) continue;
-    if (k > (100 - Pct) * nvoxels / 100.0) continue;
-    val = vlist[k];
-    if (m == 0) {
-      *min = val;
-      *max = val;
-    }
-    if (*min > val) *min = val;
-    if (*max < val) *max = val;
-    sum += val;
-    sum2 += (val * val);
-    m = m + 1;
-  }
-
-  *range = *max - *min;
-  *mean = sum / m;
-  if (m > 1)
-    *std = sqrt(((m) * (*mean) * (*mean) - 2 * (*mean) * sum + sum2) / (m - 1));
-  else
-    *std = 0.0;
-
+  m = segStatsRobustList(vlist, nvoxels, min, max, range, mean, std, Pct);
   free(vlist);
   vlist = NULL;
   return (m);
@@ -3717,6 +3731,269 @@ int MRIsegFrameAvg(MRI *seg, int segid, MRI *mri, double *favg)
   return (nvoxels);
 }
 
+/*---------------------------------------------------------
+  MRIsegIndexAlloc() - builds, in one pass over frame 0 of seg,
+  the list of voxels in each of the given segmentations, in the
+  same column-row-slice order that MRIsegStats() visits them.
+  Segmentation ids are mapped to list slots with a lookup table
+  so each voxel is only looked at once. The MRIsegXXXIndexed()
+  functions then give the same results as their unindexed
+  counterparts while only visiting the voxels of the requested
+  segmentation. The index is only read by those functions, so
+  they can be called concurrently.
+  ---------------------------------------------------------*/
+MRI_SEG_INDEX *MRIsegIndexAlloc(MRI *seg, int nsegs, const int *segids)
+{
+  MRI_SEG_INDEX *index;
+  int c, r, s, n, id, slot, idmin, idmax;
+  int *slotofvox;
+  size_t nvox, v;
+
+  index = (MRI_SEG_INDEX *)calloc(1, sizeof(MRI_SEG_INDEX));
+  index->segids = (int *)calloc(nsegs + 1, sizeof(int));
+  index->start = (int *)calloc(nsegs + 1, sizeof(int));
+
+  // Unique ids, sorted, so lookups can fall back to a binary search
+  for (n = 0; n < nsegs; n++) index->segids[n] = segids[n];
+  std::sort(index->segids, index->segids + nsegs);
+  index->nsegs = std::unique(index->segids, index->segids + nsegs) - index->segids;
+
+  // Dense id-to-slot table when the id range is modest
+  index->idmin = 0;
+  index->nlut = 0;
+  if (index->nsegs > 0) {
+    idmin = index->segids[0];
+    idmax = index->segids[index->nsegs - 1];
+    if ((double)idmax - idmin < 16 * 1024 * 1024) {
+      index->idmin = idmin;
+      index->nlut = idmax - idmin + 1;
+      index->lut = (int *)malloc(index->nlut * sizeof(int));
+      for (n = 0; n < index->nlut; n++) index->lut[n] = -1;
+      for (n = 0; n < index->nsegs; n++) index->lut[index->segids[n] - idmin] = n;
+    }
+  }
+
+  // One pass over the segmentation to find the slot of each voxel
+  nvox = (size_t)seg->width * seg->height * seg->depth;
+  slotofvox = (int *)malloc(nvox * sizeof(int));
+  v = 0;
+  for (c = 0; c < seg->width; c++) {
+    for (r = 0; r < seg->height; r++) {
+      for (s = 0; s < seg->depth; s++) {
+        id = (int)MRIgetVoxVal(seg, c, r, s, 0);
+        slot = MRIsegIndexSlot(index, id);
+        slotofvox[v++] = slot;
+        if (slot >= 0) index->start[slot + 1]++;
+      }
+    }
+  }
+  for (n = 0; n < index->nsegs; n++) index->start[n + 1] += index->start[n];
+
+  // Fill the per-segmentation voxel lists in scan order
+  index->crs = (int *)malloc((3 * (size_t)index->start[index->nsegs] + 1) * sizeof(int));
+  std::vector<int> fill(index->start, index->start + index->nsegs);
+  v = 0;
+  for (c = 0; c < seg->width; c++) {
+    for (r = 0; r < seg->height; r++) {
+      for (s = 0; s < seg->depth; s++) {
+        slot = slotofvox[v++];
+        if (slot < 0) continue;
+        n = fill[slot]++;
+        index->crs[3 * (size_t)n + 0] = c;
+        index->crs[3 * (size_t)n + 1] = r;
+        index->crs[3 * (size_t)n + 2] = s;
+      }
+    }
+  }
+  free(slotofvox);
+
+  return (index);
+}
+
+/*---------------------------------------------------------
+  MRIsegIndexFree() - frees an index from MRIsegIndexAlloc()
+  ---------------------------------------------------------*/
+int MRIsegIndexFree(MRI_SEG_INDEX **pindex)
+{
+  MRI_SEG_INDEX *index = *pindex;
+  if (index == NULL) return (0);
+  free(index->segids);
+  free(index->start);
+  free(index->lut);
+  free(index->crs);
+  free(index);
+  *pindex = NULL;
+  return (0);
+}
+
+/*---------------------------------------------------------
+  MRIsegIndexSlot() - returns the slot of segid in the index,
+  or -1 if it was not one of the ids the index was built for.
+  ---------------------------------------------------------*/
+int MRIsegIndexSlot(const MRI_SEG_INDEX *index, int segid)
+{
+  const int *p;
+  if (index->lut) {
+    if (segid < index->idmin || segid - index->idmin >= index->nlut) return (-1);
+    return (index->lut[segid - index->idmin]);
+  }
+  p = std::lower_bound(index->segids, index->segids + index->nsegs, segid);
+  if (p == index->segids + index->nsegs || *p != segid) return (-1);
+  return (p - index->segids);
+}
+
+/*---------------------------------------------------------
+  MRIsegIndexCount() - number of voxels with the given
+  segmentation id. Same as counting them in frame 0 of the
+  segmentation the index was built from.
+  ---------------------------------------------------------*/
+int MRIsegIndexCount(const MRI_SEG_INDEX *index, int segid)
+{
+  int slot = MRIsegIndexSlot(index, segid);
+  if (slot < 0) return (0);
+  return (index->start[slot + 1] - index->start[slot]);
+}
+
+/*---------------------------------------------------------
+  MRIsegStatsIndexed() - same as MRIsegStats() but only visits
+  the voxels of segid, using an index from MRIsegIndexAlloc().
+  ---------------------------------------------------------*/
+int MRIsegStatsIndexed(const MRI_SEG_INDEX *index,
+                       int segid,
+                       MRI *mri,
+                       int frame,
+                       float *min,
+                       float *max,
+                       float *range,
+                       float *mean,
+                       float *std)
+{
+  int nvoxels, n, slot;
+  const int *crs;
+  double val, sum, sum2;
+
+  *min = 0;
+  *max = 0;
+  sum = 0;
+  sum2 = 0;
+  nvoxels = 0;
+  slot = MRIsegIndexSlot(index, segid);
+  if (slot >= 0) {
+    for (n = index->start[slot]; n < index->start[slot + 1]; n++) {
+      crs = &index->crs[3 * (size_t)n];
+      val = MRIgetVoxVal(mri, crs[0], crs[1], crs[2], frame);
+      nvoxels++;
+      if (nvoxels == 1) {
+        *min = val;
+        *max = val;
+      }
+      if (*min > val) {
+        *min = val;
+      }
+      if (*max < val) {
+        *max = val;
+      }
+      sum += val;
+      sum2 += (val * val);
+    }
+  }
+
+  *range = *max - *min;
+
+  if (nvoxels != 0) {
+    *mean = sum / nvoxels;
+  }
+  else {
+    *mean = 0.0;
+  }
+
+  if (nvoxels > 1)
+    *std = sqrt(((nvoxels) * (*mean) * (*mean) - 2 * (*mean) * sum + sum2) / (nvoxels - 1));
+  else {
+    *std = 0.0;
+  }
+
+  return (nvoxels);
+}
+
+/*---------------------------------------------------------
+  MRIsegStatsRobustIndexed() - same as MRIsegStatsRobust() but
+  only visits the voxels of segid, using an index from
+  MRIsegIndexAlloc().
+  ---------------------------------------------------------*/
+int MRIsegStatsRobustIndexed(const MRI_SEG_INDEX *index,
+                             int segid,
+                             MRI *mri,
+                             int frame,
+                             float *min,
+                             float *max,
+                             float *range,
+                             float *mean,
+                             float *std,
+                             float Pct)
+{
+  int nvoxels, n, m, slot;
+  const int *crs;
+  float *vlist;
+
+  *min = 0;
+  *max = 0;
+  *range = 0;
+  *mean = 0;
+  *std = 0;
+
+  slot = MRIsegIndexSlot(index, segid);
+  if (slot < 0) return (0);
+  nvoxels = index->start[slot + 1] - index->start[slot];
+  if (nvoxels == 0) return (nvoxels);
+
+  vlist = (float *)calloc(sizeof(float), nvoxels);
+  for (n = 0; n < nvoxels; n++) {
+    crs = &index->crs[3 * ((size_t)index->start[slot] + n)];
+    vlist[n] = MRIgetVoxVal(mri, crs[0], crs[1], crs[2], frame);
+  }
+  m = segStatsRobustList(vlist, nvoxels, min, max, range, mean, std, Pct);
+  free(vlist);
+  return (m);
+}
+
+/*---------------------------------------------------------
+  MRIsegFrameAvgIndexed() - same as MRIsegFrameAvg() but only
+  visits the voxels of segid, using an index from
+  MRIsegIndexAlloc().
+  ---------------------------------------------------------*/
+int MRIsegFrameAvgIndexed(const MRI_SEG_INDEX *index, int segid, MRI *mri, double *favg)
+{
+  int nvoxels, n, f, slot;
+  const int *crs;
+  double val;
+
+  /* zero it out */
+  for (f = 0; f < mri->nframes; f++) {
+    favg[f] = 0;
+  }
+
+  nvoxels = 0;
+  slot = MRIsegIndexSlot(index, segid);
+  if (slot >= 0) {
+    for (n = index->start[slot]; n < index->start[slot + 1]; n++) {
+      crs = &index->crs[3 * (size_t)n];
+      for (f = 0; f < mri->nframes; f++) {
+        val = MRIgetVoxVal(mri, crs[0], crs[1], crs[2], f);
+        favg[f] += val;
+      }
+      nvoxels++;
+    }
+  }
+
+  if (nvoxels != 0)
+    for (f = 0; f < mri->nframes; f++) {
+      favg[f] /= nvoxels;
+    }
+
+  return (nvoxels);
+}
+
 MRI *MRImask_with_T2_and_aparc_aseg(
     MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior)
 {
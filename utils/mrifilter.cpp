@@ -3000,6 +3000,48 @@ MRI *MRIreduceByte(MRI *mri_src, MRI *mri_dst)
   return (mri_dst);
 }
 
+/*-----------------------------------------------------
+  mriConvolve1dRows() - convolves along the y or z axis one output row at
+  a time. Each kernel tap adds a whole (contiguous) source row into a row
+  accumulator, so the inner loop is unit stride and vectorizes, instead of
+  jumping a full row or slice in memory for every tap of every voxel. The
+  taps are summed in the same order as the voxel-wise loops, so the
+  results are identical. Only used for float destinations.
+------------------------------------------------------*/
+template <class SrcType>
+static void mriConvolve1dRows(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int src_frame, int dst_frame)
+{
+  int const width = mri_src->width, height = mri_src->height, depth = mri_src->depth;
+  int const halflen = len / 2;
+  int const *yi = mri_src->yi, *zi = mri_src->zi;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1)
+#endif
+  for (int z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    float *total = (float *)malloc(width * sizeof(float));
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) total[x] = 0.0f;
+      for (int i = 0; i < len; i++) {
+        SrcType const *in;
+        if (axis == MRI_HEIGHT)
+          in = (SrcType const *)&MRIseq_vox(mri_src, 0, yi[y + i - halflen], z, src_frame);
+        else
+          in = (SrcType const *)&MRIseq_vox(mri_src, 0, y, zi[z + i - halflen], src_frame);
+        float const ki = k[i];
+        for (int x = 0; x < width; x++) total[x] += ki * (float)in[x];
+      }
+      memmove(&MRIFseq_vox(mri_dst, 0, y, z, dst_frame), total, width * sizeof(float));
+    }
+    free(total);
+    exec_progress_callback(z, depth, 0, 1);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
 /*-----------------------------------------------------
         Parameters:
 
@@ -3011,7 +3053,7 @@ MRI *MRIreduceByte(MRI *mri_src, MRI *mri_dst)
 MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int src_frame, int dst_frame)
 {
   int width, height, depth;
-  int x = 0, y = 0, z = 0, halflen, *xi, *yi, *zi;
+  int x = 0, y = 0, z = 0, halflen, *xi;
   int i = 0;
   BUFTYPE *inBase = NULL;
   float *ki = NULL, total = 0, *inBase_f = NULL, *foutPix = NULL, val = 0;
@@ -3046,8 +3088,6 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
   halflen = len / 2;
 
   xi = mri_src->xi;
-  yi = mri_src->yi;
-  zi = mri_src->zi;
 
   switch (mri_src->type) {
     case MRI_UCHAR:
@@ -3056,7 +3096,7 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
           ROMP_PF_begin
 #ifdef HAVE_OPENMP
 	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, inBase, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_src, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
+    shared(depth, height, width, len, halflen, mri_src, mri_dst, src_frame, dst_frame, xi) schedule(static, 1)
 #endif
           for (z = 0; z < depth; z++) {
 	    ROMP_PFLB_begin
@@ -3082,56 +3122,8 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
 	  
           break;
         case MRI_HEIGHT:
-          ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
-#endif
-          for (z = 0; z < depth; z++) {
-	    ROMP_PFLB_begin
-	    
-            for (y = 0; y < height; y++) {
-              foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-              for (x = 0; x < width; x++) {
-                if (x == Gx && y == Gy && z == Gz) {
-                  DiagBreak();
-                }
-                total = 0.0f;
-
-                for (ki = k, i = 0; i < len; i++)
-                  total += *ki++ * (float)(MRIseq_vox(mri_src, x, yi[y + i - halflen], z, src_frame));
-
-                *foutPix++ = total;
-              }
-            }
-            exec_progress_callback(z, depth, 0, 1);
-	    ROMP_PFLB_end
-          }
-	  ROMP_PF_end
-          break;
         case MRI_DEPTH:
-          ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
-#endif
-          for (z = 0; z < depth; z++) {
-	    ROMP_PFLB_begin
-            for (y = 0; y < height; y++) {
-              foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-              for (x = 0; x < width; x++) {
-                total = 0.0f;
-
-                for (ki = k, i = 0; i < len; i++)
-                  total += *ki++ * (float)(MRIseq_vox(mri_src, x, y, zi[z + i - halflen], src_frame));
-
-                *foutPix++ = total;
-              }
-            }
-            exec_progress_callback(z, depth, 0, 1);
-	    ROMP_PFLB_end
-          }
-	  ROMP_PF_end
+          mriConvolve1dRows<unsigned char>(mri_src, mri_dst, k, len, axis, src_frame, dst_frame);
           break;
       }
       break;
@@ -3141,7 +3133,7 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
           ROMP_PF_begin
 #ifdef HAVE_OPENMP
 	  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(y, x, inBase_f, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
+    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi) schedule(static, 1)
 #endif
           for (z = 0; z < depth; z++) {
 	    ROMP_PFLB_begin
@@ -3169,56 +3161,8 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
 	  ROMP_PF_end
           break;
         case MRI_HEIGHT:
-          ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(y, x, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
-#endif
-          for (z = 0; z < depth; z++) {
-	    ROMP_PFLB_begin
-            for (y = 0; y < height; y++) {
-              foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-              for (x = 0; x < width; x++) {
-                total = 0.0f;
-
-                if (x == Gx && y == Gy && z == Gz) {
-                  DiagBreak();
-                }
-
-                for (ki = k, i = 0; i < len; i++)
-                  total += *ki++ * MRIFseq_vox(mri_src, x, yi[y + i - halflen], z, src_frame);
-
-                *foutPix++ = total;
-              }
-            }
-            exec_progress_callback(z, depth, 0, 1);
-	    ROMP_PFLB_end
-          }
-	  ROMP_PF_end
-          break;
         case MRI_DEPTH:
-          ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(y, x, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
-#endif
-          for (z = 0; z < depth; z++) {
-	    ROMP_PFLB_begin
-            for (y = 0; y < height; y++) {
-              foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-              for (x = 0; x < width; x++) {
-                total = 0.0f;
-
-                for (ki = k, i = 0; i < len; i++)
-                  total += *ki++ * MRIFseq_vox(mri_src, x, y, zi[z + i - halflen], src_frame);
-
-                *foutPix++ = total;
-              }
-            }
-            exec_progress_callback(z, depth, 0, 1);
-	    ROMP_PFLB_end
-          }
-	  ROMP_PF_end
+          mriConvolve1dRows<float>(mri_src, mri_dst, k, len, axis, src_frame, dst_frame);
           break;
       }
       break;
@@ -3228,7 +3172,7 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
           ROMP_PF_begin
 #ifdef HAVE_OPENMP
 	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, foutPix, ki, i, val, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
+    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi) schedule(static, 1)
 #endif
           for (z = 0; z < depth; z++) {
 	    ROMP_PFLB_begin
@@ -3256,7 +3200,7 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
           ROMP_PF_begin
 #ifdef HAVE_OPENMP
 	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, foutPix, ki, i, val, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
+    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi) schedule(static, 1)
 #endif
           for (z = 0; z < depth; z++) {
 	    ROMP_PFLB_begin
@@ -3286,7 +3230,7 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
           ROMP_PF_begin
 #ifdef HAVE_OPENMP
 	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, foutPix, ki, i, val, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
+    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi) schedule(static, 1)
 #endif
           for (z = 0; z < depth; z++) {
 	    ROMP_PFLB_begin
@@ -3640,7 +3584,7 @@ MRI *MRIconvolve1dInt(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, i
 ------------------------------------------------------*/
 MRI *MRIconvolve1dFloat(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int src_frame, int dst_frame)
 {
-  int x, y, z, width, height, halflen, depth, *xi, *yi, *zi;
+  int x, y, z, width, height, halflen, depth, *xi;
   int i;
   float *inBase;
   float *outPix;
@@ -3660,8 +3604,6 @@ MRI *MRIconvolve1dFloat(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis,
   halflen = len / 2;
 
   xi = mri_src->xi;
-  yi = mri_src->yi;
-  zi = mri_src->zi;
 
   switch (axis) {
     case MRI_WIDTH:
@@ -3682,34 +3624,8 @@ MRI *MRIconvolve1dFloat(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis,
       }
       break;
     case MRI_HEIGHT:
-      for (z = 0; z < depth; z++) {
-        for (y = 0; y < height; y++) {
-          outPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-          for (x = 0; x < width; x++) {
-            total = 0.0f;
-
-            for (ki = k, i = 0; i < len; i++)
-              total += *ki++ * (float)(MRIFseq_vox(mri_src, x, yi[y + i - halflen], z, src_frame));
-
-            *outPix++ = total;
-          }
-        }
-      }
-      break;
     case MRI_DEPTH:
-      for (z = 0; z < depth; z++) {
-        for (y = 0; y < height; y++) {
-          outPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-          for (x = 0; x < width; x++) {
-            total = 0.0f;
-
-            for (ki = k, i = 0; i < len; i++)
-              total += *ki++ * (float)(MRIFseq_vox(mri_src, x, y, zi[z + i - halflen], src_frame));
-
-            *outPix++ = total;
-          }
-        }
-      }
+      mriConvolve1dRows<float>(mri_src, mri_dst, k, len, axis, src_frame, dst_frame);
       break;
   }
 
@@ -65,6 +65,7 @@
 #include "math.h"
 #include "matrix.h"
 #include "mghendian.h"
+#include "mgzblock.h"
 #include "mri2.h"
 #include "mri_circulars.h"
 #include "mri_identify.h"
@@ -178,6 +179,7 @@ static MRI *sdtRead(const char *fname, int read_volume);
 static MRI *mghRead(const char *fname, int read_volume, int frame);
 static int mghWrite(MRI *mri, const char *fname, int frame);
 static int mghAppend(MRI *mri, const char *fname, int frame);
+static MRI *mriAllocMapped(const char *fname, size_t offset, int width, int height, int depth, int type, int nframes);
 
 /********************************************/
 
@@ -688,7 +690,13 @@ MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int
     mri = sdtRead(fname_copy, volume_flag);
   }
   else if (type == MRI_MGH_FILE) {
-    mri = mghRead(fname_copy, volume_flag, -1);
+    if (volume_flag && start_frame >= 0 && start_frame == end_frame && MGZBisBlocked(fname_copy)) {
+      // block-compressed mgz: only inflate the blocks holding the requested frame
+      mri = mghRead(fname_copy, volume_flag, start_frame);
+      start_frame = -1;
+    }
+    else
+      mri = mghRead(fname_copy, volume_flag, -1);
   }
   else if (type == MGH_MORPH) {
     int which = start_frame ;
@@ -944,7 +952,10 @@ MRI *MRIreadType(const char *fname, int type)
 
   chklc();
 
+  ROMP_SCOPE_begin
   mri = mri_read(fname, type, TRUE, -1, -1);
+  if (mri) ROMP_COUNT_FILE(input_file_bytes, fname);
+  ROMP_SCOPE_end
 
   return (mri);
 
@@ -962,7 +973,10 @@ MRI *MRIread(const char *fname)
   int nstart = global_progress_range[0];
   int nend = global_progress_range[1];
   global_progress_range[1] = nstart + (nend - nstart) * 2 / 3;
+  ROMP_SCOPE_begin
   mri = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, TRUE, -1, -1);
+  if (mri) ROMP_COUNT_FILE(input_file_bytes, fname);
+  ROMP_SCOPE_end
 
   /* some volume format needs to read many
      different files for slices (GE DICOM or COR).
@@ -979,7 +993,7 @@ MRI *MRIread(const char *fname)
 } /* end MRIread() */
 
 // allow picking one frame out of many frame
-// currently implemented only for Siemens dicom file
+// currently implemented only for Siemens dicom file and block-compressed mgz
 MRI *MRIreadEx(const char *fname, int nthframe)
 {
   char buf[STRLEN];
@@ -989,7 +1003,10 @@ MRI *MRIreadEx(const char *fname, int nthframe)
 
   FileNameFromWildcard(fname, buf);
   fname = buf;
+  ROMP_SCOPE_begin
   mri = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, TRUE, nthframe, nthframe);
+  if (mri) ROMP_COUNT_FILE(input_file_bytes, fname);
+  ROMP_SCOPE_end
 
   /* some volume format needs to read many
      different files for slices (GE DICOM or COR).
@@ -1219,6 +1236,7 @@ int MRIwriteType(MRI *mri, const char *fname, int type)
                  "MRIwriteType(): code inconsistency "
                  "(file type recognized but not caught)"));
   }
+  if (!error) ROMP_COUNT_FILE(output_file_bytes, fname);
   if (error || mri->bvals == NULL) return (error);
 
   fstem = IDstemFromName(fname);
@@ -1268,7 +1286,9 @@ int MRIwrite(MRI *mri, const char *fname)
     ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "unknown file type for file (%s)", fname));
   }
 
+  ROMP_SCOPE_begin
   error = MRIwriteType(mri, fname, int_type);
+  ROMP_SCOPE_end
   return (error);
 
 } /* end MRIwrite() */
@@ -9356,7 +9376,7 @@ static MRI *niiRead(const char *fname, int read_volume)
   int n_read, i, j, k, t;
   int bytes_per_voxel, time_units, space_units;
   int use_compression, fnamelen;
-  int ncols, IsIco7 = 0;
+  int ncols, IsIco7 = 0, mapped = 0;
 
   use_compression = 0;
   fnamelen = strlen(fname);
@@ -9517,7 +9537,13 @@ static MRI *niiRead(const char *fname, int read_volume)
 
   if (ncols * hdr.dim[2] * hdr.dim[3] == 163842) IsIco7 = 1;
 
-  if (read_volume)
+  // unscaled, native byte order data can be mapped instead of read
+  mri = NULL;
+  if (read_volume && !use_compression && !swapped_flag && hdr.scl_slope == 0 && hdr.datatype != DT_DOUBLE)
+    mri = mriAllocMapped(fname, (size_t)hdr.vox_offset, ncols, hdr.dim[2], hdr.dim[3], fs_type, nslices);
+  if (mri)
+    mapped = 1;
+  else if (read_volume)
     mri = MRIallocSequence(ncols, hdr.dim[2], hdr.dim[3], fs_type, nslices);
   else {
     if (!IsIco7)
@@ -9596,6 +9622,15 @@ static MRI *niiRead(const char *fname, int read_volume)
 
   if (!read_volume) return (mri);
 
+  if (mapped) {
+    if (IsIco7) {
+      mritmp = mri_reshape(mri, 163842, 1, 1, mri->nframes);
+      MRIfree(&mri);
+      mri = mritmp;
+    }
+    return (mri);
+  }
+
   fp = znzopen(fname, "r", use_compression);
   if (fp == NULL) {
     MRIfree(&mri);
@@ -11384,16 +11419,152 @@ int znzTAGreadMRIframes(znzFile fp, MRI *mri, long len)
 #define USED_SPACE_SIZE (3 * sizeof(float) + 4 * 3 * sizeof(float))
 
 #define MGH_VERSION 1
+#define MGH_HEADER_SIZE (7 * sizeof(int) + UNUSED_SPACE_SIZE)
 
 // declare function pointer
 // static int (*myclose)(FILE *stream);
 
+/*!
+  \fn static znzFile znzFromFILE(FILE *fp)
+  \brief Wraps an uncompressed stdio stream (eg, a memory stream) in a
+  znzFile so that the regular mgh reading/writing code can use it.
+*/
+static znzFile znzFromFILE(FILE *fp)
+{
+  znzFile file;
+
+  if (fp == NULL) return (NULL);
+  file = (znzFile)calloc(1, sizeof(struct znzptr));
+  file->withz = 0;
+  file->nzfptr = fp;
+  return (file);
+}
+
+/*!
+  \fn static MRI *mriAllocMapped(const char *fname, size_t offset, int width, int height, int depth, int type, int nframes)
+  \brief When FS_MMAP_VOLUMES is set (and not 0), returns a volume whose image
+  buffer is a copy-on-write mapping of the voxel data of an uncompressed file
+  starting at offset (see MRI::mapChunk). Only pages that are touched are ever
+  read, so header-only consumers and tools that look at a sub-block of a large
+  4D file skip most of the I/O. Returns NULL if mapping is disabled or fails, in
+  which case the caller reads the volume as usual. This is opt-in because a
+  mapped volume must not outlive truncation of its file (ie, a tool writing its
+  output over its input).
+*/
+static MRI *mriAllocMapped(const char *fname, size_t offset, int width, int height, int depth, int type, int nframes)
+{
+  const char *s = getenv("FS_MMAP_VOLUMES");
+  if (s == NULL || strcmp(s, "0") == 0) return (NULL);
+
+  MRI *mri = MRIallocHeader(width, height, depth, type, nframes);
+  if (!mri->mapChunk(fname, offset)) {
+    MRIfree(&mri);
+    return (NULL);
+  }
+  mri->ras_good_flag = 1;  // as set by MRIallocSequence
+  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) printf("mapped %zu bytes of image data from %s\n", mri->bytes_total, fname);
+  return (mri);
+}
+
+/*!
+  \fn static znzFile mghOpenBlocked(const char *fname, int read_volume, int frame, char **pbuf)
+  \brief Opens a block-compressed mgz (see mgzblock.h) as a seekable stream
+  over an in-memory image of the uncompressed file. Only the header, the
+  frames that mghRead() will actually read and the trailing tags are
+  inflated (in parallel); the rest of the image is never touched. The
+  image is returned in pbuf and must be freed after the stream is closed.
+*/
+static znzFile mghOpenBlocked(const char *fname, int read_volume, int frame, char **pbuf)
+{
+  MGZ_BLOCKED *mgzb;
+  char *buf;
+  int width, height, depth, nframes, type, bpv, start_frame, end_frame;
+  size_t frame_bytes, data_end;
+
+  *pbuf = NULL;
+  mgzb = MGZBopen(fname);
+  if (mgzb == NULL) return (NULL);
+  if (mgzb->total_size < MGH_HEADER_SIZE) {
+    MGZBclose(&mgzb);
+    ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): file too short", fname));
+  }
+
+  // large callocs are lazily zero-mapped, so skipped frames cost no memory
+  buf = (char *)calloc(mgzb->total_size, 1);
+  if (MGZBread(mgzb, buf, 0, MGH_HEADER_SIZE) != NO_ERROR) {
+    MGZBclose(&mgzb);
+    free(buf);
+    return (NULL);
+  }
+  width = orderIntBytes(((int *)buf)[1]);
+  height = orderIntBytes(((int *)buf)[2]);
+  depth = orderIntBytes(((int *)buf)[3]);
+  nframes = orderIntBytes(((int *)buf)[4]);
+  type = orderIntBytes(((int *)buf)[5]);
+  switch (type) {
+    case MRI_UCHAR:
+      bpv = sizeof(char);
+      break;
+    case MRI_SHORT:
+      bpv = sizeof(short);
+      break;
+    case MRI_INT:
+      bpv = sizeof(int);
+      break;
+    case MRI_TENSOR:
+      bpv = sizeof(float);
+      nframes = 9;
+      break;
+    default:
+      bpv = sizeof(float);
+      break;
+  }
+  frame_bytes = (size_t)width * height * depth * bpv;
+  data_end = MGH_HEADER_SIZE + frame_bytes * nframes;
+
+  start_frame = 0;
+  end_frame = -1;
+  if (read_volume) {
+    if (frame >= 0)
+      start_frame = end_frame = frame;
+    else
+      end_frame = (frame < -1) ? -frame - 1 : nframes - 1;
+  }
+  if (end_frame >= nframes || data_end > mgzb->total_size) {
+    MGZBclose(&mgzb);
+    free(buf);
+    ErrorReturn(NULL,
+                (ERROR_BADPARM, "mghRead(%s, %d): frame out of range (%d frames in volume)", fname, frame, nframes));
+  }
+
+  if ((end_frame >= start_frame &&
+       MGZBread(mgzb,
+                buf + MGH_HEADER_SIZE + frame_bytes * start_frame,
+                MGH_HEADER_SIZE + frame_bytes * start_frame,
+                frame_bytes * (end_frame - start_frame + 1)) != NO_ERROR) ||
+      MGZBread(mgzb, buf + data_end, data_end, mgzb->total_size - data_end) != NO_ERROR) {
+    MGZBclose(&mgzb);
+    free(buf);
+    return (NULL);
+  }
+
+  *pbuf = buf;
+  buf = NULL;
+  znzFile fp = znzFromFILE(fmemopen(*pbuf, mgzb->total_size, "rb"));
+  MGZBclose(&mgzb);
+  if (znz_isnull(fp)) {
+    free(*pbuf);
+    *pbuf = NULL;
+  }
+  return (fp);
+}
+
 static MRI *mghRead(const char *fname, int read_volume, int frame)
 {
   MRI *mri;
   znzFile fp;
-  int start_frame, end_frame, width, height, depth, nframes, type, x, y, z, bpv, dof, bytes, version, ival,
-      unused_space_size, good_ras_flag, i;
+  int start_frame, end_frame, width, height, depth, nframes, file_nframes, type, x, y, z, bpv, dof, bytes, version,
+      ival, unused_space_size, good_ras_flag, i;
   BUFTYPE *buf;
   char unused_buf[UNUSED_SPACE_SIZE + 1];
   float fval, xsize, ysize, zsize, x_r, x_a, x_s, y_r, y_a, y_s, z_r, z_a, z_s, c_r, c_a, c_s, xfov, yfov, zfov;
@@ -11403,6 +11574,7 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
   int gzipped = 0;
   int nread;
   int tag;
+  char *blockbuf = NULL;
 
   ext = strrchr(fname, '.');
   int valid_ext = 0;
@@ -11419,7 +11591,12 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
   }
 
   if (valid_ext) {
-    fp = znzopen(fname, "rb", gzipped);
+    if (gzipped && MGZBisBlocked(fname)) {
+      fp = mghOpenBlocked(fname, read_volume, frame, &blockbuf);
+      gzipped = 0;  // the memory image is seekable
+    }
+    else
+      fp = znzopen(fname, "rb", gzipped);
     if (znz_isnull(fp)) {
       errno = 0;
       ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): could not open file", fname, frame));
@@ -11496,6 +11673,7 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
       nframes = 9;
       break;
   }
+  file_nframes = nframes;
   bytes = width * height * bpv; /* bytes per slice */
   if (!read_volume) {
     mri = MRIallocHeader(width, height, depth, type, nframes);
@@ -11533,15 +11711,31 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
       end_frame = nframes - 1;
       if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "read %d frames\n", nframes);
     }
+    // the on-disk layout matches the in-memory one when no byte swapping is needed
+    mri = NULL;
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    if (type == MRI_UCHAR && !gzipped && !blockbuf)
+#else
+    if (type != MRI_TENSOR && !gzipped && !blockbuf)
+#endif
+      mri = mriAllocMapped(fname, MGH_HEADER_SIZE + (size_t)start_frame * bytes * depth, width, height, depth, type, nframes);
+    if (mri) {
+      mri->dof = dof;
+      znzseek(fp, (long)nframes * bytes * depth, SEEK_CUR);
+      end_frame = start_frame - 1;  // nothing left to read
+    }
+    else {
+      mri = MRIallocSequence(width, height, depth, type, nframes);
+      mri->dof = dof;
+    }
     buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
-    mri = MRIallocSequence(width, height, depth, type, nframes);
-    mri->dof = dof;
     for (frame = start_frame; frame <= end_frame; frame++) {
       for (z = 0; z < depth; z++) {
         if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes) {
           // fclose(fp) ;
           znzclose(fp);
           free(buf);
+          if (blockbuf) free(blockbuf);
           ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %d bytes at slice %d", fname, bytes, z));
         }
         switch (type) {
@@ -11582,6 +11776,19 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
       }
     }
     if (buf) free(buf);
+
+    // skip any frames after the ones read so that the tags are found
+    long skip_bytes = (long)(file_nframes - start_frame - nframes) * bytes * depth;
+    if (skip_bytes > 0) {
+      if (gzipped) {  // pipe cannot seek
+        long count;
+        uchar skip_buf[STRLEN];
+        for (count = 0; count < skip_bytes - STRLEN; count += STRLEN) znzread(skip_buf, STRLEN, 1, fp);
+        znzread(skip_buf, skip_bytes - count, 1, fp);
+      }
+      else
+        znzseek(fp, skip_bytes, SEEK_CUR);
+    }
   }
 
   if (good_ras_flag > 0) {
@@ -11722,6 +11929,7 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
 
   // fclose(fp) ;
   znzclose(fp);
+  if (blockbuf) free(blockbuf);
 
   // xstart, xend, ystart, yend, zstart, zend are not stored
   mri->xstart = -mri->width / 2. * mri->xsize;
@@ -11748,6 +11956,9 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
   short sval;
   int gzipped = 0;
   const char *ext;
+  char *blockbuf = NULL;
+  size_t blockbuf_size = 0;
+  int blocked = 0;
 
   if (frame >= 0)
     start_frame = end_frame = frame;
@@ -11770,7 +11981,13 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
     }
   }
   if (valid_ext) {
-    fp = znzopen(fname, "wb", gzipped);
+    if (gzipped && MGZBwriteEnabled()) {
+      // write the uncompressed image to memory, block-compress it on close
+      blocked = 1;
+      fp = znzFromFILE(open_memstream(&blockbuf, &blockbuf_size));
+    }
+    else
+      fp = znzopen(fname, "wb", gzipped);
     if (znz_isnull(fp)) {
       errno = 0;
       ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "mghWrite(%s, %d): could not open file", fname, frame));
@@ -11922,6 +12139,12 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
   // fclose(fp) ;
   znzclose(fp);
 
+  if (blocked) {
+    int error = MGZBwrite(fname, blockbuf, blockbuf_size, MGZB_DEFAULT_BLOCK_SIZE);
+    free(blockbuf);
+    return (error);
+  }
+
   return (NO_ERROR);
 }
 
@@ -159,11 +159,11 @@ static void mhtVertex2xyz_double   (VERTEX const *vtx, int which, double *x, dou
 static void mhtVertex2Ptxyz_double (VERTEX const *vtx, int which, Ptdbl_t *pt);
 static void mhtVertex2array3_double(VERTEX const *vtx, int which, double  *array3);
 
-static int mhtAddFaceOrVertexAtCoords(MRIS_HASH_TABLE *mht, float x, float y, float z, int forvnum);
 static int mhtAddFaceOrVertexAtVoxIx(MRIS_HASH_TABLE *mht, int xv, int yv, int zv, int forvnum);
 static int mhtRemoveFaceOrVertexAtVoxIx(MRIS_HASH_TABLE *mht, int xv, int yv, int zv, int forvnum);
 
 static int mhtFaceToMHT(MRIS_HASH_TABLE *mht, MRIS const *mris, int fno, int on);
+static int mhtFaceToVoxelList(MRIS_HASH_TABLE const *mht, MRIS const *mris, int fno, VOXEL_LISTgw *voxlist);
 static int mhtVoxelList_Init(VOXEL_LISTgw *voxlist);
 static int mhtVoxelList_SampleTriangle(
     float mhtres, Ptdbl_t const *vpt0, Ptdbl_t const *vpt1, Ptdbl_t const *vpt2, VOXEL_LISTgw *voxlist);
@@ -269,29 +269,33 @@ static void checkThread0()
 #endif
 }
  
+// A table that was bulk built and has not been modified since is readonly.
+// Any number of threads may query it without locking, as long as nothing
+// modifies it concurrently - which would need MHT_maybeParallel_begin anyway.
+//
 static void lockBuckets(const MRIS_HASH_TABLE *mhtc) {
 #ifdef HAVE_OPENMP
     MRIS_HASH_TABLE *mht = (MRIS_HASH_TABLE *)mhtc;
-    if (parallelLevel) omp_set_lock(&mht->buckets_lock); else checkThread0();
+    if (parallelLevel) omp_set_lock(&mht->buckets_lock); else if (!mht->readonly) checkThread0();
 #endif
 }
 static void unlockBuckets(const MRIS_HASH_TABLE *mhtc) {
 #ifdef HAVE_OPENMP
     MRIS_HASH_TABLE *mht = (MRIS_HASH_TABLE *)mhtc;
-    if (parallelLevel) omp_unset_lock(&mht->buckets_lock); else checkThread0();
+    if (parallelLevel) omp_unset_lock(&mht->buckets_lock); else if (!mht->readonly) checkThread0();
 #endif
 }
 
 static void lockBucket(const MHBT *bucketc) {
 #ifdef HAVE_OPENMP
     MHBT *bucket = (MHBT *)bucketc;
-    if (parallelLevel) omp_set_lock(&bucket->bucket_lock); else checkThread0();
+    if (parallelLevel) omp_set_lock(&bucket->bucket_lock); else if (!bucket->readonly) checkThread0();
 #endif
 }
 static void unlockBucket(const MHBT *bucketc) {
 #ifdef HAVE_OPENMP
     MHBT *bucket = (MHBT *)bucketc;
-    if (parallelLevel) omp_unset_lock(&bucket->bucket_lock); else checkThread0();
+    if (parallelLevel) omp_unset_lock(&bucket->bucket_lock); else if (!bucket->readonly) checkThread0();
 #endif
 }
 
@@ -415,6 +419,127 @@ Done:
 }
 
 
+// Bulk building
+//
+// The entries for a table are generated in parallel into per-chunk, per-slab
+// staging lists, then each slab of buckets is filled by one thread.  A slab is
+// every xv with the same xv % nslabs, so no two threads ever touch the same slice
+// or bucket and no locks are needed.  The chunks are consecutive ranges of
+// face or vertex numbers and are merged in chunk order, so every bucket ends up
+// with exactly the same bins in exactly the same order as the serial build.
+//
+typedef struct {
+  int xv, yv, zv, fno;
+} MHT_STAGED_ENTRY;
+
+typedef struct {
+  int               nused, max;
+  MHT_STAGED_ENTRY* entries;
+} MHT_STAGED;
+
+static int mhtBulkWidth()
+{
+#ifdef HAVE_OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+static void mhtStage(MHT_STAGED* staged, int nslabs, int xv, int yv, int zv, int fno)
+{
+  if (xv < 0) xv = 0;
+  if (xv >= TABLE_SIZE) xv = TABLE_SIZE - 1;
+  if (yv < 0) yv = 0;
+  if (yv >= TABLE_SIZE) yv = TABLE_SIZE - 1;
+  if (zv < 0) zv = 0;
+  if (zv >= TABLE_SIZE) zv = TABLE_SIZE - 1;
+
+  MHT_STAGED* slab = &staged[xv % nslabs];
+  if (slab->nused == slab->max) {
+    slab->max = MAX(64, 2 * slab->max);
+    slab->entries = (MHT_STAGED_ENTRY *)realloc(slab->entries, slab->max * sizeof(MHT_STAGED_ENTRY));
+    if (!slab->entries) ErrorExit(ERROR_NO_MEMORY, "%s: could not stage %d entries.\n", __MYFUNCTION__, slab->max);
+  }
+  MHT_STAGED_ENTRY* e = &slab->entries[slab->nused++];
+  e->xv = xv; e->yv = yv; e->zv = zv; e->fno = fno;
+}
+
+// Only called by the thread that owns the slab containing xv
+//
+static void mhtBulkInsert(MRIS_HASH_TABLE *mht, MHT_STAGED_ENTRY const *e)
+{
+  MHBT** slice = mht->buckets_mustUseAcqRel[e->xv][e->yv];
+  if (!slice) {
+    mht->buckets_mustUseAcqRel[e->xv][e->yv] = slice = (MHBT **)calloc(TABLE_SIZE, sizeof(MHBT *));
+    if (!slice) ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate slice.", __MYFUNCTION__);
+  }
+
+  MHBT* bucket = slice[e->zv];
+  if (!bucket) {
+    slice[e->zv] = bucket = (MHBT *)calloc(1, sizeof(MHBT));
+    if (!bucket) ErrorExit(ERROR_NOMEMORY, "%s couldn't allocate bucket.\n", __MYFUNCTION__);
+#ifdef HAVE_OPENMP
+    omp_init_lock(&bucket->bucket_lock);
+#endif
+    bucket->readonly = true;
+    reallocBins(bucket, 4);
+  }
+
+  // The entries for a bucket arrive in increasing fno order, so a repeat can only be the last one
+  //
+  if (bucket->nused && bucket->bins[bucket->nused - 1].fno == e->fno) return;
+
+  reallocBins(bucket, bucket->nused + 1);
+  bucket->bins[bucket->nused++].fno = e->fno;
+}
+
+static void mhtBulkMerge(MRIS_HASH_TABLE *mht, MHT_STAGED* staged, int nchunks, int nslabs)
+{
+  int slab;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic,1)
+#endif
+  for (slab = 0; slab < nslabs; slab++) {
+    ROMP_PFLB_begin
+    int chunk;
+    for (chunk = 0; chunk < nchunks; chunk++) {
+      MHT_STAGED* s = &staged[chunk*nslabs + slab];
+      int i;
+      for (i = 0; i < s->nused; i++) mhtBulkInsert(mht, &s->entries[i]);
+      free(s->entries);
+      s->entries = NULL;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  mht->readonly = true;
+}
+
+// Called before any change to the table.  Once cleared, the table goes back
+// to the thread-0-only or MHT_maybeParallel_begin rules.
+//
+static void mhtNotReadonly(MRIS_HASH_TABLE *mht)
+{
+  if (!mht->readonly) return;
+#ifdef HAVE_OPENMP
+  if (parallelLevel) return;    // locks are being used anyway
+#endif
+  checkThread0();
+  mht->readonly = false;
+  int xv, yv, zv;
+  for (xv = 0; xv < TABLE_SIZE; xv++) {
+    for (yv = 0; yv < TABLE_SIZE; yv++) {
+      MHBT** slice = mht->buckets_mustUseAcqRel[xv][yv];
+      if (!slice) continue;
+      for (zv = 0; zv < TABLE_SIZE; zv++) if (slice[zv]) slice[zv]->readonly = false;
+    }
+  }
+}
+
+
 #define buckets_mustUseAcqRel SHOULD_NOT_ACCESS_BUCKETS_DIRECTLY
 
 //=============================================================================
@@ -450,13 +575,41 @@ MRIS_HASH_TABLE *MHTcreateFaceTable_Resolution(
   mht->which_vertices = which;
   mht->fno_usage = MHTFNO_FACE;
 
-  int fno;
-  for (fno = 0; fno < mris->nfaces; fno++) {
-    FACE const* f = &mris->faces[fno];
-    if (f->ripflag) continue;
-    if (fno == Gdiag_no) DiagBreak();
-    mhtFaceToMHT(mht, mris, fno, 1);
+  int const nslabs = mhtBulkWidth(), nchunks = nslabs;
+  MHT_STAGED* staged = (MHT_STAGED *)calloc(nchunks*nslabs, sizeof(MHT_STAGED));
+  if (!staged) ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate staging.\n", __MYFUNCTION__);
+
+  int chunk;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (chunk = 0; chunk < nchunks; chunk++) {
+    ROMP_PFLB_begin
+    VOXEL_LISTgw* voxlist = (VOXEL_LISTgw *)malloc(sizeof(VOXEL_LISTgw));
+    if (!voxlist) ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate voxel list.\n", __MYFUNCTION__);
+
+    int const fnoLo = (int)((long)mris->nfaces *  chunk      / nchunks);
+    int const fnoHi = (int)((long)mris->nfaces * (chunk + 1) / nchunks);
+    int fno;
+    for (fno = fnoLo; fno < fnoHi; fno++) {
+      FACE const* f = &mris->faces[fno];
+      if (f->ripflag) continue;
+      if (fno == Gdiag_no) DiagBreak();
+      mhtFaceToVoxelList(mht, mris, fno, voxlist);
+      int vlix;
+      for (vlix = 0; vlix < voxlist->nused; vlix++)
+        mhtStage(&staged[chunk*nslabs], nslabs,
+          voxlist->voxels[vlix][0], voxlist->voxels[vlix][1], voxlist->voxels[vlix][2], fno);
+    }
+
+    free(voxlist);
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
+
+  mhtBulkMerge(mht, staged, nchunks, nslabs);
+  free(staged);
 
   //-------------------------------------------
   // Diagnostics
@@ -524,6 +677,7 @@ int MHTaddAllFaces(MRIS_HASH_TABLE *mht, MRIS const *mris, VERTEX_TOPOLOGY const
     ErrorExit(ERROR_BADPARM, "%s: mht not initialized for faces\n", __MYFUNCTION__);
   }
 
+  mhtNotReadonly(mht);
   for (fi = 0; fi < v->num; fi++) mhtFaceToMHT(mht, mris, v->f[fi], 1);
   return (NO_ERROR);
 }
@@ -544,6 +698,7 @@ int MHTremoveAllFaces(MRIS_HASH_TABLE *mht, MRIS const *mris, VERTEX_TOPOLOGY co
     ErrorExit(ERROR_BADPARM, "%s: mht not initialized for faces\n", __MYFUNCTION__);
   }
 
+  mhtNotReadonly(mht);
   for (fno = 0; fno < v->num; fno++) mhtFaceToMHT(mht, mris, v->f[fno], 0);
   return (NO_ERROR);
 }
@@ -554,15 +709,39 @@ int MHTremoveAllFaces(MRIS_HASH_TABLE *mht, MRIS const *mris, VERTEX_TOPOLOGY co
   of MHT Voxels (buckets) in which to list fno.
   -------------------------------------------------*/
 static int mhtFaceToMHT(MRIS_HASH_TABLE *mht, MRIS const *mris, int fno, int on)
+{
+  //------------------------------------
+  VOXEL_LISTgw voxlist;
+  int vlix, i, j, k;
+
+  mhtFaceToVoxelList(mht, mris, fno, &voxlist);
+
+  for (vlix = 0; vlix < voxlist.nused; vlix++) {
+    i = voxlist.voxels[vlix][0];
+    j = voxlist.voxels[vlix][1];
+    k = voxlist.voxels[vlix][2];
+
+    if (on)
+      mhtAddFaceOrVertexAtVoxIx(mht, i, j, k, fno);
+    else
+      mhtRemoveFaceOrVertexAtVoxIx(mht, i, j, k, fno);
+  }
+  return (NO_ERROR);
+}
+
+/*-------------------------------------------------
+  mhtFaceToVoxelList
+  Lists the MHT Voxels (buckets) that face fno impinges upon.
+  Does not touch the buckets, so is safe to call from many threads.
+  -------------------------------------------------*/
+static int mhtFaceToVoxelList(MRIS_HASH_TABLE const *mht, MRIS const *mris, int fno, VOXEL_LISTgw *voxlist)
 {
   //------------------------------------
   FACE const *face;
   VERTEX const *v0, *v1, *v2;
   Ptdbl_t vpt0, vpt1, vpt2;
-  VOXEL_LISTgw voxlist;
-  int vlix, i, j, k;
 
-  mhtVoxelList_Init(&voxlist);
+  mhtVoxelList_Init(voxlist);
 
   face = &mris->faces[fno];
   if (face->ripflag) return (NO_ERROR);
@@ -583,18 +762,8 @@ static int mhtFaceToMHT(MRIS_HASH_TABLE *mht, MRIS const *mris, int fno, int on)
     dist2 = sqrt(SQR(vpt2.x - Gx) + SQR(vpt2.y - Gy) + SQR(vpt2.z - Gz));
     if (dist0 < mht->vres || dist1 < mht->vres || dist2 < mht->vres) DiagBreak();
   }
-  mhtVoxelList_SampleTriangle(mht->vres, &vpt0, &vpt1, &vpt2, &voxlist);
-
-  for (vlix = 0; vlix < voxlist.nused; vlix++) {
-    i = voxlist.voxels[vlix][0];
-    j = voxlist.voxels[vlix][1];
-    k = voxlist.voxels[vlix][2];
+  mhtVoxelList_SampleTriangle(mht->vres, &vpt0, &vpt1, &vpt2, voxlist);
 
-    if (on)
-      mhtAddFaceOrVertexAtVoxIx(mht, i, j, k, fno);
-    else
-      mhtRemoveFaceOrVertexAtVoxIx(mht, i, j, k, fno);
-  }
   return (NO_ERROR);
 }
 
@@ -804,10 +973,7 @@ MRIS_HASH_TABLE *MHTcreateVertexTable(MRIS const *mris, int which)
 MRIS_HASH_TABLE *MHTcreateVertexTable_Resolution(MRIS const *mris, int which, float res)
 //---------------------------------------------------------
 {
-  int vno;
   int xv, yv, zv;
-  float x = 0.0, y = 0.0, z = 0.0;
-  VERTEX const *v;
   static int ncalls = 0;
 
   //-----------------------------
@@ -825,14 +991,36 @@ MRIS_HASH_TABLE *MHTcreateVertexTable_Resolution(MRIS const *mris, int which, fl
   mht->which_vertices = which;
   mht->fno_usage = MHTFNO_VERTEX;
 
-  for (vno = 0; vno < mris->nvertices; vno++) {
-    v = &mris->vertices[vno];
-    if (vno == Gdiag_no) DiagBreak();
-    if (v->ripflag) continue;
+  int const nslabs = mhtBulkWidth(), nchunks = nslabs;
+  MHT_STAGED* staged = (MHT_STAGED *)calloc(nchunks*nslabs, sizeof(MHT_STAGED));
+  if (!staged) ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate staging.\n", __MYFUNCTION__);
 
-    mhtVertex2xyz_float(v, mht->which_vertices, &x, &y, &z);
-    mhtAddFaceOrVertexAtCoords(mht, x, y, z, vno);
+  int chunk;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (chunk = 0; chunk < nchunks; chunk++) {
+    ROMP_PFLB_begin
+    int const vnoLo = (int)((long)mris->nvertices *  chunk      / nchunks);
+    int const vnoHi = (int)((long)mris->nvertices * (chunk + 1) / nchunks);
+    int vno;
+    for (vno = vnoLo; vno < vnoHi; vno++) {
+      VERTEX const *v = &mris->vertices[vno];
+      if (vno == Gdiag_no) DiagBreak();
+      if (v->ripflag) continue;
+
+      float x = 0.0, y = 0.0, z = 0.0;
+      mhtVertex2xyz_float(v, mht->which_vertices, &x, &y, &z);
+      mhtStage(&staged[chunk*nslabs], nslabs,
+        WORLD_TO_VOXEL(mht, x), WORLD_TO_VOXEL(mht, y), WORLD_TO_VOXEL(mht, z), vno);
+    }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
+
+  mhtBulkMerge(mht, staged, nchunks, nslabs);
+  free(staged);
 
   //-------------------------------------------
   // Diagnostics
@@ -934,23 +1122,6 @@ static int mhtAddFaceOrVertexAtVoxIx(MRIS_HASH_TABLE *mht, int xv, int yv, int z
   return (NO_ERROR);
 }
 
-/*------------------------------------------------------------
-  mhtAddFaceOrVertexAtCoords
-  Converts x, y, z to bucket indexes, calls mhtAddFaceOrVertexAtIndexes
-  Adds forvnum (Face or Vertex number) to mht, in bucket(xv,yv,zv)
-  -------------------------------------------------------------*/
-static int mhtAddFaceOrVertexAtCoords(MRIS_HASH_TABLE *mht, float x, float y, float z, int forvnum)
-{
-  //---------------------------------------
-  int xv, yv, zv;
-
-  xv = WORLD_TO_VOXEL(mht, x);
-  yv = WORLD_TO_VOXEL(mht, y);
-  zv = WORLD_TO_VOXEL(mht, z);
-
-  return mhtAddFaceOrVertexAtVoxIx(mht, xv, yv, zv, forvnum);
-}
-
 /*------------------------------------------------------------
   mhtRemoveFaceOrVertexAtVoxIx (was mhtRemoveFacePosition)
   Reverse of mhtAddFaceOrVertexAtIndexes
@@ -1662,10 +1833,11 @@ void mhtFindCommonSanityCheck(MRIS_HASH_TABLE *mht, MRIS const *mris)
 //------------------------------------------
 // Simple instrumentation
 //------------------------------------------
-int FindBucketsChecked_Count;
-int FindBucketsPresent_Count;
-int VertexNumFoundByMHT; /* 2007-07-30 GW: Added to allow diagnostics even
-                            with fallback-to-brute-force */
+// Per thread, so that concurrent queries of a readonly table do not race
+static __thread int FindBucketsChecked_Count;
+static __thread int FindBucketsPresent_Count;
+static __thread int VertexNumFoundByMHT; /* 2007-07-30 GW: Added to allow diagnostics even
+                                            with fallback-to-brute-force */
 
 void MHTfindReportCounts(int *BucketsChecked, int *BucketsPresent, int *VtxNumByMHT)
 {
@@ -3373,7 +3545,12 @@ static void mhtStoreFaceCentroids(MHT* mht, MRIS const *mris, int which)
   mht->f = (MHT_FACE*)calloc(mht->nfaces, sizeof(MHT_FACE));
   
   int fno;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
   for (fno = 0; fno < mris->nfaces; fno++) {
+    ROMP_PFLB_begin
     
     float xt,yt,zt;
     mhtComputeFaceCentroid(mris, which, fno, &xt, &yt, &zt);
@@ -3382,5 +3559,7 @@ static void mhtStoreFaceCentroids(MHT* mht, MRIS const *mris, int which)
     face->cx = xt;
     face->cy = yt;
     face->cz = zt;
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 }
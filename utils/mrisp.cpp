@@ -28,9 +28,11 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "diag.h"
 #include "error.h"
+#include "fio.h"
 #include "macros.h"
 #include "mrisurf.h"
 #include "proto.h"
@@ -2007,6 +2009,113 @@ MRI_SP *MRISPblur(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno) {
         (do_old ? MRISPblur_old : MRISPblur_new)(mrisp_src, mrisp_dst, sigma, fno);
 }
 
+/*-----------------------------------------------------
+        Parameters:
+           dir - directory holding blurred templates, or NULL to
+                 stop caching
+
+        Description
+           Set where MRISPblurTemplate keeps the frames it blurs.
+------------------------------------------------------*/
+static char *mrisp_blur_cache_dir = NULL;
+
+int MRISPsetBlurCacheDir(const char *dir)
+{
+  if (mrisp_blur_cache_dir) free(mrisp_blur_cache_dir);
+  mrisp_blur_cache_dir = dir ? strcpyalloc(dir) : NULL;
+  return (NO_ERROR);
+}
+
+/* FNV-1a hash of the frames a blur depends on, used to name the cache file */
+static unsigned long long mrispHashFrames(MRI_SP *mrisp, int fno, int nframes)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+  int dims[3] = {mrisp->Ip->rows, mrisp->Ip->cols, nframes};
+  const unsigned char *bytes = (const unsigned char *)dims;
+  size_t n, nbytes = sizeof(dims);
+
+  for (n = 0; n < nbytes; n++) hash = (hash ^ bytes[n]) * 1099511628211ULL;
+  bytes = (const unsigned char *)IMAGEFseq_pix(mrisp->Ip, 0, 0, fno);
+  nbytes = (size_t)mrisp->Ip->rows * mrisp->Ip->cols * nframes * sizeof(float);
+  for (n = 0; n < nbytes; n++) hash = (hash ^ bytes[n]) * 1099511628211ULL;
+  return (hash);
+}
+
+/*-----------------------------------------------------
+        Parameters:
+
+        Returns value:
+           a clone of mrisp_src with frames fno..fno+nframes-1 blurred
+
+        Description
+           Equivalent to blurring each of the frames with MRISPblur into a
+           clone of mrisp_src. The blurred frames only depend on the template
+           and sigma, so when a cache directory has been set with
+           MRISPsetBlurCacheDir they are written there under a hash of the
+           source frames, and read back by later registrations against the
+           same atlas instead of being blurred again.
+------------------------------------------------------*/
+MRI_SP *MRISPblurTemplate(MRI_SP *mrisp_src, float sigma, int fno, int nframes)
+{
+  char fname[STRLEN], tmp_fname[STRLEN];
+  MRI_SP *mrisp_dst, *mrisp_cached;
+  int f;
+
+  mrisp_dst = MRISPclone(mrisp_src);
+  mrisp_dst->sigma = sigma;
+
+  /* the alternative blurs are selected by the environment, so don't cache them */
+  if (!mrisp_blur_cache_dir || mrisp_src->Ip->pixel_format != PFFLOAT || fno < 0 ||
+      fno + nframes > mrisp_src->Ip->num_frame || getenv("FREESUREFER_MRISPblur_old") || getenv("NO_SPHERE")) {
+    for (f = fno; f < fno + nframes; f++) MRISPblur(mrisp_src, mrisp_dst, sigma, f);
+    return (mrisp_dst);
+  }
+
+  if (snprintf(fname,
+               sizeof(fname),
+               "%s/mrisp.%016llx.sigma%2.4f.mgz",
+               mrisp_blur_cache_dir,
+               mrispHashFrames(mrisp_src, fno, nframes),
+               sigma) >= (int)sizeof(fname)) {
+    printf("WARNING: blurred template cache path in %s is too long, not caching\n", mrisp_blur_cache_dir);
+    for (f = fno; f < fno + nframes; f++) MRISPblur(mrisp_src, mrisp_dst, sigma, f);
+    return (mrisp_dst);
+  }
+  if (fio_FileExistsReadable(fname)) {
+    mrisp_cached = MRISPread(fname);
+    if (mrisp_cached && mrisp_cached->Ip->rows == mrisp_src->Ip->rows &&
+        mrisp_cached->Ip->cols == mrisp_src->Ip->cols && mrisp_cached->Ip->num_frame == nframes) {
+      printf("using blurred template frames %d-%d from %s\n", fno, fno + nframes - 1, fname);
+      ImageCopyFrames(mrisp_cached->Ip, mrisp_dst->Ip, 0, nframes, fno);
+      MRISPfree(&mrisp_cached);
+      return (mrisp_dst);
+    }
+    if (mrisp_cached) MRISPfree(&mrisp_cached);
+    printf("WARNING: ignoring blurred template cache %s, it doesn't match the template\n", fname);
+  }
+
+  for (f = fno; f < fno + nframes; f++) MRISPblur(mrisp_src, mrisp_dst, sigma, f);
+
+  /* write to a private name and rename, so concurrent registrations against
+     the same atlas never read a partially written file */
+  if (snprintf(tmp_fname, sizeof(tmp_fname), "%s.%d.mgz", fname, (int)getpid()) >= (int)sizeof(tmp_fname)) {
+    printf("WARNING: blurred template cache path %s is too long, not caching\n", fname);
+    return (mrisp_dst);
+  }
+  mrisp_cached = (MRI_SP *)calloc(1, sizeof(MRI_SP));
+  mrisp_cached->scale = mrisp_src->scale;
+  mrisp_cached->Ip = ImageAlloc(mrisp_src->Ip->rows, mrisp_src->Ip->cols, PFFLOAT, nframes);
+  ImageCopyFrames(mrisp_dst->Ip, mrisp_cached->Ip, fno, nframes, 0);
+  MRISPwrite(mrisp_cached, tmp_fname);
+  if (rename(tmp_fname, fname) != 0) {
+    printf("WARNING: could not cache blurred template in %s\n", fname);
+    unlink(tmp_fname);
+  }
+  MRISPfree(&mrisp_cached);
+
+  return (mrisp_dst);
+}
+
 static MRI_SP *MRISPblur_new(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno) {
   int fnoLo_init, fnoHi_init;
   int no_sphere_init;
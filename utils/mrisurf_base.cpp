@@ -714,6 +714,9 @@ MRIS *MRISoverAlloc(int max_vertices, int max_faces, int nvertices, int nfaces)
                 "MRISalloc(%d, %d): could not allocate mris structure", max_vertices, max_faces);
 
   MRISctr(mris, max_vertices, max_faces, nvertices, nfaces);
+  ROMP_COUNT(surface_allocs, 1);
+  ROMP_COUNT(surface_alloc_bytes,
+             (long)max_vertices * (sizeof(VERTEX) + sizeof(VERTEX_TOPOLOGY)) + (long)max_faces * sizeof(FACE));
 
   return (mris);
 }
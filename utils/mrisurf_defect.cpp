@@ -12744,28 +12744,56 @@ static int mrisTessellateDefect_wkr(MRI_SURFACE *mris,
 
   ROMP_SCOPE_begin
   /* find and discard all edges that intersect one that is already in the
-     tessellation.
+     tessellation and comes before them in the list. Each edge is tested
+     independently, then the list is compacted in order.
   */
-  for (ndiscarded = i = 0; i < nedges; i++) {
-    if (et[i].used != USED_IN_TESSELLATION) {
-      continue;
-    }
+  {
+    int nused, *used;
+    char *discard;
 
-    for (j = i + 1; j < nedges; j++) {
-      if (et[j].used == USED_IN_TESSELLATION) {
-        continue;
+    used = (int *)calloc(nedges, sizeof(int));
+    discard = (char *)calloc(nedges, sizeof(char));
+    if (!used || !discard)
+      ErrorExit(ERROR_NOMEMORY, "mrisTessellateDefect: could not allocate %d edge flags", nedges);
+    for (nused = i = 0; i < nedges; i++)
+      if (et[i].used == USED_IN_TESSELLATION) {
+        used[nused++] = i;
       }
 
-      if (edgesIntersect(mris_corrected, &et[i], &et[j])) {
-        ndiscarded++;
-        if (j < nedges - 1) {
-          memmove(&et[j], &et[j + 1], (nedges - j - 1) * sizeof(EDGE));
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 64)
+#endif
+    for (j = 0; j < nedges; j++) {
+      ROMP_PFLB_begin
+      int k;
+
+      if (et[j].used != USED_IN_TESSELLATION) {
+        for (k = 0; k < nused && used[k] < j; k++) {
+          if (edgesIntersect(mris_corrected, &et[used[k]], &et[j])) {
+            discard[j] = 1;
+            break;
+          }
         }
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
 
-        nedges--;
-        j--;
+    for (ndiscarded = i = j = 0; i < nedges; i++) {
+      if (discard[i]) {
+        ndiscarded++;
+        continue;
+      }
+      if (j != i) {
+        et[j] = et[i];
       }
+      j++;
     }
+    nedges = j;
+
+    free(used);
+    free(discard);
   }
   ROMP_SCOPE_end
   
@@ -13178,6 +13206,77 @@ static int defectPatchRank(DEFECT_PATCH *dps, int index, int npatches)
 
 #define MAX_EDGES 1000
 
+/*-----------------------------------------------------
+  mrisComputeEdgeOverlaps() - allocates and fills the lists of
+  the (at most MAX_EDGES) edges of the table that intersect each
+  one. The edges are independent, so the quadratic search is split
+  over threads. Each list is in increasing edge order whatever the
+  number of threads.
+  ------------------------------------------------------*/
+static void mrisComputeEdgeOverlaps(MRI_SURFACE *mris, EDGE_TABLE *etable)
+{
+  int const nedges = etable->nedges;
+  int i;
+
+  etable->overlapping_edges = (int **)calloc(nedges, sizeof(int *));
+  etable->noverlap = (int *)calloc(nedges, sizeof(int));
+  etable->flags = (unsigned char *)calloc(nedges, sizeof(unsigned char));
+  if (!etable->edges || !etable->overlapping_edges || !etable->noverlap || !etable->flags)
+    ErrorExit(ERROR_NOMEMORY,
+              "mrisComputeOptimalRetessellation: Excessive "
+              "topologic defect encountered: could not allocate %d "
+              "edge table",
+              nedges);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 64)
+#endif
+  for (i = 0; i < nedges; i++) /* compute overlapping for each edge */
+  {
+    ROMP_PFLB_begin
+    int j, noverlap, overlap[MAX_EDGES + 1];
+
+    if (nedges > 50000 && !(i % 25000)) {
+      fprintf(WHICH_OUTPUT, "%d of %d edges processed\n", i, nedges);
+    }
+    for (noverlap = j = 0; j < nedges; j++) {
+      if (j == i) {
+        continue;
+      }
+      if (edgesIntersect(mris, &etable->edges[i], &etable->edges[j])) {
+        overlap[noverlap] = j;
+        noverlap++;
+      }
+      if (noverlap > MAX_EDGES) {
+        break;
+      }
+    }
+    if (noverlap > 0) {
+      if (noverlap > MAX_EDGES) {
+        etable->noverlap[i] = MAX_EDGES;
+        etable->flags[i] |= ET_OVERLAP_LIST_INCOMPLETE;
+      }
+      else {
+        etable->noverlap[i] = noverlap;
+      }
+
+      etable->overlapping_edges[i] = (int *)calloc(etable->noverlap[i], sizeof(int));
+      if (!etable->overlapping_edges[i])
+        ErrorExit(ERROR_NOMEMORY,
+                  "mrisComputeOptimalRetessellation: Excessive "
+                  "topologic defect encountered: could not allocate "
+                  "overlap list %d "
+                  "with %d elts",
+                  i,
+                  etable->noverlap[i]);
+      memmove(etable->overlapping_edges[i], overlap, etable->noverlap[i] * sizeof(int));
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
 static int tessellatePatch(MRI *mri,
                            MRI_SURFACE *mris,
                            MRI_SURFACE *mris_corrected,
@@ -13520,15 +13619,15 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
 {
   DEFECT_VERTEX_STATE *dvs;
   DEFECT_PATCH dps1[MAX_PATCHES], dps2[MAX_PATCHES], *dps, *dp, *dps_next_generation;
-  int i, best_i, j, g, nselected, nreplacements, rank, nunchanged = 0, nelite, ncrossovers, k, l, noverlap;
-  int *overlap, ngenerations, nbests, last_euthanasia, nremovedvertices, nfinalvertices;
+  int i, best_i, j, g, nselected, nreplacements, rank, nunchanged = 0, nelite, ncrossovers, k, l;
+  int ngenerations, nbests, last_euthanasia, nremovedvertices, nfinalvertices;
   double fitness, best_fitness, last_best, fitness_mean, fitness_sigma, fitness_norm, pfitness, two_sigma_sq,
       last_fitness;
   static int dno = 0;     /* for debugging */
   static int nmovies = 1; /* for making movies :
                                  0 is left for the original surface*/
   EDGE_TABLE etable;
-  int max_patches = MAX_PATCHES, ranks[MAX_PATCHES], next_gen_index, selected[MAX_PATCHES], nzero, sno = 0, max_edges,
+  int max_patches = MAX_PATCHES, ranks[MAX_PATCHES], next_gen_index, selected[MAX_PATCHES], sno = 0, max_edges,
       debug_patch_n = -1, nbest = 0;
   MRI *mri_defect, *mri_defect_white, *mri_defect_gray, *mri_defect_sign;
   char fname[500];
@@ -13650,62 +13749,7 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
   memmove(etable.edges, et, nedges * sizeof(EDGE));
 
   if (etable.use_overlap) {
-    etable.overlapping_edges = (int **)calloc(nedges, sizeof(int *));
-    etable.noverlap = (int *)calloc(nedges, sizeof(int));
-    etable.flags = (unsigned char *)calloc(nedges, sizeof(unsigned char));
-    overlap = (int *)calloc(nedges, sizeof(int));
-    if (!etable.edges || !etable.overlapping_edges || !etable.noverlap || !overlap)
-      ErrorExit(ERROR_NOMEMORY,
-                "mrisComputeOptimalRetessellation: Excessive "
-                "topologic defect encountered: could not allocate %d "
-                "edge table",
-                nedges);
-
-    for (nzero = i = 0; i < nedges; i++) /* compute overlapping
-                                                        for each edge */
-    {
-      if (nedges > 50000 && !(i % 25000)) {
-        fprintf(WHICH_OUTPUT, "%d of %d edges processed\n", i, nedges);
-      }
-      etable.noverlap[i] = 0;
-      for (noverlap = j = 0; j < nedges; j++) {
-        if (j == i) {
-          continue;
-        }
-        if (edgesIntersect(mris_corrected, &et[i], &et[j])) {
-          overlap[noverlap] = j;
-          noverlap++;
-        }
-        if (noverlap > MAX_EDGES) {
-          break;
-        }
-      }
-      if (noverlap > 0) {
-        if (noverlap > MAX_EDGES) {
-          etable.noverlap[i] = MAX_EDGES;
-          etable.flags[i] |= ET_OVERLAP_LIST_INCOMPLETE;
-        }
-        else {
-          etable.noverlap[i] = noverlap;
-        }
-
-        etable.overlapping_edges[i] = (int *)calloc(etable.noverlap[i], sizeof(int));
-        if (!etable.overlapping_edges[i])
-          ErrorExit(ERROR_NOMEMORY,
-                    "mrisComputeOptimalRetessellation: Excessive "
-                    "topologic defect encountered: could not allocate "
-                    "overlap list %d "
-                    "with %d elts",
-                    i,
-                    etable.noverlap[i]);
-        memmove(etable.overlapping_edges[i], overlap, etable.noverlap[i] * sizeof(int));
-      }
-      else {
-        nzero++;
-      }
-    }
-
-    free(overlap);
+    mrisComputeEdgeOverlaps(mris_corrected, &etable);
   }
 
   ROMP_SCOPE_end
@@ -14962,8 +15006,8 @@ static int mrisComputeRandomRetessellation(MRI_SURFACE *mris,
 {
   DEFECT_VERTEX_STATE *dvs;
   DEFECT_PATCH dp;
-  int niters, m, tmp, best_i, i, j, k, noverlap;
-  int *overlap, ngenerations, nbests, last_euthanasia;
+  int niters, m, tmp, best_i, i, j, k;
+  int ngenerations, nbests, last_euthanasia;
   int nremovedvertices, nfinalvertices;
   double fitness, best_fitness;
   static int dno = 0; /* for debugging */
@@ -15016,57 +15060,7 @@ static int mrisComputeRandomRetessellation(MRI_SURFACE *mris,
   memmove(etable.edges, et, nedges * sizeof(EDGE));
 
   if (etable.use_overlap) {
-    etable.overlapping_edges = (int **)calloc(nedges, sizeof(int *));
-    etable.noverlap = (int *)calloc(nedges, sizeof(int));
-    etable.flags = (unsigned char *)calloc(nedges, sizeof(unsigned char));
-    overlap = (int *)calloc(nedges, sizeof(int));
-    if (!etable.edges || !etable.overlapping_edges || !etable.noverlap || !overlap)
-      ErrorExit(ERROR_NOMEMORY,
-                "mrisComputeOptimalRetessellation: Excessive "
-                "topologic defect encountered: could not allocate "
-                "%d edge table",
-                nedges);
-
-    for (i = 0; i < nedges; i++) /* compute overlapping for each edge */
-    {
-      if (nedges > 50000 && !(i % 25000)) {
-        printf("%d of %d edges processed\n", i, nedges);
-      }
-      etable.noverlap[i] = 0;
-      for (noverlap = j = 0; j < nedges; j++) {
-        if (j == i) {
-          continue;
-        }
-        if (edgesIntersect(mris_corrected, &et[i], &et[j])) {
-          overlap[noverlap] = j;
-          noverlap++;
-        }
-        if (noverlap > MAX_EDGES) {
-          break;
-        }
-      }
-      if (noverlap > 0) {
-        if (noverlap > MAX_EDGES) {
-          etable.noverlap[i] = MAX_EDGES;
-          etable.flags[i] |= ET_OVERLAP_LIST_INCOMPLETE;
-        }
-        else {
-          etable.noverlap[i] = noverlap;
-        }
-
-        etable.overlapping_edges[i] = (int *)calloc(etable.noverlap[i], sizeof(int));
-        if (!etable.overlapping_edges[i])
-          ErrorExit(ERROR_NOMEMORY,
-                    "mrisComputeOptimalRetessellation: Excessive "
-                    "topologic defect encountered: could not allocate "
-                    "overlap list %d "
-                    "with %d elts",
-                    i,
-                    etable.noverlap[i]);
-        memmove(etable.overlapping_edges[i], overlap, etable.noverlap[i] * sizeof(int));
-      };
-    }
-    free(overlap);
+    mrisComputeEdgeOverlaps(mris_corrected, &etable);
   }
 
   /* allocate the volume constituted by the potential edges */
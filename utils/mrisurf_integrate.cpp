@@ -970,8 +970,7 @@ int MRISregister(MRI_SURFACE *mris,
       mrisp = MRIStoParameterization(mris, NULL, 1, 0);
 #if 1
       parms->mrisp = MRISPblur(mrisp, NULL, sigma, 0);
-      parms->mrisp_template = MRISPblur(mrisp_template, NULL, sigma, ino);
-      MRISPblur(mrisp_template, parms->mrisp_template, sigma, ino + 1); /* variances */
+      parms->mrisp_template = MRISPblurTemplate(mrisp_template, sigma, ino, 2); /* means and variances */
 #else
       dof = *IMAGEFseq_pix(mrisp_template->Ip, 0, 0, 2);
       if (dof < 1) {
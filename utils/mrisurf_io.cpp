@@ -3880,10 +3880,14 @@ MRIS* MRISreadOverAlloc(const char *fname, double nVFMultiplier)
     }
   }
   
-  return 
-    useOldBehaviour 
+  MRIS *mris;
+  ROMP_SCOPE_begin
+  mris = useOldBehaviour 
     ? MRISreadOverAlloc_old(fname, nVFMultiplier)
     : MRISreadOverAlloc_new(fname, nVFMultiplier);
+  if (mris) ROMP_COUNT_FILE(input_file_bytes, fname);
+  ROMP_SCOPE_end
+  return mris;
 }
 
 static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier)
@@ -4792,9 +4796,14 @@ int MRISwrite(MRIS *mris, const char *name)
     }
   }
   
-  return useOldBehaviour
+  int error;
+  ROMP_SCOPE_begin
+  error = useOldBehaviour
     ? MRISwrite_old(mris, name)
     : MRISwrite_new(mris, name);
+  if (!error) ROMP_COUNT_FILE(output_file_bytes, name);
+  ROMP_SCOPE_end
+  return error;
 }
 
 static bool quadCombine(int quad[4], int vA[3], int vB[3])
@@ -58,6 +58,7 @@
 
 #define RESAMPLE_SOURCE_CODE_FILE
 
+#include <algorithm>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -859,6 +860,399 @@ MRI *vol2surf_linear(MRI *SrcVol,
   return (TrgVol);
 }
 
+/*------------------------------------------------------------
+  vol2surf_linear_weights() - precomputes, for every vertex and
+  every projection fraction in ProjFracs, which source voxels are
+  sampled and with what weights. The coordinate math is the same as
+  vol2surf_linear(), so applying the weights with
+  vol2surf_apply_weights() gives the same values as calling
+  vol2surf_linear() once per projection fraction and combining the
+  results the way mri_vol2surf does. Only SAMPLE_NEAREST and
+  SAMPLE_TRILINEAR on chunked UCHAR, SHORT, INT or FLOAT volumes are
+  supported (see vol2surf_weights_supported()). The weights depend
+  only on the surface, the source geometry and the projection
+  fractions, so one set can be applied to any number of frames.
+  ------------------------------------------------------------*/
+VOL2SURF_WEIGHTS *vol2surf_linear_weights(MRI *SrcVol,
+                                          MATRIX *Qsrc,
+                                          MATRIX *Fsrc,
+                                          MATRIX *Wsrc,
+                                          MATRIX *Dsrc,
+                                          MRI_SURFACE *TrgSurf,
+                                          const float *ProjFracs,
+                                          int nProjFracs,
+                                          int InterpMethod,
+                                          int float2int,
+                                          int ProjDistFlag)
+{
+  VOL2SURF_WEIGHTS *w;
+  MATRIX *QFWDsrc;
+  int FreeQsrc = 0, nthreads, tid;
+  MATRIX *Scrs[_MAX_FS_THREADS], *Txyz[_MAX_FS_THREADS];
+  int vtx;
+  size_t nsamples;
+
+  if (!vol2surf_weights_supported(SrcVol, InterpMethod)) {
+    printf("ERROR: vol2surf_linear_weights(): unsupported volume type or interpolation\n");
+    return (NULL);
+  }
+  if (float2int != FLT2INT_ROUND && float2int != FLT2INT_FLOOR && float2int != FLT2INT_TKREG) {
+    fprintf(stderr, "vol2surf_linear_weights(): unrecoginized float2int code %d\n", float2int);
+    return (NULL);
+  }
+
+  if (Qsrc == NULL) {
+    Qsrc = MRIxfmCRS2XYZtkreg(SrcVol);
+    Qsrc = MatrixInverse(Qsrc, Qsrc);
+    FreeQsrc = 1;
+  }
+  QFWDsrc = ComputeQFWD(Qsrc, Fsrc, Wsrc, Dsrc, NULL);
+  if (Gdiag_no >= 0) {
+    printf("QFWDsrc: vol2surf: ------------------------------\n");
+    MatrixPrint(stdout, QFWDsrc);
+    printf("--------------------------------------------------\n");
+  }
+
+  w = (VOL2SURF_WEIGHTS *)calloc(1, sizeof(VOL2SURF_WEIGHTS));
+  w->nvertices = TrgSurf->nvertices;
+  w->nprojfracs = nProjFracs;
+  w->InterpMethod = InterpMethod;
+  w->width = SrcVol->width;
+  w->height = SrcVol->height;
+  w->depth = SrcVol->depth;
+  w->type = SrcVol->type;
+  nsamples = (size_t)w->nvertices * nProjFracs;
+  w->status = (char *)calloc(nsamples, sizeof(char));
+  w->offset = (size_t *)calloc(nsamples * 8, sizeof(size_t));
+  w->weight = (double *)calloc(nsamples * 8, sizeof(double));
+  w->hitcrs = (int *)calloc((size_t)w->nvertices * 3, sizeof(int));
+  if (!w->status || !w->offset || !w->weight || !w->hitcrs) {
+    printf("ERROR: vol2surf_linear_weights(): could not alloc %lu samples\n", (unsigned long)nsamples);
+    vol2surf_free_weights(&w);
+    MatrixFree(&QFWDsrc);
+    if (FreeQsrc) MatrixFree(&Qsrc);
+    return (NULL);
+  }
+
+  nthreads = omp_get_max_threads();
+  if (nthreads > _MAX_FS_THREADS) nthreads = _MAX_FS_THREADS;
+  for (tid = 0; tid < nthreads; tid++) {
+    Scrs[tid] = MatrixAlloc(4, 1, MATRIX_REAL);
+    Txyz[tid] = MatrixAlloc(4, 1, MATRIX_REAL);
+    Txyz[tid]->rptr[3 + 1][0 + 1] = 1.0;
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) num_threads(nthreads) schedule(static, 1024)
+#endif
+  for (vtx = 0; vtx < w->nvertices; vtx++) {
+    ROMP_PFLB_begin
+    int p, k, icol, irow, islc, xm, xp, ym, yp, zm, zp;
+    float Tx, Ty, Tz, fcol, frow, fslc;
+    double x, y, z, xmd, ymd, zmd, xpd, ypd, zpd;
+    size_t s;
+    MATRIX *scrs = Scrs[omp_get_thread_num()], *txyz = Txyz[omp_get_thread_num()];
+
+    w->hitcrs[3 * vtx] = -1;
+    for (p = 0; p < nProjFracs; p++) {
+      s = (size_t)vtx * nProjFracs + p;
+      if (ProjFracs[p] != 0.0)
+        if (ProjDistFlag)
+          ProjNormDist(&Tx, &Ty, &Tz, TrgSurf, vtx, ProjFracs[p]);
+        else
+          ProjNormFracThick(&Tx, &Ty, &Tz, TrgSurf, vtx, ProjFracs[p]);
+      else {
+        Tx = TrgSurf->vertices[vtx].x;
+        Ty = TrgSurf->vertices[vtx].y;
+        Tz = TrgSurf->vertices[vtx].z;
+      }
+      txyz->rptr[0 + 1][0 + 1] = Tx;
+      txyz->rptr[1 + 1][0 + 1] = Ty;
+      txyz->rptr[2 + 1][0 + 1] = Tz;
+      MatrixMultiply(QFWDsrc, txyz, scrs);
+      fcol = scrs->rptr[1][1];
+      frow = scrs->rptr[2][1];
+      fslc = scrs->rptr[3][1];
+
+      switch (float2int) {
+        case FLT2INT_ROUND:
+          icol = nint(fcol);
+          irow = nint(frow);
+          islc = nint(fslc);
+          break;
+        case FLT2INT_FLOOR:
+          icol = (int)floor(fcol);
+          irow = (int)floor(frow);
+          islc = (int)floor(fslc);
+          break;
+        default: /* FLT2INT_TKREG */
+          icol = (int)floor(fcol);
+          irow = (int)ceil(frow);
+          islc = (int)floor(fslc);
+          break;
+      }
+      if (irow < 0 || irow >= w->height || icol < 0 || icol >= w->width || islc < 0 || islc >= w->depth) {
+        w->status[s] = VOL2SURF_SKIP;
+        continue;
+      }
+      if (p == nProjFracs - 1) {
+        w->hitcrs[3 * vtx + 0] = icol;
+        w->hitcrs[3 * vtx + 1] = irow;
+        w->hitcrs[3 * vtx + 2] = islc;
+      }
+      if (Gdiag_no == vtx) {
+        printf("diag -----------------------------\n");
+        printf("vtx = %d  %g %g %g\n", vtx, Tx, Ty, Tz);
+        printf("fCRS  %g %g %g\n", scrs->rptr[1][1], scrs->rptr[2][1], scrs->rptr[3][1]);
+        printf("CRS  %d %d %d\n", icol, irow, islc);
+      }
+
+      if (InterpMethod == SAMPLE_NEAREST) {
+        w->status[s] = VOL2SURF_NEAREST;
+        w->offset[8 * s] = icol + irow * SrcVol->vox_per_row + islc * SrcVol->vox_per_slice;
+        continue;
+      }
+
+      /* Same clamping and weights as MRIsampleSeqVolume() */
+      x = fcol;
+      y = frow;
+      z = fslc;
+      if (MRIindexNotInVolume(SrcVol, x, y, z) == 1) {
+        w->status[s] = VOL2SURF_OUTSIDE;
+        continue;
+      }
+      if (x >= w->width) x = w->width - 1.0;
+      if (y >= w->height) y = w->height - 1.0;
+      if (z >= w->depth) z = w->depth - 1.0;
+      if (x < 0.0) x = 0.0;
+      if (y < 0.0) y = 0.0;
+      if (z < 0.0) z = 0.0;
+      xm = MAX((int)x, 0);
+      xp = MIN(w->width - 1, xm + 1);
+      ym = MAX((int)y, 0);
+      yp = MIN(w->height - 1, ym + 1);
+      zm = MAX((int)z, 0);
+      zp = MIN(w->depth - 1, zm + 1);
+      xmd = x - (float)xm;
+      ymd = y - (float)ym;
+      zmd = z - (float)zm;
+      xpd = (1.0f - xmd);
+      ypd = (1.0f - ymd);
+      zpd = (1.0f - zmd);
+
+      {
+        const int cc[8] = {xm, xm, xm, xm, xp, xp, xp, xp};
+        const int rr[8] = {ym, ym, yp, yp, ym, ym, yp, yp};
+        const int ss[8] = {zm, zp, zm, zp, zm, zp, zm, zp};
+        const double wt[8] = {xpd * ypd * zpd, xpd * ypd * zmd, xpd * ymd * zpd, xpd * ymd * zmd,
+                              xmd * ypd * zpd, xmd * ypd * zmd, xmd * ymd * zpd, xmd * ymd * zmd};
+        for (k = 0; k < 8; k++) {
+          w->offset[8 * s + k] = cc[k] + rr[k] * SrcVol->vox_per_row + ss[k] * SrcVol->vox_per_slice;
+          w->weight[8 * s + k] = wt[k];
+        }
+      }
+      w->status[s] = VOL2SURF_TRILINEAR;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (tid = 0; tid < nthreads; tid++) {
+    MatrixFree(&Scrs[tid]);
+    MatrixFree(&Txyz[tid]);
+  }
+  MatrixFree(&QFWDsrc);
+  if (FreeQsrc) MatrixFree(&Qsrc);
+
+  return (w);
+}
+
+/*------------------------------------------------------------
+  vol2surf_weights_supported() - returns 1 if vol2surf_linear_weights()
+  can handle this source volume and interpolation method.
+  ------------------------------------------------------------*/
+int vol2surf_weights_supported(const MRI *SrcVol, int InterpMethod)
+{
+  if (InterpMethod != SAMPLE_NEAREST && InterpMethod != SAMPLE_TRILINEAR) return (0);
+  if (!SrcVol->ischunked) return (0);
+  switch (SrcVol->type) {
+    case MRI_UCHAR:
+    case MRI_SHORT:
+    case MRI_INT:
+    case MRI_FLOAT:
+      return (1);
+  }
+  return (0);
+}
+
+/* Samples one frame at every vertex and projection fraction and combines
+   the fractions into TrgVol. The arithmetic follows vol2surf_linear()
+   followed by MRIadd()/MRImax() and MRImultiplyConst(). */
+template <class T>
+static void vol2surf_apply_weights_frame(const VOL2SURF_WEIGHTS *w, const T *src, float outside_val,
+                                         int ProjMax, float *trg)
+{
+  int vtx, p;
+  size_t s;
+  float val, acc;
+  const size_t *o;
+  const double *wt;
+
+  for (vtx = 0; vtx < w->nvertices; vtx++) {
+    acc = 0;
+    for (p = 0; p < w->nprojfracs; p++) {
+      s = (size_t)vtx * w->nprojfracs + p;
+      o = &w->offset[8 * s];
+      wt = &w->weight[8 * s];
+      switch (w->status[s]) {
+        case VOL2SURF_TRILINEAR:
+          val = wt[0] * (double)src[o[0]] + wt[1] * (double)src[o[1]] + wt[2] * (double)src[o[2]] +
+                wt[3] * (double)src[o[3]] + wt[4] * (double)src[o[4]] + wt[5] * (double)src[o[5]] +
+                wt[6] * (double)src[o[6]] + wt[7] * (double)src[o[7]];
+          break;
+        case VOL2SURF_NEAREST:
+          val = (float)src[o[0]];
+          break;
+        case VOL2SURF_OUTSIDE:
+          val = outside_val;
+          break;
+        default:
+          val = 0;
+          break;
+      }
+      if (p == 0)
+        acc = val;
+      else if (!ProjMax)
+        acc = acc + val;
+      else
+        acc = std::max((double)acc, (double)val);
+    }
+    if (!ProjMax) acc = (double)acc * (1.0 / w->nprojfracs);
+    trg[vtx] = acc;
+  }
+}
+
+/*------------------------------------------------------------
+  vol2surf_apply_weights() - applies weights from
+  vol2surf_linear_weights() to every frame of SrcVol. The fractions
+  are averaged unless ProjMax is set, in which case their maximum is
+  taken. SrcVol must have the geometry and type the weights were
+  built for. If SrcHitVol is non-NULL it is zeroed and then counts the
+  voxels hit at the last projection fraction, as vol2surf_linear()
+  does when called once per fraction. Frames are independent, so
+  they are sampled in parallel.
+  ------------------------------------------------------------*/
+MRI *vol2surf_apply_weights(const VOL2SURF_WEIGHTS *w, MRI *SrcVol, int ProjMax, MRI *SrcHitVol)
+{
+  MRI *TrgVol;
+  int frm, vtx;
+
+  if (SrcVol->width != w->width || SrcVol->height != w->height || SrcVol->depth != w->depth ||
+      SrcVol->type != w->type || !SrcVol->ischunked) {
+    printf("ERROR: vol2surf_apply_weights(): source volume does not match weights\n");
+    return (NULL);
+  }
+
+  TrgVol = MRIallocSequence(w->nvertices, 1, 1, MRI_FLOAT, SrcVol->nframes);
+  if (TrgVol == NULL) return (NULL);
+  MRIcopyHeader(SrcVol, TrgVol);
+  TrgVol->xsize = 1;
+  TrgVol->ysize = 1;
+  TrgVol->zsize = 1;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (frm = 0; frm < SrcVol->nframes; frm++) {
+    ROMP_PFLB_begin
+    float *trg = &MRIFseq_vox(TrgVol, 0, 0, 0, frm);
+    size_t frameoffset = frm * SrcVol->vox_per_vol;
+    switch (SrcVol->type) {
+      case MRI_UCHAR:
+        vol2surf_apply_weights_frame(w, (unsigned char *)SrcVol->chunk + frameoffset, SrcVol->outside_val,
+                                     ProjMax, trg);
+        break;
+      case MRI_SHORT:
+        vol2surf_apply_weights_frame(w, (short *)SrcVol->chunk + frameoffset, SrcVol->outside_val,
+                                     ProjMax, trg);
+        break;
+      case MRI_INT:
+        vol2surf_apply_weights_frame(w, (int *)SrcVol->chunk + frameoffset, SrcVol->outside_val,
+                                     ProjMax, trg);
+        break;
+      case MRI_FLOAT:
+        vol2surf_apply_weights_frame(w, (float *)SrcVol->chunk + frameoffset, SrcVol->outside_val,
+                                     ProjMax, trg);
+        break;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (SrcHitVol != NULL) {
+    MRIconst(SrcHitVol->width, SrcHitVol->height, SrcHitVol->depth, 1, 0, SrcHitVol);
+    for (vtx = 0; vtx < w->nvertices; vtx++) {
+      if (w->hitcrs[3 * vtx] < 0) continue;
+      MRIFseq_vox(SrcHitVol, w->hitcrs[3 * vtx], w->hitcrs[3 * vtx + 1], w->hitcrs[3 * vtx + 2], 0)++;
+    }
+  }
+
+  return (TrgVol);
+}
+
+/*------------------------------------------------------------
+  vol2surf_free_weights() - frees weights from vol2surf_linear_weights()
+  ------------------------------------------------------------*/
+int vol2surf_free_weights(VOL2SURF_WEIGHTS **pw)
+{
+  VOL2SURF_WEIGHTS *w = *pw;
+  if (w == NULL) return (0);
+  free(w->status);
+  free(w->offset);
+  free(w->weight);
+  free(w->hitcrs);
+  free(w);
+  *pw = NULL;
+  return (0);
+}
+
+/*!
+\fn static void surf2surfClosestVertices(MRIS *ProbeSurf, MRIS *SurfReg, MHT *Hash,
+                                     MRI *SkipHits, int *vtxno, float *dist)
+\brief Finds, in parallel, the vertex of SurfReg closest to each vertex of ProbeSurf.
+Uses Hash when non-NULL, falling back to brute force when the hash finds nothing.
+Vertices with a non-zero count in SkipHits (if non-NULL) are skipped and get -1.
+The hash table is only read, so the queries need no locks. The callers then
+accumulate the results serially in vertex order, so the output is identical to
+the serial search.
+*/
+static void surf2surfClosestVertices(MRIS *ProbeSurf, MRIS *SurfReg, MHT *Hash,
+                                     MRI *SkipHits, int *vtxno, float *dist)
+{
+  int vno;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic,1024)
+#endif
+  for (vno = 0; vno < ProbeSurf->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX *v = &(ProbeSurf->vertices[vno]);
+    float dmin = 0;
+    int closest = -1;
+    if (SkipHits == NULL || MRIFseq_vox(SkipHits, vno, 0, 0, 0) == 0) {
+      if (Hash) closest = MHTfindClosestVertexNo(Hash, SurfReg, v, &dmin);
+      /* hash table failed (or not used), so use brute force */
+      if (closest < 0) closest = MRISfindClosestVertex(SurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
+    }
+    vtxno[vno] = closest;
+    dist[vno] = dmin;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
 /*!
 \fn MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs,
                   int ReverseMapFlag, int DoJac, int UseHash)
@@ -877,11 +1271,10 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
 {
   MRI *TrgSurfVals = NULL;
   MRI_SURFACE *SrcSurfReg, *TrgSurfReg;
-  int svtx = 0, tvtx, tvtxN, svtxN = 0, f, n, nrevhits, nSrcLost;
+  int svtx = 0, tvtx, f, n, nrevhits, nSrcLost;
   int npairs, kS, kT, nhits;
   // int nunmapped;
-  VERTEX *v;
-  float dmin;
+  int *TrgToSrc, *SrcToTrg;
   MHT **Hash = NULL;
   MRI *SrcHits, *TrgHits;
 
@@ -930,24 +1323,41 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
     }
   }
 
+  /* Compute, in parallel, the source vertex that corresponds to each target
+     vertex by following the chain of registrations. The hash tables are only
+     read, so no locks are needed. This is used by both the jacobian count and
+     the forward loop below. */
+  TrgToSrc = (int *)calloc(TrgSurfReg->nvertices, sizeof(int));
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic,1024)
+#endif
+  for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
+    ROMP_PFLB_begin
+    int n, tvtxN = tvtx, svtx = -1;
+    float dmin;
+    for (n = npairs - 1; n >= 0; n--) {
+      int kS = 2 * n;
+      int kT = kS + 1;
+      VERTEX *v = &(SurfReg[kT]->vertices[tvtxN]);
+      /* find closest source vertex */
+      if (UseHash) svtx = MHTfindClosestVertexNo(Hash[kS], SurfReg[kS], v, &dmin);
+      if (!UseHash || svtx < 0) {
+        if (svtx < 0 && UseHash) printf("Target vertex %d of pair %d unmapped in hash, using brute force\n", tvtxN, n);
+        svtx = MRISfindClosestVertex(SurfReg[kS], v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
+      }
+      tvtxN = svtx;
+    }
+    TrgToSrc[tvtx] = svtx;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
   if (DoJac) {
     // If using jacobian correction, get a list of the number of times
     // that a give source vertex gets sampled.
     for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-      // Compute the source vertex that corresponds to this target vertex
-      tvtxN = tvtx;
-      for (n = npairs - 1; n >= 0; n--) {
-        kS = 2 * n;
-        kT = kS + 1;
-        v = &(SurfReg[kT]->vertices[tvtxN]);
-        /* find closest source vertex */
-        if(UseHash) svtx = MHTfindClosestVertexNo(Hash[kS], SurfReg[kS], v, &dmin);
-	if(!UseHash || svtx < 0){
-	  if(svtx < 0) printf("Target vertex %d of pair %d unmapped in hash, using brute force\n", tvtxN, n);
-	  svtx = MRISfindClosestVertex(SurfReg[kS], v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-	}
-        tvtxN = svtx;
-      }
+      svtx = TrgToSrc[tvtx];
       /* update the number of hits and distance */
       MRIFseq_vox((SrcHits), svtx, 0, 0, 0)++;
       MRIFseq_vox((TrgHits), tvtx, 0, 0, 0)++;
@@ -959,32 +1369,7 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
   printf("MRISapplyReg: Forward Loop (%d)\n", TrgSurfReg->nvertices);
   // nunmapped = 0;
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-    if (!UseHash) {
-      if (tvtx % 100 == 0) {
-        printf("%5d ", tvtx);
-        fflush(stdout);
-      }
-      if (tvtx % 1000 == 999) {
-        printf("\n");
-        fflush(stdout);
-      }
-    }
-
-    // Compute the source vertex that corresponds to this target vertex
-    tvtxN = tvtx;
-    for (n = npairs - 1; n >= 0; n--) {
-      kS = 2 * n;
-      kT = kS + 1;
-      // printf("%5d %5d %d %d %d\n",tvtx,tvtxN,n,kS,kT);
-      v = &(SurfReg[kT]->vertices[tvtxN]);
-      /* find closest source vertex */
-      if (UseHash) svtx = MHTfindClosestVertexNo(Hash[kS], SurfReg[kS], v, &dmin);
-      if (!UseHash || svtx < 0) {
-        if (svtx < 0) printf("Target vertex %d of pair %d unmapped in hash, using brute force\n", tvtxN, n);
-        svtx = MRISfindClosestVertex(SurfReg[kS], v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-      }
-      tvtxN = svtx;
-    }
+    svtx = TrgToSrc[tvtx];
 
     if (!DoJac) {
       /* update the number of hits */
@@ -999,6 +1384,7 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
     for (f = 0; f < SrcSurfVals->nframes; f++)
       MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += (MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f) / nhits);
   }
+  free(TrgToSrc);
 
   /*---------------------------------------------------------------
   Go through the reverse loop (finding closest trgvtx to each srcvtx
@@ -1006,26 +1392,40 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
   is represented in the map */
   if (ReverseMapFlag) {
     printf("MRISapplyReg: Reverse Loop (%d)\n", SrcSurfReg->nvertices);
+    SrcToTrg = (int *)calloc(SrcSurfReg->nvertices, sizeof(int));
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic,1024)
+#endif
+    for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
+      ROMP_PFLB_begin
+      int n, svtxN = svtx, tvtx = -1;
+      float dmin;
+      if (MRIFseq_vox((SrcHits), svtx, 0, 0, 0) == 0) {
+        // Compute the target vertex that corresponds to this source vertex
+        for (n = 0; n < npairs; n++) {
+          int kS = 2 * n;
+          int kT = kS + 1;
+          VERTEX *v = &(SurfReg[kS]->vertices[svtxN]);
+          /* find closest target vertex */
+          if (UseHash) tvtx = MHTfindClosestVertexNo(Hash[kT], SurfReg[kT], v, &dmin);
+          if (!UseHash || tvtx < 0) {
+            if (tvtx < 0 && UseHash) printf("Source vertex %d of pair %d unmapped in hash, using brute force\n", svtxN, n);
+            tvtx = MRISfindClosestVertex(SurfReg[kT], v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
+          }
+          svtxN = tvtx;
+        }
+      }
+      SrcToTrg[svtx] = tvtx;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
     nrevhits = 0;
     for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
       if (MRIFseq_vox((SrcHits), svtx, 0, 0, 0) != 0) continue;
       nrevhits++;
-
-      // Compute the target vertex that corresponds to this source vertex
-      svtxN = svtx;
-      for (n = 0; n < npairs; n++) {
-        kS = 2 * n;
-        kT = kS + 1;
-        // printf("%5d %5d %d %d %d\n",svtx,svtxN,n,kS,kT);
-        v = &(SurfReg[kS]->vertices[svtxN]);
-        /* find closest target vertex */
-        if (UseHash) tvtx = MHTfindClosestVertexNo(Hash[kT], SurfReg[kT], v, &dmin);
-        if (!UseHash || tvtx < 0) {
-          if (tvtx < 0) printf("Source vertex %d of pair %d unmapped in hash, using brute force\n", svtxN, n);
-          tvtx = MRISfindClosestVertex(SurfReg[kT], v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-        }
-        svtxN = tvtx;
-      }
+      tvtx = SrcToTrg[svtx];
 
       /* update the number of hits */
       MRIFseq_vox((SrcHits), svtx, 0, 0, 0)++;
@@ -1034,6 +1434,7 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
       for (f = 0; f < SrcSurfVals->nframes; f++)
         MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f);
     }
+    free(SrcToTrg);
     printf("  Reverse Loop had %d hits\n", nrevhits);
   }
 
@@ -1105,6 +1506,8 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
   VERTEX *v;
   MHT *SrcHash, *TrgHash;
   float dmin;
+  int *TrgToSrc, *SrcToTrg;
+  float *TrgToSrcDist, *SrcToTrgDist;
   extern char *ResampleVtxMapFile;
   FILE *fp = NULL;
 
@@ -1159,26 +1562,12 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
     Go through the forwad loop (finding closest srcvtx to each trgvtx).
     This maps each target vertex to a source vertex */
   printf("Surf2Surf: Forward Loop (%d)\n", TrgSurfReg->nvertices);
+  TrgToSrc = (int *)calloc(TrgSurfReg->nvertices, sizeof(int));
+  TrgToSrcDist = (float *)calloc(TrgSurfReg->nvertices, sizeof(float));
+  surf2surfClosestVertices(TrgSurfReg, SrcSurfReg, UseHash ? SrcHash : NULL, NULL, TrgToSrc, TrgToSrcDist);
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-    if (!UseHash) {
-      if (tvtx % 100 == 0) {
-        printf("%5d ", tvtx);
-        fflush(stdout);
-      }
-      if (tvtx % 1000 == 999) {
-        printf("\n");
-        fflush(stdout);
-      }
-    }
-    /* find closest source vertex */
-    v = &(TrgSurfReg->vertices[tvtx]);
-    if (UseHash)
-      svtx = MHTfindClosestVertexNo(SrcHash, SrcSurfReg, v, &dmin);
-    else
-      svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-
-    /* hash table failed, so use brute force */
-    if (svtx < 0) svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
+    svtx = TrgToSrc[tvtx];
+    dmin = TrgToSrcDist[tvtx];
 
     /* update the number of hits and distance */
     MRIFseq_vox((*SrcHits), svtx, 0, 0, 0)++;
@@ -1191,12 +1580,15 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
       MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f);
 
     if (ResampleVtxMapFile != NULL) {
+      v = &(TrgSurfReg->vertices[tvtx]);
       fprintf(fp, "%6d  (%6.1f,%6.1f,%6.1f)   ", tvtx, v->x, v->y, v->z);
       v = &(SrcSurfReg->vertices[svtx]);
       fprintf(fp, "%6d  (%6.1f,%6.1f,%6.1f)    %5.4f\n", svtx, v->x, v->y, v->z, dmin);
       fflush(fp);
     }
   }
+  free(TrgToSrc);
+  free(TrgToSrcDist);
   printf("\n");
   if (UseHash) MHTfree(&SrcHash);
 
@@ -1213,18 +1605,15 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
       TrgHash = MHTcreateVertexTable_Resolution(TrgSurfReg, CURRENT_VERTICES, 16);
     }
     printf("Surf2Surf: Reverse Loop (%d)\n", SrcSurfReg->nvertices);
+    SrcToTrg = (int *)calloc(SrcSurfReg->nvertices, sizeof(int));
+    SrcToTrgDist = (float *)calloc(SrcSurfReg->nvertices, sizeof(float));
+    surf2surfClosestVertices(SrcSurfReg, TrgSurfReg, UseHash ? TrgHash : NULL, *SrcHits, SrcToTrg, SrcToTrgDist);
     nrevhits = 0;
     for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
       if (MRIFseq_vox((*SrcHits), svtx, 0, 0, 0) == 0) {
         nrevhits++;
-        /* find closest target vertex */
-        v = &(SrcSurfReg->vertices[svtx]);
-        if (UseHash)
-          tvtx = MHTfindClosestVertexNo(TrgHash, TrgSurfReg, v, &dmin);
-        else
-          tvtx = MRISfindClosestVertex(TrgSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-        /* Hash table failed, so use brute force */
-        if (tvtx < 0) tvtx = MRISfindClosestVertex(TrgSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
+        tvtx = SrcToTrg[svtx];
+        dmin = SrcToTrgDist[svtx];
 
         /* update the number of hits and distance */
         MRIFseq_vox((*SrcHits), svtx, 0, 0, 0)++;
@@ -1236,6 +1625,8 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals,
           MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f);
       }
     }
+    free(SrcToTrg);
+    free(SrcToTrgDist);
     if (UseHash) MHTfree(&TrgHash);
     printf("Reverse Loop had %d hits\n", nrevhits);
   }
@@ -1291,9 +1682,10 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
   MRI *TrgSurfVals = NULL;
   int svtx, tvtx, f, n, nrevhits, nSrcLost, nhits;
   // int nunmapped;
-  VERTEX *v;
   MHT *SrcHash, *TrgHash;
   float dmin, srcval;
+  int *TrgToSrc, *SrcToTrg;
+  float *TrgToSrcDist, *SrcToTrgDist;
 
   /* check dimension consistency */
   if (SrcSurfVals->width != SrcSurfReg->nvertices) {
@@ -1329,18 +1721,16 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
     SrcHash = MHTcreateVertexTable_Resolution(SrcSurfReg, CURRENT_VERTICES, 16);
   }
 
-  // First forward loop just counts the number of hits for each src
+  // First forward loop just counts the number of hits for each src.
+  // The closest source vertices are found once and reused by the second loop.
   printf("Surf2SurfJac: 1st Forward Loop (%d)\n", TrgSurfReg->nvertices);
+  TrgToSrc = (int *)calloc(TrgSurfReg->nvertices, sizeof(int));
+  TrgToSrcDist = (float *)calloc(TrgSurfReg->nvertices, sizeof(float));
+  surf2surfClosestVertices(TrgSurfReg, SrcSurfReg, UseHash ? SrcHash : NULL, NULL, TrgToSrc, TrgToSrcDist);
   // nunmapped = 0;
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-    /* find closest source vertex */
-    v = &(TrgSurfReg->vertices[tvtx]);
-    if (UseHash)
-      svtx = MHTfindClosestVertexNo(SrcHash, SrcSurfReg, v, &dmin);
-    else
-      svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-    /* hash table failed, so use brute force */
-    if (svtx < 0) svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
+    svtx = TrgToSrc[tvtx];
+    dmin = TrgToSrcDist[tvtx];
 
     /* update the number of hits and distance */
     MRIFseq_vox((*SrcHits), svtx, 0, 0, 0)++;  // This is what this loop is for
@@ -1352,14 +1742,7 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
   // Second forward loop accumulates
   printf("Surf2SurfJac: 2nd Forward Loop (%d)\n", TrgSurfReg->nvertices);
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-    /* find closest source vertex */
-    v = &(TrgSurfReg->vertices[tvtx]);
-    if (UseHash)
-      svtx = MHTfindClosestVertexNo(SrcHash, SrcSurfReg, v, &dmin);
-    else
-      svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-    /* hash table failed, so use bruce force */
-    if (svtx < 0) svtx = MRISfindClosestVertex(SrcSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
+    svtx = TrgToSrc[tvtx];
 
     nhits = MRIFseq_vox((*SrcHits), svtx, 0, 0, 0);
     /* Now accumulate mapped values for each frame */
@@ -1369,6 +1752,8 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
       MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += srcval;
     }
   }
+  free(TrgToSrc);
+  free(TrgToSrcDist);
 
   /*---------------------------------------------------------------
     Go through the reverse loop (finding closest trgvtx to each srcvtx
@@ -1381,18 +1766,15 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
       TrgHash = MHTcreateVertexTable_Resolution(TrgSurfReg, CURRENT_VERTICES, 16);
     }
     printf("Surf2SurfJac: Reverse Loop (%d)\n", SrcSurfReg->nvertices);
+    SrcToTrg = (int *)calloc(SrcSurfReg->nvertices, sizeof(int));
+    SrcToTrgDist = (float *)calloc(SrcSurfReg->nvertices, sizeof(float));
+    surf2surfClosestVertices(SrcSurfReg, TrgSurfReg, UseHash ? TrgHash : NULL, *SrcHits, SrcToTrg, SrcToTrgDist);
     nrevhits = 0;
     for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
       if (MRIFseq_vox((*SrcHits), svtx, 0, 0, 0) == 0) {
         nrevhits++;
-        /* find closest target vertex */
-        v = &(SrcSurfReg->vertices[svtx]);
-        if (UseHash)
-          tvtx = MHTfindClosestVertexNo(TrgHash, TrgSurfReg, v, &dmin);
-        else
-          tvtx = MRISfindClosestVertex(TrgSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
-        /* Hash table failed, so use brute force */
-        if (tvtx < 0) tvtx = MRISfindClosestVertex(TrgSurfReg, v->x, v->y, v->z, &dmin, CURRENT_VERTICES);
+        tvtx = SrcToTrg[svtx];
+        dmin = SrcToTrgDist[svtx];
         /* update the number of hits and distance */
         MRIFseq_vox((*SrcHits), svtx, 0, 0, 0)++;
         MRIFseq_vox((*TrgHits), tvtx, 0, 0, 0)++;
@@ -1403,6 +1785,8 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals,
           MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f);
       }
     }
+    free(SrcToTrg);
+    free(SrcToTrgDist);
     if (UseHash) MHTfree(&TrgHash);
     printf("Reverse Loop had %d hits\n", nrevhits);
   }
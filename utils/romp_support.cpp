@@ -31,10 +31,27 @@ static const int debug = 0;
 #endif
 
 #include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <atomic>
+
+bool romp_profiling;
+static const char* profileFileName;
+static void profileStarted();
 
 static void __attribute__((constructor)) before_main() 
 {
+    const char* profile = getenv("FS_PROFILE");
+    if (profile && *profile) {
+        romp_profiling  = true;
+        profileFileName = profile;
+        profileStarted();
+    }
+
     int n = omp_get_max_threads();
     if (n <= _MAX_FS_THREADS) return;
     omp_set_num_threads(_MAX_FS_THREADS);
@@ -67,6 +84,8 @@ typedef struct PerThreadScopeTreeData {
     long in_scope;
     long in_child_threads[ROMP_maxWatchedThreadNum];    
         // threads may be running in a different scope tree!
+    long calls;
+    long calls_parallel;
 } PerThreadScopeTreeData;
 
 static PerThreadScopeTreeData  scopeTreeRoots[ROMP_maxWatchedThreadNum];
@@ -100,6 +119,12 @@ typedef struct StaticData {
 
 ROMP_pf_static_struct* known_ROMP_pf;
 
+static long nowNanoseconds() {
+    struct timespec timespec;
+    clock_gettime(CLOCK_MONOTONIC, &timespec);
+    return timespec.tv_sec * 1000000000L + timespec.tv_nsec;
+}
+
 static long cpuTimeUsed() {
 #ifdef __APPLE__
     // not yet supported on mac
@@ -119,14 +144,34 @@ static long cpuTimeUsed() {
 #endif
 }
 
+// Counts, per thread, the omp if clauses that chose parallel.
+// The runtime profiling compares it before and after a loop rather than
+// keeping a pointer to the innermost loop's stack struct, which an early exit could leave dangling.
+//
+static __thread size_t threadGoneParallel;
+
 int ROMP_if_parallel1(ROMP_level level)
 {
-    return (level >= romp_level);               // sadly this allows nested parallelism
-}                                               // sad only because it hasn't been analyzed
+    int result = (level >= romp_level);         // sadly this allows nested parallelism
+    if (result && romp_profiling) threadGoneParallel++;
+    return result;                              // sad only because it hasn't been analyzed
+}
 
 static size_t countGoParallel;
 size_t ROMP_countGoParallel() { return countGoParallel; }
 
+// Whether the caller is already running inside a parallel loop
+//
+static bool inParallel() {
+#if defined(ROMP_SUPPORT_ENABLED)
+    return romp_level >= ROMP_level__size;      // set by ROMP_if_parallel2
+#elif defined(HAVE_OPENMP)
+    return omp_in_parallel();
+#else
+    return false;
+#endif
+}
+
 int ROMP_if_parallel2(ROMP_level level, ROMP_pf_stack_struct* pf_stack) 
 {
     ROMP_pf_static_struct * pf_static = pf_stack->staticInfo;
@@ -172,9 +217,10 @@ static const char* getMainFile()
     return mainFile;
 }
 
+static void writeProfile();
+
 static void rompExitHandler(void)
 {
-#if defined(ROMP_SUPPORT_ENABLED)
     static int once;
     if (once++ > 0) return;
     if (debug) fprintf(stderr, "ROMP staticExitHandler called\n");
@@ -184,7 +230,10 @@ static void rompExitHandler(void)
         PerThreadScopeTreeData* root = &scopeTreeRoots[tid];
         if (tidStartTime[tid].inited) root->in_scope = tidStartTime[tid].timer.nanoseconds();
     }
-    
+
+    if (romp_profiling) writeProfile();
+
+#if defined(ROMP_SUPPORT_ENABLED)
     ROMP_show_stats(stderr);
   
     if (getMainFile()) {
@@ -263,6 +312,9 @@ void ROMP_pf_begin(
 
     pf_stack->gone_parallel = 0;
     pf_stack->entry_level = romp_level;
+    pf_stack->scope = NULL;
+    pf_stack->outer_scope = NULL;
+    pf_stack->parallel_at_begin = threadGoneParallel;
 
     int tid = 
 #ifdef HAVE_OPENMP
@@ -274,14 +326,22 @@ void ROMP_pf_begin(
     
     PerThreadScopeTreeData* tos = scopeTreeToS[tid];
     if (!tos) { tos = &scopeTreeRoots[tid]; scopeTreeToS[tid] = tos; maybeInitTidStartTime(tid); }
-    scopeTreeToS[tid] = enterScope(tos, pf_static);
+
+    // Reentering the scope we are already in, either by recursion or because a continue skipped
+    // the ROMP_PF_end, accumulates into the same node rather than growing an ever deeper chain
+    //
+    PerThreadScopeTreeData* scope = (tos->key == pf_static) ? tos : enterScope(tos, pf_static);
+    scope->calls++;
+    pf_stack->scope       = scope;
+    pf_stack->outer_scope = tos;
+    scopeTreeToS[tid]     = scope;
     
     int i;
     for (i = 0; i < ROMP_maxWatchedThreadNum; i++) {
         pf_stack->watchedThreadBeginCPUTimes[i] = 0;
     }
 
-    if (romp_level >= ROMP_level__size) {
+    if (inParallel()) {
         if (debug) fprintf(stderr, "%s:%d only getting child tid start times for tid:%d pf_stack:%p\n", __FILE__, __LINE__, tid, pf_stack);
         pf_stack->watchedThreadBeginCPUTimes[tid] = cpuTimeUsed();
     } else {
@@ -314,7 +374,7 @@ void ROMP_pf_begin(
         }
     }
     
-    pf_stack->timer.reset();
+    pf_stack->begin_time = nowNanoseconds();
 }
 
 
@@ -352,6 +412,10 @@ void ROMP_pf_end(
     ROMP_pf_static_struct * pf_static = pf_stack->staticInfo;
     if (!pf_static) return;
 
+#if !defined(ROMP_SUPPORT_ENABLED)
+    if (threadGoneParallel != pf_stack->parallel_at_begin) pf_stack->gone_parallel = 1;
+#endif
+
     int tid = 
 #ifdef HAVE_OPENMP
     omp_get_thread_num();
@@ -360,11 +424,12 @@ void ROMP_pf_end(
 #endif
     if (tid < ROMP_maxWatchedThreadNum) {
 
-        PerThreadScopeTreeData* tos = scopeTreeToS[tid];
+        PerThreadScopeTreeData* tos = pf_stack->scope;
         if (tos) {
 
-            long delta = pf_stack->timer.nanoseconds();
+            long delta = nowNanoseconds() - pf_stack->begin_time;
             tos->in_scope += delta;
+            if (pf_stack->gone_parallel) tos->calls_parallel++;
 
             if (pf_stack->gone_parallel)
                 if (debug) fprintf(stderr, "ROMP_pf_end tid:%d pf_stack:%p getting other thread times\n",
@@ -382,7 +447,7 @@ void ROMP_pf_end(
                 for (i = 0; i < ROMP_maxWatchedThreadNum; i++) pf_end_one_thread(tid, pf_stack, tos);
             }
 
-            if (romp_level < ROMP_level__size) {
+            if (!inParallel()) {
                 int i;
                 for (i = 0; i < ROMP_maxWatchedThreadNum; i++) {
                     long startCPUTime = pf_stack->watchedThreadBeginCPUTimes[i];
@@ -392,11 +457,13 @@ void ROMP_pf_end(
                 } 
             }
 
-            scopeTreeToS[tid] = tos->parent;
+            scopeTreeToS[tid] = pf_stack->outer_scope;
         }
     }
 
+#if defined(ROMP_SUPPORT_ENABLED)
     romp_level = pf_stack->entry_level;
+#endif
 }
 
 
@@ -461,6 +528,144 @@ void ROMP_show_stats(FILE* file)
 }
 
 
+// Runtime profiling
+//
+static std::atomic<long> counters[ROMP_counter__size];
+
+static const char* counterNames[ROMP_counter__size] = {
+    "volume_allocs",
+    "volume_alloc_bytes",
+    "surface_allocs",
+    "surface_alloc_bytes",
+    "atlas_allocs",
+    "atlas_alloc_bytes",
+    "morph_allocs",
+    "morph_alloc_bytes",
+    "input_file_bytes",
+    "output_file_bytes"
+};
+
+void ROMP_count(ROMP_counter counter, long amount)
+{
+    counters[counter] += amount;
+}
+
+void ROMP_count_file(ROMP_counter counter, const char* fname)
+{
+    struct stat stat_buf;
+    if (fname && stat(fname, &stat_buf) == 0 && S_ISREG(stat_buf.st_mode)) ROMP_count(counter, stat_buf.st_size);
+}
+
+static void profileStarted()
+{
+    initMainTimer();    // also arranges for the report to be written at exit
+}
+
+static void json_string(FILE* file, const char* s)
+{
+    fputc('"', file);
+    for (; s && *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') fprintf(file, "\\%c", c);
+        else if (c < 0x20)         fprintf(file, "\\u%04x", c);
+        else                       fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+static void json_indent(FILE* file, unsigned int depth)
+{
+    for (unsigned int d = 0; d < depth; d++) fprintf(file, "  ");
+}
+
+static void node_write_json(FILE* file, PerThreadScopeTreeData* node, unsigned int depth)
+{
+    ROMP_pf_static_struct* pf = node->key;
+
+    long inAllThreads = 0;
+    for (int tid = 0; tid < ROMP_maxWatchedThreadNum; tid++) inAllThreads += node->in_child_threads[tid];
+
+    json_indent(file, depth);
+    fprintf(file, "{\"file\": ");
+    json_string(file, pf->file);
+    fprintf(file, ", \"func\": ");
+    json_string(file, pf->func);
+    fprintf(file, ", \"line\": %u, \"calls\": %ld, \"calls_parallel\": %ld, \"wall_ns\": %ld, \"threads_cpu_ns\": %ld",
+        pf->line, node->calls, node->calls_parallel, node->in_scope, inAllThreads);
+
+    if (node->first_child) {
+        fprintf(file, ", \"children\": [\n");
+        for (PerThreadScopeTreeData* child = node->first_child; child; child = child->next_sibling) {
+            node_write_json(file, child, depth + 1);
+            fprintf(file, child->next_sibling ? ",\n" : "\n");
+        }
+        json_indent(file, depth);
+        fprintf(file, "]");
+    }
+    fprintf(file, "}");
+}
+
+// The report has one scope tree per watched thread.  wall_ns is the elapsed time in the scope and
+// threads_cpu_ns the cpu time the watched threads spent in it, including in the parallel loops it contains.
+//
+static void writeProfile()
+{
+    char program[256];
+    const char* name = Progname ? Progname : "unknown";
+    if (strrchr(name, '/')) name = strrchr(name, '/') + 1;
+    snprintf(program, sizeof(program), "%s", name);
+    for (char* c = program; *c; c++) if (!isalnum(*c) && *c != '.' && *c != '-') *c = '_';
+
+    char fileName[1024];
+    struct stat stat_buf;
+    if (stat(profileFileName, &stat_buf) == 0 && S_ISDIR(stat_buf.st_mode))
+        snprintf(fileName, sizeof(fileName), "%s/%s.%d.json", profileFileName, program, (int)getpid());
+    else
+        snprintf(fileName, sizeof(fileName), "%s", profileFileName);
+
+    FILE* file = fopen(fileName, "w");
+    if (!file) {
+        fprintf(stderr, "FS_PROFILE: could not create %s\n", fileName);
+        return;
+    }
+
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    getrusage(RUSAGE_SELF, &usage);
+    long cpu = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000L
+             + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000L;
+
+    fprintf(file, "{\n  \"program\": ");
+    json_string(file, program);
+    fprintf(file, ",\n  \"pid\": %d,\n  \"date\": ", (int)getpid());
+    json_string(file, currentDateTime(false).c_str());
+    fprintf(file, ",\n  \"max_threads\": %d,\n  \"watched_threads\": %d,\n", omp_get_max_threads(), ROMP_maxWatchedThreadNum);
+    fprintf(file, "  \"elapsed_ns\": %ld,\n  \"cpu_ns\": %ld,\n  \"max_rss_kb\": %ld,\n", mainTimer.nanoseconds(), cpu, (long)usage.ru_maxrss);
+
+    fprintf(file, "  \"counters\": {");
+    for (int i = 0; i < ROMP_counter__size; i++) {
+        fprintf(file, "%s\n    \"%s\": %ld", i ? "," : "", counterNames[i], counters[i].load());
+    }
+    fprintf(file, "\n  },\n  \"threads\": [");
+
+    bool first = true;
+    for (int tid = 0; tid < ROMP_maxWatchedThreadNum; tid++) {
+        PerThreadScopeTreeData* root = &scopeTreeRoots[tid];
+        if (!root->first_child) continue;
+        fprintf(file, "%s\n    {\"tid\": %d, \"wall_ns\": %ld, \"scopes\": [\n", first ? "" : ",", tid, root->in_scope);
+        for (PerThreadScopeTreeData* child = root->first_child; child; child = child->next_sibling) {
+            node_write_json(file, child, 3);
+            fprintf(file, child->next_sibling ? ",\n" : "\n");
+        }
+        fprintf(file, "    ]}");
+        first = false;
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    fclose(file);
+}
+
+
 void ROMP_Distributor_begin(ROMP_Distributor* distributor,
     int lo, int hi, 
     double* sumReducedDouble0, 
@@ -35,6 +35,7 @@
 #include "matrix.h"
 #include "mri.h"
 #include "resample.h"
+#include "romp_support.h"
 #include "timer.h"
 
 // This must be included prior to volcluster.c (I think)
@@ -63,37 +64,9 @@ SCS *sclustMapSurfClusters(MRI_SURFACE *Surf, float thmin, float thmax, int thsi
 			   float minarea, int *nClusters, MATRIX *XFM, MRI *fwhmmap)
 {
   SCS *scs, *scs_sorted;
-  int vtx, vtx_inrange, vtx_clustno, CurrentClusterNo;
-  float vtx_val, ClusterArea;
-  int nVtxsInCluster;
 
-  /* initialized all cluster numbers to 0 */
-  for (vtx = 0; vtx < Surf->nvertices; vtx++) Surf->vertices[vtx].undefval = 0; /* overloads this elem of struct */
-
-  /* Go through each vertex looking for one that meets the threshold
-     criteria and has not been previously assigned to a cluster.
-     When found, grow it out. */
-  CurrentClusterNo = 1;
-  for (vtx = 0; vtx < Surf->nvertices; vtx++) {
-    vtx_val = Surf->vertices[vtx].val;
-    vtx_clustno = Surf->vertices[vtx].undefval;
-    vtx_inrange = clustValueInRange(vtx_val, thmin, thmax, thsign);
-
-    if (vtx_clustno == 0 && vtx_inrange) {
-      sclustGrowSurfCluster(CurrentClusterNo, vtx, Surf, thmin, thmax, thsign);
-      if (minarea > 0) {
-        /* If the cluster does not meet the area criteria, delete it */
-        ClusterArea = sclustSurfaceArea(CurrentClusterNo, Surf, &nVtxsInCluster);
-        if (ClusterArea < minarea) {
-          sclustZeroSurfaceClusterNo(CurrentClusterNo, Surf);
-          continue;
-        }
-      }
-      CurrentClusterNo++;
-    }
-  }
-
-  *nClusters = CurrentClusterNo - 1;
+  /* Set the undefval of each vertex to its cluster number */
+  *nClusters = sclustLabelSurfClusters(Surf, thmin, thmax, thsign, minarea);
   if (*nClusters == 0) return (NULL);
 
   /* Get a summary of the clusters */
@@ -116,6 +89,109 @@ SCS *sclustMapSurfClusters(MRI_SURFACE *Surf, float thmin, float thmax, int thsi
 
   return (scs_sorted);
 }
+/* ------------------------------------------------------------
+   sclustLabelSurfClusters() - finds the clusters of contiguous
+   vertices that meet the threshold criteria using union-find (see
+   clustUFUnion()), and sets the undefval of each vertex to its
+   cluster number (0 if not in a cluster). Ranges of vertices are
+   joined in parallel, then the edges between ranges are joined.
+   Clusters are numbered in the order of their lowest vertex, which
+   is the order sclustGrowSurfCluster() seeded from an ascending
+   vertex loop finds them. If minarea > 0, clusters whose area (as
+   computed by sclustSurfaceArea()) is less than minarea are removed
+   before numbering. Returns the number of clusters.
+   ------------------------------------------------------------ */
+int sclustLabelSurfClusters(MRI_SURFACE *Surf, float thmin, float thmax, int thsign, float minarea)
+{
+  int vtx, nbr, nbr_vtx, nrange, range, nc, n;
+  int *parent, *clusterno;
+  float *ClusterArea;
+
+  parent = (int *)malloc(Surf->nvertices * sizeof(int));
+  nrange = omp_get_max_threads();
+  if (nrange > Surf->nvertices) nrange = Surf->nvertices;
+  if (nrange < 1) nrange = 1;
+
+  for (vtx = 0; vtx < Surf->nvertices; vtx++)
+    parent[vtx] = clustValueInRange(Surf->vertices[vtx].val, thmin, thmax, thsign) ? vtx : -1;
+
+  // Join the vertices within each range
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1)
+#endif
+  for (range = 0; range < nrange; range++) {
+    ROMP_PFLB_begin
+    int v0 = (int)(((long)Surf->nvertices * range) / nrange);
+    int v1 = (int)(((long)Surf->nvertices * (range + 1)) / nrange);
+    int v, k, u;
+    for (v = v0; v < v1; v++) {
+      if (parent[v] < 0) continue;
+      for (k = 0; k < Surf->vertices_topology[v].vnum; k++) {
+        u = Surf->vertices_topology[v].v[k];
+        if (u < v0 || u >= v1 || parent[u] < 0) continue;
+        clustUFUnion(parent, v, u);
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // Join across ranges
+  for (range = 0; range < nrange && nrange > 1; range++) {
+    int v0 = (int)(((long)Surf->nvertices * range) / nrange);
+    int v1 = (int)(((long)Surf->nvertices * (range + 1)) / nrange);
+    for (vtx = v0; vtx < v1; vtx++) {
+      if (parent[vtx] < 0) continue;
+      for (nbr = 0; nbr < Surf->vertices_topology[vtx].vnum; nbr++) {
+        nbr_vtx = Surf->vertices_topology[vtx].v[nbr];
+        if ((nbr_vtx >= v0 && nbr_vtx < v1) || parent[nbr_vtx] < 0) continue;
+        clustUFUnion(parent, vtx, nbr_vtx);
+      }
+    }
+  }
+
+  // Number the clusters by their lowest vertex. The root of each
+  // set is its lowest vertex, so roots are numbered as they are met.
+  clusterno = (int *)calloc(Surf->nvertices, sizeof(int));
+  nc = 0;
+  for (vtx = 0; vtx < Surf->nvertices; vtx++) {
+    if (parent[vtx] < 0) continue;
+    n = clustUFFind(parent, vtx);
+    if (n == vtx) clusterno[vtx] = ++nc;
+    clusterno[vtx] = clusterno[n];
+  }
+  free(parent);
+
+  if (minarea > 0 && nc > 0) {
+    // Same accumulation as sclustSurfaceArea()
+    ClusterArea = (float *)calloc(nc + 1, sizeof(float));
+    for (vtx = 0; vtx < Surf->nvertices; vtx++) {
+      if (clusterno[vtx] == 0) continue;
+      if (!Surf->group_avg_vtxarea_loaded)
+        ClusterArea[clusterno[vtx]] += Surf->vertices[vtx].area;
+      else
+        ClusterArea[clusterno[vtx]] += Surf->vertices[vtx].group_avg_area;
+    }
+    int *newno = (int *)calloc(nc + 1, sizeof(int));
+    int nkeep = 0;
+    for (n = 1; n <= nc; n++) {
+      if (Surf->group_avg_surface_area > 0 && !Surf->group_avg_vtxarea_loaded)
+        ClusterArea[n] *= (Surf->group_avg_surface_area / Surf->total_area);
+      if (ClusterArea[n] < minarea) continue;
+      newno[n] = ++nkeep;
+    }
+    for (vtx = 0; vtx < Surf->nvertices; vtx++) clusterno[vtx] = newno[clusterno[vtx]];
+    nc = nkeep;
+    free(newno);
+    free(ClusterArea);
+  }
+
+  for (vtx = 0; vtx < Surf->nvertices; vtx++) Surf->vertices[vtx].undefval = clusterno[vtx];
+  free(clusterno);
+
+  return (nc);
+}
 /* ------------------------------------------------------------
    sclustGrowSurfCluster() - grows a cluster on the surface from
    the SeedVtx. The cluster is a list of vertices that are
@@ -34,6 +34,7 @@
 #include "mri.h"
 #include "randomfields.h"
 #include "resample.h"
+#include "romp_support.h"
 #include "transform.h"
 #include "utils.h"
 #define VOLCLUSTER_SRC
@@ -403,40 +404,82 @@ int clustGrowOneVoxel(VOLCLUSTER *vc, int col0, int row0, int slc0, MRI *HitMap,
   return (nadded);
 }
 
-/*------------------------------------------------------------------------*/
+/*------------------------------------------------------------------------
+  clustGrow() - grows a cluster from the seed voxel into all connected
+  voxels that are not yet set in the HitMap, setting them as it goes.
+  Members are added in breadth-first order (each member's neighbors
+  are added in dcol, drow, dslc order), which is the order repeated
+  clustGrowOneVoxel() passes over the members produce, but each member
+  is only expanded once.
+  ------------------------------------------------------------------------*/
 VOLCLUSTER *clustGrow(int col0, int row0, int slc0, MRI *HitMap, int AllowDiag)
 {
   VOLCLUSTER *vc;
-  int nthmember, nmembers_now;
-  int col, row, slc;
-  int nadded, nthpass, n;
+  int nthmember, nmembers, nalloc;
+  int col, row, slc, c, r, s;
+  int dcol, drow, dslc, dsum;
+  int *mcol, *mrow, *mslc;
 
-  vc = (VOLCLUSTER *)calloc(1, sizeof(VOLCLUSTER));
+  nalloc = 64;
+  mcol = (int *)malloc(nalloc * sizeof(int));
+  mrow = (int *)malloc(nalloc * sizeof(int));
+  mslc = (int *)malloc(nalloc * sizeof(int));
 
   /* put the seed point in the cluster */
-  clustAddMember(vc, col0, row0, slc0);
+  mcol[0] = col0;
+  mrow[0] = row0;
+  mslc[0] = slc0;
+  nmembers = 1;
   MRIsetVoxVal(HitMap, col0, row0, slc0, 0, 1);
-  vc->voxsize = HitMap->xsize * HitMap->ysize * HitMap->zsize;
 
-  nthpass = 0;
-  nadded = 1;
-  while (nadded > 0) {
-    // printf("%4d  %5d  %d\n",nthpass,vc->nmembers,nadded);
-
-    nadded = 0;
-    nmembers_now = vc->nmembers;
-    for (nthmember = 0; nthmember < nmembers_now; nthmember++) {
-      col = vc->col[nthmember];
-      row = vc->row[nthmember];
-      slc = vc->slc[nthmember];
-      n = clustGrowOneVoxel(vc, col, row, slc, HitMap, AllowDiag);
-      // printf("Grown: %3d %3d %3d  %d\n",col,row,slc,n);
-      nadded += n;
-    }
+  for (nthmember = 0; nthmember < nmembers; nthmember++) {
+    col = mcol[nthmember];
+    row = mrow[nthmember];
+    slc = mslc[nthmember];
+    for (dcol = -1; dcol <= +1; dcol++) {
+      for (drow = -1; drow <= +1; drow++) {
+        for (dslc = -1; dslc <= +1; dslc++) {
+          // Check for neighbor beyond the edge-of-volume
+          c = col + dcol;
+          if (c < 0 || c >= HitMap->width) continue;
+          r = row + drow;
+          if (r < 0 || r >= HitMap->height) continue;
+          s = slc + dslc;
+          if (s < 0 || s >= HitMap->depth) continue;
+
+          // If not allowing for diagonal connections
+          if (!AllowDiag) {
+            dsum = abs(dcol) + abs(drow) + abs(dslc);
+            if (dsum != 1) continue;
+          }
 
-    nthpass++;
+          if (MRIgetVoxVal(HitMap, c, r, s, 0)) continue;
+
+          if (nmembers == nalloc) {
+            nalloc *= 2;
+            mcol = (int *)realloc(mcol, nalloc * sizeof(int));
+            mrow = (int *)realloc(mrow, nalloc * sizeof(int));
+            mslc = (int *)realloc(mslc, nalloc * sizeof(int));
+          }
+          mcol[nmembers] = c;
+          mrow[nmembers] = r;
+          mslc[nmembers] = s;
+          nmembers++;
+          MRIsetVoxVal(HitMap, c, r, s, 0, 1);
+        }
+      }
+    }
   }
 
+  vc = clustAllocCluster(nmembers);
+  memcpy(vc->col, mcol, nmembers * sizeof(int));
+  memcpy(vc->row, mrow, nmembers * sizeof(int));
+  memcpy(vc->slc, mslc, nmembers * sizeof(int));
+  vc->voxsize = HitMap->xsize * HitMap->ysize * HitMap->zsize;
+  free(mcol);
+  free(mrow);
+  free(mslc);
+
   return (vc);
 }
 
@@ -890,6 +933,199 @@ int clustMaxClusterCount(VOLCLUSTER **VolClustList, int nClusters)
   return (MaxCount);
 }
 
+/*------------------------------------------------------------------------
+  clustUFFind() - returns the root of v in a union-find forest stored as
+  parent indices (parent[root] == root), halving the path on the way.
+  ------------------------------------------------------------------------*/
+int clustUFFind(int *parent, int v)
+{
+  while (parent[v] != v) {
+    parent[v] = parent[parent[v]];
+    v = parent[v];
+  }
+  return (v);
+}
+
+/*------------------------------------------------------------------------
+  clustUFUnion() - merges the sets of a and b. The smaller root index
+  becomes the root, so the forest does not depend on the merge order.
+  ------------------------------------------------------------------------*/
+void clustUFUnion(int *parent, int a, int b)
+{
+  a = clustUFFind(parent, a);
+  b = clustUFFind(parent, b);
+  if (a < b)
+    parent[b] = a;
+  else if (b < a)
+    parent[a] = b;
+}
+
+/*------------------------------------------------------------------------
+  clustLabelHitMap() - labels the connected components of the voxels
+  that are 0 in the HitMap (see clustInitHitMap()) using union-find.
+  Connectivity is 6 (faces), 18 (faces+edges) or 26 (faces+edges+
+  corners); clustGrow() with AllowDiag=0 is 6 and with AllowDiag=1 is
+  26. Slabs of slices are labeled in parallel and then joined across
+  the slab boundaries. Clusters are numbered from 1 in the order of
+  their first voxel in column-row-slice order, which is the order
+  clustGetClusters() finds them, so the numbering does not depend on
+  the number of threads. Returns an MRI_INT volume of cluster numbers
+  (0 outside of clusters) and, if pnMembers is non-NULL, the number of
+  voxels in each cluster (*pnMembers)[0..nClusters-1].
+  ------------------------------------------------------------------------*/
+MRI *clustLabelHitMap(MRI *HitMap, int Connectivity, int *nClusters, int **pnMembers)
+{
+  MRI *label;
+  int *parent, *clusterno, *nmembers;
+  int width, height, depth, nslab, slab, nnbrs, dc, dr, ds, n, nc;
+  int nbrdc[13], nbrdr[13], nbrds[13];
+  int col, row, slc;
+  size_t nvox, v;
+
+  if (Connectivity != 6 && Connectivity != 18 && Connectivity != 26) {
+    printf("ERROR: clustLabelHitMap: connectivity %d must be 6, 18, or 26\n", Connectivity);
+    return (NULL);
+  }
+  width = HitMap->width;
+  height = HitMap->height;
+  depth = HitMap->depth;
+  nvox = (size_t)width * height * depth;
+
+  // Neighbors that come earlier in memory order (slice slowest)
+  nnbrs = 0;
+  for (ds = -1; ds <= 0; ds++) {
+    for (dr = -1; dr <= 1; dr++) {
+      for (dc = -1; dc <= 1; dc++) {
+        if (!(ds < 0 || (ds == 0 && dr < 0) || (ds == 0 && dr == 0 && dc < 0))) continue;
+        n = abs(dc) + abs(dr) + abs(ds);
+        if (Connectivity == 6 && n != 1) continue;
+        if (Connectivity == 18 && n > 2) continue;
+        nbrdc[nnbrs] = dc;
+        nbrdr[nnbrs] = dr;
+        nbrds[nnbrs] = ds;
+        nnbrs++;
+      }
+    }
+  }
+
+  parent = (int *)malloc(nvox * sizeof(int));
+  nslab = omp_get_max_threads();
+  if (nslab > depth) nslab = depth;
+  if (nslab < 1) nslab = 1;
+
+  // Union voxels within each slab of slices
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1)
+#endif
+  for (slab = 0; slab < nslab; slab++) {
+    ROMP_PFLB_begin
+    int s0 = (int)(((long)depth * slab) / nslab), s1 = (int)(((long)depth * (slab + 1)) / nslab);
+    int c, r, s, k, cc, rr, ss;
+    size_t vv;
+    for (s = s0; s < s1; s++) {
+      for (r = 0; r < height; r++) {
+        for (c = 0; c < width; c++) {
+          vv = c + (size_t)width * (r + (size_t)height * s);
+          parent[vv] = MRIgetVoxVal(HitMap, c, r, s, 0) ? -1 : (int)vv;
+          if (parent[vv] < 0) continue;
+          for (k = 0; k < nnbrs; k++) {
+            cc = c + nbrdc[k];
+            rr = r + nbrdr[k];
+            ss = s + nbrds[k];
+            if (cc < 0 || cc >= width || rr < 0 || rr >= height || ss < s0) continue;
+            if (parent[cc + (size_t)width * (rr + (size_t)height * ss)] < 0) continue;
+            clustUFUnion(parent, (int)vv, (int)(cc + (size_t)width * (rr + (size_t)height * ss)));
+          }
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // Join the slabs across their first slice
+  for (slab = 1; slab < nslab; slab++) {
+    slc = (int)(((long)depth * slab) / nslab);
+    for (row = 0; row < height; row++) {
+      for (col = 0; col < width; col++) {
+        v = col + (size_t)width * (row + (size_t)height * slc);
+        if (parent[v] < 0) continue;
+        for (n = 0; n < nnbrs; n++) {
+          if (nbrds[n] != -1) continue;
+          dc = col + nbrdc[n];
+          dr = row + nbrdr[n];
+          if (dc < 0 || dc >= width || dr < 0 || dr >= height) continue;
+          if (parent[dc + (size_t)width * (dr + (size_t)height * (slc - 1))] < 0) continue;
+          clustUFUnion(parent, (int)v, (int)(dc + (size_t)width * (dr + (size_t)height * (slc - 1))));
+        }
+      }
+    }
+  }
+
+  // Number the clusters in column-row-slice order
+  label = MRIalloc(width, height, depth, MRI_INT);
+  MRIcopyHeader(HitMap, label);
+  clusterno = (int *)calloc(nvox, sizeof(int));
+  nmembers = (int *)calloc(nvox + 1, sizeof(int));
+  nc = 0;
+  for (col = 0; col < width; col++) {
+    for (row = 0; row < height; row++) {
+      for (slc = 0; slc < depth; slc++) {
+        v = col + (size_t)width * (row + (size_t)height * slc);
+        if (parent[v] < 0) continue;
+        n = clustUFFind(parent, (int)v);
+        if (clusterno[n] == 0) clusterno[n] = ++nc;
+        MRIsetVoxVal(label, col, row, slc, 0, clusterno[n]);
+        nmembers[clusterno[n] - 1]++;
+      }
+    }
+  }
+  free(parent);
+  free(clusterno);
+  nmembers = (int *)realloc(nmembers, (nc + 1) * sizeof(int));
+
+  *nClusters = nc;
+  if (pnMembers)
+    *pnMembers = nmembers;
+  else
+    free(nmembers);
+  return (label);
+}
+
+/*------------------------------------------------------------------------
+  clustCountClusters() - thresholds frame of vol (and masks it with
+  binmask, if non-NULL) the same way as clustGetClusters(), then finds
+  the clusters with clustLabelHitMap(). Returns the voxel count of the
+  largest cluster and sets *nClusters. With Connectivity=6 this is
+  the same as clustMaxClusterCount() of the clustGetClusters() list
+  with no size pruning, but without building the member lists.
+  ------------------------------------------------------------------------*/
+int clustCountClusters(
+    MRI *vol, int frame, float threshmin, float threshmax, int threshsign, MRI *binmask, int Connectivity, int *nClusters)
+{
+  MRI *HitMap, *label;
+  int nhits, *hitcol = NULL, *hitrow = NULL, *hitslc = NULL, *nmembers = NULL;
+  int n, MaxCount = 0;
+
+  *nClusters = 0;
+  HitMap = clustInitHitMap(vol, frame, threshmin, threshmax, threshsign, &nhits, &hitcol, &hitrow, &hitslc, binmask, 0);
+  if (HitMap == NULL) return (0);
+  if (nhits > 0) {
+    free(hitcol);
+    free(hitrow);
+    free(hitslc);
+  }
+  label = clustLabelHitMap(HitMap, Connectivity, nClusters, &nmembers);
+  MRIfree(&HitMap);
+  if (label == NULL) return (0);
+  for (n = 0; n < *nClusters; n++)
+    if (nmembers[n] > MaxCount) MaxCount = nmembers[n];
+  free(nmembers);
+  MRIfree(&label);
+  return (MaxCount);
+}
+
 /*------------------------------------------------------------------------*/
 int clustDumpSummary(FILE *fp, VOLCLUSTER **ClusterList, int nClusters)
 {